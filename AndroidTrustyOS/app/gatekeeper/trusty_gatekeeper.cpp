@@ -199,20 +199,24 @@ bool TrustyGateKeeper::GetSecureFailureRecord(uint32_t uid, secure_id_t user_id,
     char id[STORAGE_ID_LENGTH_MAX];
     memset(id, 0, sizeof(id));
 
-    file_handle_t handle;
     snprintf(id, STORAGE_ID_LENGTH_MAX, GATEKEEPER_PREFIX "%u", uid);
-    rc = storage_open_file(session, &handle, id, 0, 0);
+
+    failure_record_t owner_record;
+    struct storage_compound compound;
+    storage_compound_init(&compound, session);
+    storage_compound_open_file(&compound, id, 0, 0);
+    storage_compound_read(&compound, 0, &owner_record, sizeof(owner_record));
+    storage_compound_close_file(&compound);
+    storage_compound_send(&compound);
+    storage_close_session(session);
+
+    rc = storage_compound_result(&compound, 0);
     if (rc < 0) {
         TLOGE("Error:[%d] opening storage object.\n", rc);
-        storage_close_session(session);
         return false;
     }
 
-    failure_record_t owner_record;
-    rc = storage_read(handle, 0, &owner_record, sizeof(owner_record));
-    storage_close_file(handle);
-    storage_close_session(session);
-
+    rc = storage_compound_result(&compound, 1);
     if (rc < 0) {
         TLOGE("Error:[%d] reading storage object.\n", rc);
         return false;
@@ -262,18 +266,22 @@ bool TrustyGateKeeper::WriteSecureFailureRecord(uint32_t uid, failure_record_t *
     memset(id, 0, sizeof(id));
     snprintf(id, STORAGE_ID_LENGTH_MAX, GATEKEEPER_PREFIX "%u", uid);
 
-    file_handle_t handle;
-    rc = storage_open_file(session, &handle, id, STORAGE_FILE_OPEN_CREATE, 0);
+    struct storage_compound compound;
+    storage_compound_init(&compound, session);
+    storage_compound_open_file(&compound, id, STORAGE_FILE_OPEN_CREATE, 0);
+    storage_compound_write(&compound, 0, record, sizeof(*record),
+                           STORAGE_OP_COMPLETE);
+    storage_compound_close_file(&compound);
+    storage_compound_send(&compound);
+    storage_close_session(session);
+
+    rc = storage_compound_result(&compound, 0);
     if (rc < 0) {
         TLOGE("Error: [%d] failed to open storage object %s\n", rc, id);
-        storage_close_session(session);
         return false;
     }
 
-    rc = storage_write(handle, 0, record, sizeof(*record), STORAGE_OP_COMPLETE);
-    storage_close_file(handle);
-    storage_close_session(session);
-
+    rc = storage_compound_result(&compound, 1);
     if (rc < 0) {
         TLOGE("Error:[%d] writing storage object.\n", rc);
         return false;
@@ -307,31 +307,43 @@ static long handle_msg(keymaster_chan_ctx* ctx) {
 
     MessageDeleter md(chan, msg_inf.id);
 
-    // allocate msg_buf, with one extra byte for null-terminator
-    UniquePtr<uint8_t[]> msg_buf(new uint8_t[msg_inf.len + 1]);
-    msg_buf[msg_inf.len] = 0;
+    UniquePtr<uint8_t[]> msg_buf;
+    keymaster_message* in_msg;
+
+    if (msg_inf.buf) {
+        // parse the message in place, it stays mapped until put_msg
+        if (msg_inf.len < sizeof(keymaster_message)) {
+            LOG_E("invalid message of size (%d)", msg_inf.len, chan);
+            return ERR_NOT_VALID;
+        }
+        in_msg = reinterpret_cast<keymaster_message*>(const_cast<void*>(msg_inf.buf));
+    } else {
+        // allocate msg_buf, with one extra byte for null-terminator
+        msg_buf.reset(new uint8_t[msg_inf.len + 1]);
+        msg_buf[msg_inf.len] = 0;
 
-    /* read msg content */
-    iovec_t iov = {msg_buf.get(), msg_inf.len};
-    ipc_msg_t msg = {1, &iov, 0, NULL};
+        /* read msg content */
+        iovec_t iov = {msg_buf.get(), msg_inf.len};
+        ipc_msg_t msg = {1, &iov, 0, NULL};
 
-    rc = read_msg(chan, msg_inf.id, 0, &msg);
+        rc = read_msg(chan, msg_inf.id, 0, &msg);
 
-    // fatal error
-    if (rc < 0) {
-        LOG_E("failed to read msg (%d)", rc, chan);
-        return rc;
-    }
-    LOG_D("Read %d-byte message", rc);
+        // fatal error
+        if (rc < 0) {
+            LOG_E("failed to read msg (%d)", rc, chan);
+            return rc;
+        }
+        LOG_D("Read %d-byte message", rc);
 
-    if (((unsigned long)rc) < sizeof(keymaster_message)) {
-        LOG_E("invalid message of size (%d)", rc, chan);
-        return ERR_NOT_VALID;
+        if (((unsigned long)rc) < sizeof(keymaster_message)) {
+            LOG_E("invalid message of size (%d)", rc, chan);
+            return ERR_NOT_VALID;
+        }
+        in_msg = reinterpret_cast<keymaster_message*>(msg_buf.get());
     }
 
     UniquePtr<uint8_t[]> out_buf;
     uint32_t out_buf_size = 0;
-    keymaster_message* in_msg = reinterpret_cast<keymaster_message*>(msg_buf.get());
 
     rc = ctx->dispatch(ctx, in_msg, msg_inf.len - sizeof(*in_msg), &out_buf, &out_buf_size);
     if (rc < 0) {
@@ -446,7 +458,7 @@ static long keymaster_ipc_init(keymaster_srv_ctx* ctx) {
 
     /* Initialize secure-side service */
     rc = port_create(KEYMASTER_SECURE_PORT, 1, KEYMASTER_MAX_BUFFER_LENGTH,
-                     IPC_PORT_ALLOW_TA_CONNECT);
+                     IPC_PORT_ALLOW_TA_CONNECT | IPC_PORT_MAP_MSG_BUF);
     if (rc < 0) {
         LOG_E("Failed (%d) to create port %s", rc, KEYMASTER_SECURE_PORT);
         return rc;
@@ -462,7 +474,8 @@ static long keymaster_ipc_init(keymaster_srv_ctx* ctx) {
     }
 
     /* initialize non-secure side service */
-    rc = port_create(KEYMASTER_PORT, 1, KEYMASTER_MAX_BUFFER_LENGTH, IPC_PORT_ALLOW_NS_CONNECT);
+    rc = port_create(KEYMASTER_PORT, 1, KEYMASTER_MAX_BUFFER_LENGTH,
+                     IPC_PORT_ALLOW_NS_CONNECT | IPC_PORT_MAP_MSG_BUF);
     if (rc < 0) {
         LOG_E("Failed (%d) to create port %s", rc, KEYMASTER_PORT);
         return rc;
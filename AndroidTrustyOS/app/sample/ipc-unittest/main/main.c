@@ -1137,10 +1137,15 @@ static void run_send_msg_negative_test(void)
 	EXPECT_GE_ZERO (rc, "connect to datasink");
 	chan = (handle_t) rc;
 
-	/* handles are not supported */
+	/* handle array is not readable */
 	msg.num_handles = 1;
 	rc = send_msg(chan, &msg);
-	EXPECT_EQ (ERR_NOT_SUPPORTED, rc, "sending handles");
+	EXPECT_EQ (ERR_FAULT, rc, "sending handles");
+
+	/* only memory object handles can be sent */
+	msg.handles = &chan;
+	rc = send_msg(chan, &msg);
+	EXPECT_EQ (ERR_NOT_SUPPORTED, rc, "sending channel handle");
 	msg.num_handles = 0;
 	msg.handles  = NULL;
 
@@ -1301,11 +1306,12 @@ static void run_read_msg_negative_test(void)
 	rc = read_msg(chan, inf.id, inf.len + 1, &rx_msg);
 	EXPECT_EQ (ERR_INVALID_ARGS, rc, "read with invalid offset");
 
-	/* read with handles */
+	/* read with room for handles, message has none */
+	EXPECT_EQ (0, inf.num_handles, "echo message handles");
 	rx_msg.num_handles = 1;
 	rx_msg.handles = NULL;
 	rc = read_msg(chan, inf.id, 0, &rx_msg);
-	EXPECT_EQ (ERR_NOT_SUPPORTED, rc, "read with handles");
+	EXPECT_EQ (sizeof(tx_buf), rc, "read with handles");
 	rx_msg.num_handles = 0;
 
 	/* cleanup */
@@ -1445,6 +1451,425 @@ abort_test:
 	TEST_END
 }
 
+/*
+ *  Send requests to echo service and receive replies with call
+ */
+static void run_call_test(void)
+{
+	int rc;
+	handle_t chan;
+	handle_t port;
+	char path[MAX_PORT_PATH_LEN];
+	uint8_t tx_buf[64];
+	uint8_t rx_buf[64];
+	ipc_msg_t   tx_msg;
+	iovec_t     tx_iov;
+	ipc_msg_t   rx_msg;
+	iovec_t     rx_iov;
+
+	TEST_BEGIN(__func__);
+
+	tx_iov.base = tx_buf;
+	tx_iov.len  = sizeof(tx_buf);
+	tx_msg.num_iov = 1;
+	tx_msg.iov     = &tx_iov;
+	tx_msg.num_handles = 0;
+	tx_msg.handles = NULL;
+
+	rx_iov.base = rx_buf;
+	rx_iov.len  = sizeof(rx_buf);
+	rx_msg.num_iov = 1;
+	rx_msg.iov     = &rx_iov;
+	rx_msg.num_handles = 0;
+	rx_msg.handles = NULL;
+
+	/* call on invalid or non-existing handles */
+	rc = call(INVALID_IPC_HANDLE, &tx_msg, &rx_msg, 1000);
+	EXPECT_EQ (ERR_BAD_HANDLE, rc, "call on invalid handle");
+
+	rc = call(MAX_USER_HANDLES, &tx_msg, &rx_msg, 1000);
+	EXPECT_EQ (ERR_BAD_HANDLE, rc, "call on invalid handle");
+
+	rc = call(MAX_USER_HANDLES - 1, &tx_msg, &rx_msg, 1000);
+	EXPECT_EQ (ERR_NOT_FOUND, rc, "call on non-existing handle");
+
+	/* call on port handle */
+	sprintf(path, "%s.main.%s", SRV_PATH_BASE,  "datasink");
+	rc = port_create(path, 2, MAX_PORT_BUF_SIZE,
+	                 IPC_PORT_ALLOW_TA_CONNECT);
+	EXPECT_GE_ZERO (rc, "create datasink port");
+	port = (handle_t) rc;
+
+	rc = call(port, &tx_msg, &rx_msg, 1000);
+	EXPECT_EQ (ERR_INVALID_ARGS, rc, "call on port");
+	close(port);
+
+	sprintf(path, "%s.srv.%s", SRV_PATH_BASE,  "echo");
+	rc = sync_connect(path, 1000);
+	EXPECT_GE_ZERO (rc, "connect to echo");
+
+	if (rc >= 0) {
+		uint cnt;
+
+		chan = (handle_t) rc;
+
+		/* NULL msg on valid channel */
+		rc = call(chan, NULL, &rx_msg, 1000);
+		EXPECT_EQ (ERR_FAULT, rc, "call with NULL msg");
+
+		rc = call(chan, &tx_msg, NULL, 1000);
+		EXPECT_EQ (ERR_FAULT, rc, "call with NULL reply");
+
+		/* 10000 round trips */
+		for (cnt = 0; cnt < 10000; cnt++) {
+			memset(tx_buf, cnt, sizeof(tx_buf));
+			memset(rx_buf, ~cnt, sizeof(rx_buf));
+
+			rc = call(chan, &tx_msg, &rx_msg, 1000);
+			EXPECT_EQ (64, rc, "call echo");
+			rc = memcmp(tx_buf, rx_buf, sizeof(tx_buf));
+			EXPECT_EQ (0, rc, "echo reply data");
+
+			if (!_all_ok)
+				break;
+		}
+
+		/* reply that does not fit is dropped */
+		rx_iov.len = sizeof(rx_buf) / 2;
+		rc = call(chan, &tx_msg, &rx_msg, 1000);
+		EXPECT_EQ (ERR_TOO_BIG, rc, "call with short reply buffer");
+		rx_iov.len = sizeof(rx_buf);
+
+		rc = call(chan, &tx_msg, &rx_msg, 1000);
+		EXPECT_EQ (64, rc, "call after short reply buffer");
+
+		rc = close(chan);
+		EXPECT_EQ (NO_ERROR, rc, "close channel");
+	}
+
+	TEST_END
+}
+
+/*
+ *  Send a memory object to ourself and map it on both ends
+ */
+static void run_memref_test(void)
+{
+	int rc;
+	handle_t port;
+	handle_t chan;
+	handle_t srv_chan;
+	handle_t memref;
+	handle_t rx_memref = INVALID_IPC_HANDLE;
+	uevent_t uevt;
+	uuid_t peer_uuid;
+	ipc_msg_t msg;
+	ipc_msg_info_t inf;
+	iovec_t iov;
+	uint8_t tx_buf[16];
+	uint8_t rx_buf[16];
+	uint8_t *tx_mem;
+	uint8_t *rx_mem;
+	char path[MAX_PORT_PATH_LEN];
+	const uint32_t size = 2 * 4096;
+
+	TEST_BEGIN(__func__);
+
+	rc = memref_create(0, 0);
+	EXPECT_EQ (ERR_INVALID_ARGS, rc, "create empty memref");
+
+	rc = memref_create(size, 0);
+	EXPECT_GE_ZERO (rc, "create memref");
+	if (rc < 0)
+		goto err_create;
+	memref = (handle_t) rc;
+
+	rc = mmap(NULL, 2 * size, MMAP_FLAG_MEMREF_HANDLE, memref);
+	EXPECT_EQ (ERR_INVALID_ARGS, rc, "map more than memref size");
+
+	rc = mmap(NULL, size, MMAP_FLAG_MEMREF_HANDLE, memref);
+	EXPECT_GT_ZERO (rc, "map memref");
+	if (rc <= 0)
+		goto err_map;
+	tx_mem = (uint8_t *)(uintptr_t)rc;
+	fill_test_buf(tx_mem, size, 0x11);
+
+	/* connect to our own port and accept the connection */
+	sprintf(path, "%s.main.%s", SRV_PATH_BASE, "memref");
+	rc = port_create(path, 1, sizeof(rx_buf), IPC_PORT_ALLOW_TA_CONNECT);
+	EXPECT_GE_ZERO (rc, "create port");
+	if (rc < 0)
+		goto err_port_create;
+	port = (handle_t) rc;
+
+	rc = connect(path, IPC_CONNECT_ASYNC);
+	EXPECT_GE_ZERO (rc, "connect");
+	if (rc < 0)
+		goto err_connect;
+	chan = (handle_t) rc;
+
+	rc = wait(port, &uevt, 1000);
+	EXPECT_EQ (NO_ERROR, rc, "wait on port");
+	rc = accept(port, &peer_uuid);
+	EXPECT_GE_ZERO (rc, "accept");
+	if (rc < 0)
+		goto err_accept;
+	srv_chan = (handle_t) rc;
+
+	rc = wait(chan, &uevt, 1000);
+	EXPECT_EQ (NO_ERROR, rc, "wait for connect");
+	EXPECT_EQ (IPC_HANDLE_POLL_READY, uevt.event, "wait for connect");
+
+	/* send data and the memref */
+	fill_test_buf(tx_buf, sizeof(tx_buf), 0x22);
+	iov.base = tx_buf;
+	iov.len = sizeof(tx_buf);
+	msg.num_iov = 1;
+	msg.iov = &iov;
+	msg.num_handles = 1;
+	msg.handles = &memref;
+	rc = send_msg(chan, &msg);
+	EXPECT_EQ (sizeof(tx_buf), rc, "send memref");
+
+	rc = wait(srv_chan, &uevt, 1000);
+	EXPECT_EQ (NO_ERROR, rc, "wait for msg");
+	rc = get_msg(srv_chan, &inf);
+	EXPECT_EQ (NO_ERROR, rc, "get msg");
+	EXPECT_EQ (1, inf.num_handles, "get msg");
+
+	/* data only, handles stay attached */
+	iov.base = rx_buf;
+	iov.len = sizeof(rx_buf);
+	msg.num_handles = 0;
+	msg.handles = NULL;
+	rc = read_msg(srv_chan, inf.id, 0, &msg);
+	EXPECT_EQ (sizeof(rx_buf), rc, "read data");
+	rc = memcmp(tx_buf, rx_buf, sizeof(rx_buf));
+	EXPECT_EQ (0, rc, "read data");
+
+	msg.num_handles = 1;
+	msg.handles = &rx_memref;
+	rc = read_msg(srv_chan, inf.id, 0, &msg);
+	EXPECT_EQ (sizeof(rx_buf), rc, "read handles");
+	rc = put_msg(srv_chan, inf.id);
+	EXPECT_EQ (NO_ERROR, rc, "put msg");
+
+	/* the received handle maps the same pages */
+	rc = mmap(NULL, size, MMAP_FLAG_MEMREF_HANDLE, rx_memref);
+	EXPECT_GT_ZERO (rc, "map received memref");
+	if (rc > 0) {
+		rx_mem = (uint8_t *)(uintptr_t)rc;
+		rc = memcmp(tx_mem, rx_mem, size);
+		EXPECT_EQ (0, rc, "shared memref data");
+		rx_mem[0] = 0x33;
+		EXPECT_EQ (0x33, tx_mem[0], "shared memref data");
+		rc = munmap(rx_mem, size);
+		EXPECT_EQ (NO_ERROR, rc, "unmap received memref");
+	}
+	rc = close(rx_memref);
+	EXPECT_EQ (NO_ERROR, rc, "close received memref");
+
+	close(srv_chan);
+err_accept:
+	close(chan);
+err_connect:
+	close(port);
+err_port_create:
+	rc = munmap(tx_mem, size);
+	EXPECT_EQ (NO_ERROR, rc, "unmap memref");
+err_map:
+	rc = close(memref);
+	EXPECT_EQ (NO_ERROR, rc, "close memref");
+err_create:
+	TEST_END
+}
+
+static void run_map_msg_buf_test(void)
+{
+	int rc;
+	handle_t port;
+	handle_t chan;
+	handle_t srv_chan;
+	uevent_t uevt;
+	uuid_t peer_uuid;
+	ipc_msg_t msg;
+	ipc_msg_info_t inf;
+	iovec_t iov;
+	uint8_t tx_buf[64];
+	char path[MAX_PORT_PATH_LEN];
+
+	TEST_BEGIN(__func__);
+
+	/* connect to our own port with mapped message buffers */
+	sprintf(path, "%s.main.%s", SRV_PATH_BASE, "mapbuf");
+	rc = port_create(path, 2, sizeof(tx_buf),
+	                 IPC_PORT_ALLOW_TA_CONNECT | IPC_PORT_MAP_MSG_BUF);
+	EXPECT_GE_ZERO (rc, "create port");
+	if (rc < 0)
+		goto err_port_create;
+	port = (handle_t) rc;
+
+	rc = connect(path, IPC_CONNECT_ASYNC);
+	EXPECT_GE_ZERO (rc, "connect");
+	if (rc < 0)
+		goto err_connect;
+	chan = (handle_t) rc;
+
+	rc = wait(port, &uevt, 1000);
+	EXPECT_EQ (NO_ERROR, rc, "wait on port");
+	rc = accept(port, &peer_uuid);
+	EXPECT_GE_ZERO (rc, "accept");
+	if (rc < 0)
+		goto err_accept;
+	srv_chan = (handle_t) rc;
+
+	rc = wait(chan, &uevt, 1000);
+	EXPECT_EQ (NO_ERROR, rc, "wait for connect");
+	EXPECT_EQ (IPC_HANDLE_POLL_READY, uevt.event, "wait for connect");
+
+	iov.base = tx_buf;
+	iov.len = sizeof(tx_buf);
+	msg.num_iov = 1;
+	msg.iov = &iov;
+	msg.num_handles = 0;
+	msg.handles = NULL;
+
+	/* the server sees the message in place */
+	fill_test_buf(tx_buf, sizeof(tx_buf), 0x44);
+	rc = send_msg(chan, &msg);
+	EXPECT_EQ (sizeof(tx_buf), rc, "send to server");
+
+	rc = wait(srv_chan, &uevt, 1000);
+	EXPECT_EQ (NO_ERROR, rc, "wait for msg");
+	rc = get_msg(srv_chan, &inf);
+	EXPECT_EQ (NO_ERROR, rc, "get msg");
+	EXPECT_EQ (sizeof(tx_buf), inf.len, "get msg");
+	EXPECT_EQ (true, inf.buf != NULL, "mapped msg buf");
+	if (inf.buf) {
+		rc = memcmp(tx_buf, inf.buf, sizeof(tx_buf));
+		EXPECT_EQ (0, rc, "mapped msg data");
+	}
+	rc = put_msg(srv_chan, inf.id);
+	EXPECT_EQ (NO_ERROR, rc, "put msg");
+
+	/* replies to the client are not mapped */
+	rc = send_msg(srv_chan, &msg);
+	EXPECT_EQ (sizeof(tx_buf), rc, "send to client");
+
+	rc = wait(chan, &uevt, 1000);
+	EXPECT_EQ (NO_ERROR, rc, "wait for reply");
+	rc = get_msg(chan, &inf);
+	EXPECT_EQ (NO_ERROR, rc, "get reply");
+	EXPECT_EQ (true, inf.buf == NULL, "unmapped msg buf");
+	rc = put_msg(chan, inf.id);
+	EXPECT_EQ (NO_ERROR, rc, "put reply");
+
+	close(srv_chan);
+err_accept:
+	close(chan);
+err_connect:
+	close(port);
+err_port_create:
+	TEST_END
+}
+
+static void run_port_stats_test(void)
+{
+	int rc;
+	handle_t port;
+	handle_t chan;
+	handle_t srv_chan;
+	uevent_t uevt;
+	uuid_t peer_uuid;
+	ipc_msg_t msg;
+	ipc_msg_info_t inf;
+	ipc_stats_t stats;
+	iovec_t iov;
+	uint8_t tx_buf[64];
+	uint32_t latency_total = 0;
+	char path[MAX_PORT_PATH_LEN];
+
+	TEST_BEGIN(__func__);
+
+	sprintf(path, "%s.main.%s", SRV_PATH_BASE, "stats");
+	rc = port_stats(path, &stats);
+	EXPECT_EQ (ERR_NOT_FOUND, rc, "stats of unknown port");
+
+	/* connect to our own port with two buffers */
+	rc = port_create(path, 2, sizeof(tx_buf), IPC_PORT_ALLOW_TA_CONNECT);
+	EXPECT_GE_ZERO (rc, "create port");
+	if (rc < 0)
+		goto err_port_create;
+	port = (handle_t) rc;
+
+	rc = connect(path, IPC_CONNECT_ASYNC);
+	EXPECT_GE_ZERO (rc, "connect");
+	if (rc < 0)
+		goto err_connect;
+	chan = (handle_t) rc;
+
+	rc = wait(port, &uevt, 1000);
+	EXPECT_EQ (NO_ERROR, rc, "wait on port");
+	rc = accept(port, &peer_uuid);
+	EXPECT_GE_ZERO (rc, "accept");
+	if (rc < 0)
+		goto err_accept;
+	srv_chan = (handle_t) rc;
+
+	rc = wait(chan, &uevt, 1000);
+	EXPECT_EQ (NO_ERROR, rc, "wait for connect");
+
+	fill_test_buf(tx_buf, sizeof(tx_buf), 0x55);
+	iov.base = tx_buf;
+	iov.len = sizeof(tx_buf);
+	msg.num_iov = 1;
+	msg.iov = &iov;
+	msg.num_handles = 0;
+	msg.handles = NULL;
+
+	/* fill the server queue and block once */
+	rc = send_msg(chan, &msg);
+	EXPECT_EQ (sizeof(tx_buf), rc, "send 1");
+	rc = send_msg(chan, &msg);
+	EXPECT_EQ (sizeof(tx_buf), rc, "send 2");
+	rc = send_msg(chan, &msg);
+	EXPECT_EQ (ERR_NOT_ENOUGH_BUFFER, rc, "send 3");
+	rc = send_msg(chan, &msg);
+	EXPECT_EQ (ERR_NOT_ENOUGH_BUFFER, rc, "send 4");
+
+	for (uint i = 0; i < 2; i++) {
+		rc = get_msg(srv_chan, &inf);
+		EXPECT_EQ (NO_ERROR, rc, "get msg");
+		rc = put_msg(srv_chan, inf.id);
+		EXPECT_EQ (NO_ERROR, rc, "put msg");
+	}
+
+	/* and reply once */
+	iov.len = sizeof(tx_buf) / 2;
+	rc = send_msg(srv_chan, &msg);
+	EXPECT_EQ (sizeof(tx_buf) / 2, rc, "reply");
+
+	rc = port_stats(path, &stats);
+	EXPECT_EQ (NO_ERROR, rc, "port stats");
+	EXPECT_EQ (2, stats.rx_msgs, "rx msgs");
+	EXPECT_EQ (2 * sizeof(tx_buf), stats.rx_bytes, "rx bytes");
+	EXPECT_EQ (1, stats.tx_msgs, "tx msgs");
+	EXPECT_EQ (sizeof(tx_buf) / 2, stats.tx_bytes, "tx bytes");
+	EXPECT_EQ (0, stats.send_blocked, "send blocked");
+	EXPECT_EQ (1, stats.peer_send_blocked, "peer send blocked");
+	EXPECT_EQ (2, stats.max_queued, "max queued");
+	for (uint i = 0; i < IPC_STATS_LATENCY_BUCKETS; i++)
+		latency_total += stats.latency_hist[i];
+	EXPECT_EQ (2, latency_total, "latency samples");
+
+	close(srv_chan);
+err_accept:
+	close(chan);
+err_connect:
+	close(port);
+err_port_create:
+	TEST_END
+}
 
 /****************************************************************************/
 
@@ -1467,6 +1892,10 @@ static void run_all_tests (void)
 	run_accept_test();
 	run_send_msg_test();
 	run_end_to_end_msg_test();
+	run_call_test();
+	run_memref_test();
+	run_map_msg_buf_test();
+	run_port_stats_test();
 
 	run_connect_close_by_peer_test("closer1");
 	run_connect_close_by_peer_test("closer2");
@@ -31,6 +31,9 @@ trusty_app_manifest_t TRUSTY_APP_MANIFEST_ATTRS trusty_app_manifest =
 
 		/* 2 pages for stack */
 		TRUSTY_APP_CONFIG_MIN_STACK_SIZE(2 * 4096),
+
+		/* read ipc port statistics */
+		TRUSTY_APP_CONFIG_IPC_STATS,
 	},
 };
 
@@ -2663,6 +2663,66 @@ test_abort:
     TEST_END;
 }
 
+TEST_P(CompoundFailedOperation)
+{
+    int rc;
+    uint32_t val = 0xDEADBEEF;
+    uint32_t rd_val = 0;
+    struct storage_compound compound;
+    const char *fname = "test_compound_failed_op";
+
+    TEST_BEGIN(__func__);
+
+    // make sure the file to open in the failing operation does not exist
+    rc = storage_delete_file(ss, "foo", STORAGE_OP_COMPLETE);
+    rc = (rc == ERR_NOT_FOUND) ? 0 : rc;
+    ASSERT_EQ(0, rc);
+
+    // create, write, read back and close a file, then open a missing file
+    storage_compound_init(&compound, ss);
+    rc = storage_compound_open_file(&compound, fname,
+                                    STORAGE_FILE_OPEN_CREATE |
+                                    STORAGE_FILE_OPEN_TRUNCATE,
+                                    STORAGE_OP_COMPLETE);
+    ASSERT_EQ(0, rc);
+    rc = storage_compound_write(&compound, 0, &val, sizeof(val), 0);
+    ASSERT_EQ(0, rc);
+    rc = storage_compound_read(&compound, 0, &rd_val, sizeof(rd_val));
+    ASSERT_EQ(0, rc);
+    rc = storage_compound_close_file(&compound);
+    ASSERT_EQ(0, rc);
+    rc = storage_compound_open_file(&compound, "foo", 0, 0);
+    ASSERT_EQ(0, rc);
+    rc = storage_compound_end_transaction(&compound, true);
+    ASSERT_EQ(0, rc);
+
+    // the error of the failed operation is returned (expect ERR_NOT_FOUND)
+    rc = storage_compound_send(&compound);
+    ASSERT_EQ(ERR_NOT_FOUND, rc);
+
+    // operations before it still return their results
+    ASSERT_EQ(0, storage_compound_result(&compound, 0));
+    ASSERT_EQ((int)sizeof(val), storage_compound_result(&compound, 1));
+    ASSERT_EQ((int)sizeof(rd_val), storage_compound_result(&compound, 2));
+    ASSERT_EQ(val, rd_val);
+    ASSERT_EQ(0, storage_compound_result(&compound, 3));
+    ASSERT_EQ(ERR_NOT_FOUND, storage_compound_result(&compound, 4));
+
+    // and operations after it are not run (expect ERR_NOT_READY)
+    ASSERT_EQ(ERR_NOT_READY, storage_compound_result(&compound, 5));
+
+    // the write was not committed, discard it
+    rc = storage_end_transaction(ss, false);
+    ASSERT_EQ(0, rc);
+
+    // cleanup
+    rc = storage_delete_file(ss, fname, STORAGE_OP_COMPLETE);
+    ASSERT_EQ(0, rc);
+
+test_abort:
+    TEST_END;
+}
+
 
 void run_all_tests(const char *port)
 {
@@ -2728,6 +2788,9 @@ void run_all_tests(const char *port)
     RUN_TEST_P(port, TransactRewriteExistingSetSize);
     RUN_TEST_P(port, TransactResumeAfterNonFatalError);
 
+    // Compound request tests
+    RUN_TEST_P(port, CompoundFailedOperation);
+
     TLOGI("SS-unittest: %s: ends\n", port);
 }
 
@@ -15,9 +15,11 @@
  */
 
 #include <assert.h>
+#include <compiler.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "block_allocator.h"
@@ -229,18 +231,386 @@ block_allocator_queue_find_free_block(struct block_allocator_queue *q,
     }
 }
 
+/**
+ * block_free_index_clear - Invalidate free range index
+ * @index:      Free range index object.
+ *
+ * Call when the committed free set is replaced, or may no longer match the
+ * index. The index is rebuilt the next time it is used.
+ */
+void block_free_index_clear(struct block_free_index *index)
+{
+    index->valid = false;
+    index->count = 0;
+    index->search_start = 0;
+    index->complete_freed_count = 0;
+}
+
+/**
+ * block_free_index_reset_search - Restart free block searches at block 0
+ * @index:      Free range index object.
+ *
+ * Call when blocks allocated by a transaction may have been released.
+ */
+void block_free_index_reset_search(struct block_free_index *index)
+{
+    index->search_start = 0;
+}
+
+/**
+ * block_free_index_load - Load free range index from committed free set
+ * @tr:         Transaction object.
+ * @min_block:  First block the index should cover.
+ */
+static void block_free_index_load(struct transaction *tr,
+                                  data_block_t min_block)
+{
+    struct block_free_index *index = &tr->fs->free_index;
+
+    index->count = block_set_get_ranges(tr, &tr->fs->free, min_block,
+                                        index->ranges, countof(index->ranges));
+    if (tr->failed) {
+        block_free_index_clear(index);
+        return;
+    }
+    index->start = min_block;
+    if (index->count < countof(index->ranges)) {
+        index->end = tr->fs->dev->block_count;
+    } else {
+        index->end = index->ranges[index->count - 1].end;
+    }
+    index->valid = true;
+
+    pr_read("loaded %d free ranges, %lld-%lld\n",
+            index->count, index->start, index->end - 1);
+}
+
+/**
+ * block_free_index_lookup - Find range in free range index
+ * @index:      Free range index object.
+ * @block:      Block number.
+ *
+ * Return: Index in @index->ranges of first range that ends after @block, or
+ * @index->count if there is no such range.
+ */
+static uint block_free_index_lookup(struct block_free_index *index,
+                                    data_block_t block)
+{
+    uint lo = 0;
+    uint hi = index->count;
+    uint mid;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (index->ranges[mid].end <= block) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/**
+ * block_free_index_drop_last - Remove last range from free range index
+ * @index:      Free range index object.
+ *
+ * Make room for a new entry by moving the end of the index to the start of
+ * its last range.
+ */
+static void block_free_index_drop_last(struct block_free_index *index)
+{
+    assert(index->count);
+    index->count--;
+    index->end = index->ranges[index->count].start;
+}
+
+/**
+ * block_free_index_insert - Insert range in free range index
+ * @index:      Free range index object.
+ * @i:          Position to insert @range at.
+ * @range:      Range to insert.
+ *
+ * If @index is full, its last range is dropped first. If @range would be the
+ * last range, it is dropped instead.
+ */
+static void block_free_index_insert(struct block_free_index *index, uint i,
+                                    struct block_range range)
+{
+    if (index->count == countof(index->ranges)) {
+        if (i == index->count) {
+            index->end = range.start;
+            return;
+        }
+        block_free_index_drop_last(index);
+    }
+    memmove(&index->ranges[i + 1], &index->ranges[i],
+            sizeof(index->ranges[0]) * (index->count - i));
+    index->ranges[i] = range;
+    index->count++;
+}
+
+/**
+ * block_free_index_remove - Remove ranges from free range index
+ * @index:      Free range index object.
+ * @i:          Position of first range to remove.
+ * @count:      Number of ranges to remove.
+ */
+static void block_free_index_remove(struct block_free_index *index, uint i,
+                                    uint count)
+{
+    assert(i + count <= index->count);
+    memmove(&index->ranges[i], &index->ranges[i + count],
+            sizeof(index->ranges[0]) * (index->count - i - count));
+    index->count -= count;
+}
+
+/**
+ * block_free_index_add_range - Add range to free range index
+ * @index:      Free range index object.
+ * @range:      Range that is now in the committed free set.
+ */
+static void block_free_index_add_range(struct block_free_index *index,
+                                       struct block_range range)
+{
+    uint i;
+    uint j;
+
+    range.start = MAX(range.start, index->start);
+    range.end = MIN(range.end, index->end);
+    if (range.start >= range.end) {
+        return;
+    }
+
+    /* Merge with overlapping and adjacent ranges */
+    i = block_free_index_lookup(index, range.start);
+    if (i && index->ranges[i - 1].end == range.start) {
+        i--;
+    }
+    for (j = i; j < index->count && index->ranges[j].start <= range.end; j++) {
+        range.start = MIN(range.start, index->ranges[j].start);
+        range.end = MAX(range.end, index->ranges[j].end);
+    }
+    if (j > i) {
+        index->ranges[i] = range;
+        block_free_index_remove(index, i + 1, j - i - 1);
+    } else {
+        block_free_index_insert(index, i, range);
+    }
+}
+
+/**
+ * block_free_index_remove_range - Remove range from free range index
+ * @index:      Free range index object.
+ * @range:      Range that is no longer in the committed free set.
+ */
+static void block_free_index_remove_range(struct block_free_index *index,
+                                          struct block_range range)
+{
+    uint i;
+    struct block_range tail;
+
+    range.start = MAX(range.start, index->start);
+    range.end = MIN(range.end, index->end);
+    if (range.start >= range.end) {
+        return;
+    }
+
+    i = block_free_index_lookup(index, range.start);
+    if (i < index->count && index->ranges[i].start < range.start) {
+        tail = index->ranges[i];
+        index->ranges[i].end = range.start;
+        if (tail.end > range.end) {
+            tail.start = range.end;
+            block_free_index_insert(index, i + 1, tail);
+            return;
+        }
+        i++;
+    }
+    while (i < index->count && index->ranges[i].end <= range.end) {
+        block_free_index_remove(index, i, 1);
+    }
+    if (i < index->count && index->ranges[i].start < range.end) {
+        index->ranges[i].start = range.end;
+    }
+}
+
+/**
+ * block_free_index_complete_free - Track block freed while completing
+ * @tr:         Transaction object.
+ * @block:      Block added to @tr->new_free_set.
+ */
+static void block_free_index_complete_free(struct transaction *tr,
+                                           data_block_t block)
+{
+    struct block_free_index *index = &tr->fs->free_index;
+
+    if (index->complete_freed_count < countof(index->complete_freed)) {
+        index->complete_freed[index->complete_freed_count] = block;
+    }
+    index->complete_freed_count++;
+}
+
+/**
+ * block_free_index_commit - Update free range index for committed transaction
+ * @tr:         Transaction object.
+ *
+ * Call after the new free set of @tr has replaced the committed free set.
+ * Removes the blocks @tr allocated from the index and adds the blocks it
+ * freed, instead of reloading the index from the new free set.
+ */
+void block_free_index_commit(struct transaction *tr)
+{
+    struct block_free_index *index = &tr->fs->free_index;
+    struct block_range range;
+    uint i;
+
+    if (!index->valid ||
+        index->complete_freed_count > countof(index->complete_freed)) {
+        block_free_index_clear(index);
+        return;
+    }
+
+    range = block_set_find_next_range(tr, &tr->allocated, index->start);
+    while (!block_range_empty(range) && range.start < index->end) {
+        block_free_index_remove_range(index, range);
+        range = block_set_find_next_range(tr, &tr->allocated, range.end);
+    }
+    range = block_set_find_next_range(tr, &tr->freed, index->start);
+    while (!block_range_empty(range) && range.start < index->end) {
+        block_free_index_add_range(index, range);
+        range = block_set_find_next_range(tr, &tr->freed, range.end);
+    }
+    for (i = 0; i < index->complete_freed_count; i++) {
+        block_range_init_single(&range, index->complete_freed[i]);
+        block_free_index_add_range(index, range);
+    }
+    index->complete_freed_count = 0;
+    index->search_start = 0;
+
+    if (tr->failed) {
+        block_free_index_clear(index);
+    }
+}
+
+/**
+ * block_free_index_find_next - Find a block in the committed free set
+ * @tr:         Transaction object.
+ * @min_block:  Block number to start search at.
+ *
+ * Same as block_set_find_next_block(tr, &tr->fs->free, @min_block, true), but
+ * uses the in-memory free range index instead of walking the free set tree.
+ * The index is reloaded starting at @min_block if it does not cover it, or if
+ * it has no free blocks after @min_block but does not reach the end of the
+ * device.
+ *
+ * Return: First block in committed free set >= @min_block, or 0 if no match is
+ * found.
+ */
+data_block_t block_free_index_find_next(struct transaction *tr,
+                                        data_block_t min_block)
+{
+    struct block_free_index *index = &tr->fs->free_index;
+    uint i = 0;
+    data_block_t block;
+
+    if (index->valid && min_block >= index->start) {
+        i = block_free_index_lookup(index, min_block);
+    }
+    if (!index->valid || min_block < index->start ||
+        (i == index->count && index->end < tr->fs->dev->block_count)) {
+        block_free_index_load(tr, min_block);
+        if (tr->failed) {
+            return 0;
+        }
+        i = block_free_index_lookup(index, min_block);
+    }
+
+    if (i < index->count) {
+        block = MAX(min_block, index->ranges[i].start);
+    } else {
+        block = 0;
+    }
+
+    full_assert(tr->failed ||
+                block == block_set_find_next_block(tr, &tr->fs->free,
+                                                   min_block, true));
+
+    return block;
+}
+
+/*
+ * Blocks left free before a new run that starts in the free range that other
+ * allocations take blocks from. Other allocations take the lowest free block,
+ * so without this gap, metadata that is written while the run grows would be
+ * placed right after it and end it.
+ */
+#define BLOCK_ALLOCATE_RUN_GAP (32)
+
+/*
+ * Minimum number of free blocks a range needs to start a new run in it.
+ */
+#define BLOCK_ALLOCATE_RUN_MIN (16)
+
+/**
+ * block_free_index_find_run - Find a place to start a run of blocks
+ * @tr:         Transaction object.
+ * @block:      Block number the next non-run allocation would return.
+ * @max_block:  Block number the run should stay below.
+ *
+ * Look for a committed free range that has room for a run of consecutive
+ * blocks, so files can be stored as extents, and written to a non-secure
+ * backing file in large chunks. Start %BLOCK_ALLOCATE_RUN_GAP blocks after
+ * @block if the free range @block is in is large enough, otherwise use the
+ * first following range with at least %BLOCK_ALLOCATE_RUN_MIN blocks.
+ *
+ * Only the ranges in the index are checked, and blocks used by active
+ * transactions are not excluded.
+ *
+ * Return: Block number to start run search at, or 0 if no suitable range was
+ * found.
+ */
+data_block_t block_free_index_find_run(struct transaction *tr,
+                                       data_block_t block,
+                                       data_block_t max_block)
+{
+    struct block_free_index *index = &tr->fs->free_index;
+    uint i;
+    data_block_t start;
+
+    if (block_free_index_find_next(tr, block) != block) {
+        return 0;
+    }
+    i = block_free_index_lookup(index, block);
+    assert(i < index->count);
+    if (block + BLOCK_ALLOCATE_RUN_GAP + BLOCK_ALLOCATE_RUN_MIN <=
+        MIN(index->ranges[i].end, max_block)) {
+        return block + BLOCK_ALLOCATE_RUN_GAP;
+    }
+    for (i++; i < index->count; i++) {
+        start = index->ranges[i].start;
+        if (start + BLOCK_ALLOCATE_RUN_MIN > max_block) {
+            break;
+        }
+        if (start + BLOCK_ALLOCATE_RUN_MIN <= index->ranges[i].end) {
+            return start;
+        }
+    }
+    return 0;
+}
+
 static struct block_allocator_queue block_allocator_queue;
 
 /**
- * find_free_block - Search for a free block
+ * find_free_block_from - Search for a free block
  * @tr:             Transaction object.
  * @min_block_in:   Block number to start search at.
  *
  * Return: Block number that is in commited free set and not already allocated
  * by any transaction.
  */
-static data_block_t find_free_block(struct transaction *tr,
-                                    data_block_t min_block_in)
+static data_block_t find_free_block_from(struct transaction *tr,
+                                         data_block_t min_block_in)
 {
     data_block_t block;
     data_block_t min_block = min_block_in;
@@ -252,7 +622,7 @@ static data_block_t find_free_block(struct transaction *tr,
 
     block = min_block;
     do {
-        block = block_set_find_next_block(tr, &tr->fs->free, block, true);
+        block = block_free_index_find_next(tr, block);
         if (tr->failed) {
             return 0;
         }
@@ -261,7 +631,7 @@ static data_block_t find_free_block(struct transaction *tr,
 
             if (LOCAL_TRACE >= TRACE_LEVEL_READ) {
                 if (min_block_in) {
-                    block = find_free_block(tr, 0);
+                    block = find_free_block_from(tr, 0);
                 }
                 printf("%s: no space, min_block %lld, free block ignoring_min_block %lld\n",
                        __func__, min_block_in, block);
@@ -302,20 +672,55 @@ static data_block_t find_free_block(struct transaction *tr,
 }
 
 /**
- * block_allocate_etc - Allocate a block
+ * find_free_block - Search for a free block
+ * @tr:             Transaction object.
+ * @min_block:      Block number to start search at.
+ *
+ * Same as find_free_block_from, but skips the blocks below the search start
+ * of the free range index, which are known to be in use by active
+ * transactions, and moves the search start up to the block found.
+ *
+ * Return: Block number that is in commited free set and not already allocated
+ * by any transaction.
+ */
+static data_block_t find_free_block(struct transaction *tr,
+                                    data_block_t min_block)
+{
+    struct block_free_index *index = &tr->fs->free_index;
+    data_block_t block;
+
+    if (min_block > index->search_start) {
+        return find_free_block_from(tr, min_block);
+    }
+
+    block = find_free_block_from(tr, index->search_start);
+    full_assert(tr->failed || block == find_free_block_from(tr, min_block));
+    if (block) {
+        index->search_start = block;
+    }
+    return block;
+}
+
+/**
+ * block_allocate_common - Allocate a block
  * @tr:         Transaction object.
  * @is_tmp:     %true if allocated block should be automatically freed when
  *              transaction completes, %false if allocated block should be added
  *              to free set when transaction completes.
+ * @run:        %true to allocate a block for a run of consecutive blocks.
+ * @prev:       Previous block in run, or 0 to start a new run.
  *
  * Find a free block and add queue a set update.
  *
  * Return: Allocated block number.
  */
-data_block_t block_allocate_etc(struct transaction *tr, bool is_tmp)
+static data_block_t block_allocate_common(struct transaction *tr, bool is_tmp,
+                                          bool run, data_block_t prev)
 {
-    data_block_t block;
+    data_block_t block = 0;
+    data_block_t run_block;
     data_block_t min_block;
+    data_block_t tmp_start = tr->fs->dev->block_count / 4 * 3;
     bool update_sets;
 
     if (tr->failed) {
@@ -328,12 +733,30 @@ data_block_t block_allocate_etc(struct transaction *tr, bool is_tmp)
     /* TODO: group allocations by set */
     update_sets = block_allocator_queue_empty(&block_allocator_queue);
     if (update_sets) {
-        tr->last_tmp_free_block = tr->fs->dev->block_count / 4 * 3;
+        tr->last_tmp_free_block = tmp_start;
         tr->last_free_block = 0;
     }
     min_block = is_tmp ? tr->last_tmp_free_block : tr->last_free_block;
 
-    block = find_free_block(tr, min_block);
+    /* Keep runs out of the area tmp blocks are allocated from first */
+    if (run && prev && prev + 1 < tmp_start) {
+        block = find_free_block(tr, prev + 1);
+        if (block != prev + 1) {
+            block = 0;
+        }
+    }
+    if (!block) {
+        block = find_free_block(tr, min_block);
+        if (run && block) {
+            run_block = block_free_index_find_run(tr, block, tmp_start);
+            if (run_block) {
+                run_block = find_free_block(tr, run_block);
+            }
+            if (run_block && run_block < tmp_start) {
+                block = run_block;
+            }
+        }
+    }
     if (!block) {
         block = find_free_block(tr, 0);
         if (!block) {
@@ -359,6 +782,38 @@ data_block_t block_allocate_etc(struct transaction *tr, bool is_tmp)
     return block;
 }
 
+/**
+ * block_allocate_etc - Allocate a block
+ * @tr:         Transaction object.
+ * @is_tmp:     %true if allocated block should be automatically freed when
+ *              transaction completes, %false if allocated block should be added
+ *              to free set when transaction completes.
+ *
+ * Return: Allocated block number.
+ */
+data_block_t block_allocate_etc(struct transaction *tr, bool is_tmp)
+{
+    return block_allocate_common(tr, is_tmp, false, 0);
+}
+
+/**
+ * block_allocate_next - Allocate next block of a run of consecutive blocks
+ * @tr:         Transaction object.
+ * @prev:       Block the new block should follow, or 0 to start a new run.
+ *
+ * Allocate @prev + 1 if it is free, so consecutive file blocks end up in
+ * consecutive disk blocks. Otherwise start a new run where
+ * block_free_index_find_run finds room for one, or fall back to
+ * block_allocate's choice when free space is fragmented. Runs are not placed
+ * in the upper quarter of the device, where tmp blocks are allocated first.
+ *
+ * Return: Allocated block number.
+ */
+data_block_t block_allocate_next(struct transaction *tr, data_block_t prev)
+{
+    return block_allocate_common(tr, false, true, prev);
+}
+
 /**
  * block_allocator_add_allocated - Update block sets with new allocated block
  * @tr:         Transaction object.
@@ -404,10 +859,13 @@ static void block_allocator_add_allocated(struct transaction *tr,
  */
 void block_free_etc(struct transaction *tr, data_block_t block, bool is_tmp)
 {
+    struct block_free_index *index = &tr->fs->free_index;
     bool update_sets = block_allocator_queue_empty(&block_allocator_queue);
 
     assert(block_is_clean(tr->fs->dev, block));
 
+    index->search_start = MIN(index->search_start, block);
+
     block_allocator_queue_add(&block_allocator_queue, block, is_tmp, true);
     if (update_sets) {
         block_allocator_process_queue(tr);
@@ -460,6 +918,7 @@ static void block_allocator_add_free(struct transaction *tr,
 
             assert(tr->new_free_set);
             block_set_add_block(tr, tr->new_free_set, block);
+            block_free_index_complete_free(tr, block);
         } else {
             pr_write("add %lld to freed\n", block);
 
@@ -20,10 +20,66 @@
 #include <stdbool.h>
 
 #include "block_cache.h"
+#include "block_range.h"
+
+/*
+ * BLOCK_FREE_INDEX_SIZE:
+ * Number of committed free ranges kept in memory. If the free set has more
+ * ranges, the index holds a window of it that is moved when a lookup falls
+ * outside it.
+ */
+#define BLOCK_FREE_INDEX_SIZE (64)
+
+/*
+ * BLOCK_FREE_INDEX_COMPLETE_FREED_SIZE:
+ * Number of blocks freed straight into the new free set while a transaction
+ * completes that the index can track. The index is rebuilt if more blocks are
+ * freed this way.
+ */
+#define BLOCK_FREE_INDEX_COMPLETE_FREED_SIZE (16)
+
+/**
+ * struct block_free_index - In-memory copy of committed free ranges
+ * @valid:          %true if @ranges matches the committed free set of the file
+ *                  system, %false if it needs to be rebuilt.
+ * @start:          First block covered by @ranges.
+ * @end:            Block after the last block covered by @ranges.
+ * @search_start:   No block below this is available for allocation. Blocks
+ *                  in the committed free set below @search_start are in use
+ *                  by active transactions.
+ * @count:          Number of entries in @ranges.
+ * @ranges:         Committed free ranges between @start and @end, sorted by
+ *                  block number.
+ * @complete_freed_count:
+ *                  Number of entries in @complete_freed, or more if some did
+ *                  not fit.
+ * @complete_freed: Blocks added directly to the new free set by the
+ *                  transaction that is completing.
+ */
+struct block_free_index {
+    bool valid;
+    data_block_t start;
+    data_block_t end;
+    data_block_t search_start;
+    uint count;
+    struct block_range ranges[BLOCK_FREE_INDEX_SIZE];
+    uint complete_freed_count;
+    data_block_t complete_freed[BLOCK_FREE_INDEX_COMPLETE_FREED_SIZE];
+};
 
 struct transaction;
 
+void block_free_index_clear(struct block_free_index *index);
+void block_free_index_reset_search(struct block_free_index *index);
+void block_free_index_commit(struct transaction *tr);
+data_block_t block_free_index_find_next(struct transaction *tr,
+                                        data_block_t min_block);
+data_block_t block_free_index_find_run(struct transaction *tr,
+                                       data_block_t block,
+                                       data_block_t max_block);
+
 data_block_t block_allocate_etc(struct transaction *tr, bool is_tmp);
+data_block_t block_allocate_next(struct transaction *tr, data_block_t prev);
 void block_free_etc(struct transaction *tr, data_block_t block, bool is_tmp);
 bool block_allocator_allocation_queued(struct transaction *tr,
                                        data_block_t block,
@@ -46,8 +46,269 @@ static bool print_cache_get_ref_block_count = true;
 #define BLOCK_CACHE_GUARD_1 (0xdead0001dead0003)
 #define BLOCK_CACHE_GUARD_2 (0xdead0005dead0007)
 
-static struct list_node block_cache_lru = LIST_INITIAL_VALUE(block_cache_lru);
+/* Max number of blocks block_cache_clean_transaction encrypts at once */
+#define BLOCK_CACHE_ENCRYPT_BATCH (16)
+
+/*
+ * Relative cost of replacing an entry from each lru list. An entry is picked
+ * for reuse when its age multiplied by this weight is the highest among the
+ * least recently used entries of every candidate list. Free entries are always
+ * used first.
+ */
+static const uint block_cache_lru_weight[BLOCK_CACHE_LRU_COUNT] = {
+    [BLOCK_CACHE_LRU_CLEAN] = 4,
+    [BLOCK_CACHE_LRU_DIRTY] = 2,
+    [BLOCK_CACHE_LRU_DIRTY_TMP] = 1,
+};
+
+static struct list_node block_cache_free = LIST_INITIAL_VALUE(block_cache_free);
+static struct list_node block_cache_parts = LIST_INITIAL_VALUE(block_cache_parts);
+static uint64_t block_cache_lru_seq;
 static struct block_cache_entry *block_cache_entries;
+static uint block_cache_count;
+static struct list_node *block_cache_hash;
+static uint block_cache_hash_mask;
+
+/**
+ * block_cache_entry_has_refs - Check if cache entry is referenced
+ * @entry:      Cache entry
+ *
+ * Return: true if there are no references to @entry.
+ */
+static bool block_cache_entry_has_refs(struct block_cache_entry *entry)
+{
+    return !list_is_empty(&entry->obj.ref_list);
+}
+
+/**
+ * block_cache_entry_has_one_ref - Check if cache entry is referenced once
+ * @entry:      Cache entry
+ *
+ * Return: true if there is a single reference to @entry.
+ */
+static bool block_cache_entry_has_one_ref(struct block_cache_entry *entry)
+{
+    return list_length(&entry->obj.ref_list) == 1;
+}
+
+/**
+ * block_cache_hash_bucket - Get hash bucket for a specific block
+ * @dev:        Block device object.
+ * @block:      Block number
+ *
+ * Return: List head of hash bucket that cache entries for @dev,@block is
+ * stored in.
+ */
+static struct list_node *block_cache_hash_bucket(struct block_device *dev,
+                                                 data_block_t block)
+{
+    uint64_t hash = block ^ ((uintptr_t)dev >> 4);
+
+    hash *= 0x9e3779b97f4a7c15ULL;
+
+    return &block_cache_hash[(hash >> 32) & block_cache_hash_mask];
+}
+
+/**
+ * block_cache_entry_set_block - Change the block a cache entry is used for
+ * @entry:      Cache entry.
+ * @dev:        Block device object, or %NULL to mark entry as unused.
+ * @block:      Block number.
+ *
+ * Update @entry->dev and @entry->block and move @entry to the matching hash
+ * bucket.
+ */
+static void block_cache_entry_set_block(struct block_cache_entry *entry,
+                                        struct block_device *dev,
+                                        data_block_t block)
+{
+    if (list_in_list(&entry->hash_node)) {
+        list_delete(&entry->hash_node);
+    }
+    entry->dev = dev;
+    entry->block = dev ? block : ~0;
+    if (dev) {
+        list_add_head(block_cache_hash_bucket(dev, block), &entry->hash_node);
+    }
+}
+
+/**
+ * block_cache_fs_part - Get block cache partition for file system
+ * @fs:         File system state object.
+ *
+ * Return: Block cache partition of @fs. Registered on first use.
+ */
+static struct block_cache_part *block_cache_fs_part(struct fs *fs)
+{
+    int i;
+    struct block_cache_part *part = &fs->cache_part;
+
+    if (!list_in_list(&part->node)) {
+        for (i = 0; i < BLOCK_CACHE_LRU_COUNT; i++) {
+            list_initialize(&part->lru[i]);
+        }
+        part->count = 0;
+        memset(&part->stats, 0, sizeof(part->stats));
+        list_add_tail(&block_cache_parts, &part->node);
+    }
+    return part;
+}
+
+/**
+ * block_cache_entry_set_part - Change the partition that owns a cache entry
+ * @entry:      Cache entry.
+ * @part:       New owner, or %NULL.
+ */
+static void block_cache_entry_set_part(struct block_cache_entry *entry,
+                                       struct block_cache_part *part)
+{
+    if (entry->part == part) {
+        return;
+    }
+    if (entry->part) {
+        assert(entry->part->count);
+        entry->part->count--;
+    }
+    entry->part = part;
+    if (part) {
+        part->count++;
+    }
+}
+
+/**
+ * block_cache_entry_lru_list - Get lru list that matches state of cache entry
+ * @entry:      Cache entry.
+ *
+ * Entries without valid data are released from their partition.
+ *
+ * Return: lru list that @entry should be in when it has no references.
+ */
+static struct list_node *
+block_cache_entry_lru_list(struct block_cache_entry *entry)
+{
+    if (!entry->dirty && (!entry->dev || !entry->loaded)) {
+        block_cache_entry_set_part(entry, NULL);
+        return &block_cache_free;
+    }
+    assert(entry->part);
+    if (entry->dirty) {
+        return &entry->part->lru[entry->dirty_tmp ? BLOCK_CACHE_LRU_DIRTY_TMP :
+                                                    BLOCK_CACHE_LRU_DIRTY];
+    }
+    return &entry->part->lru[BLOCK_CACHE_LRU_CLEAN];
+}
+
+/**
+ * block_cache_entry_lru_update - Move unreferenced entry to matching lru list
+ * @entry:      Cache entry.
+ *
+ * Must be called after changing the dirty or loaded state of an unreferenced
+ * cache entry. Does nothing if @entry has references.
+ */
+static void block_cache_entry_lru_update(struct block_cache_entry *entry)
+{
+    if (!list_in_list(&entry->lru_node)) {
+        return;
+    }
+    list_delete(&entry->lru_node);
+    list_add_head(block_cache_entry_lru_list(entry), &entry->lru_node);
+}
+
+/**
+ * block_cache_entry_lru_insert - Add unreferenced entry to matching lru list
+ * @entry:      Cache entry.
+ *
+ * Used when a read started by block_prefetch completes. Entries with a pending
+ * prefetch read are not in any lru list, so they cannot be picked for reuse.
+ * Does nothing if @entry has references or is already in an lru list.
+ */
+static void block_cache_entry_lru_insert(struct block_cache_entry *entry)
+{
+    if (block_cache_entry_has_refs(entry) || list_in_list(&entry->lru_node)) {
+        return;
+    }
+    entry->lru_seq = ++block_cache_lru_seq;
+    list_add_head(block_cache_entry_lru_list(entry), &entry->lru_node);
+}
+
+/**
+ * block_cache_lru_pick_part - Pick an unreferenced entry from a partition
+ * @part:       Partition to pick entry from.
+ * @best:       Pointer to best entry found so far. Updated if a better entry
+ *              is found in @part.
+ * @best_score: Score of *@best.
+ */
+static void block_cache_lru_pick_part(struct block_cache_part *part,
+                                      struct block_cache_entry **best,
+                                      uint64_t *best_score)
+{
+    int i;
+    uint64_t score;
+    struct block_cache_entry *entry;
+
+    for (i = 0; i < BLOCK_CACHE_LRU_COUNT; i++) {
+        entry = list_peek_tail_type(&part->lru[i],
+                                    struct block_cache_entry, lru_node);
+        if (!entry) {
+            continue;
+        }
+        assert(entry->lru_seq <= block_cache_lru_seq);
+        score = block_cache_lru_weight[i] *
+                (block_cache_lru_seq - entry->lru_seq + 1);
+        if (!*best || score > *best_score) {
+            *best = entry;
+            *best_score = score;
+        }
+    }
+}
+
+/**
+ * block_cache_lru_pick - Pick an unreferenced cache entry to reuse
+ * @part:       Partition that needs a new entry.
+ *
+ * If @part has reached its max_count, only entries from @part are considered.
+ * Otherwise entries can be taken from any partition that has more than its
+ * min_count entries. If no entry passes these checks, quotas are ignored.
+ *
+ * Return: Free cache entry if available, otherwise the least recently used
+ * entry of the candidate lru list with the highest weighted age. %NULL if all
+ * cache entries have references.
+ */
+static struct block_cache_entry *block_cache_lru_pick(struct block_cache_part *part)
+{
+    uint64_t best_score = 0;
+    struct block_cache_entry *best;
+    struct block_cache_part *other;
+
+    best = list_peek_tail_type(&block_cache_free,
+                               struct block_cache_entry, lru_node);
+    if (best) {
+        return best;
+    }
+
+    if (part->max_count && part->count >= part->max_count) {
+        block_cache_lru_pick_part(part, &best, &best_score);
+        if (best) {
+            return best;
+        }
+    }
+
+    list_for_every_entry(&block_cache_parts, other,
+                         struct block_cache_part, node) {
+        if (other == part || other->count > other->min_count) {
+            block_cache_lru_pick_part(other, &best, &best_score);
+        }
+    }
+    if (best) {
+        return best;
+    }
+
+    list_for_every_entry(&block_cache_parts, other,
+                         struct block_cache_part, node) {
+        block_cache_lru_pick_part(other, &best, &best_score);
+    }
+    return best;
+}
 
 /**
  * block_cache_queue_io_op - Helper function to start a read or write operation
@@ -168,6 +429,7 @@ void block_cache_complete_read(struct block_device *dev,
     if (failed) {
         printf("%s: load block %lld failed\n",
                __func__, entry->block);
+        block_cache_entry_lru_insert(entry);
         return;
     }
     assert(!failed);
@@ -187,6 +449,7 @@ void block_cache_complete_read(struct block_device *dev,
     }
 
     entry->loaded = true;
+    block_cache_entry_lru_insert(entry);
 }
 
 /**
@@ -217,28 +480,6 @@ void block_cache_complete_write(struct block_device *dev,
     entry->dirty_tr = NULL;
 }
 
-/**
- * block_cache_entry_has_refs - Check if cache entry is referenced
- * @entry:      Cache entry
- *
- * Return: true if there are no references to @entry.
- */
-static bool block_cache_entry_has_refs(struct block_cache_entry *entry)
-{
-    return !list_is_empty(&entry->obj.ref_list);
-}
-
-/**
- * block_cache_entry_has_one_ref - Check if cache entry is referenced once
- * @entry:      Cache entry
- *
- * Return: true if there is a single reference to @entry.
- */
-static bool block_cache_entry_has_one_ref(struct block_cache_entry *entry)
-{
-    return list_length(&entry->obj.ref_list) == 1;
-}
-
 /**
  * block_cache_entry_decrypt - Decrypt cache entry
  * @entry:          Cache entry
@@ -275,56 +516,71 @@ static void block_cache_entry_decrypt(struct block_cache_entry *entry)
 }
 
 /**
- * block_cache_entry_encrypt - Encrypt cache entry and update mac
- * @entry:          Cache entry
+ * block_cache_entries_encrypt - Encrypt cache entries and update macs
+ * @entries:        Cache entries.
+ * @count:          Number of entries in @entries, at most
+ *                  %BLOCK_CACHE_ENCRYPT_BATCH.
  */
-static void block_cache_entry_encrypt(struct block_cache_entry *entry)
+static void block_cache_entries_encrypt(struct block_cache_entry **entries,
+                                        size_t count)
 {
     int ret;
-    void *encrypt_data;
-    size_t encrypt_size;
-    struct mac mac;
-    struct iv *iv = NULL; /* TODO: support external iv */
+    size_t i;
+    struct block_cache_entry *entry;
+    struct mac mac[BLOCK_CACHE_ENCRYPT_BATCH];
+    const struct iv *iv;
 
-    assert(entry->dirty);
-    assert(!entry->encrypted);
-    assert(!block_cache_entry_has_refs(entry));
-
-    encrypt_data = entry->data;
-    encrypt_size = entry->block_size;
-    if (!iv) {
-        iv = (void *)entry->data;
-        assert(encrypt_size > sizeof(*iv));
-        encrypt_data += sizeof(*iv);
-        encrypt_size -= sizeof(*iv);
-    }
+    assert(count && count <= BLOCK_CACHE_ENCRYPT_BATCH);
 
     stats_timer_start(STATS_FS_WRITE_BLOCK_ENCRYPT);
-    ret = encrypt(entry->key, encrypt_data, encrypt_size, iv);
-    stats_timer_stop(STATS_FS_WRITE_BLOCK_ENCRYPT);
-    assert(!ret);
-    entry->encrypted = true;
-    if (print_block_decrypt_encrypt) {
-        printf("%s: encrypt block %lld complete\n",
-               __func__, entry->block);
-    }
+    for (i = 0; i < count; i++) {
+        entry = entries[i];
+        assert(entry->dirty);
+        assert(!entry->encrypted);
+        assert(!block_cache_entry_has_refs(entry));
 
-    if (!entry->dirty_mac) {
-        mac = entry->mac;
+        /* The iv is stored at the start of the block */
+        assert(entry->block_size > sizeof(*iv));
+        iv = (const void *)entry->data;
+        ret = encrypt(entry->key, (uint8_t *)entry->data + sizeof(*iv),
+                      entry->block_size - sizeof(*iv), iv);
+        assert(!ret);
     }
+    stats_timer_stop(STATS_FS_WRITE_BLOCK_ENCRYPT);
 
     stats_timer_start(STATS_FS_WRITE_BLOCK_CALC_MAC);
-    ret = calculate_mac(entry->key, &entry->mac,
-                        entry->data, entry->block_size);
+    for (i = 0; i < count; i++) {
+        entry = entries[i];
+        mac[i] = entry->mac;
+        ret = calculate_mac(entry->key, &entry->mac,
+                            entry->data, entry->block_size);
+        assert(!ret);
+    }
     stats_timer_stop(STATS_FS_WRITE_BLOCK_CALC_MAC);
-    assert(!ret);
 
-    if (!entry->dirty_mac) {
-        assert(!CRYPTO_memcmp(&mac, &entry->mac, sizeof(mac)));
+    for (i = 0; i < count; i++) {
+        entry = entries[i];
+        entry->encrypted = true;
+        if (print_block_decrypt_encrypt) {
+            printf("%s: encrypt block %lld complete\n",
+                   __func__, entry->block);
+        }
+        if (!entry->dirty_mac) {
+            assert(!CRYPTO_memcmp(&mac[i], &entry->mac, sizeof(mac[i])));
+        }
+        entry->dirty_mac = false;
+        //assert(!entry->parent || entry->parent->ref_count);
+        //assert(!entry->parent || entry->parent->dirty_ref);
     }
-    entry->dirty_mac = false;
-    //assert(!entry->parent || entry->parent->ref_count);
-    //assert(!entry->parent || entry->parent->dirty_ref);
+}
+
+/**
+ * block_cache_entry_encrypt - Encrypt cache entry and update mac
+ * @entry:          Cache entry
+ */
+static void block_cache_entry_encrypt(struct block_cache_entry *entry)
+{
+    block_cache_entries_encrypt(&entry, 1);
 }
 
 /**
@@ -354,22 +610,6 @@ static void block_cache_entry_clean(struct block_cache_entry *entry)
     entry->dirty = false;
 }
 
-/**
- * block_cache_entry_score - Get a keep score
- * @entry:      Block cache entry to check
- * @index:      Number of available entries before @entry in lru.
- *
- * Return: A score value indicating in what order entries that are close in the
- * lru should be replaced.
- */
-static uint block_cache_entry_score(struct block_cache_entry *entry, uint index)
-{
-    if (!entry->dev) {
-        return ~0;
-    }
-    return (entry->dirty ? (entry->dirty_tmp ? 1 : 2) : 4) * index;
-}
-
 /**
  * block_cache_lookup - Get cache entry for a specific block
  * @fs:         File system state object, or %NULL is @allocate is %false.
@@ -389,17 +629,19 @@ static struct block_cache_entry *block_cache_lookup(struct fs *fs,
                                                     bool allocate)
 {
     struct block_cache_entry *entry;
-    struct block_cache_entry *unused_entry = NULL;
-    uint unused_entry_score = 0;
-    uint score;
-    uint available = 0;
-    uint in_use = 0;
+    struct list_node *bucket;
+    struct block_cache_part *part = NULL;
 
     assert(dev);
     assert(fs || !allocate);
 
+    if (allocate) {
+        part = block_cache_fs_part(fs);
+    }
+
     stats_timer_start(STATS_CACHE_LOOKUP);
-    list_for_every_entry(&block_cache_lru, entry, struct block_cache_entry, lru_node) {
+    bucket = block_cache_hash_bucket(dev, block);
+    list_for_every_entry(bucket, entry, struct block_cache_entry, hash_node) {
         assert(entry->guard1 == BLOCK_CACHE_GUARD_1);
         assert(entry->guard2 == BLOCK_CACHE_GUARD_2);
         if (entry->dev == dev && entry->block == block) {
@@ -410,47 +652,52 @@ static struct block_cache_entry *block_cache_lookup(struct fs *fs,
             }
             stats_timer_start(STATS_CACHE_LOOKUP_FOUND);
             stats_timer_stop(STATS_CACHE_LOOKUP_FOUND);
-            goto done;
-        }
-        if (!block_cache_entry_has_refs(entry)) {
-            score = block_cache_entry_score(entry, available);
-            available++;
-            if (score >= unused_entry_score) {
-                unused_entry = entry;
-                unused_entry_score = score;
+            if (part) {
+                part->stats.hits++;
             }
-            if (print_cache_lookup_verbose) {
-                printf("%s: block %lld, cache entry %zd available last used for %lld\n",
-                       __func__, block, entry - block_cache_entries, entry->block);
+            if (entry->io_op != BLOCK_CACHE_IO_OP_NONE) {
+                /*
+                 * Wait for read started by block_prefetch or write the block
+                 * device has not submitted yet.
+                 */
+                block_cache_complete_io(dev);
             }
-        } else {
-            if (print_cache_lookup_verbose) {
-                printf("%s: block %lld, cache entry %zd in use for %lld\n",
-                       __func__, block, entry - block_cache_entries, entry->block);
-            }
-            in_use++;
+            goto done;
+        }
+        if (print_cache_lookup_verbose) {
+            printf("%s: block %lld, cache entry %zd in same bucket used for %lld\n",
+                   __func__, block, entry - block_cache_entries, entry->block);
         }
     }
-    entry = unused_entry;
 
-    if (!entry || !allocate) {
+    entry = part ? block_cache_lru_pick(part) : NULL;
+    if (!entry) {
         if (print_cache_lookup) {
-            printf("%s: block %lld, no available entries, %u in use, allocate %d\n",
-                   __func__, block, in_use, allocate);
+            printf("%s: block %lld, no available entries, allocate %d\n",
+                   __func__, block, allocate);
         }
-        entry = NULL;
         goto done;
     }
 
     if (print_cache_lookup) {
-        printf("%s: block %lld, use cache entry %zd, dirty %d, %u available, %u in_use\n",
+        printf("%s: block %lld, use cache entry %zd, dirty %d, last used for %lld\n",
                __func__, block, entry - block_cache_entries,
-               entry->dirty, available, in_use);
+               entry->dirty, entry->block);
     }
 
+    assert(!block_cache_entry_has_refs(entry));
     assert(!entry->dirty_ref);
 
+    if (entry->io_op != BLOCK_CACHE_IO_OP_NONE) {
+        block_cache_complete_io(entry->dev);
+    }
+
+    part->stats.misses++;
+    if (entry->part) {
+        entry->part->stats.evictions++;
+    }
     if (entry->dirty) {
+        entry->part->stats.writebacks++;
         stats_timer_start(STATS_CACHE_LOOKUP_CLEAN);
         block_cache_entry_clean(entry);
         block_cache_complete_io(entry->dev);
@@ -460,13 +707,13 @@ static struct block_cache_entry *block_cache_lookup(struct fs *fs,
     assert(!entry->dirty_mac);
     assert(!entry->dirty_tr);
 
-    entry->dev = dev;
-    entry->block = block;
+    block_cache_entry_set_block(entry, dev, block);
     assert(dev->block_size <= sizeof(entry->data));
     entry->block_size = dev->block_size;
     entry->key = fs->key;
     entry->loaded = false;
     entry->encrypted = false;
+    block_cache_entry_lru_update(entry);
 
 done:
     stats_timer_stop(STATS_CACHE_LOOKUP);
@@ -560,6 +807,11 @@ static struct block_cache_entry *block_cache_get(struct fs *fs,
     }
 
     assert(!entry->dirty_ref);
+    if (!block_cache_entry_has_refs(entry)) {
+        assert(list_in_list(&entry->lru_node));
+        list_delete(&entry->lru_node);
+        block_cache_entry_set_part(entry, block_cache_fs_part(fs));
+    }
     obj_add_ref(&entry->obj, ref);
     if (print_block_ops) {
         printf("%s: block %lld, cache entry %zd, loaded %d, dirty %d\n",
@@ -610,7 +862,7 @@ static struct block_cache_entry *data_to_block_cache_entry(const void *data)
     assert(data);
     entry = containerof(data, struct block_cache_entry, data);
     assert(entry >= block_cache_entries);
-    assert(entry < &block_cache_entries[BLOCK_CACHE_SIZE]);
+    assert(entry < &block_cache_entries[block_cache_count]);
     assert(((uintptr_t)entry - (uintptr_t)entry) % sizeof(entry[0]) == 0);
     return entry;
 }
@@ -639,45 +891,184 @@ static void block_cache_entry_destroy(obj_t *obj)
 {
     struct block_cache_entry *entry = containerof(obj, struct block_cache_entry, obj);
 
-    list_delete(&entry->lru_node);
-    list_add_head(&block_cache_lru, &entry->lru_node);
+    assert(!list_in_list(&entry->lru_node));
 
     if (entry->dirty_mac) {
         block_cache_entry_encrypt(entry);
     }
+
+    entry->lru_seq = ++block_cache_lru_seq;
+    list_add_head(block_cache_entry_lru_list(entry), &entry->lru_node);
 }
 
 /**
  * block_cache_init - Allocate and initialize block cache
+ * @max_count:  Maximum number of cache entries to allocate.
+ *
+ * Allocate as many cache entries as the heap allows, up to @max_count, while
+ * leaving BLOCK_CACHE_HEAP_RESERVE bytes of heap for other allocations. At
+ * least BLOCK_CACHE_SIZE_MIN entries must be available.
+ *
+ * Return: Number of cache entries allocated.
  */
-void block_cache_init(void)
+uint block_cache_init(uint max_count)
 {
-    int i;
+    uint i;
+    uint count;
+    uint hash_size;
+    void *reserve;
     obj_ref_t ref;
     struct block_cache_entry *entry;
 
     assert(!block_cache_entries);
+    assert(max_count >= BLOCK_CACHE_SIZE_MIN);
+
+    reserve = malloc(BLOCK_CACHE_HEAP_RESERVE);
+    for (count = max_count; ; count -= (count - BLOCK_CACHE_SIZE_MIN + 1) / 2) {
+        for (hash_size = 1; hash_size < count; hash_size <<= 1)
+            ;
+        block_cache_hash = malloc(sizeof(block_cache_hash[0]) * hash_size);
+        entry = malloc(sizeof(block_cache_entries[0]) * count);
+        if ((entry && block_cache_hash) || count == BLOCK_CACHE_SIZE_MIN) {
+            break;
+        }
+        free(entry);
+        free(block_cache_hash);
+    }
+    free(reserve);
 
-    entry = malloc(sizeof(block_cache_entries[0]) * BLOCK_CACHE_SIZE);
     assert(entry);
-    full_assert(memset(entry, 1, sizeof(block_cache_entries[0]) * BLOCK_CACHE_SIZE));
+    assert(block_cache_hash);
+    if (count != max_count) {
+        pr_warn("block cache reduced to %u of %u entries\n", count, max_count);
+    }
+
+    block_cache_hash_mask = hash_size - 1;
+    for (i = 0; i < hash_size; i++) {
+        list_initialize(&block_cache_hash[i]);
+    }
+
+    full_assert(memset(entry, 1, sizeof(block_cache_entries[0]) * count));
     block_cache_entries = entry;
+    block_cache_count = count;
 
-    for (i = 0; i < BLOCK_CACHE_SIZE; i++, entry++) {
+    for (i = 0; i < count; i++, entry++) {
         entry->guard1 = BLOCK_CACHE_GUARD_1;
         entry->guard2 = BLOCK_CACHE_GUARD_2;
         entry->dev = NULL;
         entry->block = ~0;
+        entry->loaded = false;
         entry->dirty = false;
         entry->dirty_ref = false;
         entry->dirty_mac = false;
         entry->dirty_tr = NULL;
+        entry->part = NULL;
         entry->io_op = BLOCK_CACHE_IO_OP_NONE;
         obj_init(&entry->obj, &ref);
+        list_clear_node(&entry->hash_node);
         list_clear_node(&entry->io_op_node);
-        list_add_head(&block_cache_lru, &entry->lru_node);
+        list_clear_node(&entry->lru_node);
         obj_del_ref(&entry->obj, &ref, block_cache_entry_destroy);
     }
+
+    return count;
+}
+
+/**
+ * block_cache_set_quota - Set cache quota for file system
+ * @fs:         File system state object.
+ * @min_count:  Number of cache entries that other file systems cannot take
+ *              from @fs.
+ * @max_count:  Maximum number of cache entries @fs should use, or 0 for no
+ *              limit.
+ *
+ * Quotas are soft limits. If no other entry is available, entries are reused
+ * regardless of quota.
+ */
+void block_cache_set_quota(struct fs *fs, uint min_count, uint max_count)
+{
+    struct block_cache_part *part = block_cache_fs_part(fs);
+
+    assert(!max_count || min_count <= max_count);
+    if (min_count > block_cache_count / 2) {
+        pr_warn("min_count %u too large for cache size %u\n",
+                min_count, block_cache_count);
+        min_count = block_cache_count / 2;
+    }
+    part->min_count = min_count;
+    part->max_count = max_count;
+}
+
+/**
+ * block_cache_remove_fs - Remove all cache entries used by file system
+ * @fs:         File system state object.
+ *
+ * Drop all cache entries in the cache partition of @fs, and entries on @fs->dev
+ * that no file system has claimed, then unregister the partition. Entries other
+ * file systems hold on a shared device, e.g. a super_dev shared with rpmb, are
+ * left alone. No entries used by @fs can be referenced or dirty.
+ */
+void block_cache_remove_fs(struct fs *fs)
+{
+    uint i;
+    struct block_cache_entry *entry;
+    struct block_cache_part *part = &fs->cache_part;
+
+    if (!list_in_list(&part->node)) {
+        return;
+    }
+
+    for (i = 0, entry = block_cache_entries; i < block_cache_count; i++, entry++) {
+        if (entry->part != part &&
+            (entry->part || !entry->dev || entry->dev != fs->dev)) {
+            continue;
+        }
+        assert(!block_cache_entry_has_refs(entry));
+        assert(!list_in_list(&entry->io_op_node));
+        if (entry->dirty) {
+            pr_warn("discard dirty block %lld\n", entry->block);
+        }
+        entry->loaded = false;
+        entry->dirty = false;
+        entry->dirty_mac = false;
+        entry->dirty_tr = NULL;
+        block_cache_entry_set_block(entry, NULL, 0);
+        block_cache_entry_lru_update(entry);
+    }
+    assert(!part->count);
+    list_delete(&part->node);
+}
+
+/**
+ * block_cache_get_stats - Get cache counters for file system
+ * @fs:         File system state object.
+ * @stats:      Pointer to store counters in.
+ */
+void block_cache_get_stats(struct fs *fs, struct block_cache_stats *stats)
+{
+    *stats = block_cache_fs_part(fs)->stats;
+}
+
+/**
+ * block_cache_print_stats - Print cache counters for all partitions
+ */
+void block_cache_print_stats(void)
+{
+    struct block_cache_part *part;
+
+    printf("block cache: %u entries, %zd free\n",
+           block_cache_count, list_length(&block_cache_free));
+    list_for_every_entry(&block_cache_parts, part,
+                         struct block_cache_part, node) {
+        printf("  part %p: %u entries (min %u, max %u), "
+               "%lld hits, %lld misses, %lld evictions, %lld writebacks, "
+               "%lld prefetches\n",
+               part, part->count, part->min_count, part->max_count,
+               (long long)part->stats.hits, (long long)part->stats.misses,
+               (long long)part->stats.evictions,
+               (long long)part->stats.writebacks,
+               (long long)part->stats.prefetches);
+    }
 }
 
 /**
@@ -687,11 +1078,39 @@ void block_cache_init(void)
 void block_cache_clean_transaction(struct transaction *tr)
 {
     struct block_cache_entry *entry;
+    struct block_cache_entry *tmp_entry;
+    struct block_cache_part *part;
     struct block_device *dev = NULL;
+    struct block_cache_entry *encrypt_batch[BLOCK_CACHE_ENCRYPT_BATCH];
+    size_t encrypt_count = 0;
 
     stats_timer_start(STATS_CACHE_CLEAN_TRANSACTION);
 
-    list_for_every_entry(&block_cache_lru, entry, struct block_cache_entry, lru_node) {
+    /*
+     * Non-tmp dirty blocks of @tr have no references at this point, so they
+     * are all on the dirty lru list of the cache partition of @tr->fs.
+     */
+    part = block_cache_fs_part(tr->fs);
+
+    /* Encrypt and mac all blocks before queuing any of the writes */
+    list_for_every_entry(&part->lru[BLOCK_CACHE_LRU_DIRTY], entry,
+                         struct block_cache_entry, lru_node) {
+        if (entry->dirty_tr != tr || entry->encrypted) {
+            continue;
+        }
+        encrypt_batch[encrypt_count++] = entry;
+        if (encrypt_count == countof(encrypt_batch)) {
+            block_cache_entries_encrypt(encrypt_batch, encrypt_count);
+            encrypt_count = 0;
+        }
+    }
+    if (encrypt_count) {
+        block_cache_entries_encrypt(encrypt_batch, encrypt_count);
+    }
+
+    list_for_every_entry_safe(&part->lru[BLOCK_CACHE_LRU_DIRTY],
+                              entry, tmp_entry,
+                              struct block_cache_entry, lru_node) {
         assert(entry->guard1 == BLOCK_CACHE_GUARD_1);
         assert(entry->guard2 == BLOCK_CACHE_GUARD_2);
         if (entry->dirty_tr != tr) {
@@ -699,13 +1118,9 @@ void block_cache_clean_transaction(struct transaction *tr)
         }
 
         assert(entry->dirty);
-
+        assert(!entry->dirty_tmp);
         assert(!entry->dirty_ref);
 
-        if (entry->dirty_tmp) {
-            continue;
-        }
-
         if (!dev) {
             dev = entry->dev;
             assert(dev == tr->fs->dev || dev == tr->fs->super_dev);
@@ -722,7 +1137,8 @@ void block_cache_clean_transaction(struct transaction *tr)
         block_cache_entry_clean(entry);
         stats_timer_stop(STATS_CACHE_CLEAN_TRANSACTION_ENT_CLN);
         assert(!entry->dirty);
-        assert(!entry->dirty_tr);
+        assert(!entry->dirty_tr || entry->io_op == BLOCK_CACHE_IO_OP_WRITE);
+        block_cache_entry_lru_update(entry);
     }
 
     if (dev) {
@@ -744,10 +1160,11 @@ void block_cache_clean_transaction(struct transaction *tr)
  */
 void block_cache_discard_transaction(struct transaction *tr, bool discard_all)
 {
+    uint i;
     struct block_cache_entry *entry;
     struct block_device *dev = NULL;
 
-    list_for_every_entry(&block_cache_lru, entry, struct block_cache_entry, lru_node) {
+    for (i = 0, entry = block_cache_entries; i < block_cache_count; i++, entry++) {
         assert(entry->guard1 == BLOCK_CACHE_GUARD_1);
         assert(entry->guard2 == BLOCK_CACHE_GUARD_2);
         if (entry->dirty_tr != tr) {
@@ -781,7 +1198,8 @@ void block_cache_discard_transaction(struct transaction *tr, bool discard_all)
         entry->dirty_tr = NULL;
         entry->loaded = false;
         assert(!entry->dirty);
-        assert(!entry->dirty_tr);
+        assert(!entry->dirty_tr || entry->io_op == BLOCK_CACHE_IO_OP_WRITE);
+        block_cache_entry_lru_update(entry);
     }
 }
 
@@ -893,6 +1311,91 @@ const void *block_get(struct transaction *tr,
     return data;
 }
 
+/**
+ * block_prefetch - Start reading a block into the cache
+ * @tr:         Transaction to get device from
+ * @block_mac:  Block number and mac
+ *
+ * Start a read operation for @block_mac if it is not already cached, without
+ * waiting for it to complete. Reads queued by block_prefetch complete when
+ * the block is looked up, when block_prefetch_wait is called, or together
+ * with any other read or write on the same device. The mac is checked when
+ * the block is later returned by block_get.
+ */
+void block_prefetch(struct transaction *tr, const struct block_mac *block_mac)
+{
+    data_block_t block;
+    struct block_device *dev;
+    struct block_cache_entry *entry;
+
+    assert(tr);
+    assert(tr->fs);
+
+    if (tr->failed) {
+        return;
+    }
+    dev = tr->fs->dev;
+    block = block_mac_to_block(tr, block_mac);
+    if (!block || block >= dev->block_count) {
+        return;
+    }
+
+    entry = block_cache_lookup(tr->fs, dev, block, true);
+    if (!entry || entry->loaded || entry->dirty ||
+        block_cache_entry_has_refs(entry)) {
+        return;
+    }
+    assert(entry->io_op == BLOCK_CACHE_IO_OP_NONE);
+    assert(list_in_list(&entry->lru_node));
+
+    if (print_block_load) {
+        printf("%s: prefetch block %lld\n", __func__, block);
+    }
+    list_delete(&entry->lru_node);
+    block_cache_entry_set_part(entry, block_cache_fs_part(tr->fs));
+    entry->part->stats.prefetches++;
+    block_cache_queue_read(entry);
+}
+
+/**
+ * block_prefetch_wait - Wait for reads started by block_prefetch to complete
+ * @tr:         Transaction to get device from
+ */
+void block_prefetch_wait(struct transaction *tr)
+{
+    assert(tr);
+    assert(tr->fs);
+
+    block_cache_complete_io(tr->fs->dev);
+}
+
+/**
+ * block_prefetch_submit - Submit reads started by block_prefetch
+ * @tr:         Transaction to get device from
+ *
+ * Ask the block device to send queued reads without waiting for them. If the
+ * block device cannot do that, wait for them like block_prefetch_wait.
+ *
+ * Return: %true if reads are still in progress, %false if all reads have
+ * completed.
+ */
+bool block_prefetch_submit(struct transaction *tr)
+{
+    struct block_device *dev;
+
+    assert(tr);
+    assert(tr->fs);
+
+    dev = tr->fs->dev;
+    if (list_is_empty(&dev->io_ops)) {
+        return false;
+    }
+    if (dev->submit_io && dev->submit_io(dev)) {
+        return true;
+    }
+    block_cache_complete_io(dev);
+    return false;
+}
 
 /**
  * block_dirty - Mark cache entry dirty and return non-const block data pointer.
@@ -954,10 +1457,10 @@ void block_discard_dirty(const void *data)
     if (entry->dirty) {
         assert(entry->dev);
         entry->loaded = false;
-        entry->dev = NULL;
-        entry->block = ~0;
+        block_cache_entry_set_block(entry, NULL, 0);
         entry->dirty = false;
         entry->dirty_tr = NULL;
+        block_cache_entry_lru_update(entry);
     }
 }
 
@@ -1201,6 +1704,36 @@ void *block_get_copy(struct transaction *tr,
     return dst_data;
 }
 
+/**
+ * block_cache_clear_move_dest - Drop cached data for block that is moved to
+ * @tr:         Transaction
+ * @block:      Block number another cache entry is about to be moved to.
+ */
+static void block_cache_clear_move_dest(struct transaction *tr,
+                                        data_block_t block)
+{
+    struct block_cache_entry *dest_entry;
+
+    dest_entry = block_cache_lookup(NULL, tr->fs->dev, block, false);
+    if (!dest_entry) {
+        return;
+    }
+    assert(!block_cache_entry_has_refs(dest_entry));
+    assert(!dest_entry->dirty_ref);
+    assert(!dest_entry->dirty_tr || dest_entry->dirty_tr == tr);
+    assert(!list_in_list(&dest_entry->io_op_node));
+    assert(dest_entry->block == block);
+    if (print_block_move) {
+        printf("%s: clear old cache entry for block %lld, %zd\n",
+               __func__, block, dest_entry - block_cache_entries);
+    }
+    dest_entry->loaded = false;
+    block_cache_entry_set_block(dest_entry, NULL, 0);
+    dest_entry->dirty = false;
+    dest_entry->dirty_tr = NULL;
+    block_cache_entry_lru_update(dest_entry);
+}
+
 /**
  * block_move - Get block for write and move to new location
  * @tr:         Transaction
@@ -1218,7 +1751,6 @@ void *block_move(struct transaction *tr,
                  data_block_t block,
                  bool is_tmp)
 {
-    struct block_cache_entry *dest_entry;
     struct block_cache_entry *entry = data_to_block_cache_entry(data);
 
     assert(block_cache_entry_has_one_ref(entry));
@@ -1230,26 +1762,54 @@ void *block_move(struct transaction *tr,
                __func__, entry - block_cache_entries, entry->block, block);
     }
 
-    dest_entry = block_cache_lookup(NULL, tr->fs->dev, block, false);
-    if (dest_entry) {
-        assert(!block_cache_entry_has_refs(dest_entry));
-        assert(!dest_entry->dirty_ref);
-        assert(!dest_entry->dirty_tr || dest_entry->dirty_tr == tr);
-        assert(!list_in_list(&dest_entry->io_op_node));
-        assert(dest_entry->block == block);
-        if (print_block_move) {
-            printf("%s: clear old cache entry for block %lld, %zd\n",
-                   __func__, block, dest_entry - block_cache_entries);
-        }
-        dest_entry->loaded = false;
-        dest_entry->dev = NULL;
-        dest_entry->block = ~0;
-        dest_entry->dirty = false;
-        dest_entry->dirty_tr = NULL;
+    block_cache_clear_move_dest(tr, block);
+    block_cache_entry_set_block(entry, entry->dev, block);
+    return block_dirty(tr, data, is_tmp);
+}
+
+/**
+ * block_move_dirty - Move unreferenced dirty block to new location
+ * @tr:         Transaction
+ * @block:      Block number of dirty block written by @tr.
+ * @new_block:  New block number.
+ * @is_tmp:     If true, data is only needed until @tr is commited.
+ *
+ * Change block number of the cache entry for @block without copying or
+ * encrypting it again. The encrypted data and mac do not depend on the block
+ * number, so a block_mac for @block stays valid after changing its block to
+ * @new_block.
+ *
+ * Return: %true if the cache entry was moved, %false if @block is not dirty in
+ * the cache. The caller has to read and copy the block in that case.
+ */
+bool block_move_dirty(struct transaction *tr,
+                      data_block_t block,
+                      data_block_t new_block,
+                      bool is_tmp)
+{
+    struct block_cache_entry *entry;
+
+    assert(new_block);
+    assert(new_block < tr->fs->dev->block_count);
+
+    entry = block_cache_lookup(NULL, tr->fs->dev, block, false);
+    if (!entry || !entry->dirty || list_in_list(&entry->io_op_node)) {
+        return false;
     }
+    assert(entry->dirty_tr == tr);
+    assert(!entry->dirty_ref);
+    assert(!block_cache_entry_has_refs(entry));
 
-    entry->block = block;
-    return block_dirty(tr, data, is_tmp);
+    if (print_block_move) {
+        printf("%s: move cache entry %zd, from block %lld to %lld\n",
+               __func__, entry - block_cache_entries, entry->block, new_block);
+    }
+
+    block_cache_clear_move_dest(tr, new_block);
+    block_cache_entry_set_block(entry, entry->dev, new_block);
+    entry->dirty_tmp = is_tmp;
+    block_cache_entry_lru_update(entry);
+    return true;
 }
 
 /**
@@ -1296,10 +1856,11 @@ data_block_t data_to_block_num(const void *data)
  */
 uint block_cache_debug_get_ref_block_count(void)
 {
+    uint i;
     uint count = 0;
     struct block_cache_entry *entry;
 
-    list_for_every_entry(&block_cache_lru, entry, struct block_cache_entry, lru_node) {
+    for (i = 0, entry = block_cache_entries; i < block_cache_count; i++, entry++) {
         assert(entry->guard1 == BLOCK_CACHE_GUARD_1);
         assert(entry->guard2 == BLOCK_CACHE_GUARD_2);
         if (block_cache_entry_has_refs(entry)) {
@@ -26,6 +26,67 @@ struct fs;
 struct iv;
 struct transaction;
 
+/**
+ * enum block_cache_lru_list - Lists unreferenced cache entries are tracked in
+ * @BLOCK_CACHE_LRU_CLEAN:      Entries with loaded data that matches the disk.
+ * @BLOCK_CACHE_LRU_DIRTY:      Entries that must be written back before reuse.
+ * @BLOCK_CACHE_LRU_DIRTY_TMP:  Dirty entries only needed until the transaction
+ *                              that modified them is complete.
+ * @BLOCK_CACHE_LRU_COUNT:      Number of lists.
+ *
+ * Each list is ordered with the most recently released entry at the head.
+ * Entries that do not contain valid data are not owned by any partition and
+ * are tracked in a separate free list.
+ */
+enum block_cache_lru_list {
+    BLOCK_CACHE_LRU_CLEAN,
+    BLOCK_CACHE_LRU_DIRTY,
+    BLOCK_CACHE_LRU_DIRTY_TMP,
+    BLOCK_CACHE_LRU_COUNT,
+};
+
+/**
+ * struct block_cache_stats - Block cache counters
+ * @hits:       Number of lookups that found a matching cache entry.
+ * @misses:     Number of lookups that had to assign a cache entry.
+ * @evictions:  Number of entries with valid data that were reused for another
+ *              block.
+ * @writebacks: Number of evicted entries that had to be written first.
+ * @prefetches: Number of reads started by block_prefetch.
+ */
+struct block_cache_stats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    uint64_t writebacks;
+    uint64_t prefetches;
+};
+
+/**
+ * struct block_cache_part - Block cache partition
+ * @node:       List node for tracking all partitions.
+ * @lru:        Unreferenced cache entries owned by this partition.
+ * @count:      Number of cache entries owned by this partition.
+ * @min_count:  Number of entries that other partitions cannot take from this
+ *              partition.
+ * @max_count:  Maximum number of entries this partition should own, or 0 for
+ *              no limit.
+ * @stats:      Counters for lookups using this partition and for entries
+ *              taken from this partition.
+ *
+ * Each file system owns one partition. All fields are managed by the block
+ * cache. A zero initialized partition has no quota and is registered on first
+ * use.
+ */
+struct block_cache_part {
+    struct list_node node;
+    struct list_node lru[BLOCK_CACHE_LRU_COUNT];
+    uint count;
+    uint min_count;
+    uint max_count;
+    struct block_cache_stats stats;
+};
+
 void block_cache_complete_read(struct block_device *dev,
                                data_block_t block,
                                const void *data,
@@ -36,7 +97,15 @@ void block_cache_complete_write(struct block_device *dev,
                                 data_block_t block,
                                 bool failed);
 
-void block_cache_init(void);
+uint block_cache_init(uint max_count);
+
+void block_cache_set_quota(struct fs *fs, uint min_count, uint max_count);
+
+void block_cache_remove_fs(struct fs *fs);
+
+void block_cache_get_stats(struct fs *fs, struct block_cache_stats *stats);
+
+void block_cache_print_stats(void);
 
 void block_cache_clean_transaction(struct transaction *tr);
 
@@ -60,6 +129,12 @@ const void *block_get(struct transaction *tr,
                       const struct iv *iv,
                       obj_ref_t *ref);
 
+void block_prefetch(struct transaction *tr, const struct block_mac *block_mac);
+
+void block_prefetch_wait(struct transaction *tr);
+
+bool block_prefetch_submit(struct transaction *tr);
+
 void *block_dirty(struct transaction *tr, const void *data, bool is_tmp);
 
 bool block_is_clean(struct block_device *dev, data_block_t block);
@@ -100,6 +175,11 @@ void *block_move(struct transaction *tr,
                  data_block_t block,
                  bool is_tmp);
 
+bool block_move_dirty(struct transaction *tr,
+                      data_block_t block,
+                      data_block_t new_block,
+                      bool is_tmp);
+
 void *block_get_copy(struct transaction *tr,
                      const void *data,
                      data_block_t block,
@@ -20,14 +20,28 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+#include "block_cache.h"
 #include "block_device.h"
 #include "crypt.h"
 
+/*
+ * The app manifest reserves heap for BLOCK_CACHE_SIZE_MAX cache entries and
+ * their hash table. block_cache_init uses as much of the heap as is available,
+ * up to BLOCK_CACHE_SIZE_MAX entries, while leaving BLOCK_CACHE_HEAP_RESERVE
+ * bytes for other allocations.
+ */
 #ifdef APP_STORAGE_BLOCK_CACHE_SIZE
 #define BLOCK_CACHE_SIZE (APP_STORAGE_BLOCK_CACHE_SIZE)
 #else
 #define BLOCK_CACHE_SIZE (64)
 #endif
+#ifdef APP_STORAGE_BLOCK_CACHE_SIZE_MAX
+#define BLOCK_CACHE_SIZE_MAX (APP_STORAGE_BLOCK_CACHE_SIZE_MAX)
+#else
+#define BLOCK_CACHE_SIZE_MAX (BLOCK_CACHE_SIZE * 4)
+#endif
+#define BLOCK_CACHE_SIZE_MIN (16)
+#define BLOCK_CACHE_HEAP_RESERVE (8 * 4096)
 #ifdef APP_STORAGE_MAIN_BLOCK_SIZE
 #define MAX_BLOCK_SIZE  (APP_STORAGE_MAIN_BLOCK_SIZE)
 #else
@@ -57,9 +71,17 @@
  * @dirty_tmp:              Data can be discarded by
  *                          block_cache_discard_transaction.
  * @dirty_tr:               Transaction that modified block.
+ * @part:                   Partition that owns the entry, or %NULL if the
+ *                          entry does not contain valid data.
  * @obj:                    Reference tracking struct.
+ * @hash_node:              List node for block_cache_hash bucket that matches
+ *                          @dev and @block. Not in any list if @dev is %NULL.
  * @lru_node:               List node for tracking least recently used cache
- *                          entries.
+ *                          entries. Only in a list when there are no
+ *                          references to the entry. The list used depends on
+ *                          the state of the entry (free, clean or dirty).
+ * @lru_seq:                Value of block_cache_lru_seq when the last
+ *                          reference to the entry was released.
  * @io_op_node:             List node for tracking active read and write
  *                          operations.
  * @io_op:                  Currently active io operation.
@@ -81,9 +103,12 @@ struct block_cache_entry {
     bool dirty_mac;
     bool dirty_tmp;
     struct transaction *dirty_tr;
+    struct block_cache_part *part;
 
     obj_t obj;
+    struct list_node hash_node;
     struct list_node lru_node;
+    uint64_t lru_seq;
     struct list_node io_op_node;
     enum {
         BLOCK_CACHE_IO_OP_NONE,
@@ -92,4 +117,7 @@ struct block_cache_entry {
     } io_op;
 };
 
-#define BLOCK_CACHE_SIZE_BYTES (sizeof(struct block_cache_entry[BLOCK_CACHE_SIZE]))
+/* The hash table is rounded up to a power of two, so less than 2x entries */
+#define BLOCK_CACHE_SIZE_BYTES \
+    (sizeof(struct block_cache_entry[BLOCK_CACHE_SIZE_MAX]) + \
+     sizeof(struct list_node[BLOCK_CACHE_SIZE_MAX * 2]))
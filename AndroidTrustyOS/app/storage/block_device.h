@@ -17,10 +17,13 @@
 #pragma once
 
 #include <list.h>
+#include <stdbool.h>
 #include <stdint.h>
 
 typedef unsigned long long data_block_t;
 
+struct block_range;
+
 /**
  * struct block_device - Block device functions and state
  * @start_read:         Function to start a read operation from block device.
@@ -28,7 +31,20 @@ typedef unsigned long long data_block_t;
  * @wait_for_io:        Function to wait for read or write operations to
  *                      complete. If @start_read and @start_write always call
  *                      block_cache_complete_read and block_cache_complete_write
- *                      this can be %NULL.
+ *                      this can be %NULL. A block device that queues
+ *                      operations to submit them together must submit them
+ *                      here. Data passed to @start_write stays valid until the
+ *                      write completes.
+ * @submit_io:          Optional function to send queued read operations
+ *                      without waiting for them to complete. Returns %true if
+ *                      the reads were submitted, in which case the block
+ *                      device calls block_cache_complete_read later, from the
+ *                      event loop or from @wait_for_io. Returns %false if
+ *                      nothing was submitted.
+ * @discard:            Optional function to tell the block device that the
+ *                      data in @count ranges of blocks is no longer needed.
+ *                      The blocks may read back as anything until they are
+ *                      written again. Failures are not reported.
  * @block_count:        Number of blocks in block device.
  * @block_size:         Number of bytes per block.
  * @block_num_size:     Number of bytes used to store block numbers.
@@ -48,6 +64,9 @@ struct block_device {
     void (*start_write)(struct block_device *dev, data_block_t block,
                         const void *data, size_t data_size);
     void (*wait_for_io)(struct block_device *dev);
+    bool (*submit_io)(struct block_device *dev);
+    void (*discard)(struct block_device *dev,
+                    const struct block_range *ranges, unsigned int count);
 
     data_block_t block_count;
     size_t block_size;
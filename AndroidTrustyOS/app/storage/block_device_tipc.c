@@ -18,6 +18,7 @@
 #include <errno.h>
 #include <compiler.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 #include <trusty_ipc.h>
 
@@ -25,8 +26,10 @@
 
 #include "block_device_tipc.h"
 #include "block_cache.h"
+#include "block_range.h"
 #include "client_tipc.h"
 #include "ipc.h"
+#include "tipc_limits.h"
 #include "tipc_ns.h"
 #include "rpmb.h"
 
@@ -51,17 +54,89 @@
 #define BLOCK_COUNT_MAIN (0x10000000000 / BLOCK_SIZE_MAIN)
 #endif
 
+/*
+ * Number of block cache entries reserved for the rpmb file system, so writes to
+ * the main file system cannot evict its super and tree blocks.
+ */
+#ifdef APP_STORAGE_RPMB_BLOCK_CACHE_MIN
+#define BLOCK_CACHE_MIN_RPMB (APP_STORAGE_RPMB_BLOCK_CACHE_MIN)
+#else
+#define BLOCK_CACHE_MIN_RPMB (16)
+#endif
+
 #define BLOCK_SIZE_RPMB_BLOCKS (BLOCK_SIZE_RPMB / RPMB_BUF_SIZE)
 
+/*
+ * Number of rpmb frames the device accepts in a single reliable write
+ * (REL_WR_SEC_C * 2 on eMMC). Adjacent blocks are combined into one
+ * authenticated write up to this limit. The default is the largest number of
+ * whole blocks that fit in one proxy message next to the result read request
+ * frame, devices that only accept smaller reliable writes have to set
+ * APP_STORAGE_RPMB_MAX_WRITE_FRAMES.
+ */
+#ifdef APP_STORAGE_RPMB_MAX_WRITE_FRAMES
+#define RPMB_MAX_WRITE_FRAMES (APP_STORAGE_RPMB_MAX_WRITE_FRAMES)
+#else
+#define RPMB_MAX_WRITE_FRAMES \
+    ((STORAGE_MAX_BUFFER_SIZE - sizeof(struct storage_msg) - \
+      sizeof(struct storage_rpmb_send_req) - RPMB_FRAME_SIZE) / \
+     (RPMB_FRAME_SIZE * BLOCK_SIZE_RPMB_BLOCKS) * BLOCK_SIZE_RPMB_BLOCKS)
+#endif
+
+#define BLOCK_RPMB_WRITE_BATCH_MAX \
+    (RPMB_MAX_WRITE_FRAMES / BLOCK_SIZE_RPMB_BLOCKS)
+
+/* Reads are only limited by the response size existing proxies accept */
+#define BLOCK_RPMB_READ_BATCH_MAX \
+    MIN(BLOCK_DEVICE_RPMB_BATCH_MAX, \
+        (STORAGE_MAX_BUFFER_SIZE - sizeof(struct storage_msg)) / \
+        (RPMB_FRAME_SIZE * BLOCK_SIZE_RPMB_BLOCKS))
+
 STATIC_ASSERT(BLOCK_SIZE_RPMB_BLOCKS == 1 || BLOCK_SIZE_RPMB_BLOCKS == 2);
 STATIC_ASSERT(BLOCK_SIZE_RPMB_BLOCKS * RPMB_BUF_SIZE == BLOCK_SIZE_RPMB);
 
 STATIC_ASSERT(BLOCK_COUNT_RPMB == 0 || BLOCK_COUNT_RPMB >= 8);
 
+STATIC_ASSERT(BLOCK_RPMB_WRITE_BATCH_MAX >= 1);
+STATIC_ASSERT(BLOCK_RPMB_WRITE_BATCH_MAX <= BLOCK_DEVICE_RPMB_BATCH_MAX);
+STATIC_ASSERT(sizeof(struct storage_msg) +
+              sizeof(struct storage_rpmb_send_req) +
+              (RPMB_MAX_WRITE_FRAMES + 1) * RPMB_FRAME_SIZE <=
+              STORAGE_MAX_BUFFER_SIZE);
+STATIC_ASSERT(BLOCK_RPMB_READ_BATCH_MAX >= 1);
+
 STATIC_ASSERT(BLOCK_SIZE_MAIN >= 256);
 STATIC_ASSERT(BLOCK_COUNT_MAIN >= 8);
 STATIC_ASSERT(BLOCK_SIZE_MAIN >= BLOCK_SIZE_RPMB);
 
+/*
+ * Max number of blocks sent to the proxy in one vectored ns request. A writev
+ * request carries an extent and the data of each block, a readv response the
+ * data of each block, and both have to fit in a single proxy message. With the
+ * default 2k block size this is a single block, larger batches need a smaller
+ * APP_STORAGE_MAIN_BLOCK_SIZE.
+ */
+#define BLOCK_NS_BATCH_MAX \
+    MIN(NS_MAX_EXTENTS, \
+        (STORAGE_MAX_BUFFER_SIZE - sizeof(struct storage_msg) - \
+         sizeof(struct storage_file_writev_req)) / \
+        (sizeof(struct storage_file_extent) + BLOCK_SIZE_MAIN))
+
+STATIC_ASSERT(BLOCK_NS_BATCH_MAX >= 1);
+STATIC_ASSERT(sizeof(struct storage_msg) + BLOCK_NS_BATCH_MAX * BLOCK_SIZE_MAIN <=
+              STORAGE_MAX_BUFFER_SIZE);
+
+/*
+ * Read buffer for vectored ns requests, only one is in progress at a time. A
+ * read sent by block_device_tipc_ns_submit_io completes before any other
+ * request is sent to the proxy.
+ */
+static uint8_t block_device_tipc_ns_buf[BLOCK_NS_BATCH_MAX][BLOCK_SIZE_MAIN];
+
+/* Data buffer for multi-block rpmb requests */
+static uint8_t block_device_tipc_rpmb_buf[BLOCK_DEVICE_RPMB_BATCH_MAX]
+                                         [BLOCK_SIZE_RPMB];
+
 #define SS_ERR(args...)  fprintf(stderr, "ss: " args)
 #define SS_WARN(args...)  fprintf(stderr, "ss: " args)
 #define SS_DBG_IO(args...)  do {} while(0)
@@ -112,25 +187,109 @@ static struct block_device_rpmb *dev_rpmb_to_state(struct block_device *dev)
     return containerof(dev, struct block_device_rpmb, dev);
 }
 
-static void block_device_tipc_rpmb_start_read(struct block_device *dev,
-                                              data_block_t block)
+/**
+ * block_device_tipc_rpmb_flush - Submit queued rpmb operations
+ * @dev_rpmb:   Block device state.
+ *
+ * Sort the queued reads or writes by block number and send each run of
+ * adjacent blocks as a single multi-frame rpmb request, then complete the
+ * operations in the order they were queued.
+ */
+static void block_device_tipc_rpmb_flush(struct block_device_rpmb *dev_rpmb)
 {
     int ret;
-    uint8_t tmp[BLOCK_SIZE_RPMB]; /* TODO: pass data in? */
+    unsigned int i, j, k;
+    unsigned int count = dev_rpmb->batch_count;
+    bool write = dev_rpmb->batch_write;
+    unsigned int run_max = write ? BLOCK_RPMB_WRITE_BATCH_MAX :
+                                   BLOCK_RPMB_READ_BATCH_MAX;
+    const data_block_t *blocks = dev_rpmb->batch_block;
+    unsigned int order[BLOCK_DEVICE_RPMB_BATCH_MAX];
+    unsigned int pos[BLOCK_DEVICE_RPMB_BATCH_MAX];
+    bool failed[BLOCK_DEVICE_RPMB_BATCH_MAX];
     uint16_t rpmb_block;
-    struct block_device_rpmb *dev_rpmb = dev_rpmb_to_state(dev);
 
-    assert(block < dev->block_count);
-    rpmb_block = block + dev_rpmb->base;
+    dev_rpmb->batch_count = 0;
+
+    for (i = 0; i < count; i++) {
+        for (j = i; j > 0 && blocks[order[j - 1]] > blocks[i]; j--) {
+            order[j] = order[j - 1];
+        }
+        order[j] = i;
+    }
 
-    ret = rpmb_read(dev_rpmb->state->rpmb_state, tmp,
-                    rpmb_block * BLOCK_SIZE_RPMB_BLOCKS,
-                    BLOCK_SIZE_RPMB_BLOCKS);
+    for (i = 0; i < count; i = j) {
+        for (j = i + 1; j < count && j - i < run_max &&
+             blocks[order[j]] == blocks[order[j - 1]] + 1; j++) {
+        }
+        rpmb_block = blocks[order[i]] + dev_rpmb->base;
+
+        if (write) {
+            for (k = i; k < j; k++) {
+                memcpy(block_device_tipc_rpmb_buf[k],
+                       dev_rpmb->batch_data[order[k]], BLOCK_SIZE_RPMB);
+            }
+            ret = rpmb_write(dev_rpmb->state->rpmb_state,
+                             block_device_tipc_rpmb_buf[i],
+                             rpmb_block * BLOCK_SIZE_RPMB_BLOCKS,
+                             (j - i) * BLOCK_SIZE_RPMB_BLOCKS, true);
+        } else {
+            ret = rpmb_read(dev_rpmb->state->rpmb_state,
+                            block_device_tipc_rpmb_buf[i],
+                            rpmb_block * BLOCK_SIZE_RPMB_BLOCKS,
+                            (j - i) * BLOCK_SIZE_RPMB_BLOCKS);
+        }
 
-    SS_DBG_IO("%s: block %lld, base %d, rpmb_block %d, ret %d\n",
-              __func__, block, dev_rpmb->base, rpmb_block, ret);
+        SS_DBG_IO("%s: write %d, block %lld, count %d, base %d, rpmb_block %d, ret %d\n",
+                  __func__, write, blocks[order[i]], j - i, dev_rpmb->base,
+                  rpmb_block, ret);
 
-    block_cache_complete_read(dev, block, tmp, BLOCK_SIZE_RPMB, !!ret);
+        for (k = i; k < j; k++) {
+            pos[order[k]] = k;
+            failed[order[k]] = !!ret;
+        }
+    }
+
+    for (i = 0; i < count; i++) {
+        if (write) {
+            block_cache_complete_write(&dev_rpmb->dev, blocks[i], failed[i]);
+        } else {
+            block_cache_complete_read(&dev_rpmb->dev, blocks[i],
+                                      block_device_tipc_rpmb_buf[pos[i]],
+                                      BLOCK_SIZE_RPMB, failed[i]);
+        }
+    }
+}
+
+/**
+ * block_device_tipc_rpmb_queue - Queue rpmb operation
+ * @dev_rpmb:   Block device state.
+ * @block:      Block number.
+ * @data:       Data to write, or %NULL to read @block.
+ */
+static void block_device_tipc_rpmb_queue(struct block_device_rpmb *dev_rpmb,
+                                         data_block_t block,
+                                         const void *data)
+{
+    bool write = data;
+
+    assert(block < dev_rpmb->dev.block_count);
+
+    if (dev_rpmb->batch_count &&
+        (dev_rpmb->batch_write != write ||
+         dev_rpmb->batch_count == BLOCK_DEVICE_RPMB_BATCH_MAX)) {
+        block_device_tipc_rpmb_flush(dev_rpmb);
+    }
+    dev_rpmb->batch_write = write;
+    dev_rpmb->batch_block[dev_rpmb->batch_count] = block;
+    dev_rpmb->batch_data[dev_rpmb->batch_count] = data;
+    dev_rpmb->batch_count++;
+}
+
+static void block_device_tipc_rpmb_start_read(struct block_device *dev,
+                                              data_block_t block)
+{
+    block_device_tipc_rpmb_queue(dev_rpmb_to_state(dev), block, NULL);
 }
 
 static void block_device_tipc_rpmb_start_write(struct block_device *dev,
@@ -138,28 +297,18 @@ static void block_device_tipc_rpmb_start_write(struct block_device *dev,
                                                const void *data,
                                                size_t data_size)
 {
-    int ret;
-    uint16_t rpmb_block;
-    struct block_device_rpmb *dev_rpmb = dev_rpmb_to_state(dev);
-
+    assert(data);
     assert(data_size == BLOCK_SIZE_RPMB);
-    assert(block < dev->block_count);
 
-    rpmb_block = block + dev_rpmb->base;
-
-    ret = rpmb_write(dev_rpmb->state->rpmb_state, data,
-                     rpmb_block * BLOCK_SIZE_RPMB_BLOCKS,
-                     BLOCK_SIZE_RPMB_BLOCKS, true);
-
-    SS_DBG_IO("%s: block %lld, base %d, rpmb_block %d, ret %d\n",
-              __func__, block, dev_rpmb->base, rpmb_block, ret);
-
-    block_cache_complete_write(dev, block, !!ret);
+    block_device_tipc_rpmb_queue(dev_rpmb_to_state(dev), block, data);
 }
 
 static void block_device_tipc_rpmb_wait_for_io(struct block_device *dev)
 {
-    assert(0); /* TODO: use async read/write */
+    struct block_device_rpmb *dev_rpmb = dev_rpmb_to_state(dev);
+
+    assert(dev_rpmb->batch_count);
+    block_device_tipc_rpmb_flush(dev_rpmb);
 }
 
 
@@ -169,38 +318,292 @@ static struct block_device_tipc *dev_ns_to_state(struct block_device *dev)
     return containerof(dev, struct block_device_tipc, dev_ns);
 }
 
-static void block_device_tipc_ns_start_read(struct block_device *dev, data_block_t block)
+static void block_device_tipc_ns_read_block(struct block_device_tipc *state,
+                                            data_block_t block)
 {
     int ret;
     uint8_t tmp[BLOCK_SIZE_MAIN]; /* TODO: pass data in? */
-    struct block_device_tipc *state = dev_ns_to_state(dev);
 
     ret = ns_read_pos(state->ipc_handle, state->ns_handle,
                       block * BLOCK_SIZE_MAIN, tmp, BLOCK_SIZE_MAIN);
     SS_DBG_IO("%s: block %lld, ret %d\n", __func__, block, ret);
-    block_cache_complete_read(dev, block, tmp,
+    block_cache_complete_read(&state->dev_ns, block, tmp,
                               BLOCK_SIZE_MAIN, ret != BLOCK_SIZE_MAIN);
 }
 
+static void block_device_tipc_ns_write_block(struct block_device_tipc *state,
+                                             data_block_t block,
+                                             const void *data)
+{
+    int ret;
+
+    ret = ns_write_pos(state->ipc_handle, state->ns_handle,
+                       block * BLOCK_SIZE_MAIN, data, BLOCK_SIZE_MAIN);
+    SS_DBG_IO("%s: block %lld, ret %d\n", __func__, block, ret);
+    block_cache_complete_write(&state->dev_ns, block, ret != BLOCK_SIZE_MAIN);
+}
+
+/**
+ * block_device_tipc_ns_flush - Submit queued ns operations
+ * @state:      Block device state.
+ *
+ * Send all queued reads or writes to the proxy in a single vectored request,
+ * then complete them in the order they were queued. Falls back to one request
+ * per block if the proxy does not support vectored requests.
+ */
+static void block_device_tipc_ns_flush(struct block_device_tipc *state)
+{
+    int ret;
+    unsigned int i;
+    unsigned int count = state->ns_batch_count;
+    struct ns_extent extents[NS_MAX_EXTENTS];
+
+    state->ns_batch_count = 0;
+
+    if (!state->ns_vec || count == 1) {
+        for (i = 0; i < count; i++) {
+            if (state->ns_batch_write) {
+                block_device_tipc_ns_write_block(state,
+                                                 state->ns_batch_block[i],
+                                                 state->ns_batch_data[i]);
+            } else {
+                block_device_tipc_ns_read_block(state,
+                                                state->ns_batch_block[i]);
+            }
+        }
+        return;
+    }
+
+    for (i = 0; i < count; i++) {
+        extents[i].pos = state->ns_batch_block[i] * BLOCK_SIZE_MAIN;
+        extents[i].size = BLOCK_SIZE_MAIN;
+        if (state->ns_batch_write) {
+            extents[i].src = state->ns_batch_data[i];
+        } else {
+            extents[i].data = block_device_tipc_ns_buf[i];
+        }
+    }
+
+    if (state->ns_batch_write) {
+        ret = ns_write_vec(state->ipc_handle, state->ns_handle,
+                           extents, count);
+    } else {
+        ret = ns_read_vec(state->ipc_handle, state->ns_handle,
+                          extents, count);
+    }
+    SS_DBG_IO("%s: write %d, count %d, ret %d\n",
+              __func__, state->ns_batch_write, count, ret);
+
+    for (i = 0; i < count; i++) {
+        if (state->ns_batch_write) {
+            block_cache_complete_write(&state->dev_ns,
+                                       state->ns_batch_block[i],
+                                       ret != (int)(count * BLOCK_SIZE_MAIN));
+        } else {
+            block_cache_complete_read(&state->dev_ns,
+                                      state->ns_batch_block[i],
+                                      block_device_tipc_ns_buf[i],
+                                      BLOCK_SIZE_MAIN,
+                                      ret != (int)(count * BLOCK_SIZE_MAIN));
+        }
+    }
+}
+
+/**
+ * block_device_tipc_ns_queue - Queue ns operation
+ * @state:      Block device state.
+ * @block:      Block number.
+ * @data:       Data to write, or %NULL to read @block.
+ *
+ * Operations are completed in order, so the queued batch is submitted first if
+ * it holds the other kind of operation or is full. Without vectored requests
+ * each operation is sent on its own, so only one is queued at a time.
+ */
+static void block_device_tipc_ns_queue(struct block_device_tipc *state,
+                                       data_block_t block,
+                                       const void *data)
+{
+    bool write = data;
+
+    unsigned int batch_max = state->ns_vec ? BLOCK_NS_BATCH_MAX : 1;
+
+    if (state->ns_batch_count &&
+        (state->ns_batch_write != write ||
+         state->ns_batch_count == batch_max)) {
+        block_device_tipc_ns_flush(state);
+    }
+    state->ns_batch_write = write;
+    state->ns_batch_block[state->ns_batch_count] = block;
+    state->ns_batch_data[state->ns_batch_count] = data;
+    state->ns_batch_count++;
+}
+
+static void block_device_tipc_ns_start_read(struct block_device *dev, data_block_t block)
+{
+    block_device_tipc_ns_queue(dev_ns_to_state(dev), block, NULL);
+}
+
 static void block_device_tipc_ns_start_write(struct block_device *dev,
                                              data_block_t block,
                                              const void *data,
                                              size_t data_size)
+{
+    assert(data);
+    assert(data_size == BLOCK_SIZE_MAIN);
+
+    block_device_tipc_ns_queue(dev_ns_to_state(dev), block, data);
+}
+
+/**
+ * block_device_tipc_ns_read_done - Complete reads sent by submit_io
+ * @op:         Read operation.
+ * @ret:        Result of @op.
+ */
+static void block_device_tipc_ns_read_done(struct ns_read_vec_op *op, int ret)
+{
+    unsigned int i;
+    struct block_device_tipc *state =
+            containerof(op, struct block_device_tipc, ns_async_op);
+    unsigned int count = state->ns_async_count;
+
+    SS_DBG_IO("%s: count %d, ret %d\n", __func__, count, ret);
+
+    assert(count);
+    state->ns_async_count = 0;
+    for (i = 0; i < count; i++) {
+        block_cache_complete_read(&state->dev_ns, state->ns_async_block[i],
+                                  block_device_tipc_ns_buf[i],
+                                  BLOCK_SIZE_MAIN,
+                                  ret != (int)(count * BLOCK_SIZE_MAIN));
+    }
+    client_io_complete();
+}
+
+/**
+ * block_device_tipc_ns_submit_io - Send queued ns reads without waiting
+ * @dev:        Block device.
+ *
+ * If the proxy does not support vectored requests the queue holds at most one
+ * block, which is sent as a plain read.
+ *
+ * Return: %true if the queued reads were sent, %false if there was nothing to
+ * send, the queue holds writes or another read is already in progress.
+ */
+static bool block_device_tipc_ns_submit_io(struct block_device *dev)
 {
     int ret;
+    unsigned int i;
     struct block_device_tipc *state = dev_ns_to_state(dev);
+    unsigned int count = state->ns_batch_count;
+    struct ns_extent extents[NS_MAX_EXTENTS];
 
-    assert(data_size == BLOCK_SIZE_MAIN);
+    if (!count || state->ns_batch_write || state->ns_async_count) {
+        return false;
+    }
 
-    ret = ns_write_pos(state->ipc_handle, state->ns_handle,
-                       block * BLOCK_SIZE_MAIN, data, data_size);
-    SS_DBG_IO("%s: block %lld, ret %d\n", __func__, block, ret);
-    block_cache_complete_write(dev, block, ret != BLOCK_SIZE_MAIN);
+    state->ns_batch_count = 0;
+    if (!state->ns_vec) {
+        assert(count == 1);
+        state->ns_async_block[0] = state->ns_batch_block[0];
+        state->ns_async_count = 1;
+        ret = ns_read_pos_start(state->ipc_handle, state->ns_handle,
+                                state->ns_batch_block[0] * BLOCK_SIZE_MAIN,
+                                block_device_tipc_ns_buf[0], BLOCK_SIZE_MAIN,
+                                &state->ns_async_op,
+                                block_device_tipc_ns_read_done);
+        SS_DBG_IO("%s: block %lld, ret %d\n",
+                  __func__, state->ns_batch_block[0], ret);
+        if (ret < 0) {
+            block_device_tipc_ns_read_done(&state->ns_async_op, ret);
+        }
+        return true;
+    }
+
+    for (i = 0; i < count; i++) {
+        state->ns_async_block[i] = state->ns_batch_block[i];
+        extents[i].pos = state->ns_batch_block[i] * BLOCK_SIZE_MAIN;
+        extents[i].size = BLOCK_SIZE_MAIN;
+        extents[i].data = block_device_tipc_ns_buf[i];
+    }
+    state->ns_async_count = count;
+
+    ret = ns_read_vec_start(state->ipc_handle, state->ns_handle,
+                            extents, count, &state->ns_async_op,
+                            block_device_tipc_ns_read_done);
+    SS_DBG_IO("%s: count %d, ret %d\n", __func__, count, ret);
+    if (ret < 0) {
+        block_device_tipc_ns_read_done(&state->ns_async_op, ret);
+    }
+    return true;
 }
 
 static void block_device_tipc_ns_wait_for_io(struct block_device *dev)
 {
-    assert(0); /* TODO: use async read/write */
+    struct block_device_tipc *state = dev_ns_to_state(dev);
+
+    if (state->ns_async_count) {
+        /* Reads sent by submit_io are first in the io_ops list */
+        ipc_await_async_msgs(state->ipc_handle);
+        return;
+    }
+    assert(state->ns_batch_count);
+    block_device_tipc_ns_flush(state);
+}
+
+/**
+ * block_device_tipc_ns_discard - Release storage of unused ns blocks
+ * @dev:        Block device.
+ * @ranges:     Ranges of blocks that are no longer needed.
+ * @count:      Number of entries in @ranges.
+ *
+ * Send the ranges to the proxy, up to %NS_MAX_EXTENTS per request. Queued
+ * operations and reads sent by submit_io are completed first, so the proxy
+ * cannot reorder them with the discard. Errors are logged and otherwise
+ * ignored, as the blocks are not read again before they are rewritten.
+ */
+static void block_device_tipc_ns_discard(struct block_device *dev,
+                                         const struct block_range *ranges,
+                                         unsigned int count)
+{
+    int ret;
+    unsigned int extent_count = 0;
+    struct block_device_tipc *state = dev_ns_to_state(dev);
+    struct ns_extent extents[NS_MAX_EXTENTS];
+    data_block_t block;
+    data_block_t block_count;
+    const data_block_t max_block_count = UINT32_MAX / BLOCK_SIZE_MAIN;
+
+    if (state->ns_async_count) {
+        ipc_await_async_msgs(state->ipc_handle);
+    }
+    if (state->ns_batch_count) {
+        block_device_tipc_ns_flush(state);
+    }
+
+    while (count) {
+        block = ranges->start;
+        while (block < ranges->end) {
+            block_count = MIN(ranges->end - block, max_block_count);
+            extents[extent_count].pos = block * BLOCK_SIZE_MAIN;
+            extents[extent_count].size = block_count * BLOCK_SIZE_MAIN;
+            extents[extent_count].data = NULL;
+            extent_count++;
+            block += block_count;
+            if (extent_count == NS_MAX_EXTENTS ||
+                (block == ranges->end && count == 1)) {
+                ret = ns_discard_vec(state->ipc_handle, state->ns_handle,
+                                     extents, extent_count);
+                SS_DBG_IO("%s: count %d, ret %d\n", __func__, extent_count,
+                          ret);
+                if (ret < 0) {
+                    SS_ERR("%s: discard failed, %d\n", __func__, ret);
+                }
+                extent_count = 0;
+            }
+        }
+        ranges++;
+        count--;
+    }
 }
 
 static void block_device_tipc_init_dev_rpmb(struct block_device_rpmb *dev_rpmb,
@@ -211,6 +614,8 @@ static void block_device_tipc_init_dev_rpmb(struct block_device_rpmb *dev_rpmb,
     dev_rpmb->dev.start_read = block_device_tipc_rpmb_start_read;
     dev_rpmb->dev.start_write = block_device_tipc_rpmb_start_write;
     dev_rpmb->dev.wait_for_io = block_device_tipc_rpmb_wait_for_io;
+    dev_rpmb->dev.submit_io = NULL;
+    dev_rpmb->dev.discard = NULL;
     dev_rpmb->dev.block_count = block_count;
     dev_rpmb->dev.block_size = BLOCK_SIZE_RPMB;
     dev_rpmb->dev.block_num_size = 2;
@@ -219,6 +624,7 @@ static void block_device_tipc_init_dev_rpmb(struct block_device_rpmb *dev_rpmb,
     list_initialize(&dev_rpmb->dev.io_ops);
     dev_rpmb->state = state;
     dev_rpmb->base = base;
+    dev_rpmb->batch_count = 0;
 }
 
 int block_device_tipc_init(struct block_device_tipc *state,
@@ -268,6 +674,7 @@ int block_device_tipc_init(struct block_device_tipc *state,
     if (ret < 0) {
         goto err_init_tr_state_rpmb;
     }
+    block_cache_set_quota(&state->tr_state_rpmb, BLOCK_CACHE_MIN_RPMB, 0);
 
     state->fs_rpmb.tr_state = &state->tr_state_rpmb;
 
@@ -288,6 +695,8 @@ int block_device_tipc_init(struct block_device_tipc *state,
     state->dev_ns.start_read = block_device_tipc_ns_start_read;
     state->dev_ns.start_write = block_device_tipc_ns_start_write;
     state->dev_ns.wait_for_io = block_device_tipc_ns_wait_for_io;
+    state->dev_ns.submit_io = block_device_tipc_ns_submit_io;
+    state->dev_ns.discard = NULL;
     state->dev_ns.block_count = BLOCK_COUNT_MAIN;
     state->dev_ns.block_size = BLOCK_SIZE_MAIN;
     state->dev_ns.block_num_size = sizeof(data_block_t);
@@ -301,6 +710,15 @@ int block_device_tipc_init(struct block_device_tipc *state,
         return 0;
     }
 
+    /* Older proxies reply to the empty probe with STORAGE_ERR_UNIMPLEMENTED */
+    state->ns_vec = ns_read_vec(state->ipc_handle, state->ns_handle,
+                                NULL, 0) == 0;
+    if (ns_discard_vec(state->ipc_handle, state->ns_handle, NULL, 0) == 0) {
+        state->dev_ns.discard = block_device_tipc_ns_discard;
+    }
+    state->ns_batch_count = 0;
+    state->ns_async_count = 0;
+
     /* Request empty file system if file is empty */
     ret = ns_read_pos(state->ipc_handle, state->ns_handle, 0,
                       &dummy, sizeof(dummy));
@@ -325,15 +743,15 @@ int block_device_tipc_init(struct block_device_tipc *state,
     return 0;
 
 err_fs_ns_create_port:
-    /* undo fs_init */
 err_init_fs_ns_tr_state:
+    fs_destroy(&state->tr_state_ns);
     ns_close_file(state->ipc_handle, state->ns_handle);
     ipc_port_destroy(&state->fs_rpmb_boot.client_ctx);
 err_fs_rpmb_boot_create_port:
     ipc_port_destroy(&state->fs_rpmb.client_ctx);
 err_fs_rpmb_create_port:
-    /* undo fs_init */
 err_init_tr_state_rpmb:
+    fs_destroy(&state->tr_state_rpmb);
     rpmb_uninit(state->rpmb_state);
 err_bad_rpmb_size:
 err_rpmb_init:
@@ -344,11 +762,13 @@ void block_device_tipc_uninit(struct block_device_tipc *state)
 {
     if (state->dev_ns.block_count) {
         ipc_port_destroy(&state->fs_ns.client_ctx);
-        /* undo fs_init */
+        client_scrub_cancel(&state->tr_state_ns);
+        fs_destroy(&state->tr_state_ns);
         ns_close_file(state->ipc_handle, state->ns_handle);
     }
     ipc_port_destroy(&state->fs_rpmb_boot.client_ctx);
     ipc_port_destroy(&state->fs_rpmb.client_ctx);
-    /* undo fs_init */
+    client_scrub_cancel(&state->tr_state_rpmb);
+    fs_destroy(&state->tr_state_rpmb);
     rpmb_uninit(state->rpmb_state);
 }
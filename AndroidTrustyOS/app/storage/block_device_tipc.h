@@ -25,16 +25,27 @@
 struct rpmb_key;
 struct block_device_tipc;
 
+/* Max number of queued rpmb block device operations */
+#define BLOCK_DEVICE_RPMB_BATCH_MAX (8)
+
 /**
  * struct block_device_rpmb
- * @state:      Pointer to shared state containing ipc_handle and rpmb_state
- * @dev:        Block device state
- * @base:       First block to use in rpmb partition
+ * @state:          Pointer to shared state containing ipc_handle and rpmb_state
+ * @dev:            Block device state
+ * @base:           First block to use in rpmb partition
+ * @batch_write:    %true if the queued operations are writes.
+ * @batch_count:    Number of queued operations.
+ * @batch_block:    Block numbers of queued operations.
+ * @batch_data:     Data of queued writes.
  */
 struct block_device_rpmb {
     struct block_device dev;
     struct block_device_tipc *state;
     uint16_t base;
+    bool batch_write;
+    unsigned int batch_count;
+    data_block_t batch_block[BLOCK_DEVICE_RPMB_BATCH_MAX];
+    const void *batch_data[BLOCK_DEVICE_RPMB_BATCH_MAX];
 };
 
 struct client_port_context {
@@ -45,6 +56,15 @@ struct client_port_context {
 /**
  * struct block_device_tipc
  * @ipc_handle
+ * @ns_vec:             %true if the proxy supports vectored ns requests.
+ * @ns_batch_write:     %true if the queued ns operations are writes.
+ * @ns_batch_count:     Number of queued ns operations.
+ * @ns_batch_block:     Block numbers of queued ns operations.
+ * @ns_batch_data:      Data of queued ns writes.
+ * @ns_async_count:     Number of reads in @ns_async_op, 0 if no read submitted
+ *                      by block_device_tipc_ns_submit_io is in progress.
+ * @ns_async_block:     Block numbers of reads in @ns_async_op.
+ * @ns_async_op:        Read waiting for a response from the proxy.
  */
 
 struct block_device_tipc {
@@ -57,6 +77,14 @@ struct block_device_tipc {
     struct client_port_context fs_rpmb_boot;
 
     ns_handle_t ns_handle;
+    bool ns_vec;
+    bool ns_batch_write;
+    unsigned int ns_batch_count;
+    data_block_t ns_batch_block[NS_MAX_EXTENTS];
+    const void *ns_batch_data[NS_MAX_EXTENTS];
+    unsigned int ns_async_count;
+    data_block_t ns_async_block[NS_MAX_EXTENTS];
+    struct ns_read_vec_op ns_async_op;
     struct block_device dev_ns;
     struct block_device_rpmb dev_ns_rpmb;
     struct fs tr_state_ns;
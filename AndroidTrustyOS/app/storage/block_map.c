@@ -15,6 +15,7 @@
  */
 
 #include <assert.h>
+#include <string.h>
 
 #include "block_allocator.h"
 #include "block_map.h"
@@ -24,6 +25,621 @@
 
 static bool print_block_map;
 
+/*
+ * Block map entry format
+ *
+ * If extents are not enabled, each key is the file block index + 1 and each
+ * value is the block_mac of the data block at that index.
+ *
+ * If extents are enabled, the key is shifted left by one and the low bit
+ * selects the entry type:
+ *
+ * Per-block entries have key (index + 1) << 1, and store the block_mac of the
+ * data block at index like above. They are used for blocks that do not
+ * continue the disk block run of the previous file block.
+ *
+ * Extent entries have key ((last + 1) << 1) | 1, where last is the index of
+ * the last file block in the extent, and store the block_mac of a
+ * &struct block_map_extent. That block holds the first disk block and the
+ * length of the extent, and the mac of every data block in it. A leaf entry
+ * only has room for the one block_mac that authenticates the extent block, so
+ * the start and length are stored in the extent block.
+ *
+ * Since extents are keyed by their last index, a walk to the per-block key of
+ * an index finds either the per-block entry of that index, or the extent that
+ * could contain it.
+ */
+
+#define BLOCK_MAP_EXTENT_MAGIC (0x0000746e65747865) /* extent\0\0 */
+
+/**
+ * struct block_map_extent - On-disk extent block
+ * @iv:         Initial value used for encrypt/decrypt.
+ * @magic:      BLOCK_MAP_EXTENT_MAGIC.
+ * @start:      Disk block of first file block in extent.
+ * @count:      Number of blocks in extent. At least 2.
+ * @reserved:   Reserved for future use. Write 0, read ignore.
+ * @mac:        Macs of the @count data blocks starting at @start, packed as
+ *              &struct fs->mac_size bytes each.
+ */
+struct block_map_extent {
+    struct iv iv;
+    uint64_t magic;
+    data_block_t start;
+    uint32_t count;
+    uint32_t reserved;
+    uint8_t mac[0];
+};
+
+/**
+ * struct block_map_entry - Decoded block map entry
+ * @key:        Tree key of entry.
+ * @block_mac:  Tree data of entry. Data block or extent block.
+ * @extent:     %true if entry is an extent entry.
+ * @index:      Index of first file block mapped by entry.
+ * @count:      Number of file blocks mapped by entry.
+ * @start:      Disk block that @index is stored in.
+ */
+struct block_map_entry {
+    data_block_t key;
+    struct block_mac block_mac;
+    bool extent;
+    data_block_t index;
+    data_block_t count;
+    data_block_t start;
+};
+
+/**
+ * block_map_key - Get tree key of an entry
+ * @block_map:  Block map object.
+ * @index:      Index of block for per-block entries, index of last block for
+ *              extent entries.
+ * @extent:     %true to get the key of an extent entry.
+ *
+ * Return: Tree key.
+ */
+static data_block_t block_map_key(const struct block_map *block_map,
+                                  data_block_t index,
+                                  bool extent)
+{
+    index++; /* 0 is not a valid block tree key */
+    if (!block_map->extents) {
+        assert(!extent);
+        return index;
+    }
+    return index << 1 | extent;
+}
+
+/**
+ * block_map_key_to_index - Get index from tree key
+ * @block_map:  Block map object.
+ * @key:        Tree key.
+ *
+ * Return: Index of block for per-block entries, index of last block for extent
+ * entries.
+ */
+static data_block_t block_map_key_to_index(const struct block_map *block_map,
+                                           data_block_t key)
+{
+    if (block_map->extents) {
+        key >>= 1;
+    }
+    return key - 1;
+}
+
+/**
+ * block_map_extent_max_count - Get number of blocks an extent block can map
+ * @tr:         Transaction object.
+ * @block_map:  Block map object.
+ *
+ * Return: Max value of &struct block_map_extent->count.
+ */
+static uint block_map_extent_max_count(const struct transaction *tr,
+                                       const struct block_map *block_map)
+{
+    return (block_map->tree.block_size - sizeof(struct block_map_extent)) /
+           tr->fs->mac_size;
+}
+
+/**
+ * block_map_extent_get - Get extent block for read
+ * @tr:         Transaction object.
+ * @block_map:  Block map object.
+ * @block_mac:  Block and mac of extent block.
+ * @ref:        Pointer to store reference in.
+ *
+ * Return: Extent block, or %NULL if @tr failed.
+ */
+static const struct block_map_extent *
+block_map_extent_get(struct transaction *tr,
+                     const struct block_map *block_map,
+                     const struct block_mac *block_mac,
+                     obj_ref_t *ref)
+{
+    const struct block_map_extent *extent;
+
+    extent = block_get(tr, block_mac, NULL, ref);
+    if (!extent) {
+        assert(tr->failed);
+        return NULL;
+    }
+    assert(extent->magic == BLOCK_MAP_EXTENT_MAGIC);
+    assert(extent->count >= 2);
+    assert(extent->count <= block_map_extent_max_count(tr, block_map));
+    return extent;
+}
+
+/**
+ * block_map_extent_get_block_mac - Get block_mac of a block in an extent
+ * @tr:         Transaction object.
+ * @extent:     Extent block.
+ * @i:          Index of block in @extent.
+ * @block_mac:  Pointer to return block_mac in.
+ */
+static void block_map_extent_get_block_mac(const struct transaction *tr,
+                                           const struct block_map_extent *extent,
+                                           data_block_t i,
+                                           struct block_mac *block_mac)
+{
+    assert(i < extent->count);
+    block_mac_set_block(tr, block_mac, extent->start + i);
+    block_mac_set_mac(tr, block_mac,
+                      (const void *)(extent->mac + i * tr->fs->mac_size));
+}
+
+/**
+ * block_map_extent_set_mac_at - Store mac of a block in an extent
+ * @tr:         Transaction object.
+ * @extent:     Writeable extent block.
+ * @i:          Index of block in @extent.
+ * @block_mac:  block_mac to copy mac from.
+ */
+static void block_map_extent_set_mac_at(const struct transaction *tr,
+                                        struct block_map_extent *extent,
+                                        data_block_t i,
+                                        const struct block_mac *block_mac)
+{
+    memcpy(extent->mac + i * tr->fs->mac_size,
+           block_mac_to_mac(tr, block_mac), tr->fs->mac_size);
+}
+
+/**
+ * block_map_path_entry - Decode block map entry at @path
+ * @tr:         Transaction object.
+ * @block_map:  Block map object.
+ * @path:       Tree path.
+ * @entry:      Pointer to return entry in.
+ *
+ * Skip the empty insert spot that block_tree_walk can return if the key it
+ * was looking for is not in the tree, and read the extent block of extent
+ * entries.
+ *
+ * Return: %true if @entry was filled in, %false if there are no more entries
+ * or if @tr failed.
+ */
+static bool block_map_path_entry(struct transaction *tr,
+                                 struct block_map *block_map,
+                                 struct block_tree_path *path,
+                                 struct block_map_entry *entry)
+{
+    const struct block_map_extent *extent;
+    obj_ref_t ref = OBJ_REF_INITIAL_VALUE(ref);
+
+    if (tr->failed) {
+        return false;
+    }
+    if (block_tree_path_get_key(path) && !block_tree_path_get_data(path)) {
+        block_tree_path_next(path);
+        if (tr->failed) {
+            return false;
+        }
+    }
+    entry->key = block_tree_path_get_key(path);
+    if (!entry->key) {
+        return false;
+    }
+    entry->block_mac = block_tree_path_get_data_block_mac(path);
+    entry->extent = block_map->extents && (entry->key & 1);
+    if (!entry->extent) {
+        entry->index = block_map_key_to_index(block_map, entry->key);
+        entry->count = 1;
+        entry->start = block_mac_to_block(tr, &entry->block_mac);
+        return true;
+    }
+
+    extent = block_map_extent_get(tr, block_map, &entry->block_mac, &ref);
+    if (!extent) {
+        return false;
+    }
+    entry->count = extent->count;
+    entry->start = extent->start;
+    block_put(extent, &ref);
+    entry->index = block_map_key_to_index(block_map, entry->key) + 1 -
+                   entry->count;
+
+    return true;
+}
+
+/**
+ * block_map_find - Find entry that maps a block
+ * @tr:         Transaction object.
+ * @block_map:  Block map object.
+ * @index:      Index of block to find.
+ * @path:       Tree path object to return path to entry in.
+ * @entry:      Pointer to return entry in.
+ *
+ * Return: %true if an entry maps @index, %false if not or if @tr failed.
+ */
+static bool block_map_find(struct transaction *tr,
+                           struct block_map *block_map,
+                           data_block_t index,
+                           struct block_tree_path *path,
+                           struct block_map_entry *entry)
+{
+    block_tree_walk(tr, &block_map->tree, block_map_key(block_map, index, false),
+                    false, path);
+    if (!block_map_path_entry(tr, block_map, path, entry)) {
+        return false;
+    }
+    return entry->index <= index && index < entry->index + entry->count;
+}
+
+/**
+ * block_map_free_block - Free a block that was referenced by a block map
+ * @tr:         Transaction object.
+ * @block:      Data block or extent block.
+ */
+static void block_map_free_block(struct transaction *tr, data_block_t block)
+{
+    block_discard_dirty_by_block(tr->fs->dev, block);
+    block_free(tr, block);
+}
+
+/**
+ * block_map_extent_new - Allocate and write a new extent block
+ * @tr:         Transaction object.
+ * @block_map:  Block map object.
+ * @start:      Disk block of first block in extent.
+ * @count:      Number of blocks in extent.
+ * @mac:        Packed macs of the @count blocks.
+ * @block_mac:  Pointer to return block and mac of new extent block in.
+ *
+ * Return: %true if the extent block was written, %false if @tr failed.
+ */
+static bool block_map_extent_new(struct transaction *tr,
+                                 struct block_map *block_map,
+                                 data_block_t start,
+                                 data_block_t count,
+                                 const uint8_t *mac,
+                                 struct block_mac *block_mac)
+{
+    struct block_map_extent *extent_rw;
+    obj_ref_t ref = OBJ_REF_INITIAL_VALUE(ref);
+    data_block_t block;
+
+    assert(count >= 2);
+    assert(count <= block_map_extent_max_count(tr, block_map));
+
+    block = block_allocate(tr);
+    if (tr->failed) {
+        pr_warn("transaction failed, abort\n");
+        return false;
+    }
+    assert(block);
+    block_mac_set_block(tr, block_mac, block);
+
+    extent_rw = block_get_cleared(tr, block, false, &ref);
+    assert(extent_rw);
+    extent_rw->magic = BLOCK_MAP_EXTENT_MAGIC;
+    extent_rw->start = start;
+    extent_rw->count = count;
+    memcpy(extent_rw->mac, mac, count * tr->fs->mac_size);
+    block_put_dirty(tr, extent_rw, &ref, block_mac, NULL);
+
+    return !tr->failed;
+}
+
+/**
+ * block_map_extent_get_write - Get extent block at @path for write
+ * @tr:         Transaction object.
+ * @block_map:  Block map object.
+ * @path:       Tree path to extent entry.
+ * @ref:        Pointer to store reference in.
+ *
+ * Move the extent block to a new block if it is still used by the committed
+ * file system state, and update @path to match. The caller should release the
+ * returned block with block_tree_path_put_dirty.
+ *
+ * Return: Writeable extent block, or %NULL if @tr failed.
+ */
+static struct block_map_extent *
+block_map_extent_get_write(struct transaction *tr,
+                           struct block_map *block_map,
+                           struct block_tree_path *path,
+                           obj_ref_t *ref)
+{
+    const struct block_map_extent *extent_ro;
+    struct block_map_extent *extent_rw;
+    data_block_t block = block_tree_path_get_data(path);
+    data_block_t new_block;
+
+    extent_ro = block_map_extent_get(tr, block_map, &path->data, ref);
+    if (!extent_ro) {
+        return NULL;
+    }
+    if (!transaction_block_need_copy(tr, block)) {
+        return block_dirty(tr, extent_ro, false);
+    }
+
+    new_block = block_allocate(tr);
+    if (tr->failed) {
+        pr_warn("transaction failed, abort\n");
+        block_put(extent_ro, ref);
+        return NULL;
+    }
+    assert(new_block);
+    extent_rw = block_move(tr, extent_ro, new_block, false);
+    assert(!tr->failed);
+    block_free(tr, block);
+    block_mac_set_block(tr, &path->data, new_block);
+
+    return extent_rw;
+}
+
+/**
+ * block_map_extent_set_mac - Update mac of a block in an extent
+ * @tr:         Transaction object.
+ * @block_map:  Block map object.
+ * @entry:      Extent entry that maps @index.
+ * @index:      Index of block to update.
+ * @block_mac:  block_mac of @index. Block must match the extent.
+ */
+static void block_map_extent_set_mac(struct transaction *tr,
+                                     struct block_map *block_map,
+                                     const struct block_map_entry *entry,
+                                     data_block_t index,
+                                     const struct block_mac *block_mac)
+{
+    struct block_tree_path path;
+    struct block_map_extent *extent_rw;
+    obj_ref_t ref = OBJ_REF_INITIAL_VALUE(ref);
+
+    assert(entry->extent);
+    assert(block_mac_to_block(tr, block_mac) ==
+           entry->start + index - entry->index);
+
+    block_tree_walk(tr, &block_map->tree, entry->key, false, &path);
+    extent_rw = block_map_extent_get_write(tr, block_map, &path, &ref);
+    if (!extent_rw) {
+        pr_warn("transaction failed, abort\n");
+        return;
+    }
+    block_map_extent_set_mac_at(tr, extent_rw, index - entry->index,
+                                block_mac);
+    block_tree_path_put_dirty(tr, &path, path.count, extent_rw, &ref);
+}
+
+/**
+ * block_map_extent_remove - Remove blocks from an extent
+ * @tr:         Transaction object.
+ * @block_map:  Block map object.
+ * @entry:      Extent entry that maps @index to @index + @count - 1.
+ * @index:      Index of first block to remove.
+ * @count:      Number of blocks to remove.
+ *
+ * Shrink or split the extent so it no longer maps the removed blocks. The
+ * extent block is kept for the part after the removed blocks, or for the part
+ * before them if there is nothing after. Parts that only have a single block
+ * left are stored as per-block entries. The removed data blocks are not freed.
+ */
+static void block_map_extent_remove(struct transaction *tr,
+                                    struct block_map *block_map,
+                                    const struct block_map_entry *entry,
+                                    data_block_t index,
+                                    data_block_t count)
+{
+    struct block_tree_path path;
+    const struct block_map_extent *extent_ro;
+    struct block_map_extent *extent_rw;
+    obj_ref_t ref = OBJ_REF_INITIAL_VALUE(ref);
+    size_t mac_size = tr->fs->mac_size;
+    data_block_t left = index - entry->index;
+    data_block_t right;
+    data_block_t new_count;
+    data_block_t left_key = 0;
+    data_block_t right_key = 0;
+    struct block_mac left_block_mac;
+    struct block_mac right_block_mac;
+    struct block_mac extent_block_mac;
+
+    assert(entry->extent);
+    assert(index >= entry->index);
+    assert(left + count <= entry->count);
+    right = entry->count - left - count;
+
+    if (print_block_map) {
+        printf("%s: block_map at %lld: extent [%lld-%lld], remove %lld-%lld\n",
+               __func__, block_mac_to_block(tr, &block_map->tree.root),
+               entry->index, entry->index + entry->count - 1,
+               index, index + count - 1);
+    }
+
+    extent_ro = block_map_extent_get(tr, block_map, &entry->block_mac, &ref);
+    if (!extent_ro) {
+        pr_warn("transaction failed, abort\n");
+        return;
+    }
+    if (left == 1) {
+        block_map_extent_get_block_mac(tr, extent_ro, 0, &left_block_mac);
+        left_key = block_map_key(block_map, entry->index, false);
+    } else if (left && right >= 2) {
+        block_map_extent_new(tr, block_map, extent_ro->start, left,
+                             extent_ro->mac, &left_block_mac);
+        left_key = block_map_key(block_map, index - 1, true);
+    }
+    if (right == 1) {
+        block_map_extent_get_block_mac(tr, extent_ro, entry->count - 1,
+                                       &right_block_mac);
+        right_key = block_map_key(block_map, index + count, false);
+    }
+    block_put(extent_ro, &ref);
+    if (tr->failed) {
+        pr_warn("transaction failed, abort\n");
+        return;
+    }
+
+    if (left >= 2 || right >= 2) {
+        block_tree_walk(tr, &block_map->tree, entry->key, false, &path);
+        extent_rw = block_map_extent_get_write(tr, block_map, &path, &ref);
+        if (!extent_rw) {
+            pr_warn("transaction failed, abort\n");
+            return;
+        }
+        if (right >= 2) {
+            memmove(extent_rw->mac, extent_rw->mac + (left + count) * mac_size,
+                    right * mac_size);
+            extent_rw->start += left + count;
+            new_count = right;
+        } else {
+            new_count = left;
+        }
+        memset(extent_rw->mac + new_count * mac_size, 0,
+               (entry->count - new_count) * mac_size);
+        extent_rw->count = new_count;
+        block_tree_path_put_dirty(tr, &path, path.count, extent_rw, &ref);
+        if (right < 2 && !tr->failed) {
+            /* extent now ends before @index, update key to match */
+            extent_block_mac = path.entry[path.count].block_mac;
+            block_tree_update_block_mac(tr, &block_map->tree,
+                                        entry->key, extent_block_mac,
+                                        block_map_key(block_map, index - 1, true),
+                                        extent_block_mac);
+        }
+    } else {
+        block_tree_remove(tr, &block_map->tree, entry->key,
+                          block_mac_to_block(tr, &entry->block_mac));
+        if (!tr->failed) {
+            block_map_free_block(tr, block_mac_to_block(tr, &entry->block_mac));
+        }
+    }
+    if (tr->failed) {
+        pr_warn("transaction failed, abort\n");
+        return;
+    }
+
+    if (left_key) {
+        block_tree_insert_block_mac(tr, &block_map->tree, left_key,
+                                    left_block_mac);
+        if (tr->failed) {
+            pr_warn("transaction failed, abort\n");
+            return;
+        }
+    }
+    if (right_key) {
+        block_tree_insert_block_mac(tr, &block_map->tree, right_key,
+                                    right_block_mac);
+    }
+}
+
+/**
+ * block_map_can_append - Check if a block continues the entry before it
+ * @tr:         Transaction object.
+ * @block_map:  Block map object.
+ * @index:      Index of block to store.
+ * @block_mac:  block_mac to store.
+ * @prev:       Pointer to return entry that maps @index - 1 in.
+ *
+ * Return: %true if @index - 1 is the last block of an entry, is stored in the
+ * disk block before @block_mac, and the entry can grow, %false otherwise.
+ */
+static bool block_map_can_append(struct transaction *tr,
+                                 struct block_map *block_map,
+                                 data_block_t index,
+                                 const struct block_mac *block_mac,
+                                 struct block_map_entry *prev)
+{
+    struct block_tree_path path;
+
+    if (!block_map->extents || !index) {
+        return false;
+    }
+    return block_map_find(tr, block_map, index - 1, &path, prev) &&
+           prev->index + prev->count == index &&
+           prev->start + prev->count == block_mac_to_block(tr, block_mac) &&
+           prev->count < block_map_extent_max_count(tr, block_map);
+}
+
+/**
+ * block_map_append - Store a block_mac by extending the entry before it
+ * @tr:         Transaction object.
+ * @block_map:  Block map object.
+ * @prev:       Entry returned by block_map_can_append.
+ * @index:      Index of block to store. Must not be mapped.
+ * @block_mac:  block_mac to store.
+ *
+ * Add @index to the extent of @prev, or replace @prev, a per-block entry, with
+ * a new extent.
+ */
+static void block_map_append(struct transaction *tr,
+                             struct block_map *block_map,
+                             const struct block_map_entry *prev,
+                             data_block_t index,
+                             const struct block_mac *block_mac)
+{
+    struct block_tree_path path;
+    struct block_map_extent *extent_rw;
+    obj_ref_t ref = OBJ_REF_INITIAL_VALUE(ref);
+    size_t mac_size = tr->fs->mac_size;
+    uint8_t mac[2 * sizeof(struct mac)];
+    struct block_mac extent_block_mac;
+
+    assert(prev->index + prev->count == index);
+
+    if (print_block_map) {
+        printf("%s: block_map at %lld: [%lld] = %lld, extend [%lld-%lld]\n",
+               __func__, block_mac_to_block(tr, &block_map->tree.root),
+               index, block_mac_to_block(tr, block_mac),
+               prev->index, index - 1);
+    }
+
+    if (!prev->extent) {
+        memcpy(mac, block_mac_to_mac(tr, &prev->block_mac), mac_size);
+        memcpy(mac + mac_size, block_mac_to_mac(tr, block_mac), mac_size);
+        if (!block_map_extent_new(tr, block_map, prev->start, 2, mac,
+                                  &extent_block_mac)) {
+            return;
+        }
+        block_tree_remove(tr, &block_map->tree, prev->key, prev->start);
+        if (tr->failed) {
+            pr_warn("transaction failed, abort\n");
+            return;
+        }
+        block_tree_insert_block_mac(tr, &block_map->tree,
+                                    block_map_key(block_map, index, true),
+                                    extent_block_mac);
+        return;
+    }
+
+    block_tree_walk(tr, &block_map->tree, prev->key, false, &path);
+    extent_rw = block_map_extent_get_write(tr, block_map, &path, &ref);
+    if (!extent_rw) {
+        pr_warn("transaction failed, abort\n");
+        return;
+    }
+    block_map_extent_set_mac_at(tr, extent_rw, extent_rw->count, block_mac);
+    extent_rw->count++;
+    block_tree_path_put_dirty(tr, &path, path.count, extent_rw, &ref);
+    if (tr->failed) {
+        pr_warn("transaction failed, abort\n");
+        return;
+    }
+    extent_block_mac = path.entry[path.count].block_mac;
+    block_tree_update_block_mac(tr, &block_map->tree,
+                                prev->key, extent_block_mac,
+                                block_map_key(block_map, index, true),
+                                extent_block_mac);
+}
+
 /**
  * block_map_init - Initialize in-memory block map structute
  * @tr:         Transaction object.
@@ -45,6 +661,7 @@ void block_map_init(const struct transaction *tr,
     block_map->tree.copy_on_write = 1;
     block_map->tree.allow_copy_on_write = 1;
     block_map->tree.root = *root;
+    block_map->extents = tr->fs->block_map_extents;
 }
 
 /**
@@ -63,65 +680,192 @@ bool block_map_get(struct transaction *tr,
                    struct block_mac *block_mac)
 {
     struct block_tree_path path;
+    struct block_map_entry entry;
+    const struct block_map_extent *extent;
+    obj_ref_t ref = OBJ_REF_INITIAL_VALUE(ref);
 
-    index++; /* 0 is not a valid block tree key */
-
-    block_tree_walk(tr, &block_map->tree, index, false, &path);
-    if (block_tree_path_get_key(&path) != index) {
+    if (!block_map_find(tr, block_map, index, &path, &entry)) {
         if (print_block_map) {
             printf("%s: %lld not found (next key %lld)\n",
                    __func__, index, block_tree_path_get_key(&path));
         }
         return false;
     }
-    *block_mac = block_tree_path_get_data_block_mac(&path);
+    if (!entry.extent) {
+        *block_mac = entry.block_mac;
+        return true;
+    }
+
+    extent = block_map_extent_get(tr, block_map, &entry.block_mac, &ref);
+    if (!extent) {
+        return false;
+    }
+    block_map_extent_get_block_mac(tr, extent, index - entry.index, block_mac);
+    block_put(extent, &ref);
 
     return true;
 }
 
+/**
+ * block_map_get_range - Lookup consecutive blocks
+ * @tr:         Transaction object.
+ * @block_map:  Block map object.
+ * @index:      Index of first block to get.
+ * @count:      Max number of blocks to get.
+ * @block_macs: Array of @count entries to return block_macs in.
+ *
+ * Walk the tree once and then step through the leaf entries, instead of
+ * walking the tree for every index. All blocks of an extent are returned from
+ * a single read of its extent block.
+ *
+ * Return: Number of consecutive indexes starting at @index that have a
+ * block_mac, up to @count. Entries in @block_macs after the returned count are
+ * not touched.
+ */
+uint block_map_get_range(struct transaction *tr,
+                         struct block_map *block_map,
+                         data_block_t index,
+                         uint count,
+                         struct block_mac *block_macs)
+{
+    uint i = 0;
+    struct block_tree_path path;
+    struct block_map_entry entry;
+    const struct block_map_extent *extent;
+    obj_ref_t ref = OBJ_REF_INITIAL_VALUE(ref);
+    bool found;
+
+    found = block_map_find(tr, block_map, index, &path, &entry);
+    while (found && i < count) {
+        if (entry.extent) {
+            extent = block_map_extent_get(tr, block_map, &entry.block_mac,
+                                          &ref);
+            if (!extent) {
+                break;
+            }
+            for (; i < count && index + i < entry.index + entry.count; i++) {
+                block_map_extent_get_block_mac(tr, extent,
+                                               index + i - entry.index,
+                                               &block_macs[i]);
+            }
+            block_put(extent, &ref);
+        } else {
+            block_macs[i++] = entry.block_mac;
+        }
+        if (i < count) {
+            block_tree_path_next(&path);
+            found = block_map_path_entry(tr, block_map, &path, &entry) &&
+                    entry.index == index + i;
+        }
+    }
+    if (tr->failed) {
+        pr_warn("transaction failed, abort\n");
+        return 0;
+    }
+    if (print_block_map) {
+        printf("%s: %lld, got %d of %d\n", __func__, index, i, count);
+    }
+    return i;
+}
+
 /**
  * block_map_set - Store a block_mac
  * @tr:         Transaction object.
  * @block_map:  Block map object.
  * @index:      Index of block to set.
  * @block_mac:  block_mac to store, or %NULL to remove the block_mac at @index.
+ *
+ * If @index already has a block_mac, it is updated in place instead of being
+ * removed and inserted again. If @index is in an extent and @block_mac is not
+ * the block the extent already has for @index, the extent is split. A block
+ * that continues the disk block run of @index - 1 is added to its extent.
  */
 void block_map_set(struct transaction *tr, struct block_map *block_map,
                    data_block_t index, const struct block_mac *block_mac)
 {
     struct block_tree_path path;
-
-    index++; /* 0 is not a valid block tree key */
+    struct block_map_entry entry;
+    struct block_map_entry prev;
+    struct block_mac old_block_mac;
+    bool valid = block_mac && block_mac_valid(tr, block_mac);
+    bool found;
+    bool append;
 
     if (tr->failed) {
         pr_warn("transaction failed, ignore\n");
         return;
     }
 
-    block_tree_walk(tr, &block_map->tree, index, false, &path);
+    found = block_map_find(tr, block_map, index, &path, &entry);
     if (tr->failed) {
         pr_warn("transaction failed, abort\n");
         return;
     }
-    if (block_tree_path_get_key(&path) == index) {
+    if (found && entry.extent) {
+        if (valid && block_mac_to_block(tr, block_mac) ==
+                     entry.start + index - entry.index) {
+            block_map_extent_set_mac(tr, block_map, &entry, index, block_mac);
+            return;
+        }
+        block_map_extent_remove(tr, block_map, &entry, index, 1);
+        if (tr->failed) {
+            pr_warn("transaction failed, abort\n");
+            return;
+        }
+    } else if (found) {
+        old_block_mac = entry.block_mac;
+        append = valid && block_map_can_append(tr, block_map, index, block_mac,
+                                               &prev);
+        if (tr->failed) {
+            pr_warn("transaction failed, abort\n");
+            return;
+        }
+        if (valid && !append) {
+            if (print_block_map) {
+                printf("%s: block_map at %lld: [%lld] = %lld -> %lld\n",
+                       __func__, block_mac_to_block(tr, &block_map->tree.root),
+                       index, block_mac_to_block(tr, &old_block_mac),
+                       block_mac_to_block(tr, block_mac));
+            }
+            if (!block_mac_eq(tr, &old_block_mac, block_mac)) {
+                block_tree_update_block_mac(tr, &block_map->tree,
+                                            entry.key, old_block_mac,
+                                            entry.key, *block_mac);
+            }
+            return;
+        }
         if (print_block_map) {
             printf("%s: block_map at %lld: remove existing entry at %lld\n",
                    __func__, block_mac_to_block(tr, &block_map->tree.root), index);
         }
-        block_tree_remove(tr, &block_map->tree, index, block_tree_path_get_data(&path));
+        block_tree_remove(tr, &block_map->tree, entry.key,
+                          block_mac_to_block(tr, &old_block_mac));
         if (tr->failed) {
             pr_warn("transaction failed, abort\n");
             return;
         }
+        if (append) {
+            block_map_append(tr, block_map, &prev, index, block_mac);
+            return;
+        }
     }
-    if (block_mac && block_mac_valid(tr, block_mac)) {
+    if (valid) {
+        if (block_map_can_append(tr, block_map, index, block_mac, &prev)) {
+            block_map_append(tr, block_map, &prev, index, block_mac);
+            return;
+        }
+        if (tr->failed) {
+            pr_warn("transaction failed, abort\n");
+            return;
+        }
         if (print_block_map) {
             printf("%s: block_map at %lld: [%lld] = %lld\n",
                    __func__, block_mac_to_block(tr, &block_map->tree.root),
                    index, block_mac_to_block(tr, block_mac));
         }
-        block_tree_insert(tr, &block_map->tree, index, block_mac_to_block(tr, block_mac));
-        /* TODO: insert mac */
+        block_tree_insert_block_mac(tr, &block_map->tree,
+                                    block_map_key(block_map, index, false),
+                                    *block_mac);
     }
 }
 
@@ -137,10 +881,11 @@ void block_map_put_dirty(struct transaction *tr, struct block_map *block_map,
                          data_block_t index, void *data, obj_ref_t *data_ref)
 {
     struct block_tree_path path;
+    struct block_map_entry entry;
+    struct block_mac block_mac = BLOCK_MAC_INITIAL_VALUE(block_mac);
+    bool found;
 
-    index++; /* 0 is not a valid block tree key */
-
-    block_tree_walk(tr, &block_map->tree, index, false, &path);
+    found = block_map_find(tr, block_map, index, &path, &entry);
     if (tr->failed) {
         pr_warn("transaction failed\n");
         block_put_dirty_discard(data, data_ref);
@@ -152,55 +897,90 @@ void block_map_put_dirty(struct transaction *tr, struct block_map *block_map,
                __func__, index, block_tree_path_get_key(&path));
     }
 
-    assert(block_tree_path_get_key(&path) == index);
+    assert(found);
+    if (entry.extent) {
+        block_mac_set_block(tr, &block_mac, entry.start + index - entry.index);
+        block_put_dirty(tr, data, data_ref, &block_mac, NULL);
+        block_map_extent_set_mac(tr, block_map, &entry, index, &block_mac);
+        return;
+    }
     block_tree_path_put_dirty(tr, &path, path.count, data, data_ref);
 }
 
+/**
+ * block_map_path_get_blocks - Get data blocks of block map entry at @path
+ * @tr:         Transaction object.
+ * @block_map:  Block map object.
+ * @path:       Tree path in @block_map.
+ * @start:      Pointer to return first data block in.
+ *
+ * Reads and checks the extent block of extent entries.
+ *
+ * Return: Number of consecutive data blocks starting at @start that the entry
+ * at @path maps, or 0 if there are no more entries or if @tr failed.
+ */
+uint block_map_path_get_blocks(struct transaction *tr,
+                               struct block_map *block_map,
+                               struct block_tree_path *path,
+                               data_block_t *start)
+{
+    struct block_map_entry entry;
+
+    if (!block_map_path_entry(tr, block_map, path, &entry)) {
+        return 0;
+    }
+    *start = entry.start;
+    return entry.count;
+}
+
 /**
  * block_map_truncate - Free blocks
  * @tr:         Transaction object.
  * @block_map:  Block map object.
  * @index:      Index to start freeing at.
  *
- * Remove and free all blocks starting at @index.
+ * Remove and free all blocks starting at @index. An extent that starts before
+ * @index is shortened to end at @index - 1.
  */
 void block_map_truncate(struct transaction *tr,
                         struct block_map *block_map,
                         data_block_t index)
 {
     struct block_tree_path path;
-    data_block_t key;
-    data_block_t data;
-    data_block_t curr_index;
+    struct block_map_entry entry;
+    data_block_t curr_key;
+    data_block_t i;
+    data_block_t first;
 
-    curr_index = index + 1; /* 0 is not a valid block tree key */
+    curr_key = block_map_key(block_map, index, false);
 
     while (true) {
-        block_tree_walk(tr, &block_map->tree, curr_index, false, &path);
-        if (tr->failed) {
-            pr_warn("transaction failed, abort\n");
-            return;
-        }
-        key = block_tree_path_get_key(&path);
-        if (!key) {
+        block_tree_walk(tr, &block_map->tree, curr_key, false, &path);
+        if (!block_map_path_entry(tr, block_map, &path, &entry)) {
+            if (tr->failed) {
+                pr_warn("transaction failed, abort\n");
+                return;
+            }
             break;
         }
-        assert(key >= curr_index);
-        data = block_tree_path_get_data(&path);
-        if (!data) {
-            /* block_tree_walk returned an empty insert spot for curr_index */
-            assert(key != curr_index);
-            curr_index = key;
-            continue;
+        assert(entry.key >= curr_key);
+        if (entry.index < index) {
+            assert(entry.extent);
+            first = index - entry.index;
+            block_map_extent_remove(tr, block_map, &entry, index,
+                                    entry.count - first);
+        } else {
+            first = 0;
+            block_tree_remove(tr, &block_map->tree, entry.key,
+                              block_mac_to_block(tr, &entry.block_mac));
+            if (!tr->failed && entry.extent) {
+                block_map_free_block(tr,
+                                     block_mac_to_block(tr, &entry.block_mac));
+            }
         }
-        assert(data);
-        block_tree_remove(tr, &block_map->tree, key, data);
-        if (tr->failed) {
-            pr_warn("transaction failed, abort\n");
-            return;
+        for (i = first; i < entry.count && !tr->failed; i++) {
+            block_map_free_block(tr, entry.start + i);
         }
-        block_discard_dirty_by_block(tr->fs->dev, data);
-        block_free(tr, data);
         if (tr->failed) {
             pr_warn("transaction failed, abort\n");
             return;
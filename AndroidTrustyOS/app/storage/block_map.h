@@ -18,8 +18,14 @@
 
 #include "block_tree.h"
 
+/**
+ * struct block_map - In-memory block map state
+ * @tree:       B+ tree of block map entries.
+ * @extents:    %true if @tree uses the extent entry format, see block_map.c.
+ */
 struct block_map {
     struct block_tree tree;
+    bool extents;
 };
 
 #define BLOCK_MAP_INITIAL_VALUE(block_map) { \
@@ -40,12 +46,23 @@ bool block_map_get(struct transaction *tr,
                    data_block_t index,
                    struct block_mac *block_mac);
 
+uint block_map_get_range(struct transaction *tr,
+                         struct block_map *block_map,
+                         data_block_t index,
+                         uint count,
+                         struct block_mac *block_macs);
+
 void block_map_set(struct transaction *tr, struct block_map *block_map,
                    data_block_t index, const struct block_mac *block_mac);
 
 void block_map_put_dirty(struct transaction *tr, struct block_map *block_map,
                          data_block_t index, void *data, obj_ref_t *data_ref);
 
+uint block_map_path_get_blocks(struct transaction *tr,
+                               struct block_map *block_map,
+                               struct block_tree_path *path,
+                               data_block_t *start);
+
 void block_map_truncate(struct transaction *tr,
                         struct block_map *block_map,
                         data_block_t index);
@@ -318,6 +318,54 @@ struct block_range block_set_find_next_range(struct transaction *tr,
     return range;
 }
 
+/**
+ * block_set_get_ranges - Copy ranges in set to an array
+ * @tr:         Transaction object.
+ * @set:        Block-set object.
+ * @min_block:  Block number to start at.
+ * @ranges:     Array to store ranges in.
+ * @max_count:  Number of entries in @ranges.
+ *
+ * Copy the first @max_count ranges in @set that end after @min_block, in block
+ * order, to @ranges. If the first range starts before @min_block, the copy
+ * starts at @min_block.
+ *
+ * Return: Number of ranges stored in @ranges. If this is less than @max_count,
+ * @ranges holds every range in @set >= @min_block.
+ */
+uint block_set_get_ranges(struct transaction *tr,
+                          struct block_set *set,
+                          data_block_t min_block,
+                          struct block_range *ranges,
+                          uint max_count)
+{
+    struct block_tree_path path;
+    struct block_range range;
+    uint count = 0;
+
+    block_tree_walk(tr, &set->block_tree, min_block, true, &path);
+    block_range_init_from_path(&range, &path);
+    if (!block_range_empty(range) && range.end <= min_block) {
+        block_tree_path_next(&path);
+        block_range_init_from_path(&range, &path);
+    }
+    if (block_range_empty(range)) {
+        range = set->initial_range;
+        if (range.end > min_block && max_count) {
+            range.start = MAX(range.start, min_block);
+            ranges[count++] = range;
+        }
+        return count;
+    }
+    range.start = MAX(range.start, min_block);
+    while (!block_range_empty(range) && count < max_count && !tr->failed) {
+        ranges[count++] = range;
+        block_tree_path_next(&path);
+        block_range_init_from_path(&range, &path);
+    }
+    return count;
+}
+
 /**
  * block_set_block_in_set - Check if block is in set
  * @tr:         Transaction object.
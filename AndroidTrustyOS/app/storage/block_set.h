@@ -88,6 +88,12 @@ struct block_range block_set_find_next_range(struct transaction *tr,
                                              struct block_set *set,
                                              data_block_t min_block);
 
+uint block_set_get_ranges(struct transaction *tr,
+                          struct block_set *set,
+                          data_block_t min_block,
+                          struct block_range *ranges,
+                          uint max_count);
+
 bool block_set_overlap(struct transaction *tr,
                        struct block_set *set_a,
                        struct block_set *set_b);
@@ -41,6 +41,10 @@ static bool print_internal_changes;
 static bool print_changes;
 static bool print_changes_full_tree;
 
+#if BUILD_STORAGE_TEST
+bool block_tree_linear_search;
+#endif
+
 /* TODO: move to obj_ref lib */
 static void obj_ref_transfer(obj_ref_t *dst, obj_ref_t *src)
 {
@@ -1152,6 +1156,91 @@ static bool block_tree_node_need_copy(struct transaction *tr,
            !tr->failed;
 }
 
+/*
+ * block_tree_node_search scans the last few candidate keys in order instead of
+ * halving the range down to one key. Nodes with few keys, like those with
+ * 8-byte keys in 2k blocks, gain nothing from the binary search.
+ */
+#define BLOCK_TREE_NODE_LINEAR_SEARCH_MAX (8)
+
+/**
+ * block_tree_node_search_key - Check if block_tree_node_find_block should stop
+ * @key:        Key to search for.
+ * @curr_key:   Key stored in node.
+ * @is_leaf:    %true if node is a leaf node, %false otherwise.
+ *
+ * Return: %true if @curr_key is an unused entry, or if @key belongs at or
+ * before @curr_key.
+ */
+static bool block_tree_node_search_key(data_block_t key,
+                                       data_block_t curr_key,
+                                       bool is_leaf)
+{
+    return !curr_key || key <= curr_key - !is_leaf;
+}
+
+/**
+ * block_tree_node_search - Find index of key in node
+ * @tree:       Tree object.
+ * @node_ro:    Node.
+ * @key:        Key to search for.
+ * @is_leaf:    %true if @node_ro is a leaf node, %false otherwise.
+ *
+ * Keys in a node are sorted and unused entries (0) are all at the end, so
+ * block_tree_node_search_key is %false for a prefix of the stored keys and
+ * %true for the rest. Binary search for the first %true entry until at most
+ * %BLOCK_TREE_NODE_LINEAR_SEARCH_MAX entries are left, then scan those.
+ *
+ * Return: index of first stored key where block_tree_node_search_key returns
+ * %true, or max key count for @node_ro if there is no such key. Does not
+ * check @tree->inserting.
+ */
+static uint block_tree_node_search(const struct block_tree *tree,
+                                   const struct block_tree_node *node_ro,
+                                   data_block_t key,
+                                   bool is_leaf)
+{
+    uint low = 0;
+    uint high = block_tree_node_max_key_count(tree, node_ro);
+    uint mid;
+    data_block_t curr_key;
+    const size_t key_size = tree->key_size;
+
+    assert(sizeof(curr_key) >= key_size);
+
+#if BUILD_STORAGE_TEST
+    if (block_tree_linear_search) {
+        for (mid = 0; mid < high; mid++) {
+            curr_key = 0;
+            memcpy(&curr_key, node_ro->data + mid * key_size, key_size);
+            if (block_tree_node_search_key(key, curr_key, is_leaf)) {
+                break;
+            }
+        }
+        return mid;
+    }
+#endif
+
+    while (high - low > BLOCK_TREE_NODE_LINEAR_SEARCH_MAX) {
+        mid = low + (high - low) / 2;
+        curr_key = 0;
+        memcpy(&curr_key, node_ro->data + mid * key_size, key_size);
+        if (block_tree_node_search_key(key, curr_key, is_leaf)) {
+            high = mid;
+        } else {
+            low = mid + 1;
+        }
+    }
+    for (; low < high; low++) {
+        curr_key = 0;
+        memcpy(&curr_key, node_ro->data + low * key_size, key_size);
+        if (block_tree_node_search_key(key, curr_key, is_leaf)) {
+            break;
+        }
+    }
+    return low;
+}
+
 /**
  * block_tree_node_find_block - Helper function for block_tree_walk
  * @tr:             Transaction object.
@@ -1188,12 +1277,12 @@ static int block_tree_node_find_block(const struct transaction *tr,
 
     keys_count = block_tree_node_max_key_count(tree, node_ro);
 
-    /* TODO: better search? */
-    for (i = 0; i < keys_count + 1; i++) {
-        curr_key = block_tree_node_get_key(tree, node_block, node_ro, i);
-        if (key <= (curr_key - !is_leaf) || !curr_key) {
-            break;
-        }
+    i = block_tree_node_search(tree, node_ro, key, is_leaf);
+    curr_key = block_tree_node_get_key(tree, node_block, node_ro, i);
+    if (!block_tree_node_search_key(key, curr_key, is_leaf)) {
+        /* key is after pending entry in @tree->inserting */
+        assert(i == keys_count);
+        i++;
         curr_key = 0;
     }
     if (i == keys_count && curr_key) {
@@ -2732,7 +2821,8 @@ err:
  *
  * Find an entry in the tree where the key matches @key, and the start of data
  * matches @data, and update it's key or data. When updating key, the new key
- * must not cause the entry to move in the tree.
+ * must not cause the entry to move in the tree. When the key is not changed,
+ * @new_data can be the same block as @old_data with a new mac.
  *
  * TODO: Update by path instead
  */
@@ -2759,7 +2849,7 @@ void block_tree_update_block_mac(struct transaction *tr, struct block_tree *tree
     assert(new_key);
     assert(block_mac_valid(tr, &new_data));
     assert(old_key == new_key || block_mac_same_block(tr, &old_data, &new_data));
-    assert(old_key != new_key || !block_mac_same_block(tr, &old_data, &new_data));
+    assert(old_key != new_key || !block_mac_eq(tr, &old_data, &new_data));
 
     tree->updating = true;
 
@@ -176,6 +176,7 @@ void block_tree_init(struct block_tree *tree,
 void block_tree_copy(struct block_tree *dst, const struct block_tree *src);
 
 #if BUILD_STORAGE_TEST
+extern bool block_tree_linear_search;
 void block_tree_check_config(struct block_device *dev);
 void block_tree_check_config_done(void);
 #endif
@@ -16,8 +16,11 @@
 
 #pragma once
 
+#include <list.h>
 #include <stdint.h>
 
+#include <interface/storage/storage.h>
+
 #include "ipc.h"
 #include "transaction.h"
 
@@ -25,8 +28,52 @@
 
 struct file_handle;
 
+/**
+ * struct storage_client_parked_read - read request waiting for block device io
+ * @msg:    Request message header.
+ * @req:    Read request.
+ */
+struct storage_client_parked_read {
+	struct storage_msg msg;
+	struct storage_file_read_req req;
+};
+
+/**
+ * struct storage_client_commit_resp - response held until its commit is written
+ * @msg:        Request message header.
+ * @result:     Result to send.
+ * @out:        Response payload.
+ * @out_size:   Number of bytes used in @out.
+ */
+struct storage_client_commit_resp {
+	struct storage_msg msg;
+	enum storage_err result;
+	uint8_t out[sizeof(struct storage_file_open_resp)];
+	size_t out_size;
+};
+
 /*
  * Structure that tracks state associated with a session.
+ *
+ * A session that sent a read request for blocks that are not cached is parked
+ * on @parked_node while the block device reads them, and other sessions are
+ * served in the meantime. @resume_work runs the saved request again once the
+ * reads complete, or before the next request from the same session is
+ * handled.
+ *
+ * While transactions completed without a super block update are pending, a
+ * session is queued on @commit_node with its response in @commit_resp until
+ * a super block that includes them has been written, as the response can
+ * depend on them.
+ *
+ * @write_batch_result holds the first error of a write streamed with
+ * STORAGE_MSG_FLAG_BATCH, until it is returned for the last part of the write.
+ * A read streamed the same way is continued from @parked_read after each part
+ * has been sent.
+ *
+ * While the operations of a STORAGE_COMPOUND request run, their responses are
+ * stored in @compound_result, and the data read in @compound_data, instead of
+ * being sent.
  */
 struct storage_client_session {
 	uint32_t magic;
@@ -35,5 +82,18 @@ struct storage_client_session {
 	struct file_handle **files;
 	size_t files_count;
 
+	struct list_node parked_node;
+	struct ipc_deferred_work resume_work;
+	struct storage_client_parked_read parked_read;
+	bool resuming;
+
+	struct list_node commit_node;
+	struct storage_client_commit_resp commit_resp;
+
+	enum storage_err write_batch_result;
+
+	struct storage_compound_result *compound_result;
+	uint8_t *compound_data;
+
 	struct ipc_channel_context context;
 };
@@ -30,6 +30,7 @@
 
 #include "client_tipc.h"
 #include "client_session_tipc.h"
+#include "debug_stats.h"
 #include "file.h"
 #include "ipc.h"
 #include "session.h"
@@ -47,10 +48,15 @@
 #endif
 
 static int client_handle_msg(struct ipc_channel_context *ctx, void *msg, size_t msg_size);
+static int client_handle_request(struct storage_client_session *session,
+                                 void *msg_buf, size_t msg_size);
 static void client_disconnect(struct ipc_channel_context *context);
 static int send_response(struct storage_client_session *session,
                          enum storage_err result, struct storage_msg *msg,
                          void *out, size_t out_size);
+static int send_response_etc(struct storage_client_session *session,
+                             enum storage_err result, struct storage_msg *msg,
+                             uint32_t flags, void *out, size_t out_size);
 
 /*
  * Legal secure storage directory and file names contain only
@@ -236,6 +242,145 @@ static struct file_handle *get_file_handle(struct storage_client_session *sessio
 	return file;
 }
 
+/*
+ * Limits on how long a completed transaction can wait for other transactions to
+ * share its super block write.
+ */
+#define CLIENT_COMMIT_GROUP_MAX_COUNT		(8)
+#define CLIENT_COMMIT_GROUP_MAX_DELAY_NS	(2LL * 1000 * 1000)
+
+/* Sessions waiting for the super block write that covers their transaction */
+static struct list_node client_commit_sessions =
+	LIST_INITIAL_VALUE(client_commit_sessions);
+static int64_t client_commit_group_start;
+
+static void client_commit_flush_work(struct ipc_deferred_work *work);
+
+static struct ipc_deferred_work client_commit_work = {
+	.node = LIST_INITIAL_CLEARED_VALUE,
+	.fn = client_commit_flush_work,
+};
+
+/**
+ * client_transaction_complete - Complete transaction as part of a commit group
+ * @session:    Client session.
+ *
+ * The super block update is left to client_commit_flush, and send_response
+ * holds back the response to the current request until then.
+ */
+static void client_transaction_complete(struct storage_client_session *session)
+{
+	transaction_complete_etc(&session->tr, false);
+}
+
+/**
+ * client_commit_flush - Write super blocks for held responses and send them
+ */
+static void client_commit_flush(void)
+{
+	int rc;
+	struct storage_client_session *session;
+	struct storage_client_commit_resp *resp;
+
+	ipc_cancel_work(&client_commit_work);
+
+	while ((session = list_remove_head_type(&client_commit_sessions,
+	                                        struct storage_client_session,
+	                                        commit_node))) {
+		transaction_group_commit(session->tr.fs);
+		assert(!session->tr.super_pending);
+
+		resp = &session->commit_resp;
+		rc = send_response(session, resp->result, &resp->msg,
+		                   resp->out_size ? resp->out : NULL,
+		                   resp->out_size);
+		if (rc < 0) {
+			SS_ERR("%s: failed (%d) to send held response\n",
+			       __func__, rc);
+		}
+	}
+}
+
+static void client_commit_flush_work(struct ipc_deferred_work *work)
+{
+	client_commit_flush();
+}
+
+/**
+ * response_payload_size - Get size of payload to send with a response
+ * @result:     Result of request.
+ * @msg:        Request message header.
+ * @out:        Response payload.
+ * @out_size:   Size of @out.
+ *
+ * Failed requests get no payload, except compound requests, where it holds
+ * the results of the operations that ran, including the one that failed.
+ *
+ * Return: number of bytes of @out to send.
+ */
+static size_t response_payload_size(enum storage_err result,
+                                    struct storage_msg *msg,
+                                    void *out, size_t out_size)
+{
+	if (!out) {
+		return 0;
+	}
+	if (result != STORAGE_NO_ERROR &&
+	    (msg->cmd & ~STORAGE_RESP_BIT) != STORAGE_COMPOUND) {
+		return 0;
+	}
+	return out_size;
+}
+
+/**
+ * client_commit_hold_response - Hold response until its commit is written
+ * @session:    Client session.
+ * @result:     Result to send.
+ * @msg:        Request message header.
+ * @out:        Response payload.
+ * @out_size:   Size of @out.
+ *
+ * The group is written once the ipc loop has no more events to handle, or
+ * right away if it is already large or old enough.
+ *
+ * Return: NO_ERROR.
+ */
+static int client_commit_hold_response(struct storage_client_session *session,
+                                       enum storage_err result,
+                                       struct storage_msg *msg,
+                                       void *out, size_t out_size)
+{
+	int64_t now;
+	struct storage_client_commit_resp *resp = &session->commit_resp;
+
+	assert(!list_in_list(&session->commit_node));
+
+	out_size = response_payload_size(result, msg, out, out_size);
+	assert(out_size <= sizeof(resp->out));
+
+	resp->msg = *msg;
+	resp->result = result;
+	if (out_size) {
+		memcpy(resp->out, out, out_size);
+	}
+	resp->out_size = out_size;
+
+	gettime(0, 0, &now);
+	if (list_is_empty(&client_commit_sessions)) {
+		client_commit_group_start = now;
+	}
+	list_add_tail(&client_commit_sessions, &session->commit_node);
+
+	if (list_length(&client_commit_sessions) >= CLIENT_COMMIT_GROUP_MAX_COUNT ||
+	    now - client_commit_group_start >= CLIENT_COMMIT_GROUP_MAX_DELAY_NS) {
+		client_commit_flush();
+	} else {
+		ipc_defer_idle_work(&client_commit_work);
+	}
+
+	return NO_ERROR;
+}
+
 static enum storage_err storage_file_delete(struct storage_msg *msg,
                                             struct storage_file_delete_req *req, size_t req_size,
                                             struct storage_client_session *session)
@@ -283,7 +428,7 @@ static enum storage_err storage_file_delete(struct storage_msg *msg,
 	}
 
 	if (msg->flags & STORAGE_MSG_FLAG_TRANSACT_COMPLETE) {
-		transaction_complete(&session->tr);
+		client_transaction_complete(session);
 		if (session->tr.failed) {
 			SS_ERR("%s: transaction commit failed\n", __func__);
 			return STORAGE_ERR_GENERIC;
@@ -379,7 +524,7 @@ static int storage_file_open(struct storage_msg *msg,
 	}
 
 	if (msg->flags & STORAGE_MSG_FLAG_TRANSACT_COMPLETE) {
-		transaction_complete(&session->tr);
+		client_transaction_complete(session);
 		if (session->tr.failed) {
 			SS_ERR("%s: transaction commit failed\n", __func__);
 			result = STORAGE_ERR_GENERIC;
@@ -428,7 +573,7 @@ static enum storage_err storage_file_close(struct storage_msg *msg,
 	free_file_handle(session, req->handle);
 
 	if (msg->flags & STORAGE_MSG_FLAG_TRANSACT_COMPLETE) {
-		transaction_complete(&session->tr);
+		client_transaction_complete(session);
 		if (session->tr.failed) {
 			SS_ERR("%s: transaction commit failed\n", __func__);
 			return STORAGE_ERR_GENERIC;
@@ -439,6 +584,174 @@ static enum storage_err storage_file_close(struct storage_msg *msg,
 	return STORAGE_NO_ERROR;
 }
 
+/* Sessions waiting for block device reads started by their read request */
+static struct list_node client_parked_sessions =
+	LIST_INITIAL_VALUE(client_parked_sessions);
+
+/* Request and response buffer used to run parked requests */
+static uint64_t client_resume_buf[STORAGE_MAX_BUFFER_SIZE / sizeof(uint64_t)];
+
+STATIC_ASSERT(offsetof(struct storage_client_parked_read, req) ==
+              sizeof(struct storage_msg));
+STATIC_ASSERT(sizeof(struct storage_client_parked_read) <=
+              sizeof(client_resume_buf));
+
+/**
+ * client_park_read - Save read request until block device reads complete
+ * @session:    Client session.
+ * @msg:        Request message header.
+ * @req:        Read request.
+ */
+static void client_park_read(struct storage_client_session *session,
+                             struct storage_msg *msg,
+                             struct storage_file_read_req *req)
+{
+	assert(!list_in_list(&session->parked_node));
+
+	session->parked_read.msg = *msg;
+	session->parked_read.req = *req;
+	list_add_tail(&client_parked_sessions, &session->parked_node);
+}
+
+/**
+ * client_resume - Run parked request
+ * @session:    Client session.
+ *
+ * The block device reads started for the request may still be in progress, in
+ * which case they are waited for when the blocks are accessed.
+ */
+static void client_resume(struct storage_client_session *session)
+{
+	int rc;
+
+	assert(list_in_list(&session->parked_node));
+	list_delete(&session->parked_node);
+	ipc_cancel_work(&session->resume_work);
+
+	memcpy(client_resume_buf, &session->parked_read,
+	       sizeof(session->parked_read));
+
+	session->resuming = true;
+	rc = client_handle_request(session, client_resume_buf,
+	                           sizeof(session->parked_read));
+	session->resuming = false;
+	if (rc < 0) {
+		SS_ERR("%s: failed to handle parked request (%d)\n",
+		       __func__, rc);
+	}
+}
+
+static void client_resume_work(struct ipc_deferred_work *work)
+{
+	struct storage_client_session *session =
+		containerof(work, struct storage_client_session, resume_work);
+
+	assert(session->magic == STORAGE_CLIENT_SESSION_MAGIC);
+
+	if (list_in_list(&session->parked_node)) {
+		client_resume(session);
+	}
+}
+
+/**
+ * client_io_complete - Resume parked sessions
+ *
+ * Called by the block device when reads sent without waiting have completed.
+ * The sessions are resumed from the ipc loop, as this can be called while
+ * another request is being handled.
+ */
+void client_io_complete(void)
+{
+	struct storage_client_session *session;
+
+	list_for_every_entry(&client_parked_sessions, session,
+	                     struct storage_client_session, parked_node) {
+		ipc_defer_work(&session->resume_work);
+	}
+}
+
+/*
+ * Budget of each background integrity check run. A run is started when the ipc
+ * loop becomes idle after handling requests for a file system, so the
+ * scrubber does not delay requests and does not run while clients are idle.
+ */
+#define CLIENT_SCRUB_MAX_ENTRIES	(32)
+#define CLIENT_SCRUB_MAX_READS		(4)
+#define CLIENT_SCRUB_MAX_FS		(2)
+
+/* File systems that have handled requests since the last scrub run */
+static struct fs *client_scrub_fs[CLIENT_SCRUB_MAX_FS];
+
+static void client_scrub_work_fn(struct ipc_deferred_work *work);
+
+static struct ipc_deferred_work client_scrub_work = {
+	.node = LIST_INITIAL_CLEARED_VALUE,
+	.fn = client_scrub_work_fn,
+};
+
+/**
+ * client_scrub_schedule - Check part of a file system once the loop is idle
+ * @fs:         File system used by the request that was handled.
+ */
+static void client_scrub_schedule(struct fs *fs)
+{
+	uint i;
+
+	for (i = 0; i < countof(client_scrub_fs); i++) {
+		if (client_scrub_fs[i] == fs) {
+			break;
+		}
+		if (!client_scrub_fs[i]) {
+			client_scrub_fs[i] = fs;
+			break;
+		}
+	}
+	ipc_defer_idle_work(&client_scrub_work);
+}
+
+/**
+ * client_scrub_cancel - Drop scheduled scrub run for a file system
+ * @fs:         File system that is about to be destroyed.
+ */
+void client_scrub_cancel(struct fs *fs)
+{
+	uint i;
+
+	for (i = 0; i < countof(client_scrub_fs); i++) {
+		if (client_scrub_fs[i] == fs) {
+			memmove(&client_scrub_fs[i], &client_scrub_fs[i + 1],
+			        (countof(client_scrub_fs) - i - 1) *
+			        sizeof(client_scrub_fs[0]));
+			client_scrub_fs[countof(client_scrub_fs) - 1] = NULL;
+			break;
+		}
+	}
+}
+
+static void client_scrub_work_fn(struct ipc_deferred_work *work)
+{
+	uint i;
+	struct fs *fs;
+
+	/* wait for the next request if sessions are waiting for reads */
+	if (!list_is_empty(&client_parked_sessions)) {
+		return;
+	}
+	if (!list_is_empty(&client_commit_sessions)) {
+		client_commit_flush();
+	}
+
+	for (i = 0; i < countof(client_scrub_fs); i++) {
+		fs = client_scrub_fs[i];
+		if (!fs) {
+			break;
+		}
+		client_scrub_fs[i] = NULL;
+		fs_scrub_run(fs, CLIENT_SCRUB_MAX_ENTRIES,
+		             CLIENT_SCRUB_MAX_READS);
+	}
+}
+
 static int storage_file_read(struct storage_msg *msg,
                              struct storage_file_read_req *req, size_t req_size,
                              struct storage_client_session *session)
@@ -456,13 +769,22 @@ static int storage_file_read(struct storage_msg *msg,
 	const uint8_t *block_data;
 	obj_ref_t block_data_ref = OBJ_REF_INITIAL_VALUE(block_data_ref);
 	size_t block_offset;
+	bool stream = msg->flags & STORAGE_MSG_FLAG_BATCH;
+	bool more = false;
+	struct storage_client_parked_read next;
+	int rc;
 
 	if (req_size < sizeof(*req)) {
 		SS_ERR("%s: invalid request size (%zd)\n", __func__, req_size);
 		result = STORAGE_ERR_NOT_VALID;
+		stream = false;
 		goto err_invalid_input;
 	}
 
+	/* the response data overwrites the request, save it for the next part */
+	next.msg = *msg;
+	next.req = *req;
+
 	file = get_file_handle(session, req->handle);
 	if (!file) {
 		SS_ERR("%s: invalid file handle (%d)\n", __func__, req->handle);
@@ -472,10 +794,13 @@ static int storage_file_read(struct storage_msg *msg,
 
 	buflen = req->size;
 	if (buflen > STORAGE_MAX_BUFFER_SIZE - sizeof(*msg)) {
-		SS_ERR("can't read more than %d bytes, requested %zd\n",
-		       STORAGE_MAX_BUFFER_SIZE, buflen);
-		result = STORAGE_ERR_NOT_VALID;
-		goto err_invalid_input;
+		if (!stream) {
+			SS_ERR("can't read more than %d bytes, requested %zd\n",
+			       STORAGE_MAX_BUFFER_SIZE, buflen);
+			result = STORAGE_ERR_NOT_VALID;
+			goto err_invalid_input;
+		}
+		buflen = STORAGE_MAX_BUFFER_SIZE - sizeof(*msg);
 	}
 
 	offset = req->offset;
@@ -499,6 +824,22 @@ static int storage_file_read(struct storage_msg *msg,
 
 	SS_INFO("%s: start 0x%x cnt %d\n", __func__, offset, bytes_left);
 
+	/* read-ahead was already done before the request was parked */
+	if (bytes_left && !session->resuming) {
+		if (session->compound_result) {
+			/* operations of compound requests are not parked */
+			file_read_ahead(&session->tr, file, offset / block_size,
+			                (offset + bytes_left - 1) / block_size -
+			                offset / block_size + 1);
+		} else if (file_read_ahead_async(&session->tr, file,
+		                                 offset / block_size,
+		                                 (offset + bytes_left - 1) / block_size -
+		                                 offset / block_size + 1)) {
+			client_park_read(session, msg, req);
+			return NO_ERROR;
+		}
+	}
+
 	result = STORAGE_NO_ERROR;
 	while (bytes_left) {
 		block_num = offset / block_size;
@@ -522,12 +863,45 @@ static int storage_file_read(struct storage_msg *msg,
 		bufp += len;
 	}
 
+	/* start reading the next part while this one is sent */
+	more = stream && next.req.size > buflen && offset < file->size;
+	if (more) {
+		bytes_left = MIN(next.req.size - buflen,
+		                 STORAGE_MAX_BUFFER_SIZE - sizeof(*msg));
+		bytes_left = MIN(bytes_left, file->size - offset);
+		file_read_ahead_async(&session->tr, file, offset / block_size,
+		                      (offset + bytes_left - 1) / block_size -
+		                      offset / block_size + 1);
+	}
+
 	out = (uint8_t *)(msg + 1);
 	out_size = buflen;
 
 err_get_block:
 err_invalid_input:
-	return send_response(session, result, msg, out, out_size);
+	if (session->compound_result) {
+		/* operations of compound requests are not streamed */
+		return send_response(session, result, msg, out, out_size);
+	}
+	/* the data read may come from transactions that are not on disk yet */
+	if (transaction_group_pending(session->tr.fs)) {
+		transaction_group_commit(session->tr.fs);
+	}
+	rc = send_response_etc(session, result, msg,
+	                       more ? STORAGE_MSG_FLAG_BATCH : 0, out, out_size);
+	if (stream && rc == ERR_NOT_ENOUGH_BUFFER) {
+		/* send this part again once the client has made room */
+		client_park_read(session, &next.msg, &next.req);
+		return NO_ERROR;
+	}
+	if (more && rc >= 0) {
+		next.req.offset += buflen;
+		next.req.size -= buflen;
+		client_park_read(session, &next.msg, &next.req);
+		ipc_defer_work(&session->resume_work);
+		return NO_ERROR;
+	}
+	return rc;
 }
 
 static enum storage_err storage_file_write(struct storage_msg *msg,
@@ -607,7 +981,7 @@ static enum storage_err storage_file_write(struct storage_msg *msg,
 	}
 
 	if (msg->flags & STORAGE_MSG_FLAG_TRANSACT_COMPLETE) {
-		transaction_complete(&session->tr);
+		client_transaction_complete(session);
 		if (session->tr.failed) {
 			SS_ERR("%s: transaction commit failed\n", __func__);
 			return STORAGE_ERR_GENERIC;
@@ -699,7 +1073,7 @@ static enum storage_err storage_file_set_size(struct storage_msg *msg,
 
 	/* try to commit */
 	if (msg->flags & STORAGE_MSG_FLAG_TRANSACT_COMPLETE) {
-		transaction_complete(&session->tr);
+		client_transaction_complete(session);
 	}
 
 	if (session->tr.failed) {
@@ -710,6 +1084,282 @@ static enum storage_err storage_file_set_size(struct storage_msg *msg,
 	return STORAGE_NO_ERROR;
 }
 
+STATIC_ASSERT(STATS_TIMER_HIST_BUCKETS == STORAGE_DEBUG_STATS_HIST_BUCKETS);
+
+static int storage_debug_stats(struct storage_msg *msg,
+                               struct storage_debug_stats_req *req, size_t req_size,
+                               struct storage_client_session *session)
+{
+#if STORAGE_DEBUG_STATS
+	enum storage_err result = STORAGE_NO_ERROR;
+	struct storage_debug_stats_resp *resp = NULL;
+	struct storage_debug_stats_timer *out_timer;
+	const struct stats_timer *timer;
+	uint32_t flags;
+	uint32_t id;
+	size_t out_size = 0;
+	size_t max_count;
+
+	if (req_size != sizeof(*req)) {
+		SS_ERR("%s: invalid request size (%zd)\n", __func__, req_size);
+		result = STORAGE_ERR_NOT_VALID;
+		goto err_invalid_input;
+	}
+
+	flags = req->flags;
+	id = req->first;
+	if ((flags & ~STORAGE_DEBUG_STATS_MASK) || id > STATS_TIMER_COUNT) {
+		SS_ERR("%s: invalid request, flags 0x%x, first %d\n",
+		       __func__, flags, id);
+		result = STORAGE_ERR_NOT_VALID;
+		goto err_invalid_input;
+	}
+
+	// reuse the input buffer
+	resp = (struct storage_debug_stats_resp *)(msg + 1);
+	max_count = (STORAGE_MAX_BUFFER_SIZE - sizeof(*msg) - sizeof(*resp)) /
+	            sizeof(resp->timers[0]);
+
+	resp->timer_count = STATS_TIMER_COUNT;
+	resp->count = 0;
+	for (; id < STATS_TIMER_COUNT && resp->count < max_count; id++) {
+		timer = stats_timer_get(id);
+		out_timer = &resp->timers[resp->count++];
+		memset(out_timer, 0, sizeof(*out_timer));
+		strncpy(out_timer->name, stats_timer_name(id),
+		        sizeof(out_timer->name) - 1);
+		out_timer->count = timer->count;
+		out_timer->total_ns = timer->total;
+		out_timer->min_ns = timer->min;
+		out_timer->max_ns = timer->max;
+		memcpy(out_timer->hist, timer->hist, sizeof(out_timer->hist));
+	}
+	out_size = sizeof(*resp) + resp->count * sizeof(resp->timers[0]);
+
+	if ((flags & STORAGE_DEBUG_STATS_RESET) && id == STATS_TIMER_COUNT) {
+		stats_timer_reset();
+	}
+
+err_invalid_input:
+	return send_response(session, result, msg, resp, out_size);
+#else
+	/* statistics are only built into debug and test builds */
+	return send_response(session, STORAGE_ERR_UNIMPLEMENTED, msg, NULL, 0);
+#endif
+}
+
+/* Response buffer used to collect the results of compound requests */
+static uint64_t client_compound_buf[STORAGE_MAX_BUFFER_SIZE / sizeof(uint64_t)];
+
+/**
+ * compound_op_req_size - Get minimum request size of compound operation
+ * @cmd:        Command of operation.
+ *
+ * Return: minimum payload size for @cmd, or -1 if @cmd is not supported in
+ * compound requests.
+ */
+static ssize_t compound_op_req_size(uint32_t cmd)
+{
+	switch (cmd) {
+	case STORAGE_FILE_DELETE:
+		return sizeof(struct storage_file_delete_req);
+	case STORAGE_FILE_OPEN:
+		return sizeof(struct storage_file_open_req);
+	case STORAGE_FILE_CLOSE:
+		return sizeof(struct storage_file_close_req);
+	case STORAGE_FILE_READ:
+		return sizeof(struct storage_file_read_req);
+	case STORAGE_FILE_WRITE:
+		return sizeof(struct storage_file_write_req);
+	case STORAGE_FILE_GET_SIZE:
+		return sizeof(struct storage_file_get_size_req);
+	case STORAGE_FILE_SET_SIZE:
+		return sizeof(struct storage_file_set_size_req);
+	case STORAGE_END_TRANSACTION:
+		return 0;
+	default:
+		return -1;
+	}
+}
+
+/**
+ * compound_op_handle - Get file handle of compound operation
+ * @op:         Operation message, with a payload checked by
+ *              compound_op_req_size.
+ *
+ * Return: pointer to the file handle in the payload of @op, or %NULL if the
+ * command of @op does not take a file handle.
+ */
+static uint32_t *compound_op_handle(struct storage_msg *op)
+{
+	switch (op->cmd) {
+	case STORAGE_FILE_CLOSE:
+		return &((struct storage_file_close_req *)op->payload)->handle;
+	case STORAGE_FILE_READ:
+		return &((struct storage_file_read_req *)op->payload)->handle;
+	case STORAGE_FILE_WRITE:
+		return &((struct storage_file_write_req *)op->payload)->handle;
+	case STORAGE_FILE_GET_SIZE:
+		return &((struct storage_file_get_size_req *)op->payload)->handle;
+	case STORAGE_FILE_SET_SIZE:
+		return &((struct storage_file_set_size_req *)op->payload)->handle;
+	default:
+		return NULL;
+	}
+}
+
+/**
+ * client_compound_capture - Store response of compound operation
+ * @session:    Client session.
+ * @result:     Result of operation.
+ * @msg:        Operation message.
+ * @out:        Response payload.
+ * @out_size:   Size of @out.
+ *
+ * Return: NO_ERROR.
+ */
+static int client_compound_capture(struct storage_client_session *session,
+                                   enum storage_err result,
+                                   struct storage_msg *msg,
+                                   void *out, size_t out_size)
+{
+	struct storage_compound_result *op_result = session->compound_result;
+
+	op_result->result = result;
+	if (result != STORAGE_NO_ERROR) {
+		return NO_ERROR;
+	}
+
+	switch (msg->cmd) {
+	case STORAGE_FILE_OPEN:
+		assert(out_size == sizeof(struct storage_file_open_resp));
+		op_result->handle = ((struct storage_file_open_resp *)out)->handle;
+		break;
+	case STORAGE_FILE_READ:
+		memcpy(session->compound_data, out, out_size);
+		op_result->size = out_size;
+		break;
+	case STORAGE_FILE_GET_SIZE:
+		assert(out_size == sizeof(struct storage_file_get_size_resp));
+		op_result->size = ((struct storage_file_get_size_resp *)out)->size;
+		break;
+	}
+
+	return NO_ERROR;
+}
+
+static int storage_compound(struct storage_msg *msg,
+                            struct storage_compound_req *req, size_t req_size,
+                            struct storage_client_session *session)
+{
+	enum storage_err result = STORAGE_NO_ERROR;
+	struct storage_compound_resp *resp = (void *)client_compound_buf;
+	struct storage_msg *op = (void *)client_resume_buf;
+	struct storage_msg op_hdr;
+	struct storage_file_read_req read_req;
+	ssize_t op_req_size;
+	size_t ops_size;
+	size_t op_offset;
+	size_t data_size = 0;
+	size_t resp_size;
+	size_t read_size;
+	uint8_t *data;
+	uint32_t *handle;
+	uint32_t opened_handle = STORAGE_COMPOUND_OPENED_FILE;
+	uint i;
+	int rc;
+
+	if (req_size < sizeof(*req) || req->count > STORAGE_COMPOUND_MAX_OPS) {
+		SS_ERR("%s: invalid request size (%zd)\n", __func__, req_size);
+		result = STORAGE_ERR_NOT_VALID;
+		goto err_invalid_input;
+	}
+
+	/* check every operation, and that all results fit, before running any */
+	ops_size = req_size - sizeof(*req);
+	for (i = 0, op_offset = 0; i < req->count; i++) {
+		if (ops_size - op_offset < sizeof(op_hdr)) {
+			SS_ERR("%s: operation %d truncated\n", __func__, i);
+			result = STORAGE_ERR_NOT_VALID;
+			goto err_invalid_input;
+		}
+		memcpy(&op_hdr, req->ops + op_offset, sizeof(op_hdr));
+		op_req_size = compound_op_req_size(op_hdr.cmd);
+		if (op_req_size < 0 || (op_hdr.flags & STORAGE_MSG_FLAG_BATCH) ||
+		    op_hdr.size < sizeof(op_hdr) + op_req_size ||
+		    op_hdr.size > ops_size - op_offset) {
+			SS_ERR("%s: invalid operation %d, cmd 0x%x, size %d\n",
+			       __func__, i, op_hdr.cmd, op_hdr.size);
+			result = STORAGE_ERR_NOT_VALID;
+			goto err_invalid_input;
+		}
+		if (op_hdr.cmd == STORAGE_FILE_READ) {
+			memcpy(&read_req, req->ops + op_offset + sizeof(op_hdr),
+			       sizeof(read_req));
+			if (read_req.size > STORAGE_MAX_BUFFER_SIZE) {
+				result = STORAGE_ERR_NOT_VALID;
+				goto err_invalid_input;
+			}
+			data_size += read_req.size;
+		}
+		op_offset += op_hdr.size;
+	}
+
+	resp_size = sizeof(*resp) + req->count * sizeof(resp->results[0]);
+	if (resp_size + data_size > STORAGE_MAX_BUFFER_SIZE - sizeof(*msg)) {
+		SS_ERR("%s: results do not fit in response\n", __func__);
+		result = STORAGE_ERR_NOT_VALID;
+		goto err_invalid_input;
+	}
+
+	memset(resp, 0, resp_size);
+	data = (uint8_t *)&resp->results[req->count];
+
+	for (i = 0, op_offset = 0; i < req->count; i++) {
+		/* operations can use their message buffer for their response */
+		memcpy(&op_hdr, req->ops + op_offset, sizeof(op_hdr));
+		memcpy(op, req->ops + op_offset, op_hdr.size);
+		op_offset += op_hdr.size;
+
+		handle = compound_op_handle(op);
+		if (handle && *handle == STORAGE_COMPOUND_OPENED_FILE) {
+			*handle = opened_handle;
+		}
+		read_size = 0;
+		if (op->cmd == STORAGE_FILE_READ) {
+			read_size = ((struct storage_file_read_req *)op->payload)->size;
+		}
+
+		session->compound_result = &resp->results[i];
+		session->compound_data = data;
+		rc = client_handle_request(session, op, op_hdr.size);
+		session->compound_result = NULL;
+		if (rc < 0) {
+			return rc;
+		}
+
+		resp->count++;
+		result = resp->results[i].result;
+		if (result != STORAGE_NO_ERROR) {
+			break;
+		}
+		if (op_hdr.cmd == STORAGE_FILE_OPEN) {
+			opened_handle = resp->results[i].handle;
+		}
+		if (read_size) {
+			memset(data + resp->results[i].size, 0,
+			       read_size - resp->results[i].size);
+			data += read_size;
+			resp_size = data - (uint8_t *)resp;
+		}
+	}
+
+	return send_response(session, result, msg, resp, resp_size);
+
+err_invalid_input:
+	return send_response(session, result, msg, NULL, 0);
+}
+
 static struct storage_client_session *chan_context_to_client_session(struct ipc_channel_context *ctx)
 {
 	assert(ctx != NULL);
@@ -727,10 +1377,26 @@ static struct client_port_context *port_context_to_client_port_context(struct ip
 	return containerof(context, struct client_port_context, client_ctx);
 }
 
+/**
+ * client_send_unblocked - Continue streamed read after client made room
+ * @context:    Channel context of client session.
+ */
+static void client_send_unblocked(struct ipc_channel_context *context)
+{
+	struct storage_client_session *session;
+
+	session = chan_context_to_client_session(context);
+
+	if (list_in_list(&session->parked_node)) {
+		ipc_defer_work(&session->resume_work);
+	}
+}
+
 static void client_channel_ops_init(struct ipc_channel_ops *ops)
 {
 	ops->on_handle_msg = client_handle_msg;
 	ops->on_disconnect = client_disconnect;
+	ops->on_send_unblocked = client_send_unblocked;
 }
 
 static struct ipc_channel_context *client_connect(struct ipc_port_context *parent_ctx,
@@ -753,6 +1419,15 @@ static struct ipc_channel_context *client_connect(struct ipc_port_context *paren
 	client_session->files = NULL;
 	client_session->files_count = 0;
 
+	list_clear_node(&client_session->parked_node);
+	list_clear_node(&client_session->commit_node);
+	client_session->write_batch_result = STORAGE_NO_ERROR;
+	client_session->compound_result = NULL;
+	client_session->compound_data = NULL;
+	ipc_deferred_work_init(&client_session->resume_work,
+	                       client_resume_work);
+	client_session->resuming = false;
+
 	transaction_init(&client_session->tr, client_port_context->tr_state,
 	                 false);
 
@@ -774,6 +1449,16 @@ static void client_disconnect(struct ipc_channel_context *context)
 
 	session = chan_context_to_client_session(context);
 
+	if (list_in_list(&session->parked_node)) {
+		list_delete(&session->parked_node);
+	}
+	ipc_cancel_work(&session->resume_work);
+
+	if (list_in_list(&session->commit_node)) {
+		list_delete(&session->commit_node);
+		transaction_group_commit(session->tr.fs);
+	}
+
 	if (list_in_list(&session->tr.allocated.node) && !session->tr.failed) {
 		transaction_fail(&session->tr); /* discard partial transaction */
 	}
@@ -784,19 +1469,21 @@ static void client_disconnect(struct ipc_channel_context *context)
 	free(session);
 }
 
-static int send_response(struct storage_client_session *session,
-                         enum storage_err result, struct storage_msg *msg,
-                         void *out, size_t out_size)
+static int send_response_etc(struct storage_client_session *session,
+                             enum storage_err result, struct storage_msg *msg,
+                             uint32_t flags, void *out, size_t out_size)
 {
 	size_t resp_buf_count = 1;
-	if (result == STORAGE_NO_ERROR && out != NULL && out_size != 0) {
+
+	out_size = response_payload_size(result, msg, out, out_size);
+	if (out_size != 0) {
 		++resp_buf_count;
 	}
 
 	iovec_t resp_bufs[resp_buf_count];
 
 	msg->cmd |= STORAGE_RESP_BIT;
-	msg->flags = 0;
+	msg->flags = flags;
 	msg->size = sizeof(struct storage_msg) + out_size;
 	msg->result = result;
 
@@ -816,6 +1503,47 @@ static int send_response(struct storage_client_session *session,
 	return send_msg(session->context.common.handle, &resp_ipc_msg);
 }
 
+static int send_response(struct storage_client_session *session,
+                         enum storage_err result, struct storage_msg *msg,
+                         void *out, size_t out_size)
+{
+	/* streamed writes are only answered once the last part arrives */
+	if (msg->cmd == STORAGE_FILE_WRITE &&
+	    (msg->flags & STORAGE_MSG_FLAG_BATCH)) {
+		if (session->tr.super_pending) {
+			transaction_group_commit(session->tr.fs);
+		}
+		if (session->write_batch_result == STORAGE_NO_ERROR) {
+			session->write_batch_result = result;
+		}
+		return NO_ERROR;
+	}
+
+	/*
+	 * Any response can depend on transactions of other sessions that are
+	 * merged into the file system state before their super block is
+	 * written, so it is held until that super block is on disk too.
+	 * Responses too large to hold, and those of compound operations, which
+	 * are only sent after the last operation, write it right away.
+	 */
+	if (transaction_group_pending(session->tr.fs)) {
+		if (!session->compound_result &&
+		    response_payload_size(result, msg, out, out_size) <=
+		    sizeof(session->commit_resp.out)) {
+			return client_commit_hold_response(session, result, msg,
+			                                   out, out_size);
+		}
+		transaction_group_commit(session->tr.fs);
+	}
+
+	if (session->compound_result) {
+		return client_compound_capture(session, result, msg,
+		                               out, out_size);
+	}
+
+	return send_response_etc(session, result, msg, 0, out, out_size);
+}
+
 static int send_result(struct storage_client_session *session,
                        struct storage_msg *msg, enum storage_err result)
 {
@@ -825,13 +1553,30 @@ static int send_result(struct storage_client_session *session,
 static int client_handle_msg(struct ipc_channel_context *ctx, void *msg_buf, size_t msg_size)
 {
 	struct storage_client_session *session;
+
+	session = chan_context_to_client_session(ctx);
+
+	/* requests from a session are handled in order */
+	if (list_in_list(&session->parked_node)) {
+		client_resume(session);
+	}
+	if (list_in_list(&session->commit_node)) {
+		client_commit_flush();
+	}
+
+	client_scrub_schedule(session->tr.fs);
+
+	return client_handle_request(session, msg_buf, msg_size);
+}
+
+static int client_handle_request(struct storage_client_session *session,
+                                 void *msg_buf, size_t msg_size)
+{
 	struct storage_msg *msg = msg_buf;
 	size_t payload_len;
 	enum storage_err result;
 	void *payload;
 
-	session = chan_context_to_client_session(ctx);
-
 	if (msg_size < sizeof(struct storage_msg)) {
 		SS_ERR("%s: invalid message of size (%zd)\n", __func__, msg_size);
 		struct storage_msg err_msg = {.cmd = STORAGE_RESP_MSG_ERR};
@@ -842,12 +1587,33 @@ static int client_handle_msg(struct ipc_channel_context *ctx, void *msg_buf, siz
 	payload_len = msg_size - sizeof(struct storage_msg);
 	payload = msg->payload;
 
+	/* statistics are not part of any transaction */
+	if (msg->cmd == STORAGE_DEBUG_STATS) {
+		return storage_debug_stats(msg, payload, payload_len, session);
+	}
+
+	/* each operation is handled as a separate request */
+	if (msg->cmd == STORAGE_COMPOUND && !session->compound_result) {
+		return storage_compound(msg, payload, payload_len, session);
+	}
+
+	/* skip the rest of a streamed write after one of its parts failed */
+	if (msg->cmd == STORAGE_FILE_WRITE &&
+	    session->write_batch_result != STORAGE_NO_ERROR) {
+		if (msg->flags & STORAGE_MSG_FLAG_BATCH) {
+			return NO_ERROR;
+		}
+		result = session->write_batch_result;
+		session->write_batch_result = STORAGE_NO_ERROR;
+		return send_result(session, msg, result);
+	}
+
 	/* abort transaction and clear sticky transaction error */
 	if (msg->cmd == STORAGE_END_TRANSACTION) {
 		if (msg->flags & STORAGE_MSG_FLAG_TRANSACT_COMPLETE) {
 			/* try to complete current transaction */
 			if (transaction_is_active(&session->tr)) {
-				transaction_complete(&session->tr);
+				client_transaction_complete(session);
 			}
 			if (session->tr.failed) {
 				SS_ERR("%s: failed to complete transaction\n", __func__);
@@ -916,7 +1682,7 @@ int client_create_port(struct ipc_port_context *client_ctx,
 	/* start accepting client connections */
 	client_ctx->ops.on_connect = client_connect;
 	ret = ipc_port_create(client_ctx, port_name,
-	                      1, STORAGE_MAX_BUFFER_SIZE,
+	                      STORAGE_CLIENT_QUEUE_DEPTH, STORAGE_MAX_BUFFER_SIZE,
 	                      IPC_PORT_ALLOW_NS_CONNECT | IPC_PORT_ALLOW_TA_CONNECT);
 	if (ret < 0) {
 		SS_ERR("%s: failure initializing client port (%d)\n", __func__,
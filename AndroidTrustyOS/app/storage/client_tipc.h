@@ -16,5 +16,9 @@
 
 #include "ipc.h"
 
+struct fs;
+
 int client_create_port(struct ipc_port_context *client_ctx,
                        const char *port_name);
+void client_io_complete(void);
+void client_scrub_cancel(struct fs *fs);
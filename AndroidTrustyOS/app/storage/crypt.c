@@ -19,6 +19,7 @@
 #include <stdio.h>
 #include <string.h>
 
+#include <openssl/crypto.h>
 #include <openssl/evp.h>
 #include <openssl/hmac.h>
 #include <openssl/rand.h>
@@ -26,23 +27,111 @@
 #include "crypt.h"
 
 /**
- * crypt - Helper function for encrypt and decrypt.
+ * crypt_key_init - Initialize cipher and mac contexts for a key
+ * @key:            Key object with key data in @key->byte.
+ *
+ * Expand the key schedule and hmac pads once, so each block only needs to
+ * set the iv or rewind the hmac.
+ *
+ * Return: 0 on success, -1 if an error was detected.
+ */
+int crypt_key_init(struct key *key)
+{
+    int ret;
+    size_t key_len;
+    const EVP_CIPHER *cipher;
+
+    assert(!key->ctx_valid);
+
+    cipher = EVP_aes_128_ctr();
+    key_len = EVP_CIPHER_key_length(cipher);
+    if (key_len > sizeof(key->byte)) {
+        fprintf(stderr, "key too small for selected cipher, %zd < %zd\n",
+                sizeof(key->byte), key_len);
+        return -1;
+    }
+
+    EVP_CIPHER_CTX_init(&key->cipher_ctx);
+    HMAC_CTX_init(&key->hmac_ctx);
+    key->ctx_valid = true;
+
+    ret = EVP_CipherInit_ex(&key->cipher_ctx, cipher, NULL,
+                            key->byte, NULL, true);
+    if (!ret) {
+        fprintf(stderr, "EVP_CipherInit_ex failed\n");
+        goto err;
+    }
+
+    ret = EVP_CIPHER_CTX_set_padding(&key->cipher_ctx, 0);
+    if (!ret) {
+        fprintf(stderr, "EVP_CIPHER_CTX_set_padding failed\n");
+        goto err;
+    }
+
+    ret = HMAC_Init_ex(&key->hmac_ctx, key->byte, sizeof(key->byte),
+                       EVP_sha256(), NULL);
+    if (!ret) {
+        fprintf(stderr, "HMAC_Init_ex failed\n");
+        goto err;
+    }
+
+    return 0;
+
+err:
+    crypt_key_destroy(key);
+    return -1;
+}
+
+/**
+ * crypt_key_destroy - Free key contexts and wipe key data
+ * @key:            Key object.
+ *
+ * Call when @key is no longer in use, so no copy of it, expanded or not, is
+ * left in memory.
+ */
+void crypt_key_destroy(struct key *key)
+{
+    if (key->ctx_valid) {
+        EVP_CIPHER_CTX_cleanup(&key->cipher_ctx);
+        HMAC_CTX_cleanup(&key->hmac_ctx);
+    }
+    OPENSSL_cleanse(key->byte, sizeof(key->byte));
+    key->ctx_valid = false;
+}
+
+/**
+ * crypt_key_check - Check that a key has initialized contexts
+ * @key:            Key object.
+ *
+ * Return: %true if crypt_key_init succeeded for @key.
+ */
+static bool crypt_key_check(const struct key *key)
+{
+    if (!key->ctx_valid) {
+        fprintf(stderr, "key contexts not initialized\n");
+        return false;
+    }
+    return true;
+}
+
+/**
+ * crypt_ctx - Encrypt or decrypt data with the initialized key contexts.
  * @key:            Key object.
  * @data_in_out:    Data to encrypt or decrypt.
  * @data_size:      Number of bytes in @data_in_out.
  * @iv:             Initialization vector to use for Cipher Block Chaining.
- * @encrypt:        %true to select encrypt, %false to select decrypt.
+ *
+ * AES-CTR encryption and decryption are the same operation.
  *
  * Return: 0 on success, -1 if an error was detected.
  */
-static int crypt(const struct key *key, void *data_in_out, size_t data_size,
-                 const struct iv *iv, bool encrypt)
+static int crypt_ctx(const struct key *key, void *data_in_out,
+                     size_t data_size, const struct iv *iv)
 {
     int evp_ret;
-    const EVP_CIPHER *cipher;
-    EVP_CIPHER_CTX ctx;
     int out_data_size;
-    size_t key_len;
+    /* Only the iv and stream state change, the key schedule does not */
+    EVP_CIPHER_CTX *cipher_ctx = (EVP_CIPHER_CTX *)&key->cipher_ctx;
 
     /*
      * Make sure iv is large enough. Current implementation allows static
@@ -52,52 +141,95 @@ static int crypt(const struct key *key, void *data_in_out, size_t data_size,
      */
     STATIC_ASSERT(sizeof(*iv) >= EVP_MAX_IV_LENGTH);
 
-    cipher = EVP_aes_128_ctr();
-    key_len = EVP_CIPHER_key_length(cipher);
-    if (key_len > sizeof(*key)) {
-        fprintf(stderr, "key too small for selected cipher, %zd < %zd\n",
-                sizeof(*key), key_len);
-        evp_ret = 0;
-        goto err_bad_key_len;
-    }
-
-    EVP_CIPHER_CTX_init(&ctx);
-    evp_ret = EVP_CipherInit_ex(&ctx, cipher, NULL,
-                                key->byte, iv->byte, encrypt);
+    evp_ret = EVP_CipherInit_ex(cipher_ctx, NULL, NULL,
+                                NULL, iv->byte, -1);
     if (!evp_ret) {
         fprintf(stderr, "EVP_CipherInit_ex failed\n");
-        goto err;
+        return -1;
     }
 
-    evp_ret = EVP_CIPHER_CTX_set_padding(&ctx, 0);
-    if (!evp_ret) {
-        fprintf(stderr, "EVP_CIPHER_CTX_set_padding failed\n");
-        goto err;
-    }
-
-    evp_ret = EVP_CipherUpdate(&ctx, data_in_out, &out_data_size,
-                                data_in_out, data_size);
+    evp_ret = EVP_CipherUpdate(cipher_ctx, data_in_out, &out_data_size,
+                               data_in_out, data_size);
     if (!evp_ret) {
         fprintf(stderr, "EVP_CipherUpdate failed\n");
-        goto err;
+        return -1;
     }
     if (out_data_size != (int)data_size) {
         fprintf(stderr, "bad output data size %d != %zd\n",
                 out_data_size, data_size);
-        evp_ret = 0;
-        goto err;
+        return -1;
     }
 
-    evp_ret = EVP_CipherFinal_ex(&ctx, NULL, &out_data_size);
+    evp_ret = EVP_CipherFinal_ex(cipher_ctx, NULL, &out_data_size);
     if (!evp_ret) {
         fprintf(stderr, "EVP_CipherFinal_ex failed\n");
-        goto err;
+        return -1;
     }
 
-err:
-    EVP_CIPHER_CTX_cleanup(&ctx);
-err_bad_key_len:
-    return evp_ret ? 0 : -1;
+    return 0;
+}
+
+/**
+ * calculate_mac_ctx - Calulate HMAC SHA256 with the initialized key contexts.
+ * @key:            Key object.
+ * @mac:            Mac object to return calulated mac in.
+ * @data:           Data to calculate mac for.
+ * @data_size:      Number of bytes in @data.
+ *
+ * Return: 0 on success, -1 if an error was detected.
+ */
+static int calculate_mac_ctx(const struct key *key, struct mac *mac,
+                             const void *data, size_t data_size)
+{
+    int hmac_ret;
+    unsigned int md_len;
+    unsigned char mac_buf[EVP_MAX_MD_SIZE];
+    /* Only the hash state changes, the precomputed pads do not */
+    HMAC_CTX *hmac_ctx = (HMAC_CTX *)&key->hmac_ctx;
+
+    /* NULL key and md rewinds to the precomputed pads */
+    hmac_ret = HMAC_Init_ex(hmac_ctx, NULL, 0, NULL, NULL);
+    if (!hmac_ret) {
+        fprintf(stderr, "HMAC_Init_ex failed\n");
+        return -1;
+    }
+
+    hmac_ret = HMAC_Update(hmac_ctx, data, data_size);
+    if (!hmac_ret) {
+        fprintf(stderr, "HMAC_Update failed\n");
+        return -1;
+    }
+
+    hmac_ret = HMAC_Final(hmac_ctx, mac_buf, &md_len);
+    if (!hmac_ret) {
+        fprintf(stderr, "HMAC_Final failed\n");
+        return -1;
+    }
+    if (md_len < sizeof(*mac)) {
+        fprintf(stderr, "bad md_len %d < %zd\n", md_len, sizeof(*mac));
+        return -1;
+    }
+    memcpy(mac, mac_buf, sizeof(*mac));
+
+    return 0;
+}
+
+/**
+ * crypt - Helper function for encrypt and decrypt.
+ * @key:            Key object.
+ * @data_in_out:    Data to encrypt or decrypt.
+ * @data_size:      Number of bytes in @data_in_out.
+ * @iv:             Initialization vector to use for Cipher Block Chaining.
+ *
+ * Return: 0 on success, -1 if an error was detected.
+ */
+static int crypt(const struct key *key, void *data_in_out, size_t data_size,
+                 const struct iv *iv)
+{
+    if (!crypt_key_check(key)) {
+        return -1;
+    }
+    return crypt_ctx(key, data_in_out, data_size, iv);
 }
 
 /**
@@ -136,40 +268,10 @@ uint64_t str_hash(const char *str)
 int calculate_mac(const struct key *key, struct mac *mac,
                   const void *data, size_t data_size)
 {
-    int hmac_ret;
-    unsigned int md_len;
-    unsigned char mac_buf[EVP_MAX_MD_SIZE];
-    HMAC_CTX hmac_ctx;
-
-    HMAC_CTX_init(&hmac_ctx);
-
-    hmac_ret = HMAC_Init_ex(&hmac_ctx, key, sizeof(*key), EVP_sha256(), NULL);
-    if (!hmac_ret) {
-        fprintf(stderr, "HMAC_Init_ex failed\n");
-        goto err;
+    if (!crypt_key_check(key)) {
+        return -1;
     }
-
-    hmac_ret = HMAC_Update(&hmac_ctx, data, data_size);
-    if (!hmac_ret) {
-        fprintf(stderr, "HMAC_Update failed\n");
-        goto err;
-    }
-
-    hmac_ret = HMAC_Final(&hmac_ctx, mac_buf, &md_len);
-    if (!hmac_ret) {
-        fprintf(stderr, "HMAC_Final failed\n");
-        goto err;
-    }
-    if (md_len < sizeof(*mac)) {
-        fprintf(stderr, "bad md_len %d < %zd\n", md_len, sizeof(*mac));
-        hmac_ret = 0;
-        goto err;
-    }
-    memcpy(mac, mac_buf, sizeof(*mac));
-
-err:
-    HMAC_CTX_cleanup(&hmac_ctx);
-    return hmac_ret ? 0 : -1;
+    return calculate_mac_ctx(key, mac, data, data_size);
 }
 
 /**
@@ -202,7 +304,7 @@ int generate_iv(struct iv *iv_out)
 int encrypt(const struct key *key, void *data_in_out, size_t data_size,
             const struct iv *iv_in)
 {
-    return crypt(key, data_in_out, data_size, iv_in, true);
+    return crypt(key, data_in_out, data_size, iv_in);
 }
 
 /**
@@ -218,5 +320,5 @@ int encrypt(const struct key *key, void *data_in_out, size_t data_size,
 int decrypt(const struct key *key, void *data_in_out, size_t data_size,
             const struct iv *iv_in)
 {
-    return crypt(key, data_in_out, data_size, iv_in, false);
+    return crypt(key, data_in_out, data_size, iv_in);
 }
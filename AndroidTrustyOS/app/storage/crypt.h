@@ -16,12 +16,33 @@
 
 #pragma once
 
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+
 #define DEBUG_MAC_VALUES 0
 
+/**
+ * struct key - Key and the cipher and mac contexts expanded from it
+ * @byte:           Key data.
+ * @ctx_valid:      %true if @cipher_ctx and @hmac_ctx are initialized.
+ * @cipher_ctx:     AES-128-CTR context with expanded key schedule. Only the iv
+ *                  is set per block.
+ * @hmac_ctx:       HMAC-SHA256 context with precomputed inner and outer pads.
+ *                  Rewound per block.
+ *
+ * Fill in @byte, then call crypt_key_init before passing the key to any other
+ * function in this file. Call crypt_key_destroy when the key is no longer
+ * used.
+ */
 struct key {
     uint8_t byte[32];
+    bool ctx_valid;
+    EVP_CIPHER_CTX cipher_ctx;
+    HMAC_CTX hmac_ctx;
 };
 
 struct mac {
@@ -50,6 +71,10 @@ struct iv {
 
 uint64_t str_hash(const char *str);
 
+int crypt_key_init(struct key *key);
+
+void crypt_key_destroy(struct key *key);
+
 int calculate_mac(const struct key *key, struct mac *mac,
                   const void *data, size_t data_size);
 
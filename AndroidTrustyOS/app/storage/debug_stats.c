@@ -0,0 +1,195 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <assert.h>
+#include <compiler.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <trusty_std.h>
+
+#include "debug_stats.h"
+
+#if STORAGE_DEBUG_STATS
+
+static struct stats_timer stats_timers[STATS_TIMER_COUNT];
+
+static const char *stats_timer_names[STATS_TIMER_COUNT] = {
+    [STATS_CACHE_START_READ] = "cache_start_read",
+    [STATS_CACHE_START_WRITE] = "cache_start_write",
+    [STATS_FS_READ_BLOCK_CALC_MAC] = "read_block_calc_mac",
+    [STATS_FS_READ_BLOCK_DECRYPT] = "read_block_decrypt",
+    [STATS_FS_WRITE_BLOCK_ENCRYPT] = "write_block_encrypt",
+    [STATS_FS_WRITE_BLOCK_CALC_MAC] = "write_block_calc_mac",
+    [STATS_CACHE_LOOKUP] = "cache_lookup",
+    [STATS_CACHE_LOOKUP_FOUND] = "cache_lookup_found",
+    [STATS_CACHE_LOOKUP_CLEAN] = "cache_lookup_clean",
+    [STATS_CACHE_CLEAN_TRANSACTION] = "clean_tr",
+    [STATS_CACHE_CLEAN_TRANSACTION_ENT_CLN] = "clean_tr_entry",
+    [STATS_CACHE_CLEAN_TRANSACTION_WAIT_IO] = "clean_tr_wait_io",
+    [STATS_TR_COMPLETE] = "tr_complete",
+    [STATS_TR_COMPLETE_FILES] = "tr_complete_files",
+    [STATS_TR_COMPLETE_FREE] = "tr_complete_free",
+    [STATS_TR_COMPLETE_SUPER] = "tr_complete_super",
+};
+
+/**
+ * stats_timer_now - Get current time from the secure timer
+ *
+ * Return: Current time in ns.
+ */
+static int64_t stats_timer_now(void)
+{
+    int64_t time = 0;
+
+    gettime(0, 0, &time);
+    return time;
+}
+
+/**
+ * stats_timer_hist_bucket - Get histogram bucket for a sample
+ * @ns:         Sample in ns.
+ *
+ * Return: floor(log2(@ns)) clamped to a valid bucket index.
+ */
+static unsigned int stats_timer_hist_bucket(uint64_t ns)
+{
+    unsigned int bucket;
+
+    if (!ns) {
+        return 0;
+    }
+    bucket = 63 - __builtin_clzll(ns);
+    if (bucket >= STATS_TIMER_HIST_BUCKETS) {
+        bucket = STATS_TIMER_HIST_BUCKETS - 1;
+    }
+    return bucket;
+}
+
+/**
+ * stats_timer_start - Start timing a probe point
+ * @id:         Probe point.
+ */
+void stats_timer_start(enum stats_timer_id id)
+{
+    assert(id < STATS_TIMER_COUNT);
+    stats_timers[id].start = stats_timer_now();
+}
+
+/**
+ * stats_timer_stop - Stop timing a probe point and record the sample
+ * @id:         Probe point.
+ *
+ * Does nothing if stats_timer_start was not called for @id since the last
+ * stop or reset.
+ */
+void stats_timer_stop(enum stats_timer_id id)
+{
+    struct stats_timer *timer;
+    int64_t now = stats_timer_now();
+    uint64_t ns;
+
+    assert(id < STATS_TIMER_COUNT);
+    timer = &stats_timers[id];
+    if (!timer->start) {
+        return;
+    }
+    ns = now > timer->start ? now - timer->start : 0;
+    timer->start = 0;
+
+    if (!timer->count || ns < timer->min) {
+        timer->min = ns;
+    }
+    if (ns > timer->max) {
+        timer->max = ns;
+    }
+    timer->count++;
+    timer->total += ns;
+    timer->hist[stats_timer_hist_bucket(ns)]++;
+}
+
+/**
+ * stats_timer_get - Get accumulated samples for a probe point
+ * @id:         Probe point.
+ *
+ * Return: Timer for @id, or %NULL if @id is not valid.
+ */
+const struct stats_timer *stats_timer_get(enum stats_timer_id id)
+{
+    if (id >= STATS_TIMER_COUNT) {
+        return NULL;
+    }
+    return &stats_timers[id];
+}
+
+/**
+ * stats_timer_name - Get name of a probe point
+ * @id:         Probe point.
+ *
+ * Return: Name of @id, or %NULL if @id is not valid.
+ */
+const char *stats_timer_name(enum stats_timer_id id)
+{
+    if (id >= STATS_TIMER_COUNT) {
+        return NULL;
+    }
+    return stats_timer_names[id];
+}
+
+/**
+ * stats_timer_reset - Discard all samples
+ *
+ * Samples in progress are discarded as well.
+ */
+void stats_timer_reset(void)
+{
+    memset(stats_timers, 0, sizeof(stats_timers));
+}
+
+/**
+ * stats_timer_print - Print all probe points that have samples
+ */
+void stats_timer_print(void)
+{
+    unsigned int i;
+    unsigned int j;
+    const struct stats_timer *timer;
+
+    printf("%-22s %10s %12s %10s %10s %10s\n",
+           "timer", "count", "total us", "avg us", "min us", "max us");
+    for (i = 0; i < countof(stats_timers); i++) {
+        timer = &stats_timers[i];
+        if (!timer->count) {
+            continue;
+        }
+        printf("%-22s %10llu %12llu %10llu %10llu %10llu\n",
+               stats_timer_names[i],
+               (unsigned long long)timer->count,
+               (unsigned long long)timer->total / 1000,
+               (unsigned long long)(timer->total / timer->count) / 1000,
+               (unsigned long long)timer->min / 1000,
+               (unsigned long long)timer->max / 1000);
+        printf("  log2(ns) hist:");
+        for (j = 0; j < countof(timer->hist); j++) {
+            if (timer->hist[j]) {
+                printf(" [%u: %u]", j, timer->hist[j]);
+            }
+        }
+        printf("\n");
+    }
+}
+
+#endif
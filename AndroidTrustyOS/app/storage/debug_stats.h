@@ -16,8 +16,75 @@
 
 #pragma once
 
+#include <stdint.h>
+
+/*
+ * Probe points cost two clock reads each, some of them on hot paths like the
+ * block cache lookup, and the samples can be read and reset by clients. Only
+ * build them in when APP_STORAGE_DEBUG_STATS is set, and in host tests.
+ */
+#if APP_STORAGE_DEBUG_STATS || BUILD_STORAGE_TEST
+#define STORAGE_DEBUG_STATS 1
+#else
+#define STORAGE_DEBUG_STATS 0
+#endif
+
+/**
+ * enum stats_timer_id - Probe points timed by stats_timer_start/stop
+ */
+enum stats_timer_id {
+    STATS_CACHE_START_READ,
+    STATS_CACHE_START_WRITE,
+    STATS_FS_READ_BLOCK_CALC_MAC,
+    STATS_FS_READ_BLOCK_DECRYPT,
+    STATS_FS_WRITE_BLOCK_ENCRYPT,
+    STATS_FS_WRITE_BLOCK_CALC_MAC,
+    STATS_CACHE_LOOKUP,
+    STATS_CACHE_LOOKUP_FOUND,
+    STATS_CACHE_LOOKUP_CLEAN,
+    STATS_CACHE_CLEAN_TRANSACTION,
+    STATS_CACHE_CLEAN_TRANSACTION_ENT_CLN,
+    STATS_CACHE_CLEAN_TRANSACTION_WAIT_IO,
+    STATS_TR_COMPLETE,
+    STATS_TR_COMPLETE_FILES,
+    STATS_TR_COMPLETE_FREE,
+    STATS_TR_COMPLETE_SUPER,
+    STATS_TIMER_COUNT,
+};
+
+/* log2 buckets, bucket n counts samples in [2^n, 2^(n+1)) ns */
+#define STATS_TIMER_HIST_BUCKETS (32)
+
+/**
+ * struct stats_timer - Accumulated samples for one probe point
+ * @count:      Number of samples.
+ * @total:      Sum of all samples in ns.
+ * @min:        Shortest sample in ns.
+ * @max:        Longest sample in ns.
+ * @hist:       Log2 histogram of samples. Bucket 0 also counts 0 ns samples,
+ *              and the last bucket also counts longer samples.
+ * @start:      Start time of sample in progress, 0 if none.
+ */
+struct stats_timer {
+    uint64_t count;
+    uint64_t total;
+    uint64_t min;
+    uint64_t max;
+    uint32_t hist[STATS_TIMER_HIST_BUCKETS];
+    int64_t start;
+};
+
+#if STORAGE_DEBUG_STATS
+void stats_timer_start(enum stats_timer_id id);
+void stats_timer_stop(enum stats_timer_id id);
+const struct stats_timer *stats_timer_get(enum stats_timer_id id);
+const char *stats_timer_name(enum stats_timer_id id);
+void stats_timer_reset(void);
+void stats_timer_print(void);
+#else
 #define stats_timer_start(counter) do {} while(0)
 #define stats_timer_stop(counter) do {} while(0)
 
 static inline void stats_timer_reset(void) {}
 static inline void stats_timer_print(void) {}
+#endif
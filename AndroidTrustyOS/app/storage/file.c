@@ -15,9 +15,11 @@
  */
 
 #include <assert.h>
+#include <compiler.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "block_allocator.h"
@@ -32,6 +34,14 @@
 
 #define FILE_ENTRY_MAGIC (0x0066797473757274) /* trustyf\0 */
 
+/*
+ * Read-ahead window in file blocks. The window starts at
+ * FILE_READ_AHEAD_MIN_BLOCKS when sequential access is detected and doubles
+ * on every sequential read that reaches the end of the previous window.
+ */
+#define FILE_READ_AHEAD_MIN_BLOCKS (2)
+#define FILE_READ_AHEAD_MAX_BLOCKS (16)
+
 /**
  * struct file_entry - On-disk file entry
  * @iv:         initial value used for encrypt/decrypt
@@ -77,6 +87,139 @@ static data_block_t path_hash(struct transaction *tr, const char *path)
     return hash;
 }
 
+/**
+ * file_cache_clear - Remove all entries from file cache
+ * @cache:      File cache object.
+ */
+void file_cache_clear(struct file_cache *cache)
+{
+    memset(cache, 0, sizeof(*cache));
+}
+
+/**
+ * file_cache_find - Find cache entry for a path
+ * @tr:         Transaction object.
+ * @path:       File path string.
+ *
+ * Return: Cache entry matching @path, or %NULL if @path is not cached.
+ */
+static struct file_cache_entry *file_cache_find(struct transaction *tr,
+                                                const char *path)
+{
+    struct file_cache *cache = &tr->fs->file_cache;
+    struct file_cache_entry *entry;
+
+    for (entry = cache->entries;
+         entry < cache->entries + countof(cache->entries); entry++) {
+        if (block_mac_valid(tr, &entry->block_mac) &&
+            !strcmp(entry->path, path)) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * file_cache_insert - Add or replace file cache entry
+ * @tr:         Transaction object.
+ * @path:       File path string.
+ * @block_mac:  Block and mac of file entry for @path in @tr->fs->files.
+ *
+ * Replaces the least recently used entry if @path is not already cached.
+ */
+static void file_cache_insert(struct transaction *tr, const char *path,
+                              const struct block_mac *block_mac)
+{
+    struct file_cache *cache = &tr->fs->file_cache;
+    struct file_cache_entry *entry;
+    struct file_cache_entry *lru_entry;
+
+    assert(strlen(path) < sizeof(entry->path));
+
+    entry = file_cache_find(tr, path);
+    if (!entry) {
+        entry = cache->entries;
+        for (lru_entry = cache->entries;
+             lru_entry < cache->entries + countof(cache->entries);
+             lru_entry++) {
+            if (!block_mac_valid(tr, &lru_entry->block_mac)) {
+                entry = lru_entry;
+                break;
+            }
+            if (lru_entry->last_used < entry->last_used) {
+                entry = lru_entry;
+            }
+        }
+        strcpy(entry->path, path);
+    }
+    entry->block_mac = *block_mac;
+    entry->last_used = ++cache->clock;
+}
+
+/**
+ * file_cache_update - Update or remove file cache entries for a block
+ * @tr:         Transaction object.
+ * @old_block:  Block number of file entry that was replaced or removed.
+ * @new:        Block and mac of new file entry, or %NULL if file was removed.
+ */
+static void file_cache_update(struct transaction *tr, data_block_t old_block,
+                              const struct block_mac *new)
+{
+    struct file_cache *cache = &tr->fs->file_cache;
+    struct file_cache_entry *entry;
+
+    for (entry = cache->entries;
+         entry < cache->entries + countof(cache->entries); entry++) {
+        if (!block_mac_valid(tr, &entry->block_mac) ||
+            block_mac_to_block(tr, &entry->block_mac) != old_block) {
+            continue;
+        }
+        if (new) {
+            entry->block_mac = *new;
+        } else {
+            memset(entry, 0, sizeof(*entry));
+        }
+    }
+}
+
+/**
+ * file_lookup_committed - Search for a file in @tr->fs->files
+ * @block_mac_out:  Block-mac object to return block number and mac in.
+ * @tr:             Transaction object.
+ * @tree_path:      Tree path object. Not updated if @file_path is cached.
+ * @file_path:      File path string.
+ *
+ * Check file cache before searching @tr->fs->files, and add @file_path to
+ * the cache if it was found in the tree.
+ *
+ * Return: %true if @file_path was found in @tr->fs->files, %false otherwise.
+ */
+static bool file_lookup_committed(struct block_mac *block_mac_out,
+                                  struct transaction *tr,
+                                  struct block_tree_path *tree_path,
+                                  const char *file_path)
+{
+    bool found;
+    struct file_cache *cache = &tr->fs->file_cache;
+    struct file_cache_entry *entry;
+
+    entry = file_cache_find(tr, file_path);
+    if (entry) {
+        pr_read("file %s, %lld, found in file cache\n",
+                file_path, block_mac_to_block(tr, &entry->block_mac));
+        entry->last_used = ++cache->clock;
+        *block_mac_out = entry->block_mac;
+        return true;
+    }
+
+    found = file_tree_lookup(block_mac_out, tr, &tr->fs->files, tree_path,
+                             file_path, false);
+    if (found) {
+        file_cache_insert(tr, file_path, block_mac_out);
+    }
+    return found;
+}
+
 /**
  * file_block_map_init - Initialize in-memory block map state from file entry
  * @tr:         Transaction object.
@@ -163,6 +306,74 @@ void files_print(struct transaction *tr)
     }
 }
 
+/**
+ * file_extent_clear - Discard cached block map extent
+ * @file:       File handle object.
+ */
+static void file_extent_clear(struct file_handle *file)
+{
+    file->extent_count = 0;
+}
+
+/**
+ * file_extent_get - Lookup a file block in the cached block map extent
+ * @tr:         Transaction object.
+ * @file:       File handle object.
+ * @file_block: File block number. 0 based.
+ * @block_mac:  Pointer to return block_mac in.
+ *
+ * The cached extent is only used if @file still points to the same file
+ * entry as when it was loaded. Changes to the block map through @file clear
+ * it, and all other changes to the block map also change the file entry.
+ *
+ * Return: %true if @file_block is in the cached extent, %false otherwise.
+ */
+static bool file_extent_get(struct transaction *tr,
+                            struct file_handle *file,
+                            data_block_t file_block,
+                            struct block_mac *block_mac)
+{
+    if (!file->extent_count ||
+        file_block < file->extent_start ||
+        file_block - file->extent_start >= file->extent_count ||
+        !block_mac_eq(tr, &file->extent_file, &file->block_mac)) {
+        return false;
+    }
+    *block_mac = file->extent[file_block - file->extent_start];
+    return true;
+}
+
+/**
+ * file_extent_load - Load block map extent starting at a file block
+ * @tr:         Transaction object.
+ * @file:       File handle object.
+ * @block_map:  Block map object for @file.
+ * @file_block: File block number. 0 based.
+ * @block_mac:  Pointer to return block_mac in.
+ *
+ * Cache the block_macs of @file_block and the consecutive file blocks that
+ * follow it, so they can be found without walking the block map again.
+ *
+ * Return: %true if @file_block has a block_mac, %false otherwise.
+ */
+static bool file_extent_load(struct transaction *tr,
+                             struct file_handle *file,
+                             struct block_map *block_map,
+                             data_block_t file_block,
+                             struct block_mac *block_mac)
+{
+    file->extent_count = block_map_get_range(tr, block_map, file_block,
+                                             countof(file->extent),
+                                             file->extent);
+    file->extent_start = file_block;
+    file->extent_file = file->block_mac;
+    if (!file->extent_count) {
+        return false;
+    }
+    *block_mac = file->extent[0];
+    return true;
+}
+
 /**
  * file_block_map_update - Update file entry with block_map or size changes
  * @tr:         Transaction object.
@@ -186,6 +397,8 @@ static void file_block_map_update(struct transaction *tr,
     obj_ref_t *file_entry_ref = &file_entry_old_ref;
     struct block_tree_path tree_path;
 
+    file_extent_clear(file);
+
     if (tr->failed) {
         pr_warn("transaction failed, abort\n");
         return;
@@ -203,8 +416,8 @@ static void file_block_map_update(struct transaction *tr,
     found = file_tree_lookup(&block_mac, tr, &tr->files_added, &tree_path,
                              file_entry_ro->path, false);
     if (!found) {
-        found = file_tree_lookup(&block_mac, tr, &tr->fs->files, &tree_path,
-                                 file_entry_ro->path, false);
+        found = file_lookup_committed(&block_mac, tr, &tree_path,
+                                      file_entry_ro->path);
         if (tr->failed) {
             pr_warn("transaction failed, abort\n");
             goto err;
@@ -292,6 +505,228 @@ err:
     }
 }
 
+/**
+ * file_dirty_find - Find a block written since the block map was updated
+ * @file:       File handle object.
+ * @file_block: File block number. 0 based.
+ *
+ * Return: Entry for @file_block in @file->dirty, or %NULL if not found.
+ */
+static struct file_dirty_block *file_dirty_find(struct file_handle *file,
+                                                data_block_t file_block)
+{
+    uint i;
+
+    for (i = 0; i < file->dirty_count; i++) {
+        if (file->dirty[i].file_block == file_block) {
+            return &file->dirty[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * file_dirty_add - Add a written block to @file->dirty
+ * @tr:         Transaction object.
+ * @file:       File handle object.
+ * @file_block: File block number. 0 based.
+ * @block_mac:  Block that @file_block is written to.
+ * @tmp:        @block_mac is a tmp block that file_dirty_flush should replace.
+ *
+ * Caller must make sure @file->dirty is not full.
+ */
+static void file_dirty_add(struct transaction *tr,
+                           struct file_handle *file,
+                           data_block_t file_block,
+                           const struct block_mac *block_mac,
+                           bool tmp)
+{
+    uint i;
+
+    assert(file->dirty_count < countof(file->dirty));
+    assert(!file->dirty_tr || file->dirty_tr == tr);
+
+    file->dirty_tr = tr;
+    for (i = file->dirty_count;
+         i > 0 && file->dirty[i - 1].file_block > file_block; i--) {
+        file->dirty[i] = file->dirty[i - 1];
+    }
+    file->dirty[i].file_block = file_block;
+    file->dirty[i].block_mac = *block_mac;
+    file->dirty[i].tmp = tmp;
+    file->dirty_count++;
+}
+
+/**
+ * file_dirty_clear - Clear deferred block map and size changes
+ * @file:       File handle object.
+ */
+static void file_dirty_clear(struct file_handle *file)
+{
+    file->dirty_tr = NULL;
+    file->dirty_size = false;
+    file->dirty_count = 0;
+}
+
+/**
+ * file_prev_disk_block - Get disk block of the file block before @file_block
+ * @tr:         Transaction object.
+ * @file:       File handle object.
+ * @file_block: File block number. 0 based.
+ *
+ * Used to place new data blocks right after the previous file block, so block
+ * maps can store them as extents. Must be called in file block order while
+ * file_dirty_flush replaces tmp blocks, so a tmp block is not returned.
+ *
+ * Return: Disk block of @file_block - 1, or 0 if it is not known.
+ */
+static data_block_t file_prev_disk_block(struct transaction *tr,
+                                         struct file_handle *file,
+                                         data_block_t file_block)
+{
+    struct file_dirty_block *dirty_block;
+    struct block_map block_map;
+    struct block_mac block_mac;
+
+    if (!file_block) {
+        return 0;
+    }
+    dirty_block = file_dirty_find(file, file_block - 1);
+    if (dirty_block) {
+        return block_mac_to_block(tr, &dirty_block->block_mac);
+    }
+    file_block_map_init(tr, &block_map, &file->block_mac);
+    if (tr->failed ||
+        !block_map_get(tr, &block_map, file_block - 1, &block_mac)) {
+        return 0;
+    }
+    return block_mac_to_block(tr, &block_mac);
+}
+
+/**
+ * file_dirty_allocate - Allocate the block a tmp dirty block is stored in
+ * @tr:             Transaction object.
+ * @file:           File handle object.
+ * @dirty_block:    Entry in @file->dirty that points to a tmp block.
+ *
+ * Allocate a new block, after the disk block of the previous file block if
+ * possible, and move the data from the tmp block to it.
+ */
+static void file_dirty_allocate(struct transaction *tr,
+                                struct file_handle *file,
+                                struct file_dirty_block *dirty_block)
+{
+    data_block_t tmp_block = block_mac_to_block(tr, &dirty_block->block_mac);
+    data_block_t new_block;
+    const void *data;
+    void *data_rw;
+    obj_ref_t ref = OBJ_REF_INITIAL_VALUE(ref);
+    obj_ref_t copy_ref = OBJ_REF_INITIAL_VALUE(copy_ref);
+
+    assert(dirty_block->tmp);
+
+    if (tr->fs->block_map_extents) {
+        new_block = block_allocate_next(tr, file_prev_disk_block(tr, file,
+                                                                 dirty_block->file_block));
+    } else {
+        new_block = block_allocate(tr);
+    }
+    if (tr->failed) {
+        pr_warn("transaction failed, abort\n");
+        return;
+    }
+    assert(new_block);
+
+    pr_write("file block %lld: tmp block %lld -> %lld\n",
+             dirty_block->file_block, tmp_block, new_block);
+
+    if (block_move_dirty(tr, tmp_block, new_block, false)) {
+        block_mac_set_block(tr, &dirty_block->block_mac, new_block);
+    } else {
+        /* tmp block was written back, copy it */
+        data = block_get(tr, &dirty_block->block_mac, NULL, &ref);
+        if (!data) {
+            pr_warn("transaction failed, abort\n");
+            return;
+        }
+        data_rw = block_get_copy(tr, data, new_block, false, &copy_ref);
+        block_discard_dirty(data);
+        block_put(data, &ref);
+        if (tr->failed) {
+            block_put_dirty_discard(data_rw, &copy_ref);
+            return;
+        }
+        block_mac_set_block(tr, &dirty_block->block_mac, new_block);
+        block_put_dirty(tr, data_rw, &copy_ref, &dirty_block->block_mac, NULL);
+    }
+    dirty_block->tmp = false;
+    block_free_tmp(tr, tmp_block);
+}
+
+/**
+ * file_dirty_flush - Apply deferred block allocations, block map and size
+ * changes
+ * @tr:         Transaction object.
+ * @file:       File handle object.
+ *
+ * Allocate the blocks that new data in @file->dirty is stored in, in file
+ * block order, so consecutive file blocks get consecutive disk blocks when
+ * possible. Then store them in the block map in the same order, so blocks that
+ * continue a run of disk blocks are added to the extent before them, and
+ * update the file entry once for all of them.
+ */
+static void file_dirty_flush(struct transaction *tr, struct file_handle *file)
+{
+    uint i;
+    struct block_map block_map;
+
+    if (!file->dirty_tr) {
+        return;
+    }
+    assert(file->dirty_tr == tr);
+
+    if (tr->failed) {
+        pr_warn("transaction failed, ignore\n");
+        file_dirty_clear(file);
+        return;
+    }
+
+    for (i = 0; i < file->dirty_count && !tr->failed; i++) {
+        if (file->dirty[i].tmp) {
+            file_dirty_allocate(tr, file, &file->dirty[i]);
+        }
+    }
+    file_block_map_init(tr, &block_map, &file->block_mac);
+    for (i = 0; i < file->dirty_count && !tr->failed; i++) {
+        block_map_set(tr, &block_map, file->dirty[i].file_block,
+                      &file->dirty[i].block_mac);
+    }
+    file_dirty_clear(file);
+    file_block_map_update(tr, &block_map, file);
+}
+
+/**
+ * file_dirty_flush_all - Apply deferred changes to all files open in @tr
+ * @tr:         Transaction object.
+ */
+static void file_dirty_flush_all(struct transaction *tr)
+{
+    struct file_handle *file;
+    bool flushed;
+
+    /* file_block_map_update moves @file to the head of @tr->open_files */
+    do {
+        flushed = false;
+        list_for_every_entry(&tr->open_files, file, struct file_handle, node) {
+            if (file->dirty_tr) {
+                file_dirty_flush(tr, file);
+                flushed = true;
+                break;
+            }
+        }
+    } while (flushed && !tr->failed);
+}
+
 /**
  * get_file_block_size - Get file data block size
  * @fs:         File system state object.
@@ -327,24 +762,47 @@ static const void *file_get_block_etc(struct transaction *tr,
     const void *data = NULL;
     struct block_map block_map;
     struct block_mac block_mac;
+    struct file_dirty_block *dirty_block;
     data_block_t old_disk_block;
     data_block_t new_block;
     bool dirty = false;
+    bool tmp = false;
 
     if (tr->failed) {
         pr_warn("transaction failed, ignore\n");
         goto err;
     }
 
-    file_block_map_init(tr, &block_map, &file->block_mac);
-    if (tr->failed) {
-        pr_warn("transaction failed, abort\n");
-        goto err;
+    dirty_block = file_dirty_find(file, file_block);
+    if (dirty_block) {
+        block_mac = dirty_block->block_mac;
+        found = true;
+    } else if (write && file->dirty_count == countof(file->dirty)) {
+        file_dirty_flush(tr, file);
+        if (tr->failed) {
+            pr_warn("transaction failed, abort\n");
+            goto err;
+        }
+    }
+    if (!found && !write) {
+        found = file_extent_get(tr, file, file_block, &block_mac);
+    }
+    if (!found) {
+        file_block_map_init(tr, &block_map, &file->block_mac);
+        if (tr->failed) {
+            pr_warn("transaction failed, abort\n");
+            goto err;
+        }
+        if (write) {
+            found = block_map_get(tr, &block_map, file_block, &block_mac);
+        } else {
+            found = file_extent_load(tr, file, &block_map, file_block,
+                                     &block_mac);
+        }
     }
 
     file->used_by_tr = true;
 
-    found = block_map_get(tr, &block_map, file_block, &block_mac);
     if (found) {
         if (read) {
             data = block_get(tr, &block_mac, NULL, ref); /* TODO: pass iv? */
@@ -354,9 +812,17 @@ static const void *file_get_block_etc(struct transaction *tr,
         /* TODO: handle mac mismatch better */
     }
 
+    /*
+     * New data goes to a tmp block. The block it is stored in is allocated by
+     * file_dirty_flush, once per transaction and in file block order.
+     */
     old_disk_block = found ? block_mac_to_block(tr, &block_mac) : 0;
-    if (write && (!found || transaction_block_need_copy(tr, old_disk_block))) {
-        new_block = block_allocate(tr);
+    if (dirty_block) {
+        tmp = dirty_block->tmp;
+    } else if (write && (!found ||
+                         transaction_block_need_copy(tr, old_disk_block))) {
+        tmp = true;
+        new_block = block_allocate_tmp(tr);
         if (tr->failed) {
             pr_warn("transaction failed, abort\n");
             goto err;
@@ -365,14 +831,14 @@ static const void *file_get_block_etc(struct transaction *tr,
         block_mac_set_block(tr, &block_mac, new_block);
 
         if (found) {
-            data = block_move(tr, data, new_block, false);
+            data = block_move(tr, data, new_block, true);
             dirty = true;
             assert(!tr->failed);
             block_free(tr, old_disk_block);
         } else {
             if (read) {
                 assert(write);
-                data = block_get_cleared(tr, new_block, false, ref);
+                data = block_get_cleared(tr, new_block, true, ref);
                 dirty = true;
             } else {
                 data = block_get_no_read(tr, new_block, ref);
@@ -382,17 +848,13 @@ static const void *file_get_block_etc(struct transaction *tr,
             pr_warn("transaction failed, abort\n");
             goto err;
         }
-        /* TODO: get new mac */
-        assert(!tr->failed);
-        block_map_set(tr, &block_map, file_block, &block_mac);
-        file_block_map_update(tr, &block_map, file);
-        if (tr->failed) {
-            pr_warn("transaction failed, abort\n");
-            goto err;
-        }
+    }
+    if (write && !dirty_block && !tr->failed) {
+        /* block map is updated by file_dirty_flush */
+        file_dirty_add(tr, file, file_block, &block_mac, tmp);
     }
     if (write && !dirty) {
-        data = block_dirty(tr, data, false);
+        data = block_dirty(tr, data, tmp);
     }
     if (!data) {
         return NULL;
@@ -459,20 +921,131 @@ void file_block_put(const void *data, obj_ref_t *data_ref)
  * @data_ref:   Reference pointer to release
  *
  * Release reference to a file block previously returned by
- * file_get_block_write, and update mac value in block_mac.
+ * file_get_block_write, and save the new mac in @file->dirty. The block map
+ * is not updated until the transaction completes or @file->dirty is full.
  */
 void file_block_put_dirty(struct transaction *tr,
                           struct file_handle *file, data_block_t file_block,
                           void *data, obj_ref_t *data_ref)
 {
+    struct file_dirty_block *dirty_block = file_dirty_find(file, file_block);
+
+    if (tr->failed || !dirty_block) {
+        pr_warn("transaction failed, discard block\n");
+        block_put_dirty_discard(data - sizeof(struct iv), data_ref);
+        return;
+    }
+
+    block_put_dirty(tr, data - sizeof(struct iv), data_ref,
+                    &dirty_block->block_mac, NULL);
+}
+
+/**
+ * file_read_ahead_queue - Queue reads for file_read_ahead
+ * @tr:         Transaction object.
+ * @file:       File handle object.
+ * @file_block: First file block that will be read. 0 based.
+ * @count:      Number of file blocks that will be read.
+ *
+ * Return: %true if reads may have been queued, %false otherwise.
+ */
+static bool file_read_ahead_queue(struct transaction *tr,
+                                  struct file_handle *file,
+                                  data_block_t file_block, data_block_t count)
+{
+    bool found;
+    data_block_t end = file_block + count;
+    data_block_t block;
+    data_block_t prefetch_end;
+    data_block_t file_block_count;
     struct block_map block_map;
+    struct block_mac block_mac;
+
+    if (tr->failed || !count) {
+        return false;
+    }
+
+    if (file_block == file->ra_next && file_block) {
+        if (end > file->ra_end) {
+            file->ra_window = file->ra_window ?
+                              MIN(file->ra_window * 2,
+                                  FILE_READ_AHEAD_MAX_BLOCKS) :
+                              FILE_READ_AHEAD_MIN_BLOCKS;
+        }
+    } else {
+        file->ra_window = 0;
+        file->ra_end = 0;
+    }
+    file->ra_next = end;
+
+    if (end <= file->ra_end) {
+        return false;
+    }
+
+    file_block_count = DIV_ROUND_UP(file->size, get_file_block_size(tr->fs));
+    prefetch_end = MIN(end + file->ra_window, file_block_count);
+    block = MAX(file_block, file->ra_end);
+    if (block >= prefetch_end) {
+        return false;
+    }
 
     file_block_map_init(tr, &block_map, &file->block_mac);
+    for (; block < prefetch_end && !tr->failed; block++) {
+        if (file_dirty_find(file, block)) {
+            continue; /* written by @tr, already in the block cache */
+        }
+        found = file_extent_get(tr, file, block, &block_mac) ||
+                file_extent_load(tr, file, &block_map, block, &block_mac);
+        if (found) {
+            block_prefetch(tr, &block_mac);
+        }
+    }
+    file->ra_end = prefetch_end;
+    return true;
+}
 
-    block_map_put_dirty(tr, &block_map, file_block,
-                        data - sizeof(struct iv), data_ref);
+/**
+ * file_read_ahead - Prepare file for read and start read-ahead
+ * @tr:         Transaction object.
+ * @file:       File handle object.
+ * @file_block: First file block that will be read. 0 based.
+ * @count:      Number of file blocks that will be read.
+ *
+ * Start reading all blocks in the requested range that are not already cached
+ * and, if @file is being read sequentially, the blocks following it. The read
+ * operations are queued together and this function waits for all of them to
+ * complete, so a block device that supports batched operations can handle
+ * them with a single request. The read-ahead window grows while access stays
+ * sequential and is reset on any other access.
+ */
+void file_read_ahead(struct transaction *tr, struct file_handle *file,
+                     data_block_t file_block, data_block_t count)
+{
+    if (file_read_ahead_queue(tr, file, file_block, count)) {
+        block_prefetch_wait(tr);
+    }
+}
 
-    file_block_map_update(tr, &block_map, file);
+/**
+ * file_read_ahead_async - Prepare file for read without waiting for io
+ * @tr:         Transaction object.
+ * @file:       File handle object.
+ * @file_block: First file block that will be read. 0 based.
+ * @count:      Number of file blocks that will be read.
+ *
+ * Same as file_read_ahead, but if the block device can complete the reads
+ * later, return without waiting for them.
+ *
+ * Return: %true if reads are still in progress, %false if the blocks can be
+ * read without waiting for the block device.
+ */
+bool file_read_ahead_async(struct transaction *tr, struct file_handle *file,
+                           data_block_t file_block, data_block_t count)
+{
+    if (!file_read_ahead_queue(tr, file, file_block, count)) {
+        return false;
+    }
+    return block_prefetch_submit(tr);
 }
 
 /**
@@ -511,7 +1084,8 @@ bool file_get_size(struct transaction *tr,
  * @size:       New file size.
  *
  * Set file size and free blocks that are not longer needed. Does not clear any
- * partial block data.
+ * partial block data. If @file has blocks that are waiting for a block map
+ * update, growing the file is deferred until the block map is updated.
  */
 void file_set_size(struct transaction *tr,
                    struct file_handle *file,
@@ -526,6 +1100,16 @@ void file_set_size(struct transaction *tr,
         return;
     }
 
+    if (size > file->size && file->dirty_count) {
+        /* file entry is updated with the written blocks by file_dirty_flush */
+        file->size = size;
+        file->dirty_size = true;
+        return;
+    }
+    if (size < file->size) {
+        file_dirty_flush(tr, file);
+    }
+
     file_block_map_init(tr, &block_map, &file->block_mac);
     if (tr->failed) {
         pr_warn("transaction failed, abort\n");
@@ -561,7 +1145,7 @@ static bool file_tree_lookup(struct block_mac *block_mac_out,
                              bool remove)
 {
     struct block_mac block_mac;
-    data_block_t hash = path_hash(tr, file_path);
+    data_block_t hash;
     const struct file_entry *file_entry;
     obj_ref_t file_entry_ref = OBJ_REF_INITIAL_VALUE(file_entry_ref);
     bool found = false;
@@ -569,6 +1153,12 @@ static bool file_tree_lookup(struct block_mac *block_mac_out,
     assert(strlen(file_path) < sizeof(file_entry->path));
     assert(sizeof(*file_entry) <= tr->fs->dev->block_size);
 
+    if (!block_mac_valid(tr, &tree->root)) {
+        /* empty tree, e.g. @tr->files_added, skip hash */
+        return false;
+    }
+
+    hash = path_hash(tr, file_path);
     block_tree_walk(tr, tree, hash - 1, false, tree_path);
     while (block_tree_path_get_key(tree_path) && block_tree_path_get_key(tree_path) < hash) {
         block_tree_path_next(tree_path);
@@ -719,8 +1309,7 @@ static bool file_lookup_not_removed(struct block_mac *block_mac_out,
     bool found;
     struct block_mac block_mac;
 
-    found = file_tree_lookup(&block_mac, tr, &tr->fs->files, tree_path,
-                             file_path, false);
+    found = file_lookup_committed(&block_mac, tr, tree_path, file_path);
     if (!found || file_is_removed(tr, block_mac_to_block(tr, &block_mac))) {
         if (found) {
             pr_read("file %s, %lld in removed\n",
@@ -838,6 +1427,11 @@ created:
     file->block_mac = block_mac;
     file->size = file_entry_ro->size;
     file->used_by_tr = false;
+    file->ra_next = 0;
+    file->ra_end = 0;
+    file->ra_window = 0;
+    file_extent_clear(file);
+    file_dirty_clear(file);
     block_put(file_entry_ro, &file_entry_ref);
 
     return true;
@@ -848,9 +1442,13 @@ created:
  * @file:       File handle object.
  *
  * Must be called before freeing @file after a successful file_open call.
+ * Deferred block map changes are applied to the transaction that made them.
  */
 void file_close(struct file_handle *file)
 {
+    if (file->dirty_tr) {
+        file_dirty_flush(file->dirty_tr, file);
+    }
     list_delete(&file->node);
 }
 
@@ -873,6 +1471,13 @@ bool file_delete(struct transaction *tr, const char *path)
     struct block_tree_path tree_path;
     struct file_handle *open_file;
 
+    /* blocks that are not in the block map yet would not be freed below */
+    file_dirty_flush_all(tr);
+    if (tr->failed) {
+        pr_warn("transaction failed, abort\n");
+        return false;
+    }
+
     found = file_tree_lookup(&block_mac, tr, &tr->files_added, &tree_path,
                              path, true);
     if (!found) {
@@ -1137,6 +1742,12 @@ void file_transaction_complete(struct transaction *tr,
     data_block_t hash;
     const struct block_mac clear_block_mac = BLOCK_MAC_INITIAL_VALUE(clear);
 
+    file_dirty_flush_all(tr);
+    if (tr->failed) {
+        pr_warn("transaction failed, abort\n");
+        return;
+    }
+
     block_tree_copy(&new_files, &tr->fs->files);
 
     block_tree_walk(tr, &tr->files_updated, 0, true, &tree_path);
@@ -1282,7 +1893,24 @@ static bool transaction_changed_file(struct transaction *tr,
  */
 void file_transaction_success(struct transaction *tr)
 {
+    struct block_tree_path tree_path;
+    struct block_mac file;
+    data_block_t old_block;
+
     file_for_each_open(tr, file_apply_to_commit);
+
+    /* @tr->fs->files now matches @tr, update file cache to match */
+    block_tree_walk(tr, &tr->files_updated, 0, true, &tree_path);
+    while ((old_block = block_tree_path_get_key(&tree_path))) {
+        file = block_tree_path_get_data_block_mac(&tree_path);
+        file_cache_update(tr, old_block, &file);
+        block_tree_path_next(&tree_path);
+    }
+    block_tree_walk(tr, &tr->files_removed, 0, true, &tree_path);
+    while ((old_block = block_tree_path_get_key(&tree_path))) {
+        file_cache_update(tr, old_block, NULL);
+        block_tree_path_next(&tree_path);
+    }
 }
 
 /**
@@ -1324,11 +1952,14 @@ static bool file_read_size(struct transaction *tr,
 void file_transaction_failed(struct transaction *tr)
 {
     struct file_handle *file;
+    bool changed;
     bool success;
 
     list_for_every_entry(&tr->open_files, file, struct file_handle, node) {
         file->used_by_tr = false;
-        if (transaction_changed_file(tr, file)) {
+        changed = transaction_changed_file(tr, file) || file->dirty_size;
+        file_dirty_clear(file);
+        if (changed) {
             file->block_mac = file->committed_block_mac;
             success = file_read_size(tr, &file->block_mac, &file->size);
             if (!success) {
@@ -20,11 +20,89 @@
 #include "block_cache.h"
 #include "block_mac.h"
 
+struct block_map;
 struct fs;
 struct transaction;
 
+#define FILE_EXTENT_CACHE_BLOCKS (16)
+
 #define FS_PATH_MAX (64 + 128)
 
+#define FILE_CACHE_SIZE (8)
+
+#define FILE_DIRTY_BLOCKS (16)
+
+/**
+ * struct file_cache_entry - Cached location of a committed file entry
+ * @block_mac:  Block and mac of file entry in &struct fs->files. Entry is not
+ *              in use if block is 0.
+ * @last_used:  Value of &struct file_cache->clock when entry was last used.
+ * @path:       File path.
+ */
+struct file_cache_entry {
+    struct block_mac block_mac;
+    uint last_used;
+    char path[FS_PATH_MAX];
+};
+
+/**
+ * struct file_cache - Path to file entry cache for committed files
+ * @clock:      Incremented every time an entry is used.
+ * @entries:    Cache entries.
+ *
+ * Allows files that already exist in &struct fs->files to be found without
+ * hashing the path, walking the files tree and reading the file entry to
+ * compare the path. Entries are updated or removed when a transaction that
+ * modifies or deletes the file is committed.
+ */
+struct file_cache {
+    uint clock;
+    struct file_cache_entry entries[FILE_CACHE_SIZE];
+};
+
+/**
+ * struct file_dirty_block - File block written by the current transaction
+ * @file_block: File block number. 0 based.
+ * @block_mac:  Block and mac of written data. The mac is set by
+ *              file_block_put_dirty.
+ * @tmp:        @block_mac points to a tmp block that holds the data until
+ *              file_dirty_flush allocates the block it is stored in.
+ */
+struct file_dirty_block {
+    data_block_t file_block;
+    struct block_mac block_mac;
+    bool tmp;
+};
+
+/**
+ * struct file_handle - Open file state
+ * @node:                   List node for tracking open files.
+ * @to_commit_block_mac:    Block and mac of file entry to commit.
+ * @committed_block_mac:    Block and mac of committed file entry.
+ * @block_mac:              Block and mac of current file entry.
+ * @to_commit_size:         File size to commit.
+ * @size:                   Current file size.
+ * @used_by_tr:             %true if file was accessed by transaction.
+ * @ra_next:                File block following the last block read.
+ * @ra_end:                 End of file blocks already read ahead.
+ * @ra_window:              Number of file blocks to read ahead, 0 if access
+ *                          is not sequential.
+ * @extent_file:            Value of @block_mac when @extent was loaded.
+ * @extent_start:           First file block in @extent.
+ * @extent_count:           Number of valid entries in @extent.
+ * @extent:                 Block and mac of consecutive file blocks starting
+ *                          at @extent_start, copied from the block map.
+ * @dirty_tr:               Transaction that wrote the blocks in @dirty or
+ *                          changed @size, or %NULL.
+ * @dirty_size:             %true if @size has not been stored in the file
+ *                          entry yet.
+ * @dirty_count:            Number of valid entries in @dirty.
+ * @dirty:                  Blocks written since the block map was last
+ *                          updated, sorted by file block. New blocks are
+ *                          allocated in file block order, and the block map
+ *                          and file entry are updated, when the transaction
+ *                          completes, or earlier if @dirty is full.
+ */
 struct file_handle {
     struct list_node node;
     struct block_mac to_commit_block_mac;
@@ -33,6 +111,17 @@ struct file_handle {
     data_block_t to_commit_size;
     data_block_t size;
     bool used_by_tr;
+    data_block_t ra_next;
+    data_block_t ra_end;
+    uint ra_window;
+    struct block_mac extent_file;
+    data_block_t extent_start;
+    uint extent_count;
+    struct block_mac extent[FILE_EXTENT_CACHE_BLOCKS];
+    struct transaction *dirty_tr;
+    bool dirty_size;
+    uint dirty_count;
+    struct file_dirty_block dirty[FILE_DIRTY_BLOCKS];
 };
 
 size_t get_file_block_size(struct fs *fs);
@@ -41,6 +130,10 @@ const void *file_get_block(struct transaction *tr, struct file_handle *file,
 void *file_get_block_write(struct transaction *tr, struct file_handle *file,
                            data_block_t file_block, bool read,
                            obj_ref_t *ref);
+void file_read_ahead(struct transaction *tr, struct file_handle *file,
+                     data_block_t file_block, data_block_t count);
+bool file_read_ahead_async(struct transaction *tr, struct file_handle *file,
+                           data_block_t file_block, data_block_t count);
 void file_block_put(const void *data, obj_ref_t *data_ref);
 void file_block_put_dirty(struct transaction *tr,
                           struct file_handle *file, data_block_t file_block,
@@ -52,6 +145,10 @@ void file_set_size(struct transaction *tr,
                    struct file_handle *file,
                    data_block_t size);
 
+void file_block_map_init(struct transaction *tr,
+                         struct block_map *block_map,
+                         const struct block_mac *file);
+
 void file_print(struct transaction *tr, const struct file_handle *file);
 void files_print(struct transaction *tr);
 
@@ -60,6 +157,7 @@ void file_transaction_complete(struct transaction *tr,
 void file_transaction_complete_failed(struct transaction *tr);
 
 void file_transaction_success(struct transaction *tr);
+void file_cache_clear(struct file_cache *cache);
 void file_transaction_failed(struct transaction *tr);
 
 /* TODO: move to dir? */
@@ -30,9 +30,12 @@
     do { } while(0)
 #endif
 
+#include "block_allocator.h"
 #include "block_mac.h"
 #include "block_set.h"
 #include "block_tree.h"
+#include "file.h"
+#include "scrub.h"
 
 /**
  * struct fs - File system state
@@ -41,6 +44,7 @@
  * @allocated:                      List of block sets containing blocks
  *                                  allocated by active transactions.
  * @free:                           Block set of free blocks.
+ * @free_index:                     In-memory index of ranges in @free.
  * @files:                          B+ tree of all files.
  * @super_dev:                      Block device used to store super blocks.
  * @key:                            Key to use for encrypt, decrypt and mac.
@@ -53,8 +57,16 @@
  * @block_num_size:                 Number of bytes used to store block numbers.
  * @mac_size:                       Number of bytes used to store mac values.
  *                                  Must be 16 if @dev is not tamper_detecting.
+ * @fs_version:                     On-disk format version of file system.
+ *                                  Kept when writing super blocks.
+ * @block_map_extents:              Block maps can store extent entries. Set
+ *                                  if @fs_version supports it.
  * @reserved_count:                 Number of free blocks reserved for active
  *                                  transactions.
+ * @cache_part:                     Block cache partition for blocks used by
+ *                                  this file system.
+ * @file_cache:                     Cache of recently opened files in @files.
+ * @scrub:                          Background integrity check state.
  */
 
 struct fs {
@@ -62,6 +74,7 @@ struct fs {
     struct list_node transactions;
     struct list_node allocated;
     struct block_set free;
+    struct block_free_index free_index;
     struct block_tree files;
     struct block_device *super_dev;
     const struct key *key;
@@ -71,7 +84,12 @@ struct fs {
     data_block_t min_block_num;
     size_t block_num_size;
     size_t mac_size;
+    uint32_t fs_version;
+    bool block_map_extents;
     data_block_t reserved_count;
+    struct block_cache_part cache_part;
+    struct file_cache file_cache;
+    struct fs_scrub scrub;
 };
 
 bool update_super_block(struct transaction *tr,
@@ -83,3 +101,5 @@ int fs_init(struct fs *fs,
             struct block_device *dev,
             struct block_device *super_dev,
             bool clear);
+
+void fs_destroy(struct fs *fs);
@@ -30,8 +30,14 @@
 static void *msg_buf;
 static size_t msg_buf_size;
 
+static struct list_node async_msgs = LIST_INITIAL_VALUE(async_msgs);
+static struct list_node deferred_work = LIST_INITIAL_VALUE(deferred_work);
+static struct list_node idle_work = LIST_INITIAL_VALUE(idle_work);
+
 static void handle_channel(struct ipc_context *ctx, const struct uevent *ev);
 static void handle_port(struct ipc_context *ctx, const struct uevent *ev);
+static int receive_response(handle_t session, struct ipc_msg_info *inf,
+                            iovec_t *rx_iovecs, size_t rx_iovec_count);
 
 static int maybe_grow_msg_buf(size_t new_max_size)
 {
@@ -193,8 +199,36 @@ err_read_msg:
 	return rc;
 }
 
+static struct ipc_async_msg *find_async_msg(handle_t session)
+{
+	struct ipc_async_msg *amsg;
+
+	list_for_every_entry(&async_msgs, amsg, struct ipc_async_msg, node) {
+		if (amsg->handle == session) {
+			return amsg;
+		}
+	}
+	return NULL;
+}
+
+static void complete_async_msg(struct ipc_async_msg *amsg, int rc)
+{
+	list_delete(&amsg->node);
+	amsg->on_response(amsg, rc);
+}
+
+static void fail_async_msgs(handle_t session, int rc)
+{
+	struct ipc_async_msg *amsg;
+
+	while ((amsg = find_async_msg(session))) {
+		complete_async_msg(amsg, rc);
+	}
+}
+
 static void do_disconnect(struct ipc_channel_context *context, const uevent_t *ev)
 {
+	fail_async_msgs(ev->handle, ERR_CHANNEL_CLOSED);
 	context->ops.on_disconnect(context);
 	close(ev->handle);
 }
@@ -217,8 +251,21 @@ static void handle_channel(struct ipc_context *ctx, const struct uevent *ev)
 	handle_chan_errors(ev);
 
 	if (ev->event & IPC_HANDLE_POLL_MSG) {
-
-		if (channel_ctx->ops.on_handle_msg != NULL) {
+		struct ipc_async_msg *amsg = find_async_msg(ev->handle);
+
+		if (amsg != NULL) {
+			struct ipc_msg_info inf;
+			int rc = get_msg(ev->handle, &inf);
+			if (rc == NO_ERROR) {
+				rc = receive_response(ev->handle, &inf,
+				                      amsg->rx_iovecs,
+				                      amsg->rx_iovec_count);
+				complete_async_msg(amsg, rc);
+			} else if (rc != ERR_NO_MSG) {
+				TLOGE("%s: failed to get_msg (%d)\n", __func__, rc);
+				complete_async_msg(amsg, rc);
+			}
+		} else if (channel_ctx->ops.on_handle_msg != NULL) {
 			int rc = do_handle_msg(channel_ctx, ev);
 			if (rc < 0) {
 				TLOGE("error (%d) in channel, disconnecting "
@@ -233,6 +280,11 @@ static void handle_channel(struct ipc_context *ctx, const struct uevent *ev)
 		}
 	}
 
+	if ((ev->event & IPC_HANDLE_POLL_SEND_UNBLOCKED) &&
+	    channel_ctx->ops.on_send_unblocked != NULL) {
+		channel_ctx->ops.on_send_unblocked(channel_ctx);
+	}
+
 	if (ev->event & IPC_HANDLE_POLL_HUP) {
 		do_disconnect(channel_ctx, ev);
 	}
@@ -301,14 +353,16 @@ static int wait_to_send(handle_t session, struct ipc_msg *msg)
 	return rc;
 }
 
-int sync_ipc_send_msg(handle_t session, iovec_t *tx_iovecs, size_t tx_iovec_count,
-                      iovec_t *rx_iovecs, size_t rx_iovec_count)
+static int send_request(handle_t session, iovec_t *tx_iovecs,
+                        size_t tx_iovec_count)
 {
 	struct ipc_msg tx_msg = {
 		.iov = tx_iovecs,
 		.num_iov = tx_iovec_count,
 	};
 
+	ipc_await_async_msgs(session);
+
 	long rc = send_msg(session, &tx_msg);
 	if (rc == ERR_NOT_ENOUGH_BUFFER) {
 		rc = wait_to_send(session, &tx_msg);
@@ -318,24 +372,17 @@ int sync_ipc_send_msg(handle_t session, iovec_t *tx_iovecs, size_t tx_iovec_coun
 		TLOGE("%s: failed (%ld) to send_msg\n", __func__, rc);
 		return rc;
 	}
+	return NO_ERROR;
+}
 
-	if (rx_iovecs == NULL || rx_iovec_count == 0) {
-		assert(rx_iovec_count == 0);
-		assert(rx_iovecs == NULL);
-		return NO_ERROR;
-	}
-
-	struct ipc_msg_info inf;
-	rc = await_response(session, &inf);
-	if (rc < 0) {
-		TLOGE("%s: failed (%ld) to await response\n", __func__, rc);
-		return rc;
-	}
-
+static int receive_response(handle_t session, struct ipc_msg_info *inf,
+                            iovec_t *rx_iovecs, size_t rx_iovec_count)
+{
+	long rc;
 	size_t min_len = rx_iovecs[0].len;
-	if (inf.len < min_len) {
-		TLOGE("%s: invalid response length (%d)\n", __func__, inf.len);
-		put_msg(session, inf.id);
+	if (inf->len < min_len) {
+		TLOGE("%s: invalid response length (%d)\n", __func__, inf->len);
+		put_msg(session, inf->id);
 		return ERR_NOT_VALID;
 	}
 
@@ -345,22 +392,22 @@ int sync_ipc_send_msg(handle_t session, iovec_t *tx_iovecs, size_t tx_iovec_coun
 		resp_size += rx_iovecs[i].len;
 	}
 
-	if (resp_size < inf.len) {
+	if (resp_size < inf->len) {
 		TLOGE("%s: response buffer too short (%d < %d) \n", __func__,
-		      resp_size, inf.len);
-		put_msg(session, inf.id);
+		      resp_size, inf->len);
+		put_msg(session, inf->id);
 		return ERR_BAD_LEN;
 	}
 
-	rc = read_response(session, inf.id, rx_iovecs, rx_iovec_count);
-	put_msg(session, inf.id);
+	rc = read_response(session, inf->id, rx_iovecs, rx_iovec_count);
+	put_msg(session, inf->id);
 	if (rc < 0) {
 		TLOGE("%s: response has error (%ld)\n", __func__, rc);
 		return rc;
 	}
 
 	size_t read_len = (size_t) rc;
-	if (read_len != inf.len) {
+	if (read_len != inf->len) {
 		// data read in does not match message length
 		TLOGE("%s: invalid response length (%d)\n", __func__, read_len);
 		return ERR_IO;
@@ -369,6 +416,150 @@ int sync_ipc_send_msg(handle_t session, iovec_t *tx_iovecs, size_t tx_iovec_coun
 	return read_len;
 }
 
+/*
+ * Send a request and receive its response with a single call syscall.
+ * Returns ERR_NOT_ENOUGH_BUFFER without sending anything if the request
+ * queue of the server is full.
+ */
+static int call_request(handle_t session, iovec_t *tx_iovecs,
+                        size_t tx_iovec_count, iovec_t *rx_iovecs,
+                        size_t rx_iovec_count)
+{
+	struct ipc_msg tx_msg = {
+		.iov = tx_iovecs,
+		.num_iov = tx_iovec_count,
+	};
+	struct ipc_msg rx_msg = {
+		.iov = rx_iovecs,
+		.num_iov = rx_iovec_count,
+	};
+
+	/* the first message to arrive is taken as the response */
+	ipc_await_async_msgs(session);
+
+	long rc = call(session, &tx_msg, &rx_msg, -1);
+	if (rc < 0) {
+		if (rc != ERR_NOT_ENOUGH_BUFFER) {
+			TLOGE("%s: failed (%ld) to call\n", __func__, rc);
+		}
+		return rc;
+	}
+
+	size_t read_len = (size_t) rc;
+	if (read_len < rx_iovecs[0].len) {
+		TLOGE("%s: invalid response length (%d)\n", __func__, read_len);
+		return ERR_NOT_VALID;
+	}
+
+	return read_len;
+}
+
+int sync_ipc_send_msg(handle_t session, iovec_t *tx_iovecs, size_t tx_iovec_count,
+                      iovec_t *rx_iovecs, size_t rx_iovec_count)
+{
+	long rc;
+
+	if (rx_iovecs == NULL || rx_iovec_count == 0) {
+		assert(rx_iovec_count == 0);
+		assert(rx_iovecs == NULL);
+		rc = send_request(session, tx_iovecs, tx_iovec_count);
+		return rc < 0 ? rc : NO_ERROR;
+	}
+
+	rc = call_request(session, tx_iovecs, tx_iovec_count, rx_iovecs,
+	                  rx_iovec_count);
+	if (rc != ERR_NOT_ENOUGH_BUFFER) {
+		return rc;
+	}
+
+	/* request queue is full, wait for room and get the response separately */
+	rc = send_request(session, tx_iovecs, tx_iovec_count);
+	if (rc < 0) {
+		return rc;
+	}
+
+	struct ipc_msg_info inf;
+	rc = await_response(session, &inf);
+	if (rc < 0) {
+		TLOGE("%s: failed (%ld) to await response\n", __func__, rc);
+		return rc;
+	}
+
+	return receive_response(session, &inf, rx_iovecs, rx_iovec_count);
+}
+
+int ipc_send_async_msg(handle_t session, iovec_t *tx_iovecs,
+                       uint tx_iovec_count, struct ipc_async_msg *amsg)
+{
+	assert(amsg->rx_iovecs && amsg->rx_iovec_count);
+	assert(amsg->on_response);
+
+	int rc = send_request(session, tx_iovecs, tx_iovec_count);
+	if (rc < 0) {
+		return rc;
+	}
+
+	amsg->handle = session;
+	list_add_tail(&async_msgs, &amsg->node);
+	return NO_ERROR;
+}
+
+void ipc_await_async_msgs(handle_t session)
+{
+	int rc;
+	struct ipc_msg_info inf;
+	struct ipc_async_msg *amsg;
+
+	while ((amsg = find_async_msg(session))) {
+		rc = await_response(session, &inf);
+		if (rc < 0) {
+			TLOGE("%s: failed (%d) to await response\n", __func__, rc);
+		} else {
+			rc = receive_response(session, &inf, amsg->rx_iovecs,
+			                      amsg->rx_iovec_count);
+		}
+		complete_async_msg(amsg, rc);
+	}
+}
+
+void ipc_deferred_work_init(struct ipc_deferred_work *work,
+                            void (*fn)(struct ipc_deferred_work *work))
+{
+	list_clear_node(&work->node);
+	work->fn = fn;
+}
+
+void ipc_defer_work(struct ipc_deferred_work *work)
+{
+	if (!list_in_list(&work->node)) {
+		list_add_tail(&deferred_work, &work->node);
+	}
+}
+
+void ipc_defer_idle_work(struct ipc_deferred_work *work)
+{
+	if (!list_in_list(&work->node)) {
+		list_add_tail(&idle_work, &work->node);
+	}
+}
+
+void ipc_cancel_work(struct ipc_deferred_work *work)
+{
+	if (list_in_list(&work->node)) {
+		list_delete(&work->node);
+	}
+}
+
+static void run_work(struct list_node *list)
+{
+	struct ipc_deferred_work *work;
+
+	while ((work = list_remove_head_type(list, struct ipc_deferred_work,
+	                                     node))) {
+		work->fn(work);
+	}
+}
+
 static void dispatch_event(const uevent_t *ev)
 {
 	assert(ev);
@@ -434,10 +625,16 @@ void ipc_loop(void)
 	uevent_t event;
 
 	while (true) {
+		run_work(&deferred_work);
+
 		event.handle = INVALID_IPC_HANDLE;
 		event.event = 0;
 		event.cookie = NULL;
-		rc = wait_any(&event, -1);
+		rc = wait_any(&event, list_is_empty(&idle_work) ? -1 : 0);
+		if (rc == ERR_TIMED_OUT) {
+			run_work(&idle_work);
+			continue;
+		}
 		if (rc < 0) {
 			TLOGE("wait_any failed (%d)\n", rc);
 			break;
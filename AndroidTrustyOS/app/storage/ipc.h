@@ -16,6 +16,7 @@
 
 #pragma once
 
+#include <list.h>
 #include <stdio.h>
 
 #include <trusty_ipc.h>
@@ -58,6 +59,15 @@ typedef int (*ipc_msg_handler_t)(struct ipc_channel_context *context,
  */
 typedef void (*ipc_disconnect_handler_t)(struct ipc_channel_context *context);
 
+/**
+ * ipc_send_unblocked_handler_t - handler for send unblocked events
+ * @context: the channel context returned from ipc_connect_handler_t
+ *
+ * Called when a message can be sent again after send_msg failed with
+ * ERR_NOT_ENOUGH_BUFFER.
+ */
+typedef void (*ipc_send_unblocked_handler_t)(struct ipc_channel_context *context);
+
 typedef void (*ipc_evt_handler_t) (struct ipc_context *context, const struct uevent *ev);
 
 /**
@@ -72,10 +82,12 @@ struct ipc_port_ops {
  * ipc_channel_ops
  * @on_handle_msg: optional msg handler
  * @on_disconnect: required disconnect handler
+ * @on_send_unblocked: optional send unblocked handler
  */
 struct ipc_channel_ops {
 	ipc_msg_handler_t            on_handle_msg;
 	ipc_disconnect_handler_t     on_disconnect;
+	ipc_send_unblocked_handler_t on_send_unblocked;
 };
 
 struct ipc_context {
@@ -93,6 +105,43 @@ struct ipc_port_context {
 	struct ipc_port_ops ops;
 };
 
+struct ipc_async_msg;
+
+/**
+ * ipc_async_msg_handler_t - handler for responses to asynchronous messages
+ * @amsg: the message passed to ipc_send_async_msg
+ * @rc:   the size of the received response, or error code < 0 on failure
+ */
+typedef void (*ipc_async_msg_handler_t)(struct ipc_async_msg *amsg, int rc);
+
+/**
+ * struct ipc_async_msg - message waiting for a response
+ * @node:           list node in the pending message list
+ * @handle:         the session handle the message was sent on
+ * @rx_iovecs:      the buffers to receive the response in. Must stay valid
+ *                  until @on_response is called.
+ * @rx_iovec_count: the count of buffers to receive
+ * @on_response:    called once the response was received or the session
+ *                  failed
+ */
+struct ipc_async_msg {
+	struct list_node node;
+	handle_t handle;
+	iovec_t *rx_iovecs;
+	uint rx_iovec_count;
+	ipc_async_msg_handler_t on_response;
+};
+
+/**
+ * struct ipc_deferred_work - work to run from the top of the event loop
+ * @node: list node in the deferred work list
+ * @fn:   function to call
+ */
+struct ipc_deferred_work {
+	struct list_node node;
+	void (*fn)(struct ipc_deferred_work *work);
+};
+
 /**
  * sync_ipc_send_msg - send IPC message
  * @session:        the session handle
@@ -100,10 +149,57 @@ struct ipc_port_context {
  * @tx_iovec_count: the count of buffers to send
  * @rx_iovecs:      the buffers to receive
  * @rx_iovec_count: the count of buffers to receive
+ *
+ * Responses to asynchronous messages sent earlier on @session are received
+ * first.
  */
 int sync_ipc_send_msg(handle_t session, iovec_t *tx_iovecs, uint tx_iovec_count,
                       iovec_t *rx_iovecs, uint rx_iovec_count);
 
+/**
+ * ipc_send_async_msg - send IPC message without waiting for the response
+ * @session:        the session handle
+ * @tx_iovecs:      the buffers to send
+ * @tx_iovec_count: the count of buffers to send
+ * @amsg:           the response buffers and handler, see &struct ipc_async_msg
+ *
+ * The response is received from ipc_loop, or from the next call that waits for
+ * a response on @session. Only one asynchronous message can be pending per
+ * session, a previous one is waited for before sending.
+ *
+ * Returns NO_ERROR if the message was sent, error code < 0 otherwise. The
+ * response handler is only called if the message was sent.
+ */
+int ipc_send_async_msg(handle_t session, iovec_t *tx_iovecs,
+                       uint tx_iovec_count, struct ipc_async_msg *amsg);
+
+/**
+ * ipc_await_async_msgs - wait for responses to asynchronous messages
+ * @session: the session handle
+ */
+void ipc_await_async_msgs(handle_t session);
+
+void ipc_deferred_work_init(struct ipc_deferred_work *work,
+                            void (*fn)(struct ipc_deferred_work *work));
+
+/**
+ * ipc_defer_work - run work before ipc_loop waits for the next event
+ * @work: the work to run. Does nothing if @work is already queued.
+ *
+ * Used to run handlers that cannot be called from where the event that
+ * triggered them is noticed, e.g. while another request is being handled.
+ */
+void ipc_defer_work(struct ipc_deferred_work *work);
+
+/**
+ * ipc_defer_idle_work - run work once ipc_loop has no pending events
+ * @work: the work to run. Does nothing if @work is already queued.
+ *
+ * Used to batch up work triggered by several events that arrive together.
+ */
+void ipc_defer_idle_work(struct ipc_deferred_work *work);
+void ipc_cancel_work(struct ipc_deferred_work *work);
+
 int ipc_port_create(struct ipc_port_context *contextp, const char *port_name,
                     size_t queue_size, size_t max_buffer_size, uint32_t flags);
 int ipc_port_destroy(struct ipc_port_context *context);
@@ -19,6 +19,7 @@
 #include <interface/storage/storage.h>
 
 #include "block_cache.h"
+#include "block_cache_priv.h"
 #include "ipc.h"
 #include "proxy.h"
 #include "tipc_limits.h"
@@ -33,7 +34,7 @@ int main(void)
 		}
 	};
 
-	block_cache_init();
+	block_cache_init(BLOCK_CACHE_SIZE_MAX);
 
 	int rc = ipc_port_create(&ctx, STORAGE_DISK_PROXY_PORT, 1, STORAGE_MAX_BUFFER_SIZE,
 				 IPC_PORT_ALLOW_TA_CONNECT | IPC_PORT_ALLOW_NS_CONNECT);
@@ -26,6 +26,7 @@ trusty_app_manifest_t TRUSTY_APP_MANIFEST_ATTRS trusty_app_manifest =
     },
     {
         TRUSTY_APP_CONFIG_MIN_STACK_SIZE(4 * 4096),
-        TRUSTY_APP_CONFIG_MIN_HEAP_SIZE(8 * 4096 + BLOCK_CACHE_SIZE_BYTES),
+        TRUSTY_APP_CONFIG_MIN_HEAP_SIZE(BLOCK_CACHE_HEAP_RESERVE +
+                                        BLOCK_CACHE_SIZE_BYTES),
     },
 };
@@ -107,12 +107,18 @@ struct ipc_channel_context *proxy_connect(struct ipc_port_context *parent_ctx,
 
 	/* Generate encryption key */
 	rc = get_storage_encryption_key(hwkey_session, session->key.byte,
-	                                sizeof(session->key));
+	                                sizeof(session->key.byte));
 	if (rc < 0) {
 		SS_ERR("%s: can't get storage key: (%d) \n", __func__, rc);
 		goto err_get_storage_key;
 	}
 
+	rc = crypt_key_init(&session->key);
+	if (rc < 0) {
+		SS_ERR("%s: can't init storage key: (%d)\n", __func__, rc);
+		goto err_init_storage_key;
+	}
+
 	/* Init RPMB key */
 	rc = get_rpmb_auth_key(hwkey_session, rpmb_key.byte, sizeof(rpmb_key.byte));
 	if (rc < 0) {
@@ -135,7 +141,9 @@ struct ipc_channel_context *proxy_connect(struct ipc_port_context *parent_ctx,
 
 err_init_block_device:
 err_get_rpmb_key:
+err_init_storage_key:
 err_get_storage_key:
+	crypt_key_destroy(&session->key);
 	hwkey_close(hwkey_session);
 err_hwkey_open:
 	free(session);
@@ -148,6 +156,7 @@ void proxy_disconnect(struct ipc_channel_context *ctx)
 	struct storage_session *session = proxy_context_to_session(ctx);
 
 	block_device_tipc_uninit(&session->block_device);
+	crypt_key_destroy(&session->key);
 
 	free(session);
 }
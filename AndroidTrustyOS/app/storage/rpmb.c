@@ -66,6 +66,8 @@ struct rpmb_packet {
     struct rpmb_u16      req_resp;
 };
 
+STATIC_ASSERT(sizeof(struct rpmb_packet) == RPMB_FRAME_SIZE);
+
 enum rpmb_request {
     RPMB_REQ_PROGRAM_KEY                = 0x0001,
     RPMB_REQ_GET_COUNTER                = 0x0002,
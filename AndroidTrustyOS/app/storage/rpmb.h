@@ -25,13 +25,16 @@ struct rpmb_state;
 
 #define RPMB_BUF_SIZE 256
 
+/* Size of an rpmb data frame, including authentication fields */
+#define RPMB_FRAME_SIZE 512
+
 /* provides */
 int rpmb_init(struct rpmb_state **statep,
               void *mmc_handle,
               const struct rpmb_key *key);
 void rpmb_uninit(struct rpmb_state *statep);
 int rpmb_read(struct rpmb_state *state, void *buf, uint16_t addr, uint16_t count);
-int rpmb_write(struct rpmb_state *state, const void *buf, uint16_t addr, uint16_t count, bool sync); /* count must be 1 or 2, addr must be aligned */
+int rpmb_write(struct rpmb_state *state, const void *buf, uint16_t addr, uint16_t count, bool sync); /* count must not exceed the reliable write sector count of the device */
 
 /* needs */
 int rpmb_send(void *mmc_handle,
@@ -27,12 +27,14 @@ MODULE_SRCS := \
 	$(LOCAL_DIR)/block_tree.c \
 	$(LOCAL_DIR)/client_tipc.c \
 	$(LOCAL_DIR)/crypt.c \
+	$(LOCAL_DIR)/debug_stats.c \
 	$(LOCAL_DIR)/file.c \
 	$(LOCAL_DIR)/ipc.c \
 	$(LOCAL_DIR)/main.c \
 	$(LOCAL_DIR)/manifest.c \
 	$(LOCAL_DIR)/proxy.c \
 	$(LOCAL_DIR)/rpmb.c \
+	$(LOCAL_DIR)/scrub.c \
 	$(LOCAL_DIR)/super.c \
 	$(LOCAL_DIR)/tipc_ns.c \
 	$(LOCAL_DIR)/transaction.c \
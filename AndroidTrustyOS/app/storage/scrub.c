@@ -0,0 +1,320 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "block_map.h"
+#include "block_tree.h"
+#include "debug.h"
+#include "file.h"
+#include "fs.h"
+#include "scrub.h"
+#include "transaction.h"
+
+/**
+ * struct fs_scrub_budget - Work left in the current fs_scrub_run call
+ * @entries:    Number of tree entries that can still be checked.
+ * @reads:      Number of block cache misses allowed.
+ * @misses:     Value of the cache partition miss counter at start.
+ */
+struct fs_scrub_budget {
+    uint entries;
+    uint reads;
+    uint64_t misses;
+};
+
+/**
+ * fs_scrub_init - Initialize scrubber state
+ * @scrub:      Scrubber state object.
+ *
+ * Start the first pass at the beginning of the files tree.
+ */
+void fs_scrub_init(struct fs_scrub *scrub)
+{
+    memset(scrub, 0, sizeof(*scrub));
+    scrub->stage = FS_SCRUB_FILES;
+}
+
+/**
+ * fs_scrub_budget_used - Count a checked entry and check the budget
+ * @fs:         File system state object.
+ * @budget:     Budget object.
+ *
+ * Return: %true if no more entries should be checked in this run.
+ */
+static bool fs_scrub_budget_used(struct fs *fs, struct fs_scrub_budget *budget)
+{
+    fs->scrub.checked++;
+    budget->entries--;
+    return !budget->entries ||
+           fs->cache_part.stats.misses - budget->misses >= budget->reads;
+}
+
+/**
+ * fs_scrub_error - Report a tree that could not be checked
+ * @fs:         File system state object.
+ * @tree_name:  Name of tree for log message.
+ * @key:        Files tree key of file, or 0.
+ */
+static void fs_scrub_error(struct fs *fs, const char *tree_name,
+                           data_block_t key)
+{
+    pr_err("pass %d: %s tree check failed, key 0x%llx\n",
+           fs->scrub.pass, tree_name, key);
+    fs->scrub.errors++;
+    fs->scrub.total_errors++;
+}
+
+/**
+ * fs_scrub_path_key - Get key of current entry
+ * @path:       Tree path object.
+ *
+ * Skip the empty insert spot that block_tree_walk can return if the key it
+ * was looking for is not in the tree.
+ *
+ * Return: Key of entry at @path, or 0 if there are no more entries or the
+ * transaction failed.
+ */
+static data_block_t fs_scrub_path_key(struct block_tree_path *path)
+{
+    if (path->tr->failed) {
+        return 0;
+    }
+    if (block_tree_path_get_key(path) && !block_tree_path_get_data(path)) {
+        block_tree_path_next(path);
+        if (path->tr->failed) {
+            return 0;
+        }
+    }
+    return block_tree_path_get_key(path);
+}
+
+/**
+ * fs_scrub_file - Check file entry, block map and extent blocks of a file
+ * @tr:         Transaction object.
+ * @file:       Block number and mac of file entry.
+ * @budget:     Budget object.
+ *
+ * Return: %true if the file has been checked, %false if the budget ran out or
+ * if @tr failed.
+ */
+static bool fs_scrub_file(struct transaction *tr,
+                          const struct block_mac *file,
+                          struct fs_scrub_budget *budget)
+{
+    struct fs_scrub *scrub = &tr->fs->scrub;
+    struct block_map block_map;
+    struct block_tree_path path;
+    data_block_t key;
+    data_block_t start;
+
+    file_block_map_init(tr, &block_map, file);
+    if (tr->failed) {
+        return false;
+    }
+    if (!scrub->block_map_key) {
+        scrub->block_map_key = 1; /* 0 is not a valid block tree key */
+        if (fs_scrub_budget_used(tr->fs, budget)) {
+            return false;
+        }
+    }
+
+    block_tree_walk(tr, &block_map.tree, scrub->block_map_key, false, &path);
+    key = fs_scrub_path_key(&path);
+    while (key) {
+        scrub->block_map_key = key + 1;
+        if (fs_scrub_budget_used(tr->fs, budget)) {
+            return false;
+        }
+        if (block_map.extents) {
+            /* read and check the extent block, if the entry has one */
+            block_map_path_get_blocks(tr, &block_map, &path, &start);
+        }
+        block_tree_path_next(&path);
+        key = fs_scrub_path_key(&path);
+    }
+    return !tr->failed;
+}
+
+/**
+ * fs_scrub_files - Check files tree and all files in it
+ * @tr:         Transaction object.
+ * @budget:     Budget object.
+ *
+ * Return: %true if the rest of the files tree has been checked or cannot be
+ * checked, %false if the budget ran out or if @tr failed while checking a
+ * file.
+ */
+static bool fs_scrub_files(struct transaction *tr,
+                           struct fs_scrub_budget *budget)
+{
+    struct fs *fs = tr->fs;
+    struct fs_scrub *scrub = &fs->scrub;
+    struct block_tree_path path;
+    struct block_mac file;
+    data_block_t key;
+    data_block_t prev_key = 0;
+    uint dup = 0;
+
+    /* walk to the first of the entries with a matching key */
+    block_tree_walk(tr, &fs->files, scrub->key ? scrub->key - 1 : 0, false,
+                    &path);
+    key = fs_scrub_path_key(&path);
+    while (key) {
+        dup = (key == prev_key) ? dup + 1 : 0;
+        prev_key = key;
+        if (key > scrub->key) {
+            scrub->key = key;
+            scrub->key_skip = 0;
+            scrub->block_map_key = 0;
+        }
+        if (key == scrub->key && dup >= scrub->key_skip) {
+            file = block_tree_path_get_data_block_mac(&path);
+            if (!fs_scrub_file(tr, &file, budget)) {
+                if (tr->failed) {
+                    fs_scrub_error(fs, "file", key);
+                    scrub->key_skip++;
+                    scrub->block_map_key = 0;
+                }
+                return false;
+            }
+            scrub->key_skip++;
+            scrub->block_map_key = 0;
+        }
+        block_tree_path_next(&path);
+        key = fs_scrub_path_key(&path);
+    }
+    if (tr->failed) {
+        fs_scrub_error(fs, "files", scrub->key);
+    }
+    return true;
+}
+
+/**
+ * fs_scrub_free - Check free set tree
+ * @tr:         Transaction object.
+ * @budget:     Budget object.
+ *
+ * Return: %true if the rest of the free set tree has been checked or cannot
+ * be checked, %false if the budget ran out.
+ */
+static bool fs_scrub_free(struct transaction *tr,
+                          struct fs_scrub_budget *budget)
+{
+    struct fs *fs = tr->fs;
+    struct fs_scrub *scrub = &fs->scrub;
+    struct block_tree_path path;
+    data_block_t key;
+
+    block_tree_walk(tr, &fs->free.block_tree, scrub->key, false, &path);
+    key = fs_scrub_path_key(&path);
+    while (key) {
+        scrub->key = key + 1;
+        if (fs_scrub_budget_used(fs, budget)) {
+            return false;
+        }
+        block_tree_path_next(&path);
+        key = fs_scrub_path_key(&path);
+    }
+    if (tr->failed) {
+        fs_scrub_error(fs, "free", scrub->key);
+    }
+    return true;
+}
+
+/**
+ * fs_scrub_pass_done - Report result of a pass and start the next one
+ * @fs:         File system state object.
+ */
+static void fs_scrub_pass_done(struct fs *fs)
+{
+    struct fs_scrub *scrub = &fs->scrub;
+
+    if (scrub->errors) {
+        pr_err("pass %d: checked %d entries, %d errors\n",
+               scrub->pass, scrub->checked, scrub->errors);
+    } else {
+        pr_init("pass %d: checked %d entries\n", scrub->pass,
+                scrub->checked);
+    }
+
+    scrub->stage = FS_SCRUB_FILES;
+    scrub->key = 0;
+    scrub->key_skip = 0;
+    scrub->block_map_key = 0;
+    scrub->pass++;
+    scrub->checked = 0;
+    scrub->errors = 0;
+}
+
+/**
+ * fs_scrub_run - Check part of a file system
+ * @fs:             File system state object.
+ * @max_entries:    Max number of tree entries to check. Must not be 0.
+ * @max_reads:      Stop after this many blocks had to be read from @fs->dev.
+ *
+ * Continue the current pass where the previous call stopped. Every tree node
+ * and file entry on the way is loaded with block_get which checks its mac.
+ * Errors are logged and counted in @fs->scrub, and the rest of the tree or
+ * file that could not be read is skipped.
+ *
+ * Return: %true if a pass was completed, %false otherwise.
+ */
+bool fs_scrub_run(struct fs *fs, uint max_entries, uint max_reads)
+{
+    struct fs_scrub *scrub = &fs->scrub;
+    struct fs_scrub_budget budget = {
+        .entries = max_entries,
+        .reads = max_reads,
+        .misses = fs->cache_part.stats.misses,
+    };
+    struct transaction tr;
+    bool done = false;
+
+    assert(max_entries);
+
+    transaction_init(&tr, fs, true);
+    do {
+        switch (scrub->stage) {
+        case FS_SCRUB_FILES:
+            done = fs_scrub_files(&tr, &budget);
+            if (done) {
+                scrub->stage = FS_SCRUB_FREE;
+                scrub->key = 0;
+            }
+            break;
+
+        case FS_SCRUB_FREE:
+            done = fs_scrub_free(&tr, &budget);
+            if (done) {
+                fs_scrub_pass_done(fs);
+                goto out;
+            }
+            break;
+        }
+    } while (done && !tr.failed);
+
+out:
+    if (!tr.failed) {
+        transaction_fail(&tr);
+    }
+    transaction_free(&tr);
+
+    return done;
+}
@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "block_device.h"
+
+struct fs;
+
+/**
+ * enum fs_scrub_stage - Tree checked by the scrubber
+ * @FS_SCRUB_FILES: Files tree, and the file entry and block map of each file.
+ * @FS_SCRUB_FREE:  Free set tree.
+ */
+enum fs_scrub_stage {
+    FS_SCRUB_FILES,
+    FS_SCRUB_FREE,
+};
+
+/**
+ * struct fs_scrub - Incremental integrity check state
+ * @stage:          Tree currently being checked.
+ * @key:            Next key to check in the files or free tree.
+ * @key_skip:       Number of files tree entries with key @key that have
+ *                  already been checked. File entries are keyed by path hash,
+ *                  so keys are not unique in the files tree.
+ * @block_map_key:  Next key to check in the block map of the file at @key, or
+ *                  0 if the file entry has not been checked yet.
+ * @pass:           Number of completed passes.
+ * @checked:        Number of tree entries checked in the current pass.
+ * @errors:         Number of trees or files in the current pass that could not
+ *                  be checked because a block failed to read or had the wrong
+ *                  mac.
+ * @total_errors:   Number of such errors since the file system was loaded.
+ *
+ * The scrubber walks the committed trees of a file system a few entries at a
+ * time. Every node it loads has its mac checked by block_get, so corrupt
+ * metadata is found even if no client reads it, and the nodes that are read
+ * stay in the block cache for the next client request. The position is stored
+ * as tree keys rather than as a path, so the trees can be modified by
+ * transactions that complete between calls to fs_scrub_run.
+ */
+struct fs_scrub {
+    enum fs_scrub_stage stage;
+    data_block_t key;
+    uint key_skip;
+    data_block_t block_map_key;
+    uint pass;
+    uint checked;
+    uint errors;
+    uint total_errors;
+};
+
+void fs_scrub_init(struct fs_scrub *scrub);
+bool fs_scrub_run(struct fs *fs, uint max_entries, uint max_reads);
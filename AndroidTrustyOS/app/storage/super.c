@@ -39,7 +39,14 @@
 #define SUPER_BLOCK_MAGIC (0x0073797473757274) /* trustys */
 #define SUPER_BLOCK_FLAGS_VERSION_MASK (0x3)
 #define SUPER_BLOCK_FLAGS_BLOCK_INDEX_MASK (0x1)
-#define SUPER_BLOCK_FS_VERSION (0)
+
+/*
+ * File system versions:
+ * 0: Block maps store one entry per file block.
+ * 1: Block maps can also store extent entries for runs of consecutive blocks.
+ */
+#define SUPER_BLOCK_FS_VERSION (1)
+#define SUPER_BLOCK_FS_VERSION_BLOCK_MAP_EXTENTS (1)
 
 /**
  * struct super_block - On-disk root block for file system state
@@ -125,7 +132,7 @@ bool update_super_block(struct transaction *tr,
     }
     super_rw->magic = SUPER_BLOCK_MAGIC;
     super_rw->flags = ver;
-    super_rw->fs_version = SUPER_BLOCK_FS_VERSION; /* TODO: keep existing fs version when possible */
+    super_rw->fs_version = tr->fs->fs_version;
     super_rw->block_size = tr->fs->dev->block_size;
     super_rw->block_num_size = tr->fs->block_num_size;
     super_rw->mac_size = tr->fs->mac_size;
@@ -286,18 +293,29 @@ static int fs_init_from_super(struct fs *fs,
     if(super) {
         fs->block_num_size = super->block_num_size;
         fs->mac_size = super->mac_size;
+        fs->fs_version = super->fs_version;
     } else {
         fs->block_num_size = fs->dev->block_num_size;
         fs->mac_size = fs->dev->mac_size;
+        fs->fs_version = SUPER_BLOCK_FS_VERSION;
     }
+    /*
+     * Existing file systems keep their version, and the per-block block map
+     * format that goes with it, until they are cleared.
+     */
+    fs->block_map_extents =
+        fs->fs_version >= SUPER_BLOCK_FS_VERSION_BLOCK_MAP_EXTENTS;
     block_mac_size = fs->block_num_size + fs->mac_size;
     block_set_init(fs, &fs->free);
     fs->free.block_tree.copy_on_write = true;
+    block_free_index_clear(&fs->free_index);
     block_tree_init(&fs->files, fs->dev->block_size,
                     fs->block_num_size,
                     block_mac_size, block_mac_size);
     fs->files.copy_on_write = true;
     fs->files.allow_copy_on_write = true;
+    file_cache_clear(&fs->file_cache);
+    fs_scrub_init(&fs->scrub);
 
     /* Reserve 1/4 for tmp blocks plus half of the remaining space */
     fs->reserved_count = fs->dev->block_count / 8 * 5;
@@ -421,3 +439,16 @@ int fs_init(struct fs *fs,
 
     return 0;
 }
+
+/**
+ * fs_destroy - Destroy file system state
+ * @fs:         File system state object.
+ *
+ * Drop cached blocks of @fs. No transactions can be active. Can also be called
+ * after fs_init failed.
+ */
+void fs_destroy(struct fs *fs)
+{
+    assert(!fs->dev || list_is_empty(&fs->transactions));
+    block_cache_remove_fs(fs);
+}
@@ -0,0 +1,637 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Host benchmark for the storage file system stack.
+ *
+ * Runs file system operations against a simulated block device with optional
+ * read and write latency and bandwidth limits, and reports ops/s and latency
+ * percentiles per operation type. The super blocks can be stored on a separate
+ * simulated RPMB device, like the file systems of the storage app. Block size,
+ * block count and cache size are runtime options, see usage().
+ */
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../block_cache.h"
+#include "../block_cache_priv.h"
+#include "../block_tree.h"
+#include "../crypt.h"
+#include "../debug_stats.h"
+#include "../file.h"
+#include "../transaction.h"
+#include "block_device_sim.h"
+
+#include <time.h>
+
+long gettime(uint32_t clock_id, uint32_t flags, int64_t *time)
+{
+    int ret;
+    struct timespec ts;
+    assert(!clock_id);
+    assert(!flags);
+
+    ret = clock_gettime(CLOCK_MONOTONIC, &ts);
+    assert(!ret);
+    *time = ts.tv_sec * 1000000000LL + ts.tv_nsec;
+
+    return 0;
+}
+
+static int64_t bench_time_ns(void)
+{
+    int64_t time;
+
+    gettime(0, 0, &time);
+    return time;
+}
+
+/**
+ * struct bench_config - Benchmark options
+ * @block_size:         Device block size in bytes.
+ * @block_count:        Device block count.
+ * @cache_size:         Number of block cache entries.
+ * @read_latency_ns:    Simulated latency added to every block read.
+ * @write_latency_ns:   Simulated latency added to every block write.
+ * @read_bytes_per_sec: Simulated read bandwidth, or 0 for no limit.
+ * @write_bytes_per_sec: Simulated write bandwidth, or 0 for no limit.
+ * @rpmb_latency_ns:    Simulated latency of the RPMB device that stores the
+ *                      super blocks, or -1 to store them on the main device.
+ * @ops:                Number of operations per benchmark.
+ * @seed:               Seed for random block and key order.
+ */
+struct bench_config {
+    size_t block_size;
+    data_block_t block_count;
+    uint cache_size;
+    int64_t read_latency_ns;
+    int64_t write_latency_ns;
+    uint64_t read_bytes_per_sec;
+    uint64_t write_bytes_per_sec;
+    int64_t rpmb_latency_ns;
+    uint ops;
+    uint seed;
+};
+
+static struct bench_config config = {
+    .block_size = 2048,
+    .block_count = 4096,
+    .cache_size = BLOCK_CACHE_SIZE,
+    .rpmb_latency_ns = -1,
+    .ops = 256,
+    .seed = 1,
+};
+
+static struct block_device_sim bench_dev;
+static struct block_device_sim bench_rpmb_dev;
+static struct key key;
+
+/**
+ * struct bench_result - Latency samples for one benchmark
+ * @name:       Benchmark name.
+ * @count:      Number of samples.
+ * @total_ns:   Wall time of all timed operations.
+ * @samples:    Latency of each operation.
+ * @reads:      Device reads at start of benchmark.
+ * @writes:     Device writes at start of benchmark.
+ */
+struct bench_result {
+    const char *name;
+    uint count;
+    int64_t total_ns;
+    int64_t *samples;
+    uint64_t reads;
+    uint64_t writes;
+};
+
+static int64_t *bench_samples;
+static int64_t bench_op_start_ns;
+
+static void bench_begin(struct bench_result *res, const char *name)
+{
+    res->name = name;
+    res->count = 0;
+    res->total_ns = 0;
+    res->samples = bench_samples;
+    res->reads = bench_dev.reads;
+    res->writes = bench_dev.writes;
+}
+
+static void bench_op_start(void)
+{
+    bench_op_start_ns = bench_time_ns();
+}
+
+static void bench_op_stop(struct bench_result *res)
+{
+    int64_t ns = bench_time_ns() - bench_op_start_ns;
+
+    assert(res->count < config.ops);
+    res->samples[res->count++] = ns;
+    res->total_ns += ns;
+}
+
+static int bench_cmp_ns(const void *a, const void *b)
+{
+    int64_t ns_a = *(const int64_t *)a;
+    int64_t ns_b = *(const int64_t *)b;
+
+    return (ns_a > ns_b) - (ns_a < ns_b);
+}
+
+static double bench_percentile_us(struct bench_result *res, uint percent)
+{
+    uint index = (res->count * percent + 99) / 100;
+
+    if (index) {
+        index--;
+    }
+    return res->samples[index] / 1000.0;
+}
+
+static void bench_print_header(void)
+{
+    printf("%-14s %6s %10s %10s %10s %10s %10s %8s %8s\n",
+           "benchmark", "ops", "ops/s", "p50 us", "p90 us", "p99 us",
+           "max us", "rd/op", "wr/op");
+}
+
+static void bench_end(struct bench_result *res)
+{
+    if (!res->count) {
+        printf("%-14s %6d\n", res->name, 0);
+        return;
+    }
+    qsort(res->samples, res->count, sizeof(res->samples[0]), bench_cmp_ns);
+    printf("%-14s %6d %10.0f %10.1f %10.1f %10.1f %10.1f %8.2f %8.2f\n",
+           res->name, res->count,
+           res->total_ns ? res->count * 1e9 / res->total_ns : 0.0,
+           bench_percentile_us(res, 50),
+           bench_percentile_us(res, 90),
+           bench_percentile_us(res, 99),
+           res->samples[res->count - 1] / 1000.0,
+           (double)(bench_dev.reads - res->reads) / res->count,
+           (double)(bench_dev.writes - res->writes) / res->count);
+}
+
+static void bench_file_path(char *path, size_t path_size, uint i)
+{
+    snprintf(path, path_size, "bench%u", i);
+}
+
+static void bench_file_create(struct transaction *tr)
+{
+    uint i;
+    bool found;
+    char path[16];
+    struct file_handle file;
+    struct bench_result res;
+
+    bench_begin(&res, "create");
+    for (i = 0; i < config.ops; i++) {
+        bench_file_path(path, sizeof(path), i);
+        bench_op_start();
+        transaction_activate(tr);
+        found = file_open(tr, path, &file, FILE_OPEN_CREATE_EXCLUSIVE);
+        assert(found);
+        file_close(&file);
+        transaction_complete(tr);
+        bench_op_stop(&res);
+        assert(!tr->failed);
+    }
+    bench_end(&res);
+}
+
+static void bench_file_open(struct transaction *tr)
+{
+    uint i;
+    bool found;
+    char path[16];
+    struct file_handle file;
+    struct bench_result res;
+
+    bench_begin(&res, "open");
+    transaction_activate(tr);
+    for (i = 0; i < config.ops; i++) {
+        bench_file_path(path, sizeof(path), rand() % config.ops);
+        bench_op_start();
+        found = file_open(tr, path, &file, FILE_OPEN_NO_CREATE);
+        assert(found);
+        file_close(&file);
+        bench_op_stop(&res);
+    }
+    transaction_complete(tr);
+    assert(!tr->failed);
+    bench_end(&res);
+}
+
+static void bench_file_delete(struct transaction *tr)
+{
+    uint i;
+    bool deleted;
+    char path[16];
+    struct bench_result res;
+
+    bench_begin(&res, "delete");
+    for (i = 0; i < config.ops; i++) {
+        bench_file_path(path, sizeof(path), i);
+        bench_op_start();
+        transaction_activate(tr);
+        deleted = file_delete(tr, path);
+        transaction_complete(tr);
+        bench_op_stop(&res);
+        assert(deleted);
+        assert(!tr->failed);
+    }
+    bench_end(&res);
+}
+
+/**
+ * bench_file_write - Write file blocks in one transaction
+ * @tr:         Transaction.
+ * @file:       File handle.
+ * @name:       Benchmark name.
+ * @random:     %false to write blocks in order, %true for random blocks.
+ * @allocate:   %true if the blocks do not exist yet.
+ */
+static void bench_file_write(struct transaction *tr, struct file_handle *file,
+                             const char *name, bool random, bool allocate)
+{
+    uint i;
+    data_block_t file_block;
+    void *data;
+    obj_ref_t ref = OBJ_REF_INITIAL_VALUE(ref);
+    struct bench_result res;
+    struct bench_result commit_res;
+    size_t file_block_size = get_file_block_size(tr->fs);
+
+    bench_begin(&res, name);
+    transaction_activate(tr);
+    for (i = 0; i < config.ops; i++) {
+        file_block = random ? rand() % config.ops : i;
+        bench_op_start();
+        data = file_get_block_write(tr, file, file_block, !allocate, &ref);
+        assert(data);
+        memset(data, i, file_block_size);
+        file_block_put_dirty(tr, file, file_block, data, &ref);
+        bench_op_stop(&res);
+    }
+    if (file->size < config.ops * file_block_size) {
+        file_set_size(tr, file, config.ops * file_block_size);
+    }
+    bench_end(&res);
+
+    bench_begin(&commit_res, "  commit");
+    bench_op_start();
+    transaction_complete(tr);
+    bench_op_stop(&commit_res);
+    assert(!tr->failed);
+    bench_end(&commit_res);
+}
+
+/**
+ * bench_file_read - Read file blocks
+ * @tr:         Transaction.
+ * @file:       File handle.
+ * @name:       Benchmark name.
+ * @random:     %false to read blocks in order, %true for random blocks.
+ */
+static void bench_file_read(struct transaction *tr, struct file_handle *file,
+                            const char *name, bool random)
+{
+    uint i;
+    data_block_t file_block;
+    const void *data;
+    obj_ref_t ref = OBJ_REF_INITIAL_VALUE(ref);
+    struct bench_result res;
+
+    bench_begin(&res, name);
+    transaction_activate(tr);
+    for (i = 0; i < config.ops; i++) {
+        file_block = random ? rand() % config.ops : i;
+        bench_op_start();
+        file_read_ahead(tr, file, file_block, 1);
+        data = file_get_block(tr, file, file_block, &ref);
+        assert(data);
+        file_block_put(data, &ref);
+        bench_op_stop(&res);
+    }
+    transaction_complete(tr);
+    assert(!tr->failed);
+    bench_end(&res);
+}
+
+/**
+ * bench_commit - Commit transactions that modify a single file block
+ * @tr:         Transaction.
+ * @file:       File handle.
+ */
+static void bench_commit(struct transaction *tr, struct file_handle *file)
+{
+    uint i;
+    void *data;
+    obj_ref_t ref = OBJ_REF_INITIAL_VALUE(ref);
+    struct bench_result res;
+    data_block_t file_block;
+
+    bench_begin(&res, "commit");
+    for (i = 0; i < config.ops; i++) {
+        file_block = rand() % config.ops;
+        transaction_activate(tr);
+        data = file_get_block_write(tr, file, file_block, true, &ref);
+        assert(data);
+        *(uint8_t *)data = i;
+        file_block_put_dirty(tr, file, file_block, data, &ref);
+        bench_op_start();
+        transaction_complete(tr);
+        bench_op_stop(&res);
+        assert(!tr->failed);
+    }
+    bench_end(&res);
+}
+
+static void bench_file_data(struct transaction *tr)
+{
+    bool found;
+    bool deleted;
+    struct file_handle file;
+
+    transaction_activate(tr);
+    found = file_open(tr, "bench_data", &file, FILE_OPEN_CREATE_EXCLUSIVE);
+    assert(found);
+    transaction_complete(tr);
+    assert(!tr->failed);
+
+    bench_file_write(tr, &file, "seq write", false, true);
+    bench_file_read(tr, &file, "seq read", false);
+    bench_file_write(tr, &file, "rand write", true, false);
+    bench_file_read(tr, &file, "rand read", true);
+    bench_commit(tr, &file);
+
+    file_close(&file);
+    transaction_activate(tr);
+    deleted = file_delete(tr, "bench_data");
+    assert(deleted);
+    transaction_complete(tr);
+    assert(!tr->failed);
+}
+
+static void bench_block_tree(struct transaction *tr)
+{
+    uint i;
+    uint pass;
+    uint first;
+    data_block_t key;
+    data_block_t *keys;
+    int64_t *linear_samples;
+    size_t block_mac_size = tr->fs->block_num_size + tr->fs->mac_size;
+    struct block_tree tree = BLOCK_TREE_INITIAL_VALUE(tree);
+    struct block_tree_path path;
+    struct bench_result res;
+    struct bench_result res_linear;
+
+    keys = malloc(sizeof(keys[0]) * config.ops);
+    assert(keys);
+    linear_samples = malloc(sizeof(linear_samples[0]) * config.ops);
+    assert(linear_samples);
+    for (i = 0; i < config.ops; i++) {
+        keys[i] = 1 + (data_block_t)rand() * config.ops + i;
+    }
+
+    block_tree_init(&tree, tr->fs->dev->block_size, tr->fs->block_num_size,
+                    block_mac_size, block_mac_size);
+    tree.copy_on_write = true;
+    tree.allow_copy_on_write = true;
+
+    bench_begin(&res, "tree insert");
+    transaction_activate(tr);
+    for (i = 0; i < config.ops; i++) {
+        bench_op_start();
+        block_tree_insert(tr, &tree, keys[i], i + 1);
+        bench_op_stop(&res);
+        assert(!tr->failed);
+    }
+    transaction_complete(tr);
+    assert(!tr->failed);
+    bench_end(&res);
+
+    /*
+     * Time both node searches on the same keys, in random order, so neither
+     * one always runs with the caches warmed up by the other.
+     */
+    transaction_activate(tr);
+    for (i = 0; i < config.ops; i++) {
+        block_tree_walk(tr, &tree, keys[i], false, &path);
+    }
+    bench_begin(&res, "tree lookup");
+    bench_begin(&res_linear, "  linear");
+    res_linear.samples = linear_samples;
+    for (i = 0; i < config.ops; i++) {
+        key = keys[rand() % config.ops];
+        first = rand() & 1;
+        for (pass = 0; pass < 2; pass++) {
+            block_tree_linear_search = pass != first;
+            bench_op_start();
+            block_tree_walk(tr, &tree, key, false, &path);
+            bench_op_stop(block_tree_linear_search ? &res_linear : &res);
+            assert(block_tree_path_get_key(&path));
+        }
+    }
+    transaction_complete(tr);
+    assert(!tr->failed);
+    bench_end(&res);
+    bench_end(&res_linear);
+    block_tree_linear_search = false;
+
+    free(linear_samples);
+    free(keys);
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  -b <bytes>   block size (%zd)\n"
+            "  -n <count>   block count (%lld)\n"
+            "  -c <count>   block cache entries, at least %d (%d)\n"
+            "  -r <us>      simulated read latency (0)\n"
+            "  -w <us>      simulated write latency (0)\n"
+            "  -R <KiB/s>   simulated read bandwidth (unlimited)\n"
+            "  -W <KiB/s>   simulated write bandwidth (unlimited)\n"
+            "  -p <us>      store super blocks on a simulated RPMB device\n"
+            "               with this read and write latency\n"
+            "  -o <count>   operations per benchmark (%d)\n"
+            "  -s <seed>    random seed (%d)\n",
+            name, config.block_size, config.block_count, BLOCK_CACHE_SIZE_MIN,
+            config.cache_size,
+            config.ops, config.seed);
+}
+
+int main(int argc, char *argv[])
+{
+    int i;
+    const char *arg;
+    uint cache_size;
+    struct fs fs = {
+        .transactions = LIST_INITIAL_VALUE(fs.transactions),
+        .allocated = LIST_INITIAL_VALUE(fs.allocated),
+    };
+    struct transaction tr = {};
+    struct block_device *super_dev;
+    struct block_device_sim_config dev_config;
+
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-h")) {
+            usage(argv[0]);
+            return 0;
+        }
+        if (argv[i][0] != '-' || !argv[i][1] || argv[i][2] || i + 1 >= argc) {
+            usage(argv[0]);
+            return 1;
+        }
+        arg = argv[++i];
+        switch (argv[i - 1][1]) {
+        case 'b':
+            config.block_size = strtoul(arg, NULL, 0);
+            break;
+        case 'n':
+            config.block_count = strtoull(arg, NULL, 0);
+            break;
+        case 'c':
+            config.cache_size = strtoul(arg, NULL, 0);
+            break;
+        case 'r':
+            config.read_latency_ns = strtoll(arg, NULL, 0) * 1000;
+            break;
+        case 'w':
+            config.write_latency_ns = strtoll(arg, NULL, 0) * 1000;
+            break;
+        case 'R':
+            config.read_bytes_per_sec = strtoull(arg, NULL, 0) * 1024;
+            break;
+        case 'W':
+            config.write_bytes_per_sec = strtoull(arg, NULL, 0) * 1024;
+            break;
+        case 'p':
+            config.rpmb_latency_ns = strtoll(arg, NULL, 0) * 1000;
+            break;
+        case 'o':
+            config.ops = strtoul(arg, NULL, 0);
+            break;
+        case 's':
+            config.seed = strtoul(arg, NULL, 0);
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (config.block_size < 256 || config.block_size > MAX_BLOCK_SIZE ||
+        config.block_count < 64 || config.cache_size < BLOCK_CACHE_SIZE_MIN ||
+        !config.ops) {
+        fprintf(stderr, "invalid configuration\n");
+        usage(argv[0]);
+        return 1;
+    }
+
+    dev_config = (struct block_device_sim_config) {
+        .block_count = config.block_count,
+        .block_size = config.block_size,
+        .block_num_size = 8,
+        .mac_size = 16,
+        .read_latency_ns = config.read_latency_ns,
+        .write_latency_ns = config.write_latency_ns,
+        .read_bytes_per_sec = config.read_bytes_per_sec,
+        .write_bytes_per_sec = config.write_bytes_per_sec,
+        /* the super blocks need a tamper detecting device */
+        .rpmb = config.rpmb_latency_ns < 0,
+    };
+    bench_samples = malloc(sizeof(bench_samples[0]) * config.ops);
+    if (!block_device_sim_init(&bench_dev, &dev_config) || !bench_samples) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    super_dev = &bench_dev.dev;
+    if (config.rpmb_latency_ns >= 0) {
+        dev_config = (struct block_device_sim_config) {
+            .block_count = 16,
+            .block_size = 512,
+            .block_num_size = 2,
+            .mac_size = 2,
+            .read_latency_ns = config.rpmb_latency_ns,
+            .write_latency_ns = config.rpmb_latency_ns,
+            .rpmb = true,
+        };
+        if (!block_device_sim_init(&bench_rpmb_dev, &dev_config)) {
+            fprintf(stderr, "out of memory\n");
+            return 1;
+        }
+        super_dev = &bench_rpmb_dev.dev;
+    }
+    srand(config.seed);
+
+    cache_size = block_cache_init(config.cache_size);
+    if (crypt_key_init(&key)) {
+        fprintf(stderr, "key init failed\n");
+        return 1;
+    }
+
+    printf("block size %zd, block count %lld, cache entries %d, "
+           "read latency %lld us, write latency %lld us, "
+           "read bandwidth %lld KiB/s, write bandwidth %lld KiB/s, ops %d\n",
+           config.block_size, config.block_count, cache_size,
+           (long long)config.read_latency_ns / 1000,
+           (long long)config.write_latency_ns / 1000,
+           (long long)config.read_bytes_per_sec / 1024,
+           (long long)config.write_bytes_per_sec / 1024,
+           config.ops);
+    if (super_dev != &bench_dev.dev) {
+        printf("super blocks on rpmb device, latency %lld us\n",
+               (long long)config.rpmb_latency_ns / 1000);
+    }
+
+    fs.dev = &bench_dev.dev;
+    fs_init(&fs, &key, &bench_dev.dev, super_dev, true);
+    transaction_init(&tr, &fs, false);
+
+    bench_print_header();
+    bench_file_create(&tr);
+    bench_file_open(&tr);
+    bench_file_delete(&tr);
+    bench_file_data(&tr);
+    bench_block_tree(&tr);
+
+    stats_timer_print();
+    block_cache_print_stats();
+    block_device_sim_print_stats(&bench_dev, "dev");
+    if (super_dev != &bench_dev.dev) {
+        block_device_sim_print_stats(&bench_rpmb_dev, "rpmb");
+        block_device_sim_destroy(&bench_rpmb_dev);
+    }
+    transaction_free(&tr);
+    fs_destroy(&fs);
+    crypt_key_destroy(&key);
+    free(bench_samples);
+    block_device_sim_destroy(&bench_dev);
+
+    return 0;
+}
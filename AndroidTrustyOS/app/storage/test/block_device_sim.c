@@ -0,0 +1,283 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../block_cache.h"
+#include "block_device_sim.h"
+
+/**
+ * struct block_device_sim_op - Started read or write operation
+ * @node:           List node for &struct block_device_sim->ops.
+ * @block:          Block number.
+ * @write:          %true for write operations, %false for read operations.
+ * @data:           Data to write. Valid until the write completes.
+ * @complete_ns:    Time the operation completes.
+ */
+struct block_device_sim_op {
+    struct list_node node;
+    data_block_t block;
+    bool write;
+    const void *data;
+    int64_t complete_ns;
+};
+
+static int64_t block_device_sim_time_ns(void)
+{
+    int64_t time;
+
+    gettime(0, 0, &time);
+    return time;
+}
+
+static struct block_device_sim *to_block_device_sim(struct block_device *dev)
+{
+    assert(dev);
+    return containerof(dev, struct block_device_sim, dev);
+}
+
+/**
+ * block_device_sim_transfer_ns - Get time needed to transfer one block
+ * @sim:            Simulated block device.
+ * @bytes_per_sec:  Bandwidth, or 0 for no limit.
+ */
+static int64_t block_device_sim_transfer_ns(struct block_device_sim *sim,
+                                            uint64_t bytes_per_sec)
+{
+    if (!bytes_per_sec) {
+        return 0;
+    }
+    return sim->config.block_size * 1000000000ULL / bytes_per_sec;
+}
+
+/**
+ * block_device_sim_start - Queue read or write operation
+ * @sim:        Simulated block device.
+ * @block:      Block number.
+ * @write:      %true for write operations, %false for read operations.
+ * @data:       Data to write, or %NULL for read operations.
+ */
+static void block_device_sim_start(struct block_device_sim *sim,
+                                   data_block_t block, bool write,
+                                   const void *data)
+{
+    struct block_device_sim_op *op;
+    int64_t latency_ns;
+    int64_t transfer_ns;
+
+    assert(block < sim->config.block_count);
+
+    op = malloc(sizeof(*op));
+    assert(op);
+
+    if (write) {
+        latency_ns = sim->config.write_latency_ns;
+        transfer_ns = block_device_sim_transfer_ns(
+                sim, sim->config.write_bytes_per_sec);
+    } else {
+        latency_ns = sim->config.read_latency_ns;
+        transfer_ns = block_device_sim_transfer_ns(
+                sim, sim->config.read_bytes_per_sec);
+    }
+
+    op->block = block;
+    op->write = write;
+    op->data = data;
+    op->complete_ns = MAX(block_device_sim_time_ns() + latency_ns,
+                          sim->busy_until_ns) + transfer_ns;
+    sim->busy_until_ns = op->complete_ns;
+    list_add_tail(&sim->ops, &op->node);
+    sim->queued++;
+    sim->max_queued = MAX(sim->max_queued, sim->queued);
+}
+
+/**
+ * block_device_sim_complete - Complete an operation
+ * @sim:        Simulated block device.
+ * @op:         Operation at the head of @sim->ops.
+ */
+static void block_device_sim_complete(struct block_device_sim *sim,
+                                      struct block_device_sim_op *op)
+{
+    uint8_t *block_data = sim->data + op->block * sim->config.block_size;
+    bool failed = false;
+
+    list_delete(&op->node);
+    sim->queued--;
+
+    if (!op->write) {
+        sim->reads++;
+        block_cache_complete_read(&sim->dev, op->block, block_data,
+                                  sim->config.block_size, false);
+        free(op);
+        return;
+    }
+
+    if (sim->config.rpmb) {
+        if (sim->config.write_counter_max &&
+            sim->write_counter >= sim->config.write_counter_max) {
+            failed = true;
+        } else {
+            sim->write_counter++;
+        }
+    }
+    if (failed) {
+        sim->failed_writes++;
+    } else {
+        sim->writes++;
+        memcpy(block_data, op->data, sim->config.block_size);
+    }
+    block_cache_complete_write(&sim->dev, op->block, failed);
+    free(op);
+}
+
+/**
+ * block_device_sim_poll - Complete operations that are done
+ * @sim:        Simulated block device.
+ *
+ * Call from a simulated event loop to report operations whose completion time
+ * has passed, without waiting for the rest.
+ */
+void block_device_sim_poll(struct block_device_sim *sim)
+{
+    struct block_device_sim_op *op;
+    int64_t now = block_device_sim_time_ns();
+
+    while ((op = list_peek_head_type(&sim->ops, struct block_device_sim_op,
+                                     node))) {
+        if (op->complete_ns > now) {
+            break;
+        }
+        block_device_sim_complete(sim, op);
+    }
+}
+
+static void block_device_sim_start_read(struct block_device *dev,
+                                        data_block_t block)
+{
+    block_device_sim_start(to_block_device_sim(dev), block, false, NULL);
+}
+
+static void block_device_sim_start_write(struct block_device *dev,
+                                         data_block_t block,
+                                         const void *data,
+                                         size_t data_size)
+{
+    struct block_device_sim *sim = to_block_device_sim(dev);
+
+    assert(data_size == sim->config.block_size);
+    block_device_sim_start(sim, block, true, data);
+}
+
+/**
+ * block_device_sim_wait_for_io - Wait for the oldest operation to complete
+ * @dev:        Block device.
+ *
+ * Spins instead of sleeping, as sleep granularity on build hosts is too coarse
+ * for the latencies of interest. Operations that complete at the same time
+ * are reported too.
+ */
+static void block_device_sim_wait_for_io(struct block_device *dev)
+{
+    struct block_device_sim *sim = to_block_device_sim(dev);
+    struct block_device_sim_op *op;
+
+    op = list_peek_head_type(&sim->ops, struct block_device_sim_op, node);
+    assert(op);
+    while (block_device_sim_time_ns() < op->complete_ns) {
+    }
+    block_device_sim_poll(sim);
+}
+
+/**
+ * block_device_sim_submit_io - Let started reads complete in the background
+ * @dev:        Block device.
+ *
+ * Operations are in progress as soon as they are started, so there is nothing
+ * to send.
+ *
+ * Return: %true if any operations have not completed yet.
+ */
+static bool block_device_sim_submit_io(struct block_device *dev)
+{
+    return !list_is_empty(&to_block_device_sim(dev)->ops);
+}
+
+/**
+ * block_device_sim_init - Initialize simulated block device
+ * @sim:        Simulated block device.
+ * @config:     Device parameters.
+ *
+ * Return: %true if the device was initialized, %false if out of memory.
+ */
+bool block_device_sim_init(struct block_device_sim *sim,
+                           const struct block_device_sim_config *config)
+{
+    memset(sim, 0, sizeof(*sim));
+    sim->config = *config;
+    sim->data = calloc(config->block_count, config->block_size);
+    if (!sim->data) {
+        return false;
+    }
+    list_initialize(&sim->ops);
+
+    sim->dev.start_read = block_device_sim_start_read;
+    sim->dev.start_write = block_device_sim_start_write;
+    sim->dev.wait_for_io = block_device_sim_wait_for_io;
+    sim->dev.submit_io = block_device_sim_submit_io;
+    sim->dev.block_count = config->block_count;
+    sim->dev.block_size = config->block_size;
+    sim->dev.block_num_size = config->block_num_size;
+    sim->dev.mac_size = config->mac_size;
+    sim->dev.tamper_detecting = config->rpmb;
+    list_initialize(&sim->dev.io_ops);
+
+    return true;
+}
+
+/**
+ * block_device_sim_destroy - Free simulated block device
+ * @sim:        Simulated block device. Must not have operations in progress.
+ */
+void block_device_sim_destroy(struct block_device_sim *sim)
+{
+    assert(list_is_empty(&sim->ops));
+    free(sim->data);
+    sim->data = NULL;
+}
+
+/**
+ * block_device_sim_print_stats - Print operation counts
+ * @sim:        Simulated block device.
+ * @name:       Device name to print.
+ */
+void block_device_sim_print_stats(struct block_device_sim *sim,
+                                  const char *name)
+{
+    printf("%s: %lld reads, %lld writes, max queued %d",
+           name, (long long)sim->reads, (long long)sim->writes,
+           sim->max_queued);
+    if (sim->config.rpmb) {
+        printf(", write counter %d, failed writes %lld",
+               sim->write_counter, (long long)sim->failed_writes);
+    }
+    printf("\n");
+}
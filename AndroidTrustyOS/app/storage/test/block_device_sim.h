@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <list.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "../block_device.h"
+
+/**
+ * struct block_device_sim_config - Simulated block device parameters
+ * @block_count:            Number of blocks.
+ * @block_size:             Number of bytes per block.
+ * @block_num_size:         Number of bytes used to store block numbers.
+ * @mac_size:               Number of bytes used to store mac values.
+ * @read_latency_ns:        Time from start of a read until its data transfer
+ *                          can start.
+ * @write_latency_ns:       Time from start of a write until its data transfer
+ *                          can start.
+ * @read_bytes_per_sec:     Read bandwidth, or 0 for no limit.
+ * @write_bytes_per_sec:    Write bandwidth, or 0 for no limit.
+ * @rpmb:                   %true to simulate an RPMB partition. The device is
+ *                          tamper detecting and every write increments a write
+ *                          counter.
+ * @write_counter_max:      If @rpmb is %true, fail all writes once the write
+ *                          counter has reached this value, like an RPMB
+ *                          partition that has worn out its counter. 0 for no
+ *                          limit.
+ */
+struct block_device_sim_config {
+    data_block_t block_count;
+    size_t block_size;
+    size_t block_num_size;
+    size_t mac_size;
+    int64_t read_latency_ns;
+    int64_t write_latency_ns;
+    uint64_t read_bytes_per_sec;
+    uint64_t write_bytes_per_sec;
+    bool rpmb;
+    uint32_t write_counter_max;
+};
+
+/**
+ * struct block_device_sim - In-memory block device with simulated timing
+ * @dev:            Block device.
+ * @config:         Device parameters.
+ * @data:           Block data, @config.block_count blocks of
+ *                  @config.block_size bytes.
+ * @ops:            Started operations that have not completed, in the order
+ *                  they were started.
+ * @busy_until_ns:  Time the last operation in @ops completes.
+ * @queued:         Number of operations in @ops.
+ * @max_queued:     Largest number of operations that were in @ops at once.
+ * @reads:          Number of blocks read.
+ * @writes:         Number of blocks written.
+ * @failed_writes:  Number of writes that failed because the write counter
+ *                  reached @config.write_counter_max.
+ * @write_counter:  RPMB write counter.
+ *
+ * Operations complete asynchronously. Latencies of queued operations overlap,
+ * but data transfers are serialized at the configured bandwidth, so a batch
+ * of reads started together costs one latency plus the transfer time of every
+ * block. Completed operations are reported to the block cache from
+ * @dev.wait_for_io or block_device_sim_poll, in the order they were started.
+ */
+struct block_device_sim {
+    struct block_device dev;
+    struct block_device_sim_config config;
+    uint8_t *data;
+    struct list_node ops;
+    int64_t busy_until_ns;
+    uint queued;
+    uint max_queued;
+    uint64_t reads;
+    uint64_t writes;
+    uint64_t failed_writes;
+    uint32_t write_counter;
+};
+
+bool block_device_sim_init(struct block_device_sim *sim,
+                           const struct block_device_sim_config *config);
+void block_device_sim_destroy(struct block_device_sim *sim);
+void block_device_sim_poll(struct block_device_sim *sim);
+void block_device_sim_print_stats(struct block_device_sim *sim,
+                                  const char *name);
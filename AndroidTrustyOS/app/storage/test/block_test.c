@@ -25,6 +25,7 @@
 
 #include "../block_allocator.h"
 #include "../block_cache.h"
+#include "../block_cache_priv.h"
 #include "../block_map.h"
 #include "../block_set.h"
 #include "../debug_stats.h"
@@ -96,27 +97,69 @@ struct block {
     data_block_t used_by_block;
 };
 static struct block blocks[BLOCK_COUNT];
-static const struct key key;
+static struct key key;
+
+/* Separate device used by file_extent_size_test, large enough for 1MiB files */
+#define EXTENT_TEST_BLOCK_COUNT (1024)
+static struct block extent_test_blocks[EXTENT_TEST_BLOCK_COUNT];
+static struct block_device extent_test_dev;
 
 static bool print_test_verbose = false;
 static bool print_block_tree_test_verbose = false;
 
+static struct block *block_test_get(struct block_device *dev,
+                                    data_block_t block)
+{
+    if (dev == &extent_test_dev) {
+        assert(block < countof(extent_test_blocks));
+        return &extent_test_blocks[block];
+    }
+    assert(block < countof(blocks));
+    return &blocks[block];
+}
+
+static data_block_t block_test_written;
+
 static void block_test_start_read(struct block_device *dev, data_block_t block)
 {
     assert(dev->block_size <= BLOCK_SIZE);
-    assert(block < countof(blocks));
-    block_cache_complete_read(dev, block, blocks[block].data, dev->block_size, false);
+    block_cache_complete_read(dev, block, block_test_get(dev, block)->data,
+                              dev->block_size, false);
 }
 
 static void block_test_start_write(struct block_device *dev, data_block_t block,
                                    const void *data, size_t data_size)
 {
-    assert(block < countof(blocks));
-    assert(data_size <= sizeof(blocks[block].data));
-    memcpy(blocks[block].data, data, data_size);
+    struct block *b = block_test_get(dev, block);
+
+    assert(data_size <= sizeof(b->data));
+    memcpy(b->data, data, data_size);
+    block_test_written++;
     block_cache_complete_write(dev, block, false);
 }
 
+static data_block_t block_test_discarded;
+
+/*
+ * Overwrite discarded blocks so any later read that is not preceded by a write
+ * fails the mac check.
+ */
+static void block_test_discard(struct block_device *dev,
+                               const struct block_range *ranges,
+                               unsigned int count)
+{
+    data_block_t block;
+
+    for (; count; ranges++, count--) {
+        assert(!block_range_empty(*ranges));
+        for (block = ranges->start; block < ranges->end; block++) {
+            memset(block_test_get(dev, block)->data, 0xdd,
+                   sizeof(blocks[0].data));
+            block_test_discarded++;
+        }
+    }
+}
+
 #if FULL_ASSERT
 static void block_clear_used_by(void)
 {
@@ -176,13 +219,28 @@ static void mark_files_in_use(struct transaction *tr)
                              const struct block_mac *file);
 
     struct block_tree_path path;
+    struct block_tree_path map_path;
     struct block_map block_map;
+    data_block_t file;
+    data_block_t start;
+    uint count;
 
     block_tree_walk(tr, &tr->fs->files, 0, true, &path);
     while (block_tree_path_get_key(&path)) {
         struct block_mac block_mac = block_tree_path_get_data_block_mac(&path);
+        file = block_mac_to_block(tr, &block_mac);
         file_block_map_init(tr, &block_map, &block_mac);
-        mark_block_tree_in_use(tr, &block_map.tree, true, "file", block_mac_to_block(tr, &block_mac));
+        mark_block_tree_in_use(tr, &block_map.tree, true, "file", file);
+
+        /* mark data blocks of extent entries */
+        block_tree_walk(tr, &block_map.tree, 0, true, &map_path);
+        while ((count = block_map_path_get_blocks(tr, &block_map, &map_path,
+                                                  &start))) {
+            while (count--) {
+                block_set_used_by(start + count, "file", file);
+            }
+            block_tree_path_next(&map_path);
+        }
         block_tree_path_next(&path);
     }
 }
@@ -436,6 +494,94 @@ static void block_tree_test(struct transaction *tr)
     }
 }
 
+static int64_t block_tree_search_time_lookups(struct transaction *tr,
+                                              struct block_tree *tree,
+                                              data_block_t max_key,
+                                              uint repeat)
+{
+    uint i;
+    data_block_t key;
+    int64_t start;
+    int64_t end;
+    struct block_tree_path path;
+
+    gettime(0, 0, &start);
+    for (i = 0; i < repeat; i++) {
+        for (key = 1; key <= max_key; key++) {
+            block_tree_walk(tr, tree, key, false, &path);
+        }
+    }
+    gettime(0, 0, &end);
+
+    return end - start;
+}
+
+static void block_tree_search_test(struct transaction *tr)
+{
+    size_t key_size;
+    data_block_t key;
+    data_block_t max_key;
+    data_block_t linear_key;
+    data_block_t linear_data;
+    data_block_t linear_prev_key;
+    struct block_tree tree;
+    struct block_tree_path path;
+    uint count;
+    uint i;
+    const uint repeat = 20;
+    int64_t linear_ns;
+    int64_t binary_ns;
+    int64_t ns;
+
+    for (key_size = 1; key_size <= sizeof(data_block_t); key_size++) {
+        tree = (struct block_tree)BLOCK_TREE_INITIAL_VALUE(tree);
+        block_tree_init(&tree, tr->fs->dev->block_size, key_size,
+                        sizeof(struct block_mac), key_size);
+
+        /* insert even keys so every odd key falls between two entries */
+        count = MIN(tree.key_count[1] * 4, 127U);
+        for (i = 1; i <= count; i++) {
+            block_tree_insert(tr, &tree, i * 2, i);
+            assert(!tr->failed);
+        }
+        max_key = count * 2 + 1;
+
+        for (key = 1; key <= max_key; key++) {
+            block_tree_linear_search = true;
+            block_tree_walk(tr, &tree, key, false, &path);
+            linear_key = block_tree_path_get_key(&path);
+            linear_data = block_tree_path_get_data(&path);
+            linear_prev_key = path.entry[path.count - 1].prev_key;
+
+            block_tree_linear_search = false;
+            block_tree_walk(tr, &tree, key, false, &path);
+            assert(block_tree_path_get_key(&path) == linear_key);
+            assert(block_tree_path_get_data(&path) == linear_data);
+            assert(path.entry[path.count - 1].prev_key == linear_prev_key);
+            assert(linear_key == (key + 1) / 2 * 2 || key == max_key);
+        }
+
+        /* alternate which search runs first, so neither gets warmer caches */
+        linear_ns = 0;
+        binary_ns = 0;
+        for (i = 0; i < repeat * 2; i++) {
+            block_tree_linear_search = (i ^ (i / 2)) & 1;
+            ns = block_tree_search_time_lookups(tr, &tree, max_key, 1);
+            if (block_tree_linear_search) {
+                linear_ns += ns;
+            } else {
+                binary_ns += ns;
+            }
+        }
+        block_tree_linear_search = false;
+
+        printf("%s: key size %zd, %zd keys per leaf, %lld lookups, "
+               "linear %lld ns, binary %lld ns\n",
+               __func__, key_size, tree.key_count[1], repeat * max_key,
+               (long long)linear_ns, (long long)binary_ns);
+    }
+}
+
 static void block_set_test(struct transaction *tr)
 {
     struct block_set sets[3];
@@ -690,6 +836,59 @@ static void allocate_frag_test(struct transaction *tr)
 #endif
 }
 
+static void block_free_index_check(struct transaction *tr)
+{
+    data_block_t block;
+    data_block_t expected;
+
+    for (block = 0; block <= tr->fs->dev->block_count; block++) {
+        expected = block_set_find_next_block(tr, &tr->fs->free, block, true);
+        assert(block_free_index_find_next(tr, block) == expected);
+        assert(!tr->failed);
+    }
+    for (block = tr->fs->dev->block_count; block > 0; block--) {
+        expected = block_set_find_next_block(tr, &tr->fs->free, block, true);
+        assert(block_free_index_find_next(tr, block) == expected);
+        assert(!tr->failed);
+    }
+}
+
+static void block_free_index_test(struct transaction *tr)
+{
+    int i;
+    data_block_t blocks[4];
+    struct block_free_index *index = &tr->fs->free_index;
+
+    block_free_index_clear(index);
+    block_free_index_check(tr);
+    assert(index->valid);
+    if (print_test_verbose) {
+        printf("%s: %d free ranges indexed, %lld-%lld\n",
+               __func__, index->count, index->start, index->end - 1);
+    }
+
+    /* The index should be updated, not rebuilt, when a transaction commits */
+    for (i = 0; i < countof(blocks); i++) {
+        blocks[i] = block_allocate(tr);
+        assert(!tr->failed);
+    }
+    transaction_complete(tr);
+    assert(!tr->failed);
+    assert(index->valid);
+    transaction_activate(tr);
+    block_free_index_check(tr);
+
+    for (i = 0; i < countof(blocks); i++) {
+        block_free(tr, blocks[i]);
+        assert(!tr->failed);
+    }
+    transaction_complete(tr);
+    assert(!tr->failed);
+    assert(index->valid);
+    transaction_activate(tr);
+    block_free_index_check(tr);
+}
+
 static void allocate_free_same_test(struct transaction *tr)
 {
     int i;
@@ -1024,6 +1223,7 @@ static void file_test_open(struct transaction *tr,
 
     if (read) {
         for (i = 0;; i++) {
+            file_read_ahead(tr, file, i, 1);
             block_data_ro = file_get_block(tr, file, i, &ref);
             if (!block_data_ro) {
                 break;
@@ -1223,6 +1423,535 @@ static void file_read_after_delete_test(struct transaction *tr)
 static const int file_test_block_count = BLOCK_SIZE > 64 ? 40 : 10;
 static const int file_test_many_file_count = BLOCK_SIZE > 80 ? 40 : 10;
 
+static const struct file_cache_entry *file_cache_test_find(struct transaction *tr,
+                                                          const char *path)
+{
+    const struct file_cache_entry *entry;
+    const struct file_cache *cache = &tr->fs->file_cache;
+
+    for (entry = cache->entries;
+         entry < cache->entries + countof(cache->entries); entry++) {
+        if (block_mac_valid(tr, &entry->block_mac) &&
+            !strcmp(entry->path, path)) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+static void file_cache_test(struct transaction *tr)
+{
+    const char *path = "test_cache";
+    struct file_handle file;
+    const struct file_cache_entry *entry;
+    obj_ref_t ref = OBJ_REF_INITIAL_VALUE(ref);
+    void *block_data_rw;
+    data_block_t old_block;
+
+    /* files created by a transaction are not cached */
+    open_test_file(tr, &file, path, FILE_OPEN_CREATE_EXCLUSIVE);
+    assert(!file_cache_test_find(tr, path));
+    block_data_rw = file_get_block_write(tr, &file, 0, false, &ref);
+    file_block_put_dirty(tr, &file, 0, block_data_rw, &ref);
+    file_close(&file);
+    transaction_complete(tr);
+    assert(!tr->failed);
+
+    /* first open caches committed file, second open uses cache */
+    transaction_activate(tr);
+    open_test_file(tr, &file, path, FILE_OPEN_NO_CREATE);
+    entry = file_cache_test_find(tr, path);
+    assert(entry);
+    assert(block_mac_same_block(tr, &entry->block_mac, &file.block_mac));
+    old_block = block_mac_to_block(tr, &file.block_mac);
+    file_close(&file);
+    open_test_file(tr, &file, path, FILE_OPEN_NO_CREATE);
+    assert(block_mac_to_block(tr, &file.block_mac) == old_block);
+
+    /* commit that moves the file entry updates the cache */
+    block_data_rw = file_get_block_write(tr, &file, 0, true, &ref);
+    file_block_put_dirty(tr, &file, 0, block_data_rw, &ref);
+    file_close(&file);
+    transaction_complete(tr);
+    assert(!tr->failed);
+    entry = file_cache_test_find(tr, path);
+    assert(entry);
+    assert(block_mac_to_block(tr, &entry->block_mac) != old_block);
+
+    transaction_activate(tr);
+    open_test_file(tr, &file, path, FILE_OPEN_NO_CREATE);
+    assert(block_mac_same_block(tr, &entry->block_mac, &file.block_mac));
+    file_close(&file);
+
+    /* deleted file is not found before or after commit */
+    assert(file_delete(tr, path));
+    open_test_file_etc(tr, &file, path, FILE_OPEN_NO_CREATE, true);
+    transaction_complete(tr);
+    assert(!tr->failed);
+    assert(!file_cache_test_find(tr, path));
+
+    transaction_activate(tr);
+    open_test_file_etc(tr, &file, path, FILE_OPEN_NO_CREATE, true);
+}
+
+static void file_extent_test(struct transaction *tr)
+{
+    const char *path = "test_extent";
+    struct file_handle file;
+    obj_ref_t ref = OBJ_REF_INITIAL_VALUE(ref);
+    const uint8_t *block_data_ro;
+    uint8_t *block_data_rw;
+    data_block_t i;
+    const data_block_t count = FILE_EXTENT_CACHE_BLOCKS + 4;
+
+    open_test_file(tr, &file, path, FILE_OPEN_CREATE_EXCLUSIVE);
+    for (i = 0; i < count; i++) {
+        block_data_rw = file_get_block_write(tr, &file, i, false, &ref);
+        assert(block_data_rw);
+        block_data_rw[0] = i;
+        file_block_put_dirty(tr, &file, i, block_data_rw, &ref);
+    }
+    transaction_complete(tr);
+    assert(!tr->failed);
+
+    /* read all blocks, then overwrite blocks covered by the cached extent */
+    transaction_activate(tr);
+    for (i = 0; i < count; i++) {
+        block_data_ro = file_get_block(tr, &file, i, &ref);
+        assert(block_data_ro);
+        assert(block_data_ro[0] == i);
+        file_block_put(block_data_ro, &ref);
+        assert(file.extent_count);
+    }
+    for (i = 0; i < count; i += 3) {
+        block_data_ro = file_get_block(tr, &file, i, &ref);
+        assert(block_data_ro);
+        file_block_put(block_data_ro, &ref);
+
+        block_data_rw = file_get_block_write(tr, &file, i, true, &ref);
+        assert(block_data_rw);
+        block_data_rw[0] = i + 1;
+        file_block_put_dirty(tr, &file, i, block_data_rw, &ref);
+        assert(file.dirty_count == i / 3 + 1);
+    }
+
+    /* reads must see the moved blocks and their new macs */
+    for (i = 0; i < count; i++) {
+        block_data_ro = file_get_block(tr, &file, i, &ref);
+        assert(block_data_ro);
+        assert(block_data_ro[0] == i + !(i % 3));
+        file_block_put(block_data_ro, &ref);
+    }
+    transaction_complete(tr);
+    assert(!tr->failed);
+
+    transaction_activate(tr);
+    for (i = 0; i < count; i++) {
+        block_data_ro = file_get_block(tr, &file, i, &ref);
+        assert(block_data_ro);
+        assert(block_data_ro[0] == i + !(i % 3));
+        file_block_put(block_data_ro, &ref);
+    }
+    file_close(&file);
+    assert(file_delete(tr, path));
+}
+
+static void file_dirty_test(struct transaction *tr)
+{
+    const char *path = "test_dirty";
+    struct file_handle file;
+    obj_ref_t ref = OBJ_REF_INITIAL_VALUE(ref);
+    const uint8_t *block_data_ro;
+    uint8_t *block_data_rw;
+    struct block_mac block_mac;
+    data_block_t i;
+    const data_block_t count = FILE_DIRTY_BLOCKS + 2;
+    size_t block_size = get_file_block_size(tr->fs);
+
+    open_test_file(tr, &file, path, FILE_OPEN_CREATE_EXCLUSIVE);
+    transaction_complete(tr);
+    assert(!tr->failed);
+
+    /* rewrite and grow without touching the file entry */
+    transaction_activate(tr);
+    block_mac = file.block_mac;
+    for (i = 0; i < 3; i++) {
+        block_data_rw = file_get_block_write(tr, &file, 0, i, &ref);
+        assert(block_data_rw);
+        block_data_rw[0] = i;
+        file_block_put_dirty(tr, &file, 0, block_data_rw, &ref);
+    }
+    file_set_size(tr, &file, block_size);
+    assert(file.dirty_count == 1);
+    assert(file.dirty_size);
+    assert(block_mac_eq(tr, &block_mac, &file.block_mac));
+    block_data_ro = file_get_block(tr, &file, 0, &ref);
+    assert(block_data_ro);
+    assert(block_data_ro[0] == 2);
+    file_block_put(block_data_ro, &ref);
+
+    /* failed transaction drops deferred blocks and size */
+    transaction_fail(tr);
+    assert(!file.dirty_count);
+    assert(file.size == 0);
+
+    /* append more blocks than fit in file.dirty */
+    transaction_activate(tr);
+    for (i = 0; i < count; i++) {
+        block_data_rw = file_get_block_write(tr, &file, i, false, &ref);
+        assert(block_data_rw);
+        block_data_rw[0] = i;
+        file_block_put_dirty(tr, &file, i, block_data_rw, &ref);
+        file_set_size(tr, &file, (i + 1) * block_size);
+    }
+    assert(file.dirty_count == count - FILE_DIRTY_BLOCKS);
+    transaction_complete(tr);
+    assert(!tr->failed);
+    assert(!file.dirty_count);
+    assert(file.size == count * block_size);
+
+    transaction_activate(tr);
+    for (i = 0; i < count; i++) {
+        block_data_ro = file_get_block(tr, &file, i, &ref);
+        assert(block_data_ro);
+        assert(block_data_ro[0] == i);
+        file_block_put(block_data_ro, &ref);
+    }
+    file_close(&file);
+    assert(file_delete(tr, path));
+}
+
+static void file_discard_test(struct transaction *tr)
+{
+    const char *path = "test_discard";
+    struct file_handle file;
+    obj_ref_t ref = OBJ_REF_INITIAL_VALUE(ref);
+    uint8_t *block_data_rw;
+    data_block_t i;
+    data_block_t discarded;
+    const data_block_t count = 4;
+
+    open_test_file(tr, &file, path, FILE_OPEN_CREATE_EXCLUSIVE);
+    for (i = 0; i < count; i++) {
+        block_data_rw = file_get_block_write(tr, &file, i, false, &ref);
+        assert(block_data_rw);
+        file_block_put_dirty(tr, &file, i, block_data_rw, &ref);
+    }
+    file_close(&file);
+    transaction_complete(tr);
+    assert(!tr->failed);
+
+    /* data blocks, file entry and block map are discarded on delete */
+    discarded = block_test_discarded;
+    transaction_activate(tr);
+    assert(file_delete(tr, path));
+    transaction_complete(tr);
+    assert(!tr->failed);
+    assert(block_test_discarded >= discarded + count + 1);
+    transaction_activate(tr);
+}
+
+/* Count tree nodes, entries and extent entries in the block map of @file */
+static void file_block_map_stats(struct transaction *tr,
+                                 struct file_handle *file,
+                                 uint *nodes,
+                                 uint *entries,
+                                 uint *extents)
+{
+    void file_block_map_init(struct transaction *tr,
+                             struct block_map *block_map,
+                             const struct block_mac *file);
+
+    struct block_map block_map;
+    struct block_tree_path path;
+    data_block_t node[BLOCK_TREE_MAX_DEPTH] = {0};
+    data_block_t block;
+    data_block_t start;
+    uint i;
+
+    *nodes = 0;
+    *entries = 0;
+    *extents = 0;
+    file_block_map_init(tr, &block_map, &file->block_mac);
+    block_tree_walk(tr, &block_map.tree, 0, true, &path);
+    while (block_map_path_get_blocks(tr, &block_map, &path, &start)) {
+        for (i = 0; i < path.count; i++) {
+            block = block_mac_to_block(tr, &path.entry[i].block_mac);
+            if (block != node[i]) {
+                node[i] = block;
+                (*nodes)++;
+            }
+        }
+        (*entries)++;
+        if (block_tree_path_get_data(&path) != start) {
+            (*extents)++;
+        }
+        block_tree_path_next(&path);
+    }
+    assert(!tr->failed);
+}
+
+static void file_extent_test_write(struct transaction *tr,
+                                   struct file_handle *file,
+                                   data_block_t start,
+                                   data_block_t count,
+                                   uint8_t value)
+{
+    uint8_t *block_data_rw;
+    obj_ref_t ref = OBJ_REF_INITIAL_VALUE(ref);
+    data_block_t i;
+
+    for (i = start; i < start + count; i++) {
+        block_data_rw = file_get_block_write(tr, file, i, false, &ref);
+        assert(block_data_rw);
+        block_data_rw[0] = i;
+        block_data_rw[1] = value;
+        file_block_put_dirty(tr, file, i, block_data_rw, &ref);
+    }
+}
+
+static void file_extent_test_check(struct transaction *tr,
+                                   struct file_handle *file,
+                                   data_block_t count,
+                                   const uint8_t *values)
+{
+    const uint8_t *block_data_ro;
+    obj_ref_t ref = OBJ_REF_INITIAL_VALUE(ref);
+    data_block_t i;
+
+    for (i = 0; i < count; i++) {
+        block_data_ro = file_get_block(tr, file, i, &ref);
+        assert(block_data_ro);
+        assert(block_data_ro[0] == (uint8_t)i);
+        assert(block_data_ro[1] == values[i]);
+        file_block_put(block_data_ro, &ref);
+    }
+    block_data_ro = file_get_block(tr, file, count, &ref);
+    assert(!block_data_ro);
+}
+
+/*
+ * Check that the block map of @file has one entry for each run of consecutive
+ * disk blocks in the first @count file blocks, and an extent for each run that
+ * is longer than one block.
+ */
+static void file_extent_test_check_map(struct transaction *tr,
+                                       struct file_handle *file,
+                                       data_block_t count)
+{
+    void file_block_map_init(struct transaction *tr,
+                             struct block_map *block_map,
+                             const struct block_mac *file);
+
+    struct block_map block_map;
+    struct block_mac block_mac;
+    data_block_t i;
+    data_block_t block;
+    data_block_t prev_block = 0;
+    data_block_t run = 0;
+    uint runs = 0;
+    uint long_runs = 0;
+    uint nodes;
+    uint entries;
+    uint extents;
+
+    file_block_map_init(tr, &block_map, &file->block_mac);
+    for (i = 0; i < count; i++) {
+        assert(block_map_get(tr, &block_map, i, &block_mac));
+        block = block_mac_to_block(tr, &block_mac);
+        if (i && block == prev_block + 1) {
+            run++;
+        } else {
+            runs++;
+            run = 1;
+        }
+        if (run == 2) {
+            long_runs++;
+        }
+        prev_block = block;
+    }
+    file_block_map_stats(tr, file, &nodes, &entries, &extents);
+    assert(entries == runs);
+    assert(extents == long_runs);
+}
+
+static void file_extent_split_test(struct transaction *tr)
+{
+    const char *path = "test_extent_split";
+    struct file_handle file;
+    uint8_t values[8] = {0};
+    size_t block_size = get_file_block_size(tr->fs);
+
+    assert(tr->fs->block_map_extents);
+
+    /* blocks written in order are stored in extents */
+    open_test_file(tr, &file, path, FILE_OPEN_CREATE_EXCLUSIVE);
+    file_extent_test_write(tr, &file, 0, 8, 0);
+    file_set_size(tr, &file, 8 * block_size);
+    transaction_complete(tr);
+    assert(!tr->failed);
+    transaction_activate(tr);
+    file_extent_test_check_map(tr, &file, 8);
+    file_extent_test_check(tr, &file, 8, values);
+
+    /* moving a block in the middle splits the extent around it */
+    file_extent_test_write(tr, &file, 3, 1, 1);
+    values[3] = 1;
+    transaction_complete(tr);
+    assert(!tr->failed);
+    transaction_activate(tr);
+    file_extent_test_check_map(tr, &file, 8);
+    file_extent_test_check(tr, &file, 8, values);
+
+    /* truncating into an extent shortens it, down to a per-block entry */
+    file_set_size(tr, &file, 6 * block_size);
+    file_extent_test_check_map(tr, &file, 6);
+    file_extent_test_check(tr, &file, 6, values);
+    file_set_size(tr, &file, 5 * block_size);
+    file_extent_test_check_map(tr, &file, 5);
+    file_extent_test_check(tr, &file, 5, values);
+    transaction_complete(tr);
+    assert(!tr->failed);
+
+    /* rewriting all blocks in order moves them into new extents */
+    transaction_activate(tr);
+    file_extent_test_write(tr, &file, 0, 5, 2);
+    memset(values, 2, sizeof(values));
+    transaction_complete(tr);
+    assert(!tr->failed);
+    transaction_activate(tr);
+    file_extent_test_check_map(tr, &file, 5);
+    file_extent_test_check(tr, &file, 5, values);
+
+    file_close(&file);
+    assert(file_delete(tr, path));
+}
+
+static struct block_device extent_test_dev = {
+    .start_read = block_test_start_read,
+    .start_write = block_test_start_write,
+    .discard = block_test_discard,
+    .block_count = EXTENT_TEST_BLOCK_COUNT,
+    .block_size = 2048,
+    .block_num_size = 8,
+    .mac_size = 16,
+    .tamper_detecting = true,
+    .io_ops = LIST_INITIAL_VALUE(extent_test_dev.io_ops),
+};
+
+struct file_extent_size_stats {
+    uint nodes;
+    uint extents;
+    uint commits;
+    data_block_t metadata_writes;
+};
+
+/*
+ * Write a 1MiB file in order, 64 blocks per transaction, on a new file system
+ * with or without block map extents, and count the block map blocks and the
+ * non-data blocks written by each commit.
+ */
+static void file_extent_size_test_etc(bool extents,
+                                      struct file_extent_size_stats *stats)
+{
+    const char *path = "test_extent_size";
+    const data_block_t file_size = 1024 * 1024;
+    struct fs fs = {};
+    struct transaction tr = {};
+    struct file_handle file;
+    obj_ref_t ref = OBJ_REF_INITIAL_VALUE(ref);
+    uint8_t *block_data_rw;
+    const uint8_t *block_data_ro;
+    data_block_t block_count;
+    data_block_t written;
+    data_block_t i;
+    data_block_t j;
+    size_t block_size;
+    uint entries;
+    int ret;
+
+    memset(stats, 0, sizeof(*stats));
+
+    ret = fs_init(&fs, &key, &extent_test_dev, &extent_test_dev, true);
+    assert(!ret);
+    assert(fs.block_map_extents);
+    if (!extents) {
+        /* create the file system in the format of version 0 */
+        fs.fs_version = 0;
+        fs.block_map_extents = false;
+    }
+    fs.reserved_count = 18; /* HACK: override default reserved space */
+    transaction_init(&tr, &fs, true);
+    block_size = get_file_block_size(&fs);
+    block_count = (file_size + block_size - 1) / block_size;
+
+    open_test_file(&tr, &file, path, FILE_OPEN_CREATE_EXCLUSIVE);
+    transaction_complete(&tr);
+    assert(!tr.failed);
+
+    for (i = 0; i < block_count; i += j) {
+        transaction_activate(&tr);
+        written = block_test_written;
+        for (j = 0; j < 64 && i + j < block_count; j++) {
+            block_data_rw = file_get_block_write(&tr, &file, i + j, false,
+                                                 &ref);
+            assert(block_data_rw);
+            block_data_rw[0] = i + j;
+            file_block_put_dirty(&tr, &file, i + j, block_data_rw, &ref);
+        }
+        file_set_size(&tr, &file, MIN(file_size, (i + j) * block_size));
+        transaction_complete(&tr);
+        assert(!tr.failed);
+        stats->metadata_writes += block_test_written - written - j;
+        stats->commits++;
+    }
+    file_close(&file);
+    transaction_free(&tr);
+
+    /* the file system keeps its version when it is mounted again */
+    ret = fs_init(&fs, &key, &extent_test_dev, &extent_test_dev, false);
+    assert(!ret);
+    assert(fs.block_map_extents == extents);
+    fs.reserved_count = 18; /* HACK: override default reserved space */
+    transaction_init(&tr, &fs, true);
+    open_test_file(&tr, &file, path, FILE_OPEN_NO_CREATE);
+    assert(file.size == file_size);
+    for (i = 0; i < block_count; i++) {
+        block_data_ro = file_get_block(&tr, &file, i, &ref);
+        assert(block_data_ro);
+        assert(block_data_ro[0] == (uint8_t)i);
+        file_block_put(block_data_ro, &ref);
+    }
+    file_block_map_stats(&tr, &file, &stats->nodes, &entries,
+                         &stats->extents);
+    file_close(&file);
+    assert(file_delete(&tr, path));
+    transaction_complete(&tr);
+    assert(!tr.failed);
+    transaction_free(&tr);
+    fs_destroy(&fs);
+
+    printf("%s: extents %d: %lld blocks, %d map nodes, %d extent blocks, "
+           "%lld metadata blocks written in %d commits\n",
+           __func__, extents, block_count, stats->nodes, stats->extents,
+           stats->metadata_writes, stats->commits);
+}
+
+static void file_extent_size_test(struct transaction *tr)
+{
+    struct file_extent_size_stats per_block;
+    struct file_extent_size_stats extent;
+
+    file_extent_size_test_etc(false, &per_block);
+    assert(!per_block.extents);
+    file_extent_size_test_etc(true, &extent);
+    assert(extent.extents);
+    assert(extent.commits == per_block.commits);
+
+    assert(extent.nodes + extent.extents < per_block.nodes);
+    assert(extent.metadata_writes < per_block.metadata_writes);
+}
+
 static void file_create1_small_test(struct transaction *tr)
 {
     file_test(tr, "test1s", FILE_OPEN_CREATE_EXCLUSIVE, 0, 0, 0, false, 1);
@@ -1423,6 +2152,57 @@ static void file_create_delete_2_transaction_test(struct transaction *tr)
     transaction_free(&tr2);
 }
 
+static void file_group_commit_test(struct transaction *tr)
+{
+    struct transaction tr1;
+    struct transaction tr2;
+    uint super_block_version = tr->fs->super_block_version;
+
+    transaction_init(&tr1, tr->fs, true);
+    transaction_init(&tr2, tr->fs, true);
+
+    file_test(&tr1, "test1", FILE_OPEN_CREATE_EXCLUSIVE, 1, 0, 0, false, 9);
+    file_test(&tr2, "test2", FILE_OPEN_CREATE_EXCLUSIVE, 1, 0, 0, false, 10);
+
+    transaction_complete_etc(&tr1, false);
+    transaction_complete_etc(&tr2, false);
+    assert(!tr1.failed);
+    assert(!tr2.failed);
+    assert(tr1.super_pending);
+    assert(tr2.super_pending);
+    assert(tr->fs->super_block_version == super_block_version);
+
+    /*
+     * Pending transactions are visible before the super block is written, so
+     * callers have to check transaction_group_pending before returning data.
+     */
+    assert(transaction_group_pending(tr->fs));
+    file_test(tr, "test1", FILE_OPEN_NO_CREATE, 0, 1, 0, false, 9);
+
+    transaction_group_commit(tr->fs);
+    assert(!transaction_group_pending(tr->fs));
+    assert(tr1.complete && !tr1.super_pending);
+    assert(tr2.complete && !tr2.super_pending);
+    assert(tr->fs->super_block_version != super_block_version);
+    super_block_version = tr->fs->super_block_version;
+
+    /* a regular commit also writes the pending transactions */
+    transaction_activate(&tr1);
+    transaction_activate(&tr2);
+    file_test(&tr1, "test1", FILE_OPEN_NO_CREATE, 0, 1, 1, true, 9);
+    file_test(&tr2, "test2", FILE_OPEN_NO_CREATE, 0, 1, 1, true, 10);
+    transaction_complete_etc(&tr1, false);
+    assert(tr1.super_pending);
+    transaction_complete(&tr2);
+    assert(!tr1.failed);
+    assert(!tr2.failed);
+    assert(tr1.complete && !tr1.super_pending);
+    assert(tr->fs->super_block_version != super_block_version);
+
+    transaction_free(&tr1);
+    transaction_free(&tr2);
+}
+
 static void file_create_many_test(struct transaction *tr)
 {
     char path[10];
@@ -1433,6 +2213,38 @@ static void file_create_many_test(struct transaction *tr)
     }
 }
 
+static void file_scrub_test(struct transaction *tr)
+{
+    struct fs_scrub *scrub = &tr->fs->scrub;
+    uint pass = scrub->pass;
+    uint checked;
+    uint runs = 0;
+    bool done;
+
+    /* a full pass in one call */
+    assert(fs_scrub_run(tr->fs, UINT_MAX, UINT_MAX));
+    assert(scrub->pass == pass + 1);
+
+    /* each file entry is an entry, so small runs take several calls */
+    do {
+        checked = scrub->checked;
+        done = fs_scrub_run(tr->fs, 4, UINT_MAX);
+        assert(done || scrub->checked == checked + 4);
+        runs++;
+    } while (!done);
+    assert(scrub->pass == pass + 2);
+    assert(runs > file_test_many_file_count / 4);
+
+    /* a run that uses up its read budget still makes progress */
+    do {
+        checked = scrub->checked;
+        done = fs_scrub_run(tr->fs, UINT_MAX, 1);
+        assert(done || scrub->checked > checked);
+    } while (!done);
+
+    assert(!scrub->total_errors);
+}
+
 static void file_delete_many_test(struct transaction *tr)
 {
     char path[10];
@@ -1473,7 +2285,12 @@ static void file_allocate_all_complete_multi1_test(struct transaction *tr)
 
 static void file_allocate_leave_10_test(struct transaction *tr)
 {
-    file_allocate_all_test(tr, 1, 1, 10, "test1", FILE_OPEN_CREATE);
+    /*
+     * Step back 20 blocks at a time. Block map extents use so little metadata
+     * that a 10 block step can stop a single block above the reserved space,
+     * which is not enough for the small file tests that follow.
+     */
+    file_allocate_all_test(tr, 1, 1, 20, "test1", FILE_OPEN_CREATE);
 }
 
 static void future_fs_version_test(struct transaction *tr)
@@ -1549,9 +2366,11 @@ struct {
     TEST(empty_test),
     TEST(empty_test),
     TEST(block_tree_test),
+    TEST(block_tree_search_test),
     TEST(block_set_test),
     TEST(block_map_test),
     TEST(allocate_frag_test, .no_free_check = true),
+    TEST(block_free_index_test, .no_free_check = true),
     TEST(allocate_free_same_test, .no_free_check = true),
     TEST(allocate_free_other_test, .no_free_check = true),
     TEST(free_frag_rem_test, .no_free_check = true),
@@ -1565,6 +2384,12 @@ struct {
     TEST(file_write1_small_test),
     TEST(file_delete1_small_test),
     TEST(file_read_after_delete_test),
+    TEST(file_cache_test),
+    TEST(file_extent_test),
+    TEST(file_dirty_test),
+    TEST(file_discard_test),
+    TEST(file_extent_split_test),
+    TEST(file_extent_size_test),
     TEST(file_create1_small_test),
     TEST(file_splittr1_small_test),
     TEST(file_delete1_small_test),
@@ -1585,7 +2410,9 @@ struct {
     TEST(file_delete2_test),
     TEST(file_create3_conflict_test),
     TEST(file_create_delete_2_transaction_test),
+    TEST(file_group_commit_test),
     TEST(file_create_many_test),
+    TEST(file_scrub_test),
     TEST(file_create1_small_test),
     TEST(file_write1_small_test),
     TEST(file_write1_small_test),
@@ -1638,6 +2465,7 @@ int main(int argc, const char *argv[])
     struct block_device dev = {
         .start_read = block_test_start_read,
         .start_write = block_test_start_write,
+        .discard = block_test_discard,
         .block_count = BLOCK_COUNT,
         .block_size = 256,
         .block_num_size = 8,
@@ -1679,8 +2507,13 @@ int main(int argc, const char *argv[])
 
     block_tree_check_config(&dev);
     block_tree_check_config(&dev256);
+    block_tree_check_config(&extent_test_dev);
     block_tree_check_config_done();
-    block_cache_init();
+    block_cache_init(BLOCK_CACHE_SIZE);
+    if (crypt_key_init(&key)) {
+        printf("%s: key init failed\n", __func__);
+        return 1;
+    }
 
     fs_init(&fs, &key, &dev, &dev, true);
     fs.reserved_count = 18; /* HACK: override default reserved space */
@@ -1712,7 +2545,10 @@ int main(int argc, const char *argv[])
     files_print(&tr);
     block_set_print(&tr, &tr.fs->free);
     stats_timer_print();
+    block_cache_print_stats();
     transaction_free(&tr);
+    fs_destroy(&fs);
+    crypt_key_destroy(&key);
 
     printf("%s: done\n", __func__);
 
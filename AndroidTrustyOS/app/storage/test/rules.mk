@@ -25,7 +25,9 @@ SRCS := \
 	$(LOCAL_DIR)/../block_set.c \
 	$(LOCAL_DIR)/../block_tree.c \
 	$(LOCAL_DIR)/../crypt.c \
+	$(LOCAL_DIR)/../debug_stats.c \
 	$(LOCAL_DIR)/../file.c \
+	$(LOCAL_DIR)/../scrub.c \
 	$(LOCAL_DIR)/../super.c \
 	$(LOCAL_DIR)/../transaction.c \
 	$(LOCAL_DIR)/block_test.c \
@@ -50,4 +52,31 @@ $(TOOL)_run: $(TOOL) .PHONY
 
 run_host_tests: $(TOOL)_run .PHONY
 
+BENCH_TOOL := $(SAVED_BUILDDIR)/host_tests/storage_bench
+
+BENCH_SRCS := \
+	$(filter-out $(LOCAL_DIR)/block_test.c,$(SRCS)) \
+	$(LOCAL_DIR)/block_bench.c \
+	$(LOCAL_DIR)/block_device_sim.c \
+
+$(BENCH_TOOL): TOOL_CFLAGS := -DBUILD_STORAGE_TEST=1
+
+$(BENCH_TOOL): FORCE_INCLUDE := \
+	-include $(LOCAL_DIR)/trusty_std.h \
+
+$(BENCH_TOOL): TOOL_INCLUDE := $(LOCAL_DIR)
+
+$(BENCH_TOOL): $(BENCH_SRCS)
+	@echo building $@
+	@$(MKDIR)
+	@gcc $^ $(FORCE_INCLUDE) -I$(TOOL_INCLUDE) $(TOOL_CFLAGS) $(subst -I,-idirafter,$(GLOBAL_INCLUDES)) -lm -lcrypto -lssl -g -O2 -Wall -Werror -o $@
+
+host_bench: $(BENCH_TOOL)
+
+$(BENCH_TOOL)_run: $(BENCH_TOOL) .PHONY
+	@echo running $<
+	$(BENCH_TOOL) $(STORAGE_BENCH_ARGS)
+
+run_host_bench: $(BENCH_TOOL)_run .PHONY
+
 LOCAL_DIR :=
@@ -17,4 +17,11 @@
 #pragma once
 
 #define STORAGE_MAX_BUFFER_SIZE 4096
+
+/*
+ * Number of messages that can be queued in each direction on a client
+ * channel. Streamed reads and writes keep up to this many messages in flight.
+ */
+#define STORAGE_CLIENT_QUEUE_DEPTH (4)
+
 #define STORAGE_MAX_OPEN_FILES (128)
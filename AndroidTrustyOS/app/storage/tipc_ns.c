@@ -14,8 +14,10 @@
  * limitations under the License.
  */
 
+#include <assert.h>
 #include <err.h>
 #include <compiler.h>
+#include <list.h>
 #include <stdint.h>
 #include <string.h>
 #include <trusty_ipc.h>
@@ -36,6 +38,8 @@ static inline int translate_error(enum storage_err err) {
 		return NO_ERROR;
 	case STORAGE_ERR_NOT_VALID:
 		return ERR_NOT_VALID;
+	case STORAGE_ERR_UNIMPLEMENTED:
+		return ERR_NOT_IMPLEMENTED;
 	case STORAGE_ERR_GENERIC:
 	default:
 		return ERR_GENERIC;
@@ -334,3 +338,379 @@ int ns_write_pos(handle_t ipc_handle, ns_handle_t handle, ns_off_t pos,
 
 	return data_size;
 }
+
+/**
+ * ns_read_vec_init - Build a vectored read request
+ * @op:             Request state to initialize.
+ * @handle:         File handle.
+ * @extents:        Ranges to read and buffers to read them into.
+ * @extent_count:   Number of entries in @extents, at most %NS_MAX_EXTENTS.
+ * @tx_iov:         Array to return request buffers in.
+ *
+ * Return: number of entries used in @tx_iov.
+ */
+static uint ns_read_vec_init(struct ns_read_vec_op *op, ns_handle_t handle,
+                             const struct ns_extent *extents,
+                             uint extent_count, iovec_t tx_iov[3])
+{
+	uint i;
+
+	assert(extent_count <= NS_MAX_EXTENTS);
+
+	op->req = (struct storage_file_readv_req) {
+		.handle = handle,
+		.extent_count = extent_count,
+	};
+
+	op->cmd = STORAGE_FILE_READV;
+	op->msg = (struct storage_msg) {
+		.cmd = STORAGE_FILE_READV,
+		.size = sizeof(op->msg) + sizeof(op->req) +
+		        sizeof(op->extents[0]) * extent_count,
+	};
+
+	op->data_size = 0;
+	op->rx_iov[0].base = &op->msg;
+	op->rx_iov[0].len = sizeof(op->msg);
+	for (i = 0; i < extent_count; i++) {
+		op->extents[i] = (struct storage_file_extent) {
+			.offset = extents[i].pos,
+			.size = extents[i].size,
+		};
+		op->rx_iov[i + 1].base = extents[i].data;
+		op->rx_iov[i + 1].len = extents[i].size;
+		op->data_size += extents[i].size;
+	}
+
+	tx_iov[0].base = &op->msg;
+	tx_iov[0].len = sizeof(op->msg);
+	tx_iov[1].base = &op->req;
+	tx_iov[1].len = sizeof(op->req);
+	tx_iov[2].base = op->extents;
+	tx_iov[2].len = sizeof(op->extents[0]) * extent_count;
+
+	return 3;
+}
+
+/**
+ * ns_read_vec_result - Check response to a vectored or single read request
+ * @op:     Request state.
+ * @rc:     Response size or error code from the ipc layer.
+ *
+ * Return: same as ns_read_vec.
+ */
+static int ns_read_vec_result(struct ns_read_vec_op *op, int rc)
+{
+	if (rc < 0) {
+		SS_ERR("%s: read failed, %d\n", __func__, rc);
+		return rc;
+	}
+
+	size_t bytes_read = (size_t) rc;
+
+	rc = check_response(op->cmd, &op->msg, bytes_read);
+	if (rc != NO_ERROR) {
+		return rc;
+	}
+
+	if (bytes_read != sizeof(op->msg) + op->data_size) {
+		return ERR_NOT_VALID;
+	}
+
+	return op->data_size;
+}
+
+/**
+ * ns_read_vec - Read several file ranges with a single request
+ * @ipc_handle:     Proxy channel.
+ * @handle:         File handle.
+ * @extents:        Ranges to read and buffers to read them into.
+ * @extent_count:   Number of entries in @extents, at most %NS_MAX_EXTENTS.
+ *
+ * An @extent_count of 0 can be used to check if the proxy supports vectored
+ * requests.
+ *
+ * Return: total number of bytes read if all extents were read completely,
+ * %ERR_NOT_IMPLEMENTED if the proxy does not support vectored requests,
+ * another negative error code otherwise.
+ */
+int ns_read_vec(handle_t ipc_handle, ns_handle_t handle,
+                const struct ns_extent *extents, uint extent_count)
+{
+	SS_DBG_IO("%s: handle %llu, extent count %u\n",
+		  __func__, handle, extent_count);
+
+	uint tx_iov_count;
+	iovec_t tx_iov[3];
+	struct ns_read_vec_op op;
+
+	if (extent_count > NS_MAX_EXTENTS) {
+		return ERR_INVALID_ARGS;
+	}
+
+	tx_iov_count = ns_read_vec_init(&op, handle, extents, extent_count,
+	                                tx_iov);
+
+	int rc = sync_ipc_send_msg(ipc_handle, tx_iov, tx_iov_count,
+	                           op.rx_iov, extent_count + 1);
+
+	return ns_read_vec_result(&op, rc);
+}
+
+static void ns_read_vec_response(struct ipc_async_msg *amsg, int rc)
+{
+	struct ns_read_vec_op *op = containerof(amsg, struct ns_read_vec_op,
+	                                        amsg);
+
+	op->done(op, ns_read_vec_result(op, rc));
+}
+
+/**
+ * ns_read_op_send - Send a read request without waiting for the response
+ * @ipc_handle:     Proxy channel.
+ * @op:             Request state with @op->rx_iov set up.
+ * @tx_iov:         Request buffers.
+ * @tx_iov_count:   Number of entries in @tx_iov.
+ * @rx_iov_count:   Number of entries used in @op->rx_iov.
+ * @done:           Completion handler.
+ *
+ * Return: 0 if the request was sent and @done will be called, a negative error
+ * code otherwise.
+ */
+static int ns_read_op_send(handle_t ipc_handle, struct ns_read_vec_op *op,
+                           iovec_t *tx_iov, uint tx_iov_count,
+                           uint rx_iov_count, ns_read_vec_done_t done)
+{
+	op->done = done;
+	op->amsg.rx_iovecs = op->rx_iov;
+	op->amsg.rx_iovec_count = rx_iov_count;
+	op->amsg.on_response = ns_read_vec_response;
+
+	int rc = ipc_send_async_msg(ipc_handle, tx_iov, tx_iov_count,
+	                            &op->amsg);
+	if (rc < 0) {
+		SS_ERR("%s: read failed, %d\n", __func__, rc);
+		return rc;
+	}
+	return NO_ERROR;
+}
+
+/**
+ * ns_read_vec_start - Start a vectored read without waiting for it
+ * @ipc_handle:     Proxy channel.
+ * @handle:         File handle.
+ * @extents:        Ranges to read and buffers to read them into. The buffers
+ *                  must stay valid until @done is called.
+ * @extent_count:   Number of entries in @extents, 1 to %NS_MAX_EXTENTS.
+ * @op:             Request state. Must stay valid until @done is called.
+ * @done:           Called with the result when the response arrives. Can be
+ *                  called from ipc_loop or from any later request on
+ *                  @ipc_handle.
+ *
+ * Return: 0 if the request was sent and @done will be called, a negative error
+ * code otherwise.
+ */
+int ns_read_vec_start(handle_t ipc_handle, ns_handle_t handle,
+                      const struct ns_extent *extents, uint extent_count,
+                      struct ns_read_vec_op *op, ns_read_vec_done_t done)
+{
+	SS_DBG_IO("%s: handle %llu, extent count %u\n",
+		  __func__, handle, extent_count);
+
+	uint tx_iov_count;
+	iovec_t tx_iov[3];
+
+	if (!extent_count || extent_count > NS_MAX_EXTENTS) {
+		return ERR_INVALID_ARGS;
+	}
+
+	tx_iov_count = ns_read_vec_init(op, handle, extents, extent_count,
+	                                tx_iov);
+
+	return ns_read_op_send(ipc_handle, op, tx_iov, tx_iov_count,
+	                       extent_count + 1, done);
+}
+
+/**
+ * ns_read_pos_start - Start a single read without waiting for it
+ * @ipc_handle:     Proxy channel.
+ * @handle:         File handle.
+ * @pos:            Offset in file.
+ * @data:           Buffer to read into. Must stay valid until @done is
+ *                  called.
+ * @data_size:      Number of bytes to read.
+ * @op:             Request state. Must stay valid until @done is called.
+ * @done:           Same as for ns_read_vec_start.
+ *
+ * Same as ns_read_vec_start with a single extent, for proxies that do not
+ * support vectored requests.
+ *
+ * Return: 0 if the request was sent and @done will be called, a negative error
+ * code otherwise.
+ */
+int ns_read_pos_start(handle_t ipc_handle, ns_handle_t handle,
+                      ns_off_t pos, void *data, int data_size,
+                      struct ns_read_vec_op *op, ns_read_vec_done_t done)
+{
+	SS_DBG_IO("%s: handle %llu, pos %llu, size %d\n",
+		  __func__, handle, pos, data_size);
+
+	iovec_t tx_iov[2];
+
+	op->read_req = (struct storage_file_read_req) {
+		.handle = handle,
+		.offset = pos,
+		.size = data_size,
+	};
+
+	op->cmd = STORAGE_FILE_READ;
+	op->msg = (struct storage_msg) {
+		.cmd = STORAGE_FILE_READ,
+		.size = sizeof(op->msg) + sizeof(op->read_req),
+	};
+
+	op->data_size = data_size;
+	op->rx_iov[0].base = &op->msg;
+	op->rx_iov[0].len = sizeof(op->msg);
+	op->rx_iov[1].base = data;
+	op->rx_iov[1].len = data_size;
+
+	tx_iov[0].base = &op->msg;
+	tx_iov[0].len = sizeof(op->msg);
+	tx_iov[1].base = &op->read_req;
+	tx_iov[1].len = sizeof(op->read_req);
+
+	return ns_read_op_send(ipc_handle, op, tx_iov, countof(tx_iov), 2, done);
+}
+
+/**
+ * ns_write_vec - Write several file ranges with a single request
+ * @ipc_handle:     Proxy channel.
+ * @handle:         File handle.
+ * @extents:        Ranges to write and the data to write to them.
+ * @extent_count:   Number of entries in @extents, at most %NS_MAX_EXTENTS.
+ *
+ * Return: total number of bytes written if all extents were written
+ * completely, %ERR_NOT_IMPLEMENTED if the proxy does not support vectored
+ * requests, another negative error code otherwise.
+ */
+int ns_write_vec(handle_t ipc_handle, ns_handle_t handle,
+                 const struct ns_extent *extents, uint extent_count)
+{
+	SS_DBG_IO("%s: handle %llu, extent count %u\n",
+		  __func__, handle, extent_count);
+
+	uint i;
+	size_t data_size = 0;
+	struct storage_file_extent req_extents[NS_MAX_EXTENTS];
+	iovec_t tx_iov[NS_MAX_EXTENTS + 3];
+
+	if (extent_count > NS_MAX_EXTENTS) {
+		return ERR_INVALID_ARGS;
+	}
+
+	for (i = 0; i < extent_count; i++) {
+		req_extents[i] = (struct storage_file_extent) {
+			.offset = extents[i].pos,
+			.size = extents[i].size,
+		};
+		tx_iov[i + 3].base = (void *)extents[i].src;
+		tx_iov[i + 3].len = extents[i].size;
+		data_size += extents[i].size;
+	}
+
+	struct storage_file_writev_req req = {
+		.handle = handle,
+		.extent_count = extent_count,
+	};
+
+	struct storage_msg msg = {
+		.cmd = STORAGE_FILE_WRITEV,
+		.size = sizeof(msg) + sizeof(req) +
+		        sizeof(req_extents[0]) * extent_count + data_size,
+	};
+
+	tx_iov[0].base = &msg;
+	tx_iov[0].len = sizeof(msg);
+	tx_iov[1].base = &req;
+	tx_iov[1].len = sizeof(req);
+	tx_iov[2].base = req_extents;
+	tx_iov[2].len = sizeof(req_extents[0]) * extent_count;
+
+	int rc = sync_ipc_send_msg(ipc_handle, tx_iov, extent_count + 3,
+	                           tx_iov, 1);
+	if (rc < 0) {
+		SS_ERR("%s: write failed, %d\n", __func__, rc);
+		return rc;
+	}
+
+	rc = check_response(STORAGE_FILE_WRITEV, &msg, rc);
+	if (rc != NO_ERROR) {
+		return rc;
+	}
+
+	return data_size;
+}
+
+/**
+ * ns_discard_vec - Release several file ranges with a single request
+ * @ipc_handle:     Proxy channel.
+ * @handle:         File handle.
+ * @extents:        Ranges to release. The @data fields are not used.
+ * @extent_count:   Number of entries in @extents, at most %NS_MAX_EXTENTS.
+ *                  0 checks if the proxy supports discard requests.
+ *
+ * The proxy may deallocate the storage for the ranges. Their content is
+ * undefined until they are written again.
+ *
+ * Return: %NO_ERROR if the request succeeded, %ERR_NOT_IMPLEMENTED if the
+ * proxy does not support discard requests, another negative error code
+ * otherwise.
+ */
+int ns_discard_vec(handle_t ipc_handle, ns_handle_t handle,
+                   const struct ns_extent *extents, uint extent_count)
+{
+	SS_DBG_IO("%s: handle %llu, extent count %u\n",
+		  __func__, handle, extent_count);
+
+	uint i;
+	struct storage_file_extent req_extents[NS_MAX_EXTENTS];
+	iovec_t tx_iov[3];
+
+	if (extent_count > NS_MAX_EXTENTS) {
+		return ERR_INVALID_ARGS;
+	}
+
+	for (i = 0; i < extent_count; i++) {
+		req_extents[i] = (struct storage_file_extent) {
+			.offset = extents[i].pos,
+			.size = extents[i].size,
+		};
+	}
+
+	struct storage_file_discard_req req = {
+		.handle = handle,
+		.extent_count = extent_count,
+	};
+
+	struct storage_msg msg = {
+		.cmd = STORAGE_FILE_DISCARD,
+		.size = sizeof(msg) + sizeof(req) +
+		        sizeof(req_extents[0]) * extent_count,
+	};
+
+	tx_iov[0].base = &msg;
+	tx_iov[0].len = sizeof(msg);
+	tx_iov[1].base = &req;
+	tx_iov[1].len = sizeof(req);
+	tx_iov[2].base = req_extents;
+	tx_iov[2].len = sizeof(req_extents[0]) * extent_count;
+
+	int rc = sync_ipc_send_msg(ipc_handle, tx_iov, 3, tx_iov, 1);
+	if (rc < 0) {
+		SS_ERR("%s: discard failed, %d\n", __func__, rc);
+		return rc;
+	}
+
+	return check_response(STORAGE_FILE_DISCARD, &msg, rc);
+}
@@ -19,13 +19,86 @@
 #include <stdbool.h>
 #include <trusty_ipc.h>
 
+#include <interface/storage/storage.h>
+
+#include "ipc.h"
+
 typedef uint64_t ns_handle_t;
 typedef uint64_t ns_off_t;
 
+/*
+ * Max number of extents in a single ns_read_vec, ns_write_vec or ns_discard_vec
+ * request
+ */
+#define NS_MAX_EXTENTS (16)
+
+/**
+ * struct ns_extent - File range and buffer for vectored io
+ * @pos:    Offset in file.
+ * @data:   Buffer to read into, used by ns_read_vec and ns_read_vec_start.
+ * @src:    Data to write, used by ns_write_vec.
+ * @size:   Number of bytes to transfer.
+ */
+struct ns_extent {
+	ns_off_t pos;
+	union {
+		void *data;
+		const void *src;
+	};
+	size_t size;
+};
+
+struct ns_read_vec_op;
+
+/**
+ * ns_read_vec_done_t - Completion handler for ns_read_vec_start
+ * @op:     Operation passed to ns_read_vec_start.
+ * @rc:     Same as the return value of ns_read_vec.
+ */
+typedef void (*ns_read_vec_done_t)(struct ns_read_vec_op *op, int rc);
+
+/**
+ * struct ns_read_vec_op - State of a vectored or single read request
+ * @amsg:       Pending ipc message.
+ * @cmd:        %STORAGE_FILE_READV or %STORAGE_FILE_READ.
+ * @msg:        Request and response header.
+ * @req:        Vectored read request.
+ * @read_req:   Single read request.
+ * @extents:    Request extents.
+ * @rx_iov:     Response buffers.
+ * @data_size:  Total number of bytes requested.
+ * @done:       Completion handler for asynchronous requests.
+ */
+struct ns_read_vec_op {
+	struct ipc_async_msg amsg;
+	enum storage_cmd cmd;
+	struct storage_msg msg;
+	union {
+		struct storage_file_readv_req req;
+		struct storage_file_read_req read_req;
+	};
+	struct storage_file_extent extents[NS_MAX_EXTENTS];
+	iovec_t rx_iov[NS_MAX_EXTENTS + 1];
+	size_t data_size;
+	ns_read_vec_done_t done;
+};
+
 int ns_open_file(handle_t ipc_handle, const char *name,
                  ns_handle_t *handlep, bool create);
 void ns_close_file(handle_t ipc_handle, ns_handle_t handle);
 int ns_read_pos(handle_t ipc_handle, ns_handle_t handle,
                 ns_off_t pos, void *data, int data_size);
+int ns_read_pos_start(handle_t ipc_handle, ns_handle_t handle,
+                      ns_off_t pos, void *data, int data_size,
+                      struct ns_read_vec_op *op, ns_read_vec_done_t done);
 int ns_write_pos(handle_t ipc_handle, ns_handle_t handle,
                  ns_off_t pos, const void *data, int data_size);
+int ns_read_vec(handle_t ipc_handle, ns_handle_t handle,
+                const struct ns_extent *extents, uint extent_count);
+int ns_read_vec_start(handle_t ipc_handle, ns_handle_t handle,
+                      const struct ns_extent *extents, uint extent_count,
+                      struct ns_read_vec_op *op, ns_read_vec_done_t done);
+int ns_write_vec(handle_t ipc_handle, ns_handle_t handle,
+                 const struct ns_extent *extents, uint extent_count);
+int ns_discard_vec(handle_t ipc_handle, ns_handle_t handle,
+                   const struct ns_extent *extents, uint extent_count);
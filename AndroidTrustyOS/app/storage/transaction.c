@@ -26,11 +26,15 @@
 #include "block_allocator.h"
 #include "block_set.h"
 #include "debug.h"
+#include "debug_stats.h"
 #include "file.h"
 #include "transaction.h"
 
 bool print_merge_free;
 
+/* Max number of freed ranges passed to the block device at once */
+#define TRANSACTION_DISCARD_BATCH (16)
+
 /**
  * transaction_check_free
  * @tr:         Transaction object.
@@ -182,6 +186,7 @@ void transaction_fail(struct transaction *tr)
 
     block_cache_discard_transaction(tr, true);
     transaction_delete_active(tr);
+    block_free_index_clear(&tr->fs->free_index);
     file_transaction_failed(tr);
 }
 
@@ -195,6 +200,7 @@ void transaction_fail(struct transaction *tr)
 void transaction_free(struct transaction *tr)
 {
     assert(!transaction_is_active(tr));
+    assert(!tr->super_pending);
     assert(list_is_empty(&tr->open_files));
     assert(list_in_list(&tr->node));
     list_delete(&tr->node);
@@ -224,10 +230,80 @@ static void check_free_tree(struct transaction *tr, struct block_set *free)
 }
 
 /**
- * transaction_complete - Complete transaction
- * @tr:         Transaction object.
+ * transaction_discard_freed - Tell block device about blocks freed by tr
+ * @tr:         Completed transaction object.
+ *
+ * Pass the ranges in @tr->freed to the optional discard function of the block
+ * device, a batch at a time. Only call this after a super block that no
+ * longer references the blocks has been written, and before the blocks can be
+ * allocated again.
+ */
+static void transaction_discard_freed(struct transaction *tr)
+{
+    struct block_device *dev = tr->fs->dev;
+    struct block_range ranges[TRANSACTION_DISCARD_BATCH];
+    struct block_range range = BLOCK_RANGE_INITIAL_VALUE(range);
+    uint count = 0;
+
+    if (!dev->discard) {
+        return;
+    }
+
+    while (true) {
+        range = block_set_find_next_range(tr, &tr->freed, range.end);
+        if (tr->failed || block_range_empty(range) ||
+            count == countof(ranges)) {
+            if (count) {
+                dev->discard(dev, ranges, count);
+                count = 0;
+            }
+        }
+        if (tr->failed || block_range_empty(range)) {
+            break;
+        }
+        ranges[count++] = range;
+    }
+}
+
+/**
+ * transaction_finish_pending - Finish transactions covered by new super block
+ * @fs:         File system state object.
+ *
+ * Release the blocks that were kept reserved for transactions completed
+ * without a super block update, now that a super block that includes them has
+ * been written.
+ */
+static void transaction_finish_pending(struct fs *fs)
+{
+    struct transaction *tr;
+
+    list_for_every_entry(&fs->transactions, tr, struct transaction, node) {
+        if (!tr->super_pending) {
+            continue;
+        }
+        list_delete(&tr->tmp_allocated.node);
+        list_delete(&tr->freed.node);
+        tr->super_pending = false;
+        tr->complete = true;
+        transaction_discard_freed(tr);
+        block_cache_discard_transaction(tr, false);
+    }
+    block_free_index_reset_search(&fs->free_index);
+}
+
+/**
+ * transaction_complete_etc - Complete transaction
+ * @tr:             Transaction object.
+ * @update_super:   If %false, leave the super block update to a later
+ *                  transaction_complete or transaction_group_commit call.
+ *
+ * When @update_super is %false, the changes of @tr are merged into the file
+ * system state, so transactions completed later build on them, but nothing
+ * references them on disk yet. The blocks freed by @tr stay reserved until a
+ * super block that includes @tr has been written, so the last written super
+ * block stays valid until then.
  */
-void transaction_complete(struct transaction *tr)
+void transaction_complete_etc(struct transaction *tr, bool update_super)
 {
     struct block_mac new_files;
     struct transaction *tmp_tr;
@@ -240,6 +316,8 @@ void transaction_complete(struct transaction *tr)
 
     //printf("%s: %lld\n", __func__, tr->version);
 
+    stats_timer_start(STATS_TR_COMPLETE);
+
     block_set_copy(tr, &new_free_set, &tr->fs->free);
 
     if (tr->failed) {
@@ -249,14 +327,18 @@ void transaction_complete(struct transaction *tr)
 
     assert(transaction_is_active(tr));
 
+    stats_timer_start(STATS_TR_COMPLETE_FILES);
     file_transaction_complete(tr, &new_files);
+    stats_timer_stop(STATS_TR_COMPLETE_FILES);
     if (tr->failed) {
         pr_warn("transaction failed, abort\n");
         goto err_transaction_failed;
     }
 
     tr->new_free_set = &new_free_set;
+    stats_timer_start(STATS_TR_COMPLETE_FREE);
     transaction_merge_free_sets(tr, &new_free_set, &tr->fs->free, &tr->allocated, &tr->freed);
+    stats_timer_stop(STATS_TR_COMPLETE_FREE);
     if (tr->failed) {
         pr_warn("transaction failed, abort\n");
         goto err_transaction_failed;
@@ -298,28 +380,40 @@ void transaction_complete(struct transaction *tr)
     assert(block_range_empty(new_free_set.initial_range));
     check_free_tree(tr, &new_free_set);
 
-    super_block_updated = update_super_block(tr, &new_free_set.block_tree.root,
-                                             &new_files);
-    if (!super_block_updated) {
-        assert(tr->failed);
-        pr_warn("failed to update super block, abort\n");
-        goto err_transaction_failed;
+    if (update_super) {
+        stats_timer_start(STATS_TR_COMPLETE_SUPER);
+        super_block_updated = update_super_block(tr, &new_free_set.block_tree.root,
+                                                 &new_files);
+        if (!super_block_updated) {
+            assert(tr->failed);
+            pr_warn("failed to update super block, abort\n");
+            stats_timer_stop(STATS_TR_COMPLETE_SUPER);
+            goto err_transaction_failed;
+        }
+        block_cache_clean_transaction(tr);
+        stats_timer_stop(STATS_TR_COMPLETE_SUPER);
+
+        /*
+         * If an error was detected writing the super block, it is not safe to
+         * continue as we do not know if the write completed.
+         */
+        assert(!tr->failed);
     }
-    block_cache_clean_transaction(tr);
-
-    /*
-     * If an error was detected writing the super block, it is not safe to
-     * continue as we do not know if the write completed.
-     */
-    assert(!tr->failed);
 
     tr->fs->free.block_tree.root = new_free_set.block_tree.root;
     block_range_clear(&tr->fs->free.initial_range); /* clear for initial file-system state */
+    block_free_index_commit(tr);
     tr->fs->files.root = new_files;
-    tr->fs->super_block_version = tr->fs->written_super_block_version;
 
-    transaction_delete_active(tr);
-    tr->complete = true;
+    if (update_super) {
+        tr->fs->super_block_version = tr->fs->written_super_block_version;
+        transaction_delete_active(tr);
+        tr->complete = true;
+    } else {
+        list_delete(&tr->allocated.node);
+        list_add_tail(&tr->fs->allocated, &tr->freed.node);
+        tr->super_pending = true;
+    }
 
     file_transaction_success(tr);
     assert(!tr->failed);
@@ -352,13 +446,77 @@ void transaction_complete(struct transaction *tr)
         }
     }
     assert(!tr->failed);
-    block_cache_discard_transaction(tr, false);
+    if (update_super) {
+        transaction_discard_freed(tr);
+        block_cache_discard_transaction(tr, false);
+        transaction_finish_pending(tr->fs);
+    }
 
 err_transaction_failed:
     if (tr->failed) {
         file_transaction_complete_failed(tr);
     }
     assert(!block_cache_debug_get_ref_block_count());
+    stats_timer_stop(STATS_TR_COMPLETE);
+}
+
+/**
+ * transaction_group_pending - Check for transactions waiting for a super block
+ * @fs:         File system state object.
+ *
+ * Return: %true if a transaction completed with transaction_complete_etc(tr,
+ * false) has not been written by a super block update yet. The file system
+ * state that other transactions see then includes data that is not on disk.
+ */
+bool transaction_group_pending(struct fs *fs)
+{
+    struct transaction *tr;
+
+    list_for_every_entry(&fs->transactions, tr, struct transaction, node) {
+        if (tr->super_pending) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * transaction_group_commit - Write super block for pending transactions
+ * @fs:         File system state object.
+ *
+ * Write a single super block that covers every transaction completed with
+ * transaction_complete_etc(tr, false) since the last super block update.
+ */
+void transaction_group_commit(struct fs *fs)
+{
+    struct transaction *tr = NULL;
+    struct transaction *pending_tr;
+    bool super_block_updated;
+
+    list_for_every_entry(&fs->transactions, pending_tr, struct transaction, node) {
+        if (pending_tr->super_pending) {
+            tr = pending_tr;
+        }
+    }
+    if (!tr) {
+        return;
+    }
+
+    assert(!tr->failed);
+
+    stats_timer_start(STATS_TR_COMPLETE_SUPER);
+    super_block_updated = update_super_block(tr, &fs->free.block_tree.root,
+                                             &fs->files.root);
+    assert(super_block_updated);
+    block_cache_clean_transaction(tr);
+    stats_timer_stop(STATS_TR_COMPLETE_SUPER);
+
+    /* See transaction_complete_etc */
+    assert(!tr->failed);
+
+    fs->super_block_version = fs->written_super_block_version;
+    transaction_finish_pending(fs);
+    assert(!block_cache_debug_get_ref_block_count());
 }
 
 /**
@@ -372,6 +530,7 @@ void transaction_activate(struct transaction *tr)
 
     assert(tr->fs);
     assert(!transaction_is_active(tr));
+    assert(!tr->super_pending);
 
     block_num_size = tr->fs->block_num_size;
     block_mac_size = block_num_size + tr->fs->mac_size;
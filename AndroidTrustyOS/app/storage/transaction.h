@@ -32,6 +32,9 @@
  *                          collided with another transaction, %false if no
  *                          error has occured since transaction_activate.
  * @complete:               Transaction has been written to disk.
+ * @super_pending:          Transaction has been merged into the file system
+ *                          state, but the super block that makes it persistent
+ *                          has not been written yet.
  * @min_free_block:         Used when completing a transaction to track how much
  *                          of the free set has been updated.
  * @last_free_block:        Similar to @last_tmp_free_block, used when
@@ -53,6 +56,7 @@ struct transaction {
     struct list_node open_files;
     bool failed;
     bool complete;
+    bool super_pending;
     data_block_t min_free_block;
     data_block_t last_free_block;
     data_block_t last_tmp_free_block;
@@ -72,7 +76,14 @@ void transaction_init(struct transaction *tr,
 void transaction_free(struct transaction *tr);
 void transaction_activate(struct transaction *tr);
 void transaction_fail(struct transaction *tr);
-void transaction_complete(struct transaction *tr);
+void transaction_complete_etc(struct transaction *tr, bool update_super);
+bool transaction_group_pending(struct fs *fs);
+void transaction_group_commit(struct fs *fs);
+
+static inline void transaction_complete(struct transaction *tr)
+{
+    transaction_complete_etc(tr, true);
+}
 
 static inline bool transaction_is_active(struct transaction *tr) {
     return list_in_list(&tr->allocated.node);
@@ -42,6 +42,7 @@ enum {
 	TRUSTY_APP_CONFIG_KEY_MIN_STACK_SIZE	= 1,
 	TRUSTY_APP_CONFIG_KEY_MIN_HEAP_SIZE	= 2,
 	TRUSTY_APP_CONFIG_KEY_MAP_MEM		= 3,
+	TRUSTY_APP_CONFIG_KEY_IPC_STATS		= 4,
 };
 
 #define TRUSTY_APP_CONFIG_MIN_STACK_SIZE(sz) \
@@ -53,6 +54,10 @@ enum {
 #define TRUSTY_APP_CONFIG_MAP_MEM(id,off,sz) \
 	TRUSTY_APP_CONFIG_KEY_MAP_MEM, id, off, sz
 
+/* allow the port_stats syscall */
+#define TRUSTY_APP_CONFIG_IPC_STATS \
+	TRUSTY_APP_CONFIG_KEY_IPC_STATS
+
 /* manifest section attributes */
 #define TRUSTY_APP_MANIFEST_ATTRS \
 	__attribute((aligned(4))) __attribute((section(".trusty_app.manifest")))
@@ -46,6 +46,9 @@ enum {
 	IPC_PORT_ALLOW_TA_CONNECT = 0x1,
 	/* allow non-secure clients to connect to this port */
 	IPC_PORT_ALLOW_NS_CONNECT = 0x2,
+	/* map the receive buffers of accepted channels read-only into the
+	 * server, so messages can be used in place (see ipc_msg_info) */
+	IPC_PORT_MAP_MSG_BUF = 0x4,
 };
 
 /*
@@ -56,8 +59,18 @@ enum {
 	IPC_CONNECT_ASYNC = 0x2,
 };
 
+/*
+ *  Flag for mmap syscall: map the memory object handle passed as handle,
+ *  created by memref_create or received in an ipc message. uaddr must be 0.
+ */
+#define MMAP_FLAG_MEMREF_HANDLE  (0x1 << 1)
+
 /*
  *  IPC message
+ *
+ *  Only memory object handles can be sent in the handles array. The
+ *  receiver gets new handles for the same memory object, in the handles
+ *  array of the first read_msg call that has room for all of them.
  */
 typedef struct iovec {
 	void		*base;
@@ -75,6 +88,10 @@ typedef struct ipc_msg {
 typedef struct ipc_msg_info {
 	size_t		len;
 	uint32_t	id;
+	uint32_t	num_handles; /* number of handles attached to message */
+	const void	*buf; /* message data on channels accepted from ports
+				 with IPC_PORT_MAP_MSG_BUF, valid until put_msg,
+				 or NULL */
 } ipc_msg_info_t;
 
 /*
@@ -100,4 +117,24 @@ typedef struct uevent {
 	void		*cookie; /* cookie aasociated with handle */
 } uevent_t;
 
+/*
+ *  Message statistics of a port, returned by port_stats. They add up
+ *  all connections accepted on the port, seen from the server side.
+ *  Bucket 0 of latency_hist counts messages that were received within
+ *  1 usec of being sent, bucket n those that took [2^(n-1), 2^n) usecs,
+ *  and the last bucket everything slower.
+ */
+#define IPC_STATS_LATENCY_BUCKETS	16
+
+typedef struct ipc_stats {
+	uint64_t	tx_msgs;
+	uint64_t	tx_bytes;
+	uint64_t	rx_msgs;
+	uint64_t	rx_bytes;
+	uint32_t	send_blocked;	   /* sends that found the peer queue full */
+	uint32_t	peer_send_blocked; /* sends to us that found our queue full */
+	uint32_t	max_queued;	   /* most messages queued to us at once */
+	uint32_t	latency_hist[IPC_STATS_LATENCY_BUCKETS];
+} ipc_stats_t;
+
 #endif
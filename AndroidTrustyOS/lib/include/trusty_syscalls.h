@@ -34,17 +34,20 @@
 #define __NR_munmap		0x9
 #define __NR_prepare_dma		0xa
 #define __NR_finish_dma		0xb
+#define __NR_memref_create		0xc
 #define __NR_port_create		0x10
 #define __NR_connect		0x11
 #define __NR_accept		0x12
 #define __NR_close		0x13
 #define __NR_set_cookie		0x14
+#define __NR_port_stats		0x15
 #define __NR_wait		0x18
 #define __NR_wait_any		0x19
 #define __NR_get_msg		0x20
 #define __NR_read_msg		0x21
 #define __NR_put_msg		0x22
 #define __NR_send_msg		0x23
+#define __NR_call		0x24
 
 #ifndef ASSEMBLY
 
@@ -61,17 +64,20 @@ long mmap (void* uaddr, uint32_t size, uint32_t flags, uint32_t handle);
 long munmap (void* uaddr, uint32_t size);
 long prepare_dma (void* uaddr, uint32_t size, uint32_t flags, void* pmem);
 long finish_dma (void* uaddr, uint32_t size, uint32_t flags);
+long memref_create (uint32_t size, uint32_t flags);
 long port_create (const char *path, uint num_recv_bufs, size_t recv_buf_size, uint32_t flags);
 long connect (const char *path, uint flags);
 long accept (uint32_t handle_id, uuid_t *peer_uuid);
 long close (uint32_t handle_id);
 long set_cookie (uint32_t handle, void *cookie);
+long port_stats (const char *path, ipc_stats_t *stats);
 long wait (uint32_t handle_id, uevent_t *event, unsigned long timeout_msecs);
 long wait_any (uevent_t *event, unsigned long timeout_msecs);
 long get_msg (uint32_t handle, ipc_msg_info_t *msg_info);
 long read_msg (uint32_t handle, uint32_t msg_id, uint32_t offset, ipc_msg_t *msg);
 long put_msg (uint32_t handle, uint32_t msg_id);
 long send_msg (uint32_t handle, ipc_msg_t *msg);
+long call (uint32_t handle, ipc_msg_t *msg, ipc_msg_t *reply, unsigned long timeout_msecs);
 
 __END_CDECLS
 
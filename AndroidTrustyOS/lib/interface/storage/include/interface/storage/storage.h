@@ -53,6 +53,19 @@ enum storage_cmd {
 
 	/* transaction support */
 	STORAGE_END_TRANSACTION = 9 << STORAGE_REQ_SHIFT,
+
+	/* vectored io, only used in proxy<->server interface */
+	STORAGE_FILE_READV     = 10 << STORAGE_REQ_SHIFT,
+	STORAGE_FILE_WRITEV    = 11 << STORAGE_REQ_SHIFT,
+
+	/* server statistics, only supported by debug builds of the server */
+	STORAGE_DEBUG_STATS    = 12 << STORAGE_REQ_SHIFT,
+
+	/* several requests in one message */
+	STORAGE_COMPOUND       = 13 << STORAGE_REQ_SHIFT,
+
+	/* release unused file ranges, only used in proxy<->server interface */
+	STORAGE_FILE_DISCARD   = 14 << STORAGE_REQ_SHIFT,
 };
 
 /**
@@ -117,8 +130,17 @@ enum storage_file_open_flag {
  *                                      it receives a command with this flag unset, at
  *                                      which point a cummulative result for all messages
  *                                      sent with STORAGE_MSG_FLAG_BATCH will be sent.
- *                                      This is only supported by the non-secure disk proxy
- *                                      server.
+ *                                      This is supported by the non-secure disk proxy
+ *                                      server, and by the secure storage server for
+ *                                      STORAGE_FILE_WRITE, where it allows a client to
+ *                                      stream a large write as several messages. Once a
+ *                                      write in a batch fails, the rest of the batch is
+ *                                      not written.
+ *                                      If set on a STORAGE_FILE_READ request, the read
+ *                                      is streamed: the request can ask for more data
+ *                                      than fits in one message, and the server sends it
+ *                                      in several responses. All but the last response
+ *                                      have this flag set.
  * @STORAGE_MSG_FLAG_PRE_COMMIT:        if set, indicates that server need to commit
  *                                      pending changes before processing this message.
  * @STORAGE_MSG_FLAG_POST_COMMIT:       if set, indicates that server need to commit
@@ -178,7 +200,8 @@ struct storage_file_close_req {
 /**
  * struct storage_file_read_req - request format for STORAGE_FILE_READ
  * @handle: the handle for the file from which to read
- * @size:   the quantity of bytes to read from the file
+ * @size:   the quantity of bytes to read from the file. Must fit in a single
+ *          response unless STORAGE_MSG_FLAG_BATCH is set.
  * @offset: the offset in the file from whence to read
  */
 struct storage_file_read_req {
@@ -235,6 +258,194 @@ struct storage_file_set_size_req {
 	uint32_t handle;
 };
 
+/**
+ * struct storage_file_extent - file range for vectored requests
+ * @offset:     the offset in the file of the first byte in the range
+ * @size:       the number of bytes in the range
+ * @__reserved: unused, must be set to 0.
+ */
+struct storage_file_extent {
+	uint64_t offset;
+	uint32_t size;
+	uint32_t __reserved;
+};
+
+/**
+ * struct storage_file_readv_req - request format for STORAGE_FILE_READV
+ * @handle:       the handle for the file from which to read
+ * @extent_count: number of entries in @extents
+ * @extents:      the ranges to read, in the order their data is returned
+ *
+ * The response payload is the data of every extent, concatenated in order.
+ * A request with @extent_count set to 0 reads nothing and can be used to
+ * check if the server supports vectored requests. Servers that do not, reply
+ * with STORAGE_ERR_UNIMPLEMENTED.
+ *
+ * Only used in proxy<->server interface.
+ */
+struct storage_file_readv_req {
+	uint32_t handle;
+	uint32_t extent_count;
+	struct storage_file_extent extents[0];
+};
+
+/**
+ * struct storage_file_writev_req - request format for STORAGE_FILE_WRITEV
+ * @handle:       the handle for the file to write to
+ * @extent_count: number of entries in @extents
+ * @extents:      the ranges to write
+ *
+ * @extents is followed by the data of every extent, concatenated in order.
+ * The extents are written in order, and the request fails if any of them
+ * could not be written completely.
+ *
+ * Only used in proxy<->server interface.
+ */
+struct storage_file_writev_req {
+	uint32_t handle;
+	uint32_t extent_count;
+	struct storage_file_extent extents[0];
+};
+
+/**
+ * struct storage_file_discard_req - request format for STORAGE_FILE_DISCARD
+ * @handle:       the handle for the file
+ * @extent_count: number of entries in @extents
+ * @extents:      the ranges whose data is no longer needed
+ *
+ * The server may deallocate the storage backing @extents, e.g. by punching
+ * holes in the file. The file size does not change. Until a range is written
+ * again, reading it returns either zeros or the old data. The response has no
+ * payload. A request with @extent_count set to 0 discards nothing and can be
+ * used to check if the server supports discard requests. Servers that do not,
+ * reply with STORAGE_ERR_UNIMPLEMENTED.
+ *
+ * Only used in proxy<->server interface.
+ */
+struct storage_file_discard_req {
+	uint32_t handle;
+	uint32_t extent_count;
+	struct storage_file_extent extents[0];
+};
+
+/**
+ * enum storage_debug_stats_flag - flags for STORAGE_DEBUG_STATS
+ * @STORAGE_DEBUG_STATS_RESET:  discard all samples after reading them
+ * @STORAGE_DEBUG_STATS_MASK:   mask for all supported flags
+ */
+enum storage_debug_stats_flag {
+	STORAGE_DEBUG_STATS_RESET = (1 << 0),
+	STORAGE_DEBUG_STATS_MASK  = STORAGE_DEBUG_STATS_RESET,
+};
+
+#define STORAGE_DEBUG_STATS_NAME_SIZE		24
+#define STORAGE_DEBUG_STATS_HIST_BUCKETS	32
+
+/**
+ * struct storage_debug_stats_req - request format for STORAGE_DEBUG_STATS
+ * @flags: any of enum storage_debug_stats_flag or'ed together
+ * @first: index of the first timer to return
+ */
+struct storage_debug_stats_req {
+	uint32_t flags;
+	uint32_t first;
+};
+
+/**
+ * struct storage_debug_stats_timer - accumulated latency of one server probe
+ * @name:     nul terminated probe name
+ * @count:    number of samples
+ * @total_ns: sum of all samples in ns
+ * @min_ns:   shortest sample in ns
+ * @max_ns:   longest sample in ns
+ * @hist:     log2 histogram, entry n counts samples in [2^n, 2^(n+1)) ns.
+ *            The first entry also counts 0 ns samples and the last entry
+ *            also counts all longer samples.
+ */
+struct storage_debug_stats_timer {
+	char     name[STORAGE_DEBUG_STATS_NAME_SIZE];
+	uint64_t count;
+	uint64_t total_ns;
+	uint64_t min_ns;
+	uint64_t max_ns;
+	uint32_t hist[STORAGE_DEBUG_STATS_HIST_BUCKETS];
+};
+
+/**
+ * struct storage_debug_stats_resp - response format for STORAGE_DEBUG_STATS
+ * @timer_count: total number of timers the server has
+ * @count:       number of entries in @timers
+ * @timers:      timers starting at the requested index. If fewer than
+ *               @timer_count - first are returned, the remaining timers
+ *               can be read by sending another request.
+ *
+ * The reset flag is only applied once the last timer has been returned.
+ */
+struct storage_debug_stats_resp {
+	uint32_t timer_count;
+	uint32_t count;
+	struct storage_debug_stats_timer timers[0];
+};
+
+#define STORAGE_COMPOUND_MAX_OPS	8
+
+/*
+ * File handle that refers to the file opened by the last STORAGE_FILE_OPEN
+ * operation of the same STORAGE_COMPOUND request.
+ */
+#define STORAGE_COMPOUND_OPENED_FILE	0xffffffffU
+
+/**
+ * struct storage_compound_req - request format for STORAGE_COMPOUND
+ * @count:      number of operations, at most STORAGE_COMPOUND_MAX_OPS
+ * @__reserved: unused, must be set to 0.
+ * @ops:        the operations, each a struct storage_msg with @size set and
+ *              followed by the request payload of its command
+ *
+ * Supported commands are STORAGE_FILE_DELETE, STORAGE_FILE_OPEN,
+ * STORAGE_FILE_CLOSE, STORAGE_FILE_READ, STORAGE_FILE_WRITE,
+ * STORAGE_FILE_GET_SIZE, STORAGE_FILE_SET_SIZE and STORAGE_END_TRANSACTION,
+ * without STORAGE_MSG_FLAG_BATCH. The operations run in order, as if they had
+ * been sent as separate messages, until one of them fails.
+ */
+struct storage_compound_req {
+	uint32_t count;
+	uint32_t __reserved;
+	uint8_t  ops[0];
+};
+
+/**
+ * struct storage_compound_result - result of one STORAGE_COMPOUND operation
+ * @result: one of enum storage_err
+ * @handle: for STORAGE_FILE_OPEN, the handle of the opened file
+ * @size:   for STORAGE_FILE_READ, the number of bytes read, for
+ *          STORAGE_FILE_GET_SIZE, the size of the file
+ */
+struct storage_compound_result {
+	int32_t  result;
+	uint32_t handle;
+	uint64_t size;
+};
+
+/**
+ * struct storage_compound_resp - response format for STORAGE_COMPOUND
+ * @count:      number of operations that were run
+ * @__reserved: unused, must be set to 0.
+ * @results:    one entry for every operation of the request, entries for
+ *              operations that were not run are cleared
+ *
+ * @results is followed by the data of every STORAGE_FILE_READ operation that
+ * was run. The data of each read starts where the data of the previous read
+ * would end if it had returned all the bytes it asked for, so it can be
+ * received directly into the read buffers. The result of the last operation
+ * that was run is also returned in struct storage_msg.
+ */
+struct storage_compound_resp {
+	uint32_t count;
+	uint32_t __reserved;
+	struct storage_compound_result results[0];
+};
+
 /**
  * struct storage_rpmb_send_req - request format for STORAGE_RPMB_SEND
  * @reliable_write_size:        size in bytes of reliable write region
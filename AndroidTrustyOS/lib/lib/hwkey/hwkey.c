@@ -84,42 +84,6 @@ static long send_req(hwkey_session_t session, struct hwkey_msg *msg, uint8_t *re
 		.num_iov = 2,
 	};
 
-	rc = send_msg(session, &tx_msg);
-	if (rc < 0) {
-		goto err_send_fail;
-	}
-
-	if(((size_t) rc) != sizeof(*msg) + req_buf_len) {
-		rc = ERR_IO;
-		goto err_send_fail;
-	}
-
-	uevent_t uevt;
-	rc = wait(session, &uevt, -1);
-	if (rc != NO_ERROR) {
-		goto err_send_fail;
-	}
-
-	ipc_msg_info_t inf;
-	rc = get_msg(session, &inf);
-	if (rc != NO_ERROR) {
-		TLOGE("%s: failed to get_msg (%ld)\n", __func__, rc);
-		goto err_send_fail;
-	}
-
-	if (inf.len > sizeof(*msg) + *rsp_buf_len) {
-		TLOGE("%s: insufficient output buffer size (%zu > %zu)\n",
-		      __func__, inf.len - sizeof(*msg), *rsp_buf_len);
-		rc = ERR_TOO_BIG;
-		goto err_get_fail;
-	}
-
-	if (inf.len < sizeof(*msg)) {
-		TLOGE("%s: short buffer (%zu)\n", __func__, inf.len);
-		rc = ERR_NOT_VALID;
-		goto err_get_fail;
-	}
-
 	uint32_t cmd_sent = msg->cmd;
 
 	iovec_t rx_iov[2] = {
@@ -137,19 +101,16 @@ static long send_req(hwkey_session_t session, struct hwkey_msg *msg, uint8_t *re
 		.num_iov = 2,
 	};
 
-	rc = read_msg(session, inf.id, 0, &rx_msg);
-	put_msg(session, inf.id);
+	/* send request and read response in a single syscall */
+	rc = call(session, &tx_msg, &rx_msg, -1);
 	if (rc < 0) {
-		goto err_read_fail;
+		goto err_call_fail;
 	}
 
 	size_t read_len = (size_t) rc;
-	if (read_len != inf.len) {
-		// data read in does not match message length
-		TLOGE("%s: invalid read length (%zu != %zu)\n",
-		       __func__, read_len, inf.len);
-		rc = ERR_IO;
-		goto err_read_fail;
+	if (read_len < sizeof(*msg)) {
+		TLOGE("%s: short buffer (%zu)\n", __func__, read_len);
+		return ERR_NOT_VALID;
 	}
 
 	if (msg->cmd != (cmd_sent | HWKEY_RESP_BIT)) {
@@ -161,11 +122,8 @@ static long send_req(hwkey_session_t session, struct hwkey_msg *msg, uint8_t *re
 	*rsp_buf_len = read_len - sizeof(*msg);
 	return hwkey_err_to_tipc_err(msg->status);
 
-err_get_fail:
-	put_msg(session, inf.id);
-err_send_fail:
-err_read_fail:
-	TLOGE("%s: failed read_msg (%ld)", __func__, rc);
+err_call_fail:
+	TLOGE("%s: failed call (%ld)", __func__, rc);
 	return rc;
 }
 
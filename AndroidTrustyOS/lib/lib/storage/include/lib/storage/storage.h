@@ -153,4 +153,154 @@ int storage_get_file_size(file_handle_t handle, storage_off_t *size);
  */
 int storage_end_transaction(storage_session_t session, bool complete);
 
+/**
+ * struct storage_compound_op - operation of a compound request
+ * @msg:       request header
+ * @req:       request payload
+ * @req_size:  number of bytes used in @req
+ * @data:      file name or write data sent after @req
+ * @data_size: size of @data
+ * @buf:       buffer to read into
+ */
+struct storage_compound_op {
+    struct storage_msg msg;
+    union {
+        struct storage_file_open_req open;
+        struct storage_file_close_req close;
+        struct storage_file_read_req read;
+        struct storage_file_write_req write;
+        struct storage_file_set_size_req set_size;
+    } req;
+    size_t req_size;
+    const void *data;
+    size_t data_size;
+    void *buf;
+};
+
+/**
+ * struct storage_compound - operations sent to the server in one message
+ * @session: the storage_session_t to send the operations on
+ * @count:   number of operations added
+ * @done:    number of operations the server ran
+ * @ops:     the operations
+ * @results: the result of every operation that was run
+ *
+ * Initialize with storage_compound_init, add operations with the
+ * storage_compound_* functions below, and send them with
+ * storage_compound_send. Operations that take a file act on the file opened
+ * by the last storage_compound_open_file call.
+ */
+struct storage_compound {
+    storage_session_t session;
+    uint count;
+    uint done;
+    struct storage_compound_op ops[STORAGE_COMPOUND_MAX_OPS];
+    struct storage_compound_result results[STORAGE_COMPOUND_MAX_OPS];
+};
+
+/**
+ * storage_compound_init() - Initializes a compound request
+ * @compound: the compound request to initialize
+ * @session:  the storage_session_t returned from a call to storage_open_session
+ */
+void storage_compound_init(struct storage_compound *compound,
+                           storage_session_t session);
+
+/**
+ * storage_compound_open_file() - Adds a storage_open_file operation
+ * @compound: the compound request
+ * @name:     a null-terminated string identifier of the file to open. Must
+ *            stay valid until storage_compound_send returns.
+ * @flags:    same as for storage_open_file
+ * @opflags:  a combination of @storage_op_flags
+ *
+ * Return: NO_ERROR on success, ERR_TOO_BIG if @compound is full.
+ */
+int storage_compound_open_file(struct storage_compound *compound,
+                               const char *name, uint32_t flags,
+                               uint32_t opflags);
+
+/**
+ * storage_compound_read() - Adds a storage_read operation
+ * @compound: the compound request
+ * @off:      the start offset from whence to read in the file
+ * @buf:      the buffer in which to write the data read
+ * @size:     the size of buf and number of bytes to read
+ *
+ * The data read by all operations of @compound must fit in a single message.
+ *
+ * Return: NO_ERROR on success, ERR_TOO_BIG if @compound is full.
+ */
+int storage_compound_read(struct storage_compound *compound, storage_off_t off,
+                          void *buf, size_t size);
+
+/**
+ * storage_compound_write() - Adds a storage_write operation
+ * @compound: the compound request
+ * @off:      the start offset from whence to write in the file
+ * @buf:      the buffer containing the data to write. Must stay valid until
+ *            storage_compound_send returns.
+ * @size:     the size of buf and number of bytes to write
+ * @opflags:  a combination of @storage_op_flags
+ *
+ * The request, including the data written by all operations of @compound,
+ * must fit in a single message.
+ *
+ * Return: NO_ERROR on success, ERR_TOO_BIG if @compound is full.
+ */
+int storage_compound_write(struct storage_compound *compound, storage_off_t off,
+                           const void *buf, size_t size, uint32_t opflags);
+
+/**
+ * storage_compound_set_file_size() - Adds a storage_set_file_size operation
+ * @compound:  the compound request
+ * @file_size: the number of bytes to set as the new size of the file
+ * @opflags:   a combination of @storage_op_flags
+ *
+ * Return: NO_ERROR on success, ERR_TOO_BIG if @compound is full.
+ */
+int storage_compound_set_file_size(struct storage_compound *compound,
+                                   storage_off_t file_size, uint32_t opflags);
+
+/**
+ * storage_compound_close_file() - Adds a storage_close_file operation
+ * @compound: the compound request
+ *
+ * Return: NO_ERROR on success, ERR_TOO_BIG if @compound is full.
+ */
+int storage_compound_close_file(struct storage_compound *compound);
+
+/**
+ * storage_compound_end_transaction() - Adds a storage_end_transaction operation
+ * @compound: the compound request
+ * @complete: if true, commit current transaction, discard it otherwise
+ *
+ * Return: NO_ERROR on success, ERR_TOO_BIG if @compound is full.
+ */
+int storage_compound_end_transaction(struct storage_compound *compound,
+                                     bool complete);
+
+/**
+ * storage_compound_send() - Sends a compound request and waits for the result
+ * @compound: the compound request
+ *
+ * The server runs the operations in order, until one of them fails.
+ *
+ * Return: NO_ERROR if all operations succeeded, the error of the operation
+ * that failed, or another negative error code if the request could not be
+ * sent.
+ */
+int storage_compound_send(struct storage_compound *compound);
+
+/**
+ * storage_compound_result() - Gets the result of a compound operation
+ * @compound: the compound request passed to storage_compound_send
+ * @index:    index of the operation, in the order the operations were added
+ *
+ * Return: the number of bytes read or written for read and write operations,
+ * NO_ERROR for other operations that succeeded, ERR_NOT_READY if the
+ * operation was not run, or another negative error code on failure.
+ */
+ssize_t storage_compound_result(struct storage_compound *compound, uint index);
+
 __END_CDECLS
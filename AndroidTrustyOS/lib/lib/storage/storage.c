@@ -16,6 +16,7 @@
 
 #include <err.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include <lib/storage/storage.h>
@@ -62,21 +63,11 @@ static inline uint32_t _to_msg_flags(uint32_t opflags)
     return msg_flags;
 }
 
-static ssize_t check_response(struct storage_msg *msg, ssize_t res)
+static int _to_error(uint32_t cmd, int32_t result)
 {
-    if (res < 0)
-        return res;
-
-    if ((size_t)res < sizeof(*msg)) {
-        TLOGE("invalid msg length (%zd < %zd)\n", (size_t)res, sizeof(*msg));
-        return ERR_IO;
-    }
-
-    TLOGI("cmd 0x%x: server returned %u\n", msg->cmd, msg->result);
-
-    switch(msg->result) {
+    switch(result) {
     case STORAGE_NO_ERROR:
-        return res - sizeof(*msg);
+        return NO_ERROR;
 
     case STORAGE_ERR_NOT_FOUND:
         return ERR_NOT_FOUND;
@@ -94,21 +85,41 @@ static ssize_t check_response(struct storage_msg *msg, ssize_t res)
         return ERR_ACCESS_DENIED;
 
     case STORAGE_ERR_UNIMPLEMENTED:
-        TLOGE("cmd 0x%x: is unhandles command\n", msg->cmd);
+        TLOGE("cmd 0x%x: is unhandles command\n", cmd);
         return ERR_NOT_IMPLEMENTED;
 
     case STORAGE_ERR_GENERIC:
-        TLOGE("cmd 0x%x: internal server error\n", msg->cmd);
+        TLOGE("cmd 0x%x: internal server error\n", cmd);
         return ERR_GENERIC;
 
     default:
-        TLOGE("cmd 0x%x: unhandled server response %u\n",
-              msg->cmd, msg->result);
+        TLOGE("cmd 0x%x: unhandled server response %u\n", cmd, result);
     }
 
     return ERR_IO;
 }
 
+static ssize_t check_response(struct storage_msg *msg, ssize_t res)
+{
+    int rc;
+
+    if (res < 0)
+        return res;
+
+    if ((size_t)res < sizeof(*msg)) {
+        TLOGE("invalid msg length (%zd < %zd)\n", (size_t)res, sizeof(*msg));
+        return ERR_IO;
+    }
+
+    TLOGI("cmd 0x%x: server returned %u\n", msg->cmd, msg->result);
+
+    rc = _to_error(msg->cmd, msg->result);
+    if (rc < 0)
+        return rc;
+
+    return res - sizeof(*msg);
+}
+
 static ssize_t get_response(storage_session_t session,
                             struct iovec *rx_iovs, uint rx_iovcnt)
 
@@ -188,24 +199,34 @@ ssize_t send_reqv(storage_session_t session,
         .iov = tx_iovs,
         .num_iov = tx_iovcnt,
     };
+    struct ipc_msg rx_msg = {
+        .iov = rx_iovs,
+        .num_iov = rx_iovcnt,
+    };
 
-    rc = send_msg(session, &tx_msg);
-    if (rc == ERR_NOT_ENOUGH_BUFFER) {
-        rc = wait_to_send(session, &tx_msg);
+    if (!rx_iovcnt) {
+        rc = send_msg(session, &tx_msg);
+    } else {
+        /* send request and receive response in a single syscall */
+        rc = call(session, &tx_msg, &rx_msg, -1);
     }
 
-    if (rc < 0) {
-        TLOGE("%s: failed (%d) to send_msg\n", __func__, (int)rc);
-        return rc;
+    if (rc == ERR_NOT_ENOUGH_BUFFER) {
+        /* queue is full, wait for room and get the response separately */
+        rc = wait_to_send(session, &tx_msg);
+        if (rc < 0) {
+            TLOGE("%s: failed (%d) to send_msg\n", __func__, (int)rc);
+            return rc;
+        }
+        rc = get_response(session, rx_iovs, rx_iovcnt);
     }
 
-    rc = get_response(session, rx_iovs, rx_iovcnt);
     if (rc < 0) {
         TLOGI("%s: failed (%d) to get response\n", __func__, (int)rc);
         return rc;
     }
 
-    return rc;
+    return rx_iovcnt ? rc : 0;
 }
 
 int storage_open_session(storage_session_t *session_p, const char *type)
@@ -272,28 +293,44 @@ int storage_delete_file(storage_session_t session, const char *name,
     return (int)check_response(&msg, rc);
 }
 
-static ssize_t _read_chunk(file_handle_t fh, storage_off_t off, void *buf, size_t size)
+/*
+ * Send one streamed read request and receive all responses to it. The server
+ * sets STORAGE_MSG_FLAG_BATCH on every response but the last one.
+ */
+static ssize_t _read_stream(file_handle_t fh, storage_off_t off, void *buf, size_t size)
 {
-    struct storage_msg msg = { .cmd = STORAGE_FILE_READ };
+    struct storage_msg msg = { .cmd = STORAGE_FILE_READ, .flags = STORAGE_MSG_FLAG_BATCH };
     struct storage_file_read_req req = { .handle = _to_handle(fh), .size = size, .offset = off };
     struct iovec tx[2] = {{&msg, sizeof(msg)}, {&req, sizeof(req)}};
     struct iovec rx[2] = {{&msg, sizeof(msg)}, {buf, size}};
+    size_t bytes_read = 0;
 
-    ssize_t rc = send_reqv(_to_session(fh), tx, 2, rx, 2);
-    return check_response(&msg, rc);
+    ssize_t rc = send_reqv(_to_session(fh), tx, 2, NULL, 0);
+    while (rc >= 0) {
+        rc = get_response(_to_session(fh), rx, 2);
+        rc = check_response(&msg, rc);
+        if (rc < 0)
+            break;
+        bytes_read += rc;
+        if (!(msg.flags & STORAGE_MSG_FLAG_BATCH))
+            return bytes_read;
+        rx[1].base = (uint8_t *)buf + bytes_read;
+        rx[1].len = size - bytes_read;
+    }
+    return rc;
 }
 
 ssize_t storage_read(file_handle_t fh, storage_off_t off, void *buf, size_t size)
 {
     ssize_t rc;
     size_t bytes_read = 0;
-    size_t chunk = MAX_CHUNK_SIZE;
+    size_t chunk = UINT32_MAX;
     uint8_t *ptr = buf;
 
     while (size) {
         if (chunk > size)
             chunk = size;
-        rc = _read_chunk(fh, off, ptr, chunk);
+        rc = _read_stream(fh, off, ptr, chunk);
         if (rc < 0)
             return rc;
         if (rc == 0)
@@ -306,6 +343,10 @@ ssize_t storage_read(file_handle_t fh, storage_off_t off, void *buf, size_t size
     return bytes_read;
 }
 
+/*
+ * Parts of a streamed write are sent with STORAGE_MSG_FLAG_BATCH set, and only
+ * the last part, which has it clear, gets a response.
+ */
 static ssize_t _write_req(file_handle_t fh, storage_off_t off,
                           const void *buf, size_t size, uint32_t msg_flags)
 {
@@ -313,8 +354,11 @@ static ssize_t _write_req(file_handle_t fh, storage_off_t off,
     struct storage_file_write_req req = { .handle = _to_handle(fh), .offset = off, };
     struct iovec tx[3] = {{&msg, sizeof(msg)}, {&req, sizeof(req)}, {(void *)buf, size}};
     struct iovec rx[1] = {{&msg, sizeof(msg)}};
+    uint rx_count = (msg_flags & STORAGE_MSG_FLAG_BATCH) ? 0 : 1;
 
-    ssize_t rc = send_reqv(_to_session(fh), tx, 3, rx, 1);
+    ssize_t rc = send_reqv(_to_session(fh), tx, 3, rx, rx_count);
+    if (rc >= 0 && !rx_count)
+        return size;
     rc = check_response(&msg, rc);
     return rc < 0 ? rc : (ssize_t)size;
 }
@@ -326,7 +370,8 @@ ssize_t storage_write(file_handle_t fh, storage_off_t off,
     size_t bytes_written = 0;
     size_t chunk = MAX_CHUNK_SIZE;
     const uint8_t *ptr = buf;
-    uint32_t msg_flags = _to_msg_flags(opflags & ~STORAGE_OP_COMPLETE);
+    uint32_t msg_flags = _to_msg_flags(opflags & ~STORAGE_OP_COMPLETE) |
+                         STORAGE_MSG_FLAG_BATCH;
 
     while (size) {
         if (chunk >= size) {
@@ -395,3 +440,184 @@ int storage_end_transaction(storage_session_t session, bool complete)
     return (int)check_response(&msg, rc);
 }
 
+
+void storage_compound_init(struct storage_compound *compound,
+                           storage_session_t session)
+{
+    memset(compound, 0, sizeof(*compound));
+    compound->session = session;
+}
+
+static struct storage_compound_op *_add_op(struct storage_compound *compound,
+                                           uint32_t cmd, uint32_t msg_flags,
+                                           size_t req_size)
+{
+    struct storage_compound_op *op;
+
+    if (compound->count >= STORAGE_COMPOUND_MAX_OPS)
+        return NULL;
+
+    op = &compound->ops[compound->count++];
+    op->msg.cmd = cmd;
+    op->msg.flags = msg_flags;
+    op->req_size = req_size;
+    return op;
+}
+
+int storage_compound_open_file(struct storage_compound *compound,
+                               const char *name, uint32_t flags,
+                               uint32_t opflags)
+{
+    struct storage_compound_op *op = _add_op(compound, STORAGE_FILE_OPEN,
+                                             _to_msg_flags(opflags),
+                                             sizeof(op->req.open));
+    if (!op)
+        return ERR_TOO_BIG;
+
+    op->req.open.flags = flags;
+    op->data = name;
+    op->data_size = strlen(name);
+    return NO_ERROR;
+}
+
+int storage_compound_read(struct storage_compound *compound, storage_off_t off,
+                          void *buf, size_t size)
+{
+    struct storage_compound_op *op = _add_op(compound, STORAGE_FILE_READ, 0,
+                                             sizeof(op->req.read));
+    if (!op)
+        return ERR_TOO_BIG;
+
+    op->req.read.handle = STORAGE_COMPOUND_OPENED_FILE;
+    op->req.read.size = size;
+    op->req.read.offset = off;
+    op->buf = buf;
+    return NO_ERROR;
+}
+
+int storage_compound_write(struct storage_compound *compound, storage_off_t off,
+                           const void *buf, size_t size, uint32_t opflags)
+{
+    struct storage_compound_op *op = _add_op(compound, STORAGE_FILE_WRITE,
+                                             _to_msg_flags(opflags),
+                                             sizeof(op->req.write));
+    if (!op)
+        return ERR_TOO_BIG;
+
+    op->req.write.handle = STORAGE_COMPOUND_OPENED_FILE;
+    op->req.write.offset = off;
+    op->data = buf;
+    op->data_size = size;
+    return NO_ERROR;
+}
+
+int storage_compound_set_file_size(struct storage_compound *compound,
+                                   storage_off_t file_size, uint32_t opflags)
+{
+    struct storage_compound_op *op = _add_op(compound, STORAGE_FILE_SET_SIZE,
+                                             _to_msg_flags(opflags),
+                                             sizeof(op->req.set_size));
+    if (!op)
+        return ERR_TOO_BIG;
+
+    op->req.set_size.handle = STORAGE_COMPOUND_OPENED_FILE;
+    op->req.set_size.size = file_size;
+    return NO_ERROR;
+}
+
+int storage_compound_close_file(struct storage_compound *compound)
+{
+    struct storage_compound_op *op = _add_op(compound, STORAGE_FILE_CLOSE, 0,
+                                             sizeof(op->req.close));
+    if (!op)
+        return ERR_TOO_BIG;
+
+    op->req.close.handle = STORAGE_COMPOUND_OPENED_FILE;
+    return NO_ERROR;
+}
+
+int storage_compound_end_transaction(struct storage_compound *compound,
+                                     bool complete)
+{
+    uint32_t flags = complete ? STORAGE_MSG_FLAG_TRANSACT_COMPLETE : 0;
+
+    if (!_add_op(compound, STORAGE_END_TRANSACTION, flags, 0))
+        return ERR_TOO_BIG;
+
+    return NO_ERROR;
+}
+
+int storage_compound_send(struct storage_compound *compound)
+{
+    struct storage_msg msg = { .cmd = STORAGE_COMPOUND };
+    struct storage_compound_req req = { .count = compound->count };
+    struct storage_compound_resp rsp = { 0 };
+    struct iovec tx[2 + 3 * STORAGE_COMPOUND_MAX_OPS];
+    struct iovec rx[3 + STORAGE_COMPOUND_MAX_OPS];
+    struct storage_compound_op *op;
+    uint tx_count = 0;
+    uint rx_count = 0;
+    ssize_t rc;
+    uint i;
+
+    tx[tx_count].base = &msg;
+    tx[tx_count++].len = sizeof(msg);
+    tx[tx_count].base = &req;
+    tx[tx_count++].len = sizeof(req);
+
+    rx[rx_count].base = &msg;
+    rx[rx_count++].len = sizeof(msg);
+    rx[rx_count].base = &rsp;
+    rx[rx_count++].len = sizeof(rsp);
+    rx[rx_count].base = compound->results;
+    rx[rx_count++].len = compound->count * sizeof(compound->results[0]);
+
+    for (i = 0; i < compound->count; i++) {
+        op = &compound->ops[i];
+        op->msg.size = sizeof(op->msg) + op->req_size + op->data_size;
+        tx[tx_count].base = &op->msg;
+        tx[tx_count++].len = sizeof(op->msg);
+        if (op->req_size) {
+            tx[tx_count].base = &op->req;
+            tx[tx_count++].len = op->req_size;
+        }
+        if (op->data_size) {
+            tx[tx_count].base = (void *)op->data;
+            tx[tx_count++].len = op->data_size;
+        }
+        if (op->msg.cmd == STORAGE_FILE_READ && op->req.read.size) {
+            rx[rx_count].base = op->buf;
+            rx[rx_count++].len = op->req.read.size;
+        }
+    }
+
+    memset(compound->results, 0, sizeof(compound->results));
+    compound->done = 0;
+
+    rc = send_reqv(compound->session, tx, tx_count, rx, rx_count);
+    /* the results are returned even if one of the operations failed */
+    if (rc >= (ssize_t)(sizeof(msg) + sizeof(rsp)))
+        compound->done = MIN(rsp.count, compound->count);
+    rc = check_response(&msg, rc);
+    return rc < 0 ? (int)rc : NO_ERROR;
+}
+
+ssize_t storage_compound_result(struct storage_compound *compound, uint index)
+{
+    struct storage_compound_op *op;
+    int rc;
+
+    if (index >= compound->done)
+        return ERR_NOT_READY;
+
+    op = &compound->ops[index];
+    rc = _to_error(op->msg.cmd, compound->results[index].result);
+    if (rc < 0)
+        return rc;
+
+    if (op->msg.cmd == STORAGE_FILE_READ)
+        return compound->results[index].size;
+    if (op->msg.cmd == STORAGE_FILE_WRITE)
+        return op->data_size;
+    return NO_ERROR;
+}
@@ -35,6 +35,13 @@
  */
 #define MMAP_FLAG_IO_HANDLE		(0x1 << 0)
 
+/*
+ * Maps memory object specified by handle (id) from memref_create or from a
+ * received ipc message to user address space. The mapping is read-writable
+ * and covers the first size bytes, rounded up to a page, of the object.
+ */
+#define MMAP_FLAG_MEMREF_HANDLE		(0x1 << 1)
+
 /**
  * struct dma_pmem - a contiguous physical memory block
  * @paddr: start of physical address
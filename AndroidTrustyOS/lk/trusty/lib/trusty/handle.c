@@ -51,7 +51,10 @@ void handle_init(handle_t *handle, struct handle_ops *ops)
 	handle->wait_event = NULL;
 	mutex_init(&handle->wait_event_lock);
 	handle->cookie = NULL;
+	handle->hlist = NULL;
 	list_clear_node(&handle->hlist_node);
+	list_clear_node(&handle->ready_node);
+	handle->id = INVALID_HANDLE_ID;
 }
 
 static void __handle_destroy_ref(refcount_t *ref)
@@ -154,7 +157,22 @@ err_prepare_wait:
 	return ret;
 }
 
-void handle_notify(handle_t *handle)
+/*
+ *  Put handle on the ready list of the handle list it is on, and wake up the
+ *  thread waiting on the list, if any. Must be called with the ready lock of
+ *  the list held.
+ */
+static void _hlist_queue_ready_locked(handle_list_t *hlist, handle_t *handle,
+				      bool reschedule)
+{
+	if (!list_in_list(&handle->ready_node))
+		list_add_tail(&hlist->ready, &handle->ready_node);
+
+	if (hlist->wait_event)
+		event_signal(hlist->wait_event, reschedule);
+}
+
+static void _handle_notify(handle_t *handle, bool reschedule)
 {
 	DEBUG_ASSERT(handle);
 
@@ -164,11 +182,31 @@ void handle_notify(handle_t *handle)
 	if (handle->wait_event) {
 		LTRACEF("notifying handle %p wait_event %p\n",
 			handle, handle->wait_event);
-		event_signal(handle->wait_event, true);
+		event_signal(handle->wait_event, reschedule);
+	}
+	if (handle->hlist) {
+		mutex_acquire(&handle->hlist->ready_lock);
+		_hlist_queue_ready_locked(handle->hlist, handle, reschedule);
+		mutex_release(&handle->hlist->ready_lock);
 	}
 	mutex_release(&handle->wait_event_lock);
 }
 
+void handle_notify(handle_t *handle)
+{
+	_handle_notify(handle, true);
+}
+
+/*
+ *  Like handle_notify, but lets the current thread keep running. For callers
+ *  that are about to block, so the cpu goes to the woken thread with a single
+ *  context switch.
+ */
+void handle_notify_no_resched(handle_t *handle)
+{
+	_handle_notify(handle, false);
+}
+
 void handle_list_init(handle_list_t *hlist)
 {
 	DEBUG_ASSERT(hlist);
@@ -185,16 +223,18 @@ void handle_list_add(handle_list_t *hlist, handle_t *handle)
 	handle_incref(handle);
 	mutex_acquire(&hlist->lock);
 	list_add_tail(&hlist->handles, &handle->hlist_node);
-	if (hlist->wait_event) {
-		/* somebody is waiting on list */
-		_prepare_wait_handle(hlist->wait_event, handle);
 
-		/* call poll to check if it is already signaled */
-		uint32_t event = handle->ops->poll(handle);
-		if (event) {
-			handle_notify(handle);
-		}
-	}
+	/*
+	 * Route notifications for this handle to the list, and queue it as
+	 * ready so the next wait polls it in case it is already signaled.
+	 */
+	mutex_acquire(&handle->wait_event_lock);
+	handle->hlist = hlist;
+	mutex_acquire(&hlist->ready_lock);
+	_hlist_queue_ready_locked(hlist, handle, true);
+	mutex_release(&hlist->ready_lock);
+	mutex_release(&handle->wait_event_lock);
+
 	mutex_release(&hlist->lock);
 }
 
@@ -207,15 +247,20 @@ static void _handle_list_del_locked(handle_list_t *hlist, handle_t *handle)
 	/* remove item from list */
 	list_delete(&handle->hlist_node);
 
-	/* check if somebody is waiting on this handle list */
-	if (hlist->wait_event) {
-		/* finish waiting */
-		_finish_wait_handle(handle);
-		if (list_is_empty(&hlist->handles)) {
-			/* wakeup waiter if list is now empty */
-			event_signal(hlist->wait_event, true);
-		}
-	}
+	/* stop routing notifications to the list */
+	mutex_acquire(&handle->wait_event_lock);
+	handle->hlist = NULL;
+	mutex_release(&handle->wait_event_lock);
+
+	mutex_acquire(&hlist->ready_lock);
+	if (list_in_list(&handle->ready_node))
+		list_delete(&handle->ready_node);
+	mutex_release(&hlist->ready_lock);
+
+	/* wakeup waiter if list is now empty */
+	if (hlist->wait_event && list_is_empty(&hlist->handles))
+		event_signal(hlist->wait_event, true);
+
 	handle_decref(handle);
 }
 
@@ -245,59 +290,41 @@ void handle_list_delete_all(handle_list_t *hlist)
 }
 
 /*
- *  Iterate handle list and call finish_wait for each item until the last one
- *  (inclusive) specified by corresponding function parameter. If the last item
- *  is not specified, iterate the whole list.
+ *  Poll handles on the ready list until one with a pending event is found.
+ *  Handles without events are dropped from the ready list; handle_notify puts
+ *  them back. The handle that is found is moved to the tail of the ready list,
+ *  as it may have more events, so the other ready handles go first on the
+ *  next wait. Each handle is polled once per notification, so the cost does
+ *  not depend on the number of handles on the list.
  */
-static void _hlist_finish_wait_locked(handle_list_t *hlist, handle_t *last)
+static int _hlist_poll_ready_locked(handle_list_t *hlist, handle_t **handle_ptr,
+				    uint32_t *event_ptr)
 {
 	handle_t *handle;
-	list_for_every_entry(&hlist->handles, handle, handle_t, hlist_node) {
-		_finish_wait_handle(handle);
-		if (handle == last)
-			break;
-	}
-}
-
-/*
- *  Iterate handle list and call prepare wait (if required) and poll for each
- *  handle until the ready one is found and return it to caller.
- *  Undo prepare op if ready handle is found or en error occured.
- */
-static int _hlist_do_poll_locked(handle_list_t *hlist, handle_t **handle_ptr,
-				 uint32_t *event_ptr, bool prepare)
-{
-	int ret;
+	uint32_t event;
 
-	DEBUG_ASSERT(hlist->wait_event);
+	while (true) {
+		mutex_acquire(&hlist->ready_lock);
+		handle = list_remove_head_type(&hlist->ready, handle_t,
+					       ready_node);
+		mutex_release(&hlist->ready_lock);
 
-	if (list_is_empty(&hlist->handles))
-		return ERR_NOT_FOUND;  /* no handles in the list */
+		if (!handle)
+			return 0;
 
-	handle_t *next;
-	handle_t *last_prep = NULL;
-	list_for_every_entry(&hlist->handles, next, handle_t, hlist_node) {
-		if (prepare) {
-			ret = _prepare_wait_handle(hlist->wait_event, next);
-			if (ret)
-				break;
-			last_prep = next;
-		}
-
-		uint32_t event = next->ops->poll(next);
+		event = handle->ops->poll(handle);
 		if (event) {
+			mutex_acquire(&hlist->ready_lock);
+			if (!list_in_list(&handle->ready_node))
+				list_add_tail(&hlist->ready,
+					      &handle->ready_node);
+			mutex_release(&hlist->ready_lock);
+
 			*event_ptr = event;
-			*handle_ptr = next;
-			ret = 1;
-			break;
+			*handle_ptr = handle;
+			return 1;
 		}
 	}
-
-	if (ret && prepare && last_prep) {
-		/* need to undo prepare */
-		_hlist_finish_wait_locked(hlist, last_prep);
-	}
-	return ret;
 }
 
 /* fills in the handle that has a pending event. The reference taken by the list
@@ -322,27 +349,27 @@ int handle_list_wait(handle_list_t *hlist, handle_t **handle_ptr,
 
 	DEBUG_ASSERT(hlist->wait_event == NULL);
 
+	mutex_acquire(&hlist->ready_lock);
 	hlist->wait_event = &ev;
-	ret = _hlist_do_poll_locked(hlist, handle_ptr, event_ptr, true);
-	if (ret < 0)
-		goto err_do_poll;
+	mutex_release(&hlist->ready_lock);
 
-	if (ret == 0) {
-		/* no handles ready */
-		do {
-			mutex_release(&hlist->lock);
-			ret = __do_wait(&ev, timeout);
-			mutex_acquire(&hlist->lock);
+	while (true) {
+		if (list_is_empty(&hlist->handles)) {
+			ret = ERR_NOT_FOUND;  /* no handles in the list */
+			break;
+		}
 
-			if (ret < 0)
-				break;
+		ret = _hlist_poll_ready_locked(hlist, handle_ptr, event_ptr);
+		if (ret)
+			break;
 
-			/* poll again */
-			ret = _hlist_do_poll_locked(hlist, handle_ptr,
-						    event_ptr, false);
-		} while (!ret);
+		/* no handles ready */
+		mutex_release(&hlist->lock);
+		ret = __do_wait(&ev, timeout);
+		mutex_acquire(&hlist->lock);
 
-		_hlist_finish_wait_locked(hlist, NULL);
+		if (ret < 0)
+			break;
 	}
 
 	if (ret == 1) {
@@ -353,15 +380,12 @@ int handle_list_wait(handle_list_t *hlist, handle_t **handle_ptr,
 
 		handle_incref(handle);
 
-		/* move list head after item we just found */
-		list_delete(&hlist->handles);
-		list_add_head(&handle->hlist_node, &hlist->handles);
-
 		ret = NO_ERROR;
 	}
 
-err_do_poll:
+	mutex_acquire(&hlist->ready_lock);
 	hlist->wait_event = NULL;
+	mutex_release(&hlist->ready_lock);
 	mutex_release(&hlist->lock);
 	event_destroy(&ev);
 	return ret;
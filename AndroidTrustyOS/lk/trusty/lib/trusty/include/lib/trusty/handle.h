@@ -44,7 +44,12 @@ enum {
 	IPC_HANDLE_POLL_SEND_UNBLOCKED = 0x10,
 };
 
+typedef uint32_t handle_id_t;
+
+#define INVALID_HANDLE_ID  (0xFFFFFFFFu)
+
 struct handle_ops;
+struct handle_list;
 
 typedef struct handle {
 	refcount_t		refcnt;
@@ -57,7 +62,17 @@ typedef struct handle {
 	event_t			*wait_event;
 	mutex_t			wait_event_lock;
 
+	/* handle list this handle is on, and its node in the list of
+	 * handles that were notified since they were last polled. The
+	 * pointer is protected by wait_event_lock, the node by the ready
+	 * lock of the list.
+	 */
+	struct handle_list	*hlist;
 	struct list_node	hlist_node;
+	struct list_node	ready_node;
+
+	/* id of this handle in the user context it is installed in */
+	handle_id_t		id;
 
 	void			*cookie;
 } handle_t;
@@ -73,12 +88,18 @@ typedef struct handle_list {
 	struct list_node	handles;
 	mutex_t			lock;
 	event_t			*wait_event;
+
+	/* handles that might have pending events */
+	struct list_node	ready;
+	mutex_t			ready_lock;
 } handle_list_t;
 
 #define HANDLE_LIST_INITIAL_VALUE(hs) \
 { \
 	.handles	= LIST_INITIAL_VALUE((hs).handles), \
 	.lock		= MUTEX_INITIAL_VALUE((hs).lock), \
+	.ready		= LIST_INITIAL_VALUE((hs).ready), \
+	.ready_lock	= MUTEX_INITIAL_VALUE((hs).ready_lock), \
 }
 
 /* handle management */
@@ -90,6 +111,7 @@ void handle_decref(handle_t *handle);
 
 int handle_wait(handle_t *handle, uint32_t *handle_event, lk_time_t timeout);
 void handle_notify(handle_t *handle);
+void handle_notify_no_resched(handle_t *handle);
 
 static inline void handle_set_cookie(handle_t *handle, void *cookie)
 {
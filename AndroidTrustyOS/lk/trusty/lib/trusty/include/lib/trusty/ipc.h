@@ -45,10 +45,35 @@ enum {
 enum {
 	IPC_PORT_ALLOW_TA_CONNECT	= 0x1,
 	IPC_PORT_ALLOW_NS_CONNECT	= 0x2,
+	IPC_PORT_MAP_MSG_BUF		= 0x4,
 };
 
 #define IPC_PORT_PATH_MAX	64
 
+#define IPC_STATS_LATENCY_BUCKETS	16
+
+/*
+ * Message statistics of a channel, or of all server channels of a port.
+ * Bucket 0 of latency_hist counts messages that were received within
+ * 1 usec of being sent, bucket n those that took [2^(n-1), 2^n) usecs,
+ * and the last bucket everything slower.
+ */
+typedef struct ipc_stats {
+	uint64_t		tx_msgs;
+	uint64_t		tx_bytes;
+	uint64_t		rx_msgs;
+	uint64_t		rx_bytes;
+
+	/* sends that found the peer queue full */
+	uint32_t		send_blocked;
+	/* sends by the peer that found our queue full */
+	uint32_t		peer_send_blocked;
+	/* most messages held in our queue at once */
+	uint32_t		max_queued;
+
+	uint32_t		latency_hist[IPC_STATS_LATENCY_BUCKETS];
+} ipc_stats_t;
+
 typedef struct ipc_port {
 	/* e.g. /service/sys/crypto, /service/usr/drm/widevine */
 	char			path[IPC_PORT_PATH_MAX];
@@ -64,6 +89,10 @@ typedef struct ipc_port {
 
 	struct list_node	pending_list;
 
+	/* server channels of all connections, for statistics */
+	struct list_node	chan_list;
+	ipc_stats_t		stats;
+
 	struct list_node	node;
 } ipc_port_t;
 
@@ -118,6 +147,11 @@ typedef struct ipc_chan {
 
 	ipc_msg_queue_t		*msg_queue;
 
+	/* port of a server channel, while the port is open */
+	struct ipc_port		*port;
+	struct list_node	port_node;
+	ipc_stats_t		stats;
+
 	/*
 	 * TODO: consider changing async connect to preallocate
 	 *       not-yet-existing port object then we can get rid
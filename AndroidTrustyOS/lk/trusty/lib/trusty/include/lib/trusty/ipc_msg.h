@@ -34,8 +34,11 @@
 
 typedef struct ipc_msg_queue ipc_msg_queue_t;
 
-int ipc_msg_queue_create(uint num_items, size_t item_sz, ipc_msg_queue_t **mq);
+int ipc_msg_queue_create(uint num_items, size_t item_sz, bool mappable,
+                         ipc_msg_queue_t **mq);
 void ipc_msg_queue_destroy(ipc_msg_queue_t *mq);
+int ipc_msg_queue_map(ipc_msg_queue_t *mq, uthread_t *ut);
+void ipc_msg_queue_unmap(ipc_msg_queue_t *mq);
 
 bool ipc_msg_queue_is_empty(ipc_msg_queue_t *mq);
 bool ipc_msg_queue_is_full(ipc_msg_queue_t *mq);
@@ -66,6 +69,8 @@ typedef struct ipc_msg_user {
 typedef struct ipc_msg_info {
 	uint32_t	len;
 	uint32_t	id;
+	uint32_t	num_handles;
+	user_addr_t	buf;
 } ipc_msg_info_t;
 
 int ipc_get_msg(handle_t *chandle, ipc_msg_info_t *msg_info);
@@ -0,0 +1,52 @@
+/*
+ * Copyright (c) 2016, Google, Inc. All rights reserved
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef __LIB_TRUSTY_MEMREF_H
+#define __LIB_TRUSTY_MEMREF_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <uthread.h>
+
+#include <lib/trusty/handle.h>
+#include <lib/trusty/uctx.h>
+
+/* largest memory object that can be created, in bytes */
+#define MEMREF_MAX_SIZE		(64 * PAGE_SIZE)
+
+/*
+ * A memref handle refers to a page aligned kernel buffer that can be mapped
+ * into the address space of the app that holds the handle. Handles are sent
+ * to other apps in ipc messages, so both sides can map the same pages instead
+ * of copying data through the message queue. The buffer is freed when the
+ * last handle is closed and the last mapping is removed.
+ */
+int memref_create(size_t size, handle_t **handle_ptr);
+int memref_dup(handle_t *handle, handle_t **handle_ptr);
+bool memref_is_memref(handle_t *handle);
+
+int memref_mmap(handle_id_t handle_id, size_t size, vaddr_t *vaddr);
+int memref_munmap(vaddr_t vaddr);
+
+#endif
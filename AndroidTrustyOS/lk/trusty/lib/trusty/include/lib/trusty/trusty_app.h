@@ -27,6 +27,7 @@
 
 #include <assert.h>
 #include <list.h>
+#include <stdbool.h>
 #include <sys/types.h>
 #include <uthread.h>
 
@@ -42,6 +43,7 @@ typedef struct
 	uint32_t	min_stack_size;
 	uint32_t	min_heap_size;
 	uint32_t	map_io_mem_cnt;
+	bool		ipc_stats;
 	uint32_t	config_entry_cnt;
 	uint32_t	*config_blob;
 } trusty_app_props_t;
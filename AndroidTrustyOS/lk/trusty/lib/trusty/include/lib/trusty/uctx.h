@@ -31,10 +31,6 @@
 
 typedef struct uctx uctx_t;
 
-typedef uint32_t handle_id_t;
-
-#define INVALID_HANDLE_ID  (0xFFFFFFFFu)
-
 int uctx_create(void *priv, uctx_t **ctx);
 void uctx_destroy(uctx_t *ctx);
 void *uctx_get_priv(uctx_t *ctx);
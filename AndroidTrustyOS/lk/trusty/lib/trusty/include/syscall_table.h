@@ -37,6 +37,7 @@ DEF_SYSCALL(0x8, mmap, long, 4, user_addr_t uaddr, uint32_t size, uint32_t flags
 DEF_SYSCALL(0x9, munmap, long, 2, user_addr_t uaddr, uint32_t size)
 DEF_SYSCALL(0xa, prepare_dma, long, 4, user_addr_t uaddr, uint32_t size, uint32_t flags, user_addr_t pmem)
 DEF_SYSCALL(0xb, finish_dma, long, 3, user_addr_t uaddr, uint32_t size, uint32_t flags)
+DEF_SYSCALL(0xc, memref_create, long, 2, uint32_t size, uint32_t flags)
 
 /* IPC connection establishement syscalls */
 DEF_SYSCALL(0x10, port_create, long, 4, const char *path, uint num_recv_bufs, size_t recv_buf_size, uint32_t flags)
@@ -44,6 +45,7 @@ DEF_SYSCALL(0x11, connect, long, 2, const char *path, uint flags)
 DEF_SYSCALL(0x12, accept, long, 2, uint32_t handle_id, uuid_t *peer_uuid)
 DEF_SYSCALL(0x13, close, long, 1, uint32_t handle_id)
 DEF_SYSCALL(0x14, set_cookie, long, 2, uint32_t handle, void *cookie)
+DEF_SYSCALL(0x15, port_stats, long, 2, const char *path, ipc_stats_t *stats)
 
 /* handle polling related syscalls */
 DEF_SYSCALL(0x18, wait, long, 3, uint32_t handle_id, uevent_t *event, unsigned long timeout_msecs)
@@ -54,3 +56,4 @@ DEF_SYSCALL(0x20, get_msg, long, 2, uint32_t handle, ipc_msg_info_t *msg_info)
 DEF_SYSCALL(0x21, read_msg, long, 4, uint32_t handle, uint32_t msg_id, uint32_t offset, ipc_msg_t *msg)
 DEF_SYSCALL(0x22, put_msg, long, 2, uint32_t handle, uint32_t msg_id)
 DEF_SYSCALL(0x23, send_msg, long, 2, uint32_t handle, ipc_msg_t *msg)
+DEF_SYSCALL(0x24, call, long, 4, uint32_t handle, ipc_msg_t *msg, ipc_msg_t *reply, unsigned long timeout_msecs)
@@ -38,6 +38,10 @@
 
 #include <lib/syscall.h>
 
+#if WITH_LIB_CONSOLE
+#include <lib/console.h>
+#endif
+
 #include <lib/trusty/uuid.h>
 
 #if WITH_TRUSTY_IPC
@@ -145,6 +149,7 @@ int ipc_port_create(const uuid_t *sid, const char *path,
 
 	new_port->state = IPC_PORT_STATE_INVALID;
 	list_initialize(&new_port->pending_list);
+	list_initialize(&new_port->chan_list);
 
 	handle_init(&new_port->handle, &ipc_port_handle_ops);
 
@@ -204,6 +209,11 @@ static void port_shutdown(handle_t *phandle)
 		handle_decref(phandle);
 	}
 
+	/* accepted connections outlive the port, stop counting for it */
+	while ((server = list_remove_head_type(&port->chan_list,
+	                                       ipc_chan_t, port_node)))
+		server->port = NULL;
+
 	mutex_release(&ipc_lock);
 }
 
@@ -223,6 +233,7 @@ static void port_handle_destroy(handle_t *phandle)
 	   node should not be in the list
 	 */
 	DEBUG_ASSERT(list_is_empty(&port->pending_list));
+	DEBUG_ASSERT(list_is_empty(&port->chan_list));
 	DEBUG_ASSERT(!list_in_list(&port->node));
 
 	LTRACEF("destroying port %p ('%s')\n", port, port->path);
@@ -387,6 +398,9 @@ static inline void __chan_destroy_refobj(obj_t *ref)
 	/* should not be in a list  */
 	ASSERT(!list_in_list(&chan->node));
 
+	if (chan->port)
+		list_delete(&chan->port_node);
+
 	if (chan->path)
 		free((void *)chan->path);
 
@@ -503,6 +517,9 @@ static void chan_handle_destroy(handle_t *chandle)
 
 	ipc_chan_t *chan = containerof(chandle, ipc_chan_t, handle);
 	mutex_acquire(&ipc_lock);
+	/* the app can no longer get messages from this channel */
+	if (chan->msg_queue)
+		ipc_msg_queue_unmap(chan->msg_queue);
 	chan_del_ref(chan, &chan->handle_ref);
 	mutex_release(&ipc_lock);
 }
@@ -618,7 +635,7 @@ static int port_attach_client(ipc_port_t *port, ipc_chan_t *client)
 
 	/* allocate msg queues */
 	ret = ipc_msg_queue_create(port->num_recv_bufs,
-				   port->recv_buf_size,
+				   port->recv_buf_size, false,
 				   &client->msg_queue);
 	if (ret != NO_ERROR) {
 		LTRACEF("failed to alloc mq: %d\n", ret);
@@ -627,6 +644,7 @@ static int port_attach_client(ipc_port_t *port, ipc_chan_t *client)
 
 	ret = ipc_msg_queue_create(port->num_recv_bufs,
 				   port->recv_buf_size,
+				   !!(port->flags & IPC_PORT_MAP_MSG_BUF),
 				   &server->msg_queue);
 	if (ret != NO_ERROR) {
 		LTRACEF("failed to alloc mq: %d\n", ret);
@@ -650,6 +668,10 @@ static int port_attach_client(ipc_port_t *port, ipc_chan_t *client)
 	chan_add_ref(server, &server->node_ref);
 	list_add_tail(&port->pending_list, &server->node);
 
+	/* count its messages towards the port */
+	server->port = port;
+	list_add_tail(&port->chan_list, &server->port_node);
+
 	/* bump a ref to the port while there's a pending connection */
 	handle_incref(&port->handle);
 
@@ -924,6 +946,12 @@ long __SYSCALL sys_accept(uint32_t handle_id, user_addr_t user_uuid)
 	if (ret != NO_ERROR)
 		goto err_accept;
 
+	/* map the receive buffers if the port asked for it */
+	ret = ipc_msg_queue_map(containerof(chandle, ipc_chan_t, handle)->msg_queue,
+	                        uthread_get_current());
+	if (ret != NO_ERROR)
+		goto err_map;
+
 	ret = uctx_handle_install(ctx, chandle, &new_id);
 	if (ret != NO_ERROR)
 		goto err_install;
@@ -939,12 +967,95 @@ long __SYSCALL sys_accept(uint32_t handle_id, user_addr_t user_uuid)
 err_uuid_copy:
 	uctx_handle_remove(ctx, new_id, &chandle);
 err_install:
+err_map:
 	handle_close(chandle);
 err_accept:
 	handle_decref(phandle);
 	return (long) ret;
 }
 
+/*
+ *  Called by user task to read the statistics of the port at the given
+ *  path. Only apps with TRUSTY_APP_CONFIG_IPC_STATS in their manifest
+ *  may query other services.
+ */
+long __SYSCALL sys_port_stats(user_addr_t path, user_addr_t user_stats)
+{
+	uthread_t *ut = uthread_get_current();
+	trusty_app_t *tapp = ut->private_data;
+	char tmp_path[IPC_PORT_PATH_MAX];
+	ipc_port_t *port;
+	ipc_stats_t stats;
+	int ret;
+
+	if (!tapp->props.ipc_stats)
+		return (long) ERR_ACCESS_DENIED;
+
+	ret = (int) strncpy_from_user(tmp_path, path, sizeof(tmp_path));
+	if (ret < 0)
+		return (long) ret;
+
+	if ((uint)ret >= sizeof(tmp_path))
+		return (long) ERR_INVALID_ARGS;
+
+	mutex_acquire(&ipc_lock);
+	port = port_find_locked(tmp_path);
+	if (port)
+		stats = port->stats;
+	mutex_release(&ipc_lock);
+
+	if (!port)
+		return (long) ERR_NOT_FOUND;
+
+	return (long) copy_to_user(user_stats, &stats, sizeof(stats));
+}
+
+#if WITH_LIB_CONSOLE
+
+static void dump_stats(const ipc_stats_t *stats)
+{
+	printf("    tx %llu msgs %llu bytes, rx %llu msgs %llu bytes\n",
+	       stats->tx_msgs, stats->tx_bytes,
+	       stats->rx_msgs, stats->rx_bytes);
+	printf("    send blocked %u, peer send blocked %u, max queued %u\n",
+	       stats->send_blocked, stats->peer_send_blocked,
+	       stats->max_queued);
+	printf("    latency (log2 usecs):");
+	for (uint i = 0; i < IPC_STATS_LATENCY_BUCKETS; i++)
+		printf(" %u", stats->latency_hist[i]);
+	printf("\n");
+}
+
+static int cmd_ipc(int argc, const cmd_args *argv)
+{
+	ipc_port_t *port;
+	ipc_chan_t *server;
+	bool verbose = argc > 1 && !strcmp(argv[1].str, "-v");
+
+	mutex_acquire(&ipc_lock);
+	list_for_every_entry(&ipc_port_list, port, ipc_port_t, node) {
+		printf("port %s: %u x %zu bytes\n", port->path,
+		       port->num_recv_bufs, port->recv_buf_size);
+		dump_stats(&port->stats);
+		if (!verbose)
+			continue;
+		list_for_every_entry(&port->chan_list, server, ipc_chan_t,
+		                     port_node) {
+			printf("  chan %p: state %u\n", server, server->state);
+			dump_stats(&server->stats);
+		}
+	}
+	mutex_release(&ipc_lock);
+
+	return NO_ERROR;
+}
+
+STATIC_COMMAND_START
+STATIC_COMMAND("ipc", "ipc port statistics, -v for each channel", &cmd_ipc)
+STATIC_COMMAND_END(ipc);
+
+#endif /* WITH_LIB_CONSOLE */
+
 #else /* WITH_TRUSTY_IPC */
 
 long __SYSCALL sys_port_create(user_addr_t path, uint num_recv_bufs,
@@ -963,5 +1074,10 @@ long __SYSCALL sys_accept(uint32_t handle_id, uuid_t *peer_uuid)
 	return (long) ERR_NOT_SUPPORTED;
 }
 
+long __SYSCALL sys_port_stats(user_addr_t path, user_addr_t user_stats)
+{
+	return (long) ERR_NOT_SUPPORTED;
+}
+
 #endif /* WITH_TRUSTY_IPC */
 
@@ -40,6 +40,8 @@
 #include <assert.h>
 #include <err.h>
 #include <list.h>
+#include <malloc.h>
+#include <platform.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -55,6 +57,7 @@
 #include <lib/trusty/handle.h>
 #include <lib/trusty/ipc.h>
 #include <lib/trusty/ipc_msg.h>
+#include <lib/trusty/memref.h>
 #include <lib/trusty/trusty_app.h>
 #include <lib/trusty/uctx.h>
 
@@ -70,8 +73,9 @@ typedef struct msg_item {
 	uint8_t			id;
 	uint8_t			state;
 	uint			num_handles;
-	handle_id_t		handles[MAX_MSG_HANDLES];
+	handle_t		*handles[MAX_MSG_HANDLES];
 	size_t			len;
+	lk_bigtime_t		sent_time;
 	struct list_node	node;
 } msg_item_t;
 
@@ -82,13 +86,20 @@ typedef struct ipc_msg_queue {
 
 	uint			num_items;
 	size_t			item_sz;
+	uint			num_queued;	/* filled or read items */
 
 	uint8_t			*buf;
+	size_t			buf_sz;
+
+	/* if mappable, the buffer is page aligned and can be mapped
+	 * read-only into the receiving app, at vaddr of ut.
+	 */
+	bool			mappable;
+	uthread_t		*ut;
+	vaddr_t			vaddr;
 
 	/* store the message descriptors in the queue,
-	 * and the buffer separately. The buffer could
-	 * eventually move to a separate area that can
-	 * be mapped into the process directly.
+	 * and the buffer separately.
 	 */
 	msg_item_t		items[0];
 } ipc_msg_queue_t;
@@ -104,8 +115,23 @@ typedef struct msg_desc {
 		ipc_msg_kern_t	kern;
 		ipc_msg_user_t	user;
 	};
+
+	/* handles to attach to, or just detached from, a message */
+	uint		num_handles;
+	handle_t	*handles[MAX_MSG_HANDLES];
 } msg_desc_t;
 
+/*
+ *  Drop handles that were not handed off to a message or a user context
+ */
+static void msg_release_handles(handle_t **handles, uint *num_handles)
+{
+	for (uint i = 0; i < *num_handles; i++) {
+		handle_decref(handles[i]);
+	}
+	*num_handles = 0;
+}
+
 /**
  * @brief  Create IPC message queue
  *
@@ -114,12 +140,15 @@ typedef struct msg_desc {
  *
  * @param num_items   Number of messages we need to store.
  * @param item_sz     Size of each message item.
+ * @param mappable    Allocate the buffer so it can be mapped into the
+ *                    receiving app with ipc_msg_queue_map.
  * @param mq          Pointer where to store the ptr to the newly allocated
  *                    message queue.
  *
  * @return  Returns NO_ERROR on success, ERR_NO_MEMORY on error.
  */
-int ipc_msg_queue_create(uint num_items, size_t item_sz, ipc_msg_queue_t **mq)
+int ipc_msg_queue_create(uint num_items, size_t item_sz, bool mappable,
+                         ipc_msg_queue_t **mq)
 {
 	ipc_msg_queue_t *tmp_mq;
 	int ret;
@@ -131,7 +160,16 @@ int ipc_msg_queue_create(uint num_items, size_t item_sz, ipc_msg_queue_t **mq)
 		return ERR_NO_MEMORY;
 	}
 
-	tmp_mq->buf = malloc(num_items * item_sz);
+	if (mappable) {
+		/* must not share pages with other kernel data */
+		tmp_mq->buf_sz = ROUNDUP(num_items * item_sz, PAGE_SIZE);
+		tmp_mq->buf = memalign(PAGE_SIZE, tmp_mq->buf_sz);
+		if (tmp_mq->buf)
+			memset(tmp_mq->buf, 0, tmp_mq->buf_sz);
+	} else {
+		tmp_mq->buf_sz = num_items * item_sz;
+		tmp_mq->buf = malloc(tmp_mq->buf_sz);
+	}
 	if (!tmp_mq->buf) {
 		dprintf(CRITICAL,
 			"cannot allocate memory for message queue buf\n");
@@ -141,6 +179,7 @@ int ipc_msg_queue_create(uint num_items, size_t item_sz, ipc_msg_queue_t **mq)
 
 	tmp_mq->num_items = num_items;
 	tmp_mq->item_sz = item_sz;
+	tmp_mq->mappable = mappable;
 	list_initialize(&tmp_mq->free_list);
 	list_initialize(&tmp_mq->filled_list);
 	list_initialize(&tmp_mq->read_list);
@@ -159,10 +198,54 @@ err_alloc_buf:
 
 void ipc_msg_queue_destroy(ipc_msg_queue_t *mq)
 {
+	ipc_msg_queue_unmap(mq);
+	for (uint i = 0; i < mq->num_items; i++) {
+		msg_release_handles(mq->items[i].handles,
+		                    &mq->items[i].num_handles);
+	}
 	free(mq->buf);
 	free(mq);
 }
 
+/*
+ *  Map the buffer of a mappable queue read-only into the app of ut, so
+ *  get_msg can return the address of each message. No-op for other queues.
+ */
+int ipc_msg_queue_map(ipc_msg_queue_t *mq, uthread_t *ut)
+{
+	vaddr_t vaddr;
+	int ret;
+
+	if (!mq->mappable)
+		return NO_ERROR;
+
+	DEBUG_ASSERT(!mq->ut);
+
+	ret = uthread_map_contig(ut, &vaddr, vaddr_to_paddr(mq->buf),
+				 mq->buf_sz, UTM_R, UT_MAP_ALIGN_DEFAULT);
+	if (ret != NO_ERROR) {
+		LTRACEF("failed (%d) to map message queue\n", ret);
+		return ret;
+	}
+
+	mq->ut = ut;
+	mq->vaddr = vaddr;
+	return NO_ERROR;
+}
+
+/*
+ *  Remove the mapping created by ipc_msg_queue_map, if any
+ */
+void ipc_msg_queue_unmap(ipc_msg_queue_t *mq)
+{
+	if (!mq->ut)
+		return;
+
+	uthread_unmap(mq->ut, mq->vaddr, mq->buf_sz);
+	mq->ut = NULL;
+	mq->vaddr = 0;
+}
+
 bool ipc_msg_queue_is_empty(ipc_msg_queue_t *mq)
 {
 	return list_is_empty(&mq->filled_list);
@@ -213,6 +296,161 @@ static int check_channel_connected_locked(handle_t *chandle)
 		return ERR_NOT_READY;
 }
 
+/*
+ *  Look up the handles listed in a user message in the sender's user context
+ *  and create new handles for the receiver. Only memory object handles can
+ *  be sent. The sender keeps its own handles.
+ */
+static int msg_get_user_handles(msg_desc_t *msg)
+{
+	handle_id_t ids[MAX_MSG_HANDLES];
+	handle_t *handle;
+	int ret;
+
+	DEBUG_ASSERT(msg->type == IPC_MSG_BUFFER_USER);
+
+	msg->num_handles = 0;
+	if (!msg->user.num_handles)
+		return NO_ERROR;
+
+	if (msg->user.num_handles > MAX_MSG_HANDLES) {
+		LTRACEF("too many handles (%d)\n", msg->user.num_handles);
+		return ERR_TOO_BIG;
+	}
+
+	ret = copy_from_user(ids, msg->user.handles,
+	                     msg->user.num_handles * sizeof(ids[0]));
+	if (ret != NO_ERROR)
+		return ret;
+
+	for (uint i = 0; i < msg->user.num_handles; i++) {
+		ret = uctx_handle_get(current_uctx(), ids[i], &handle);
+		if (ret != NO_ERROR)
+			goto err;
+
+		if (memref_is_memref(handle)) {
+			ret = memref_dup(handle, &msg->handles[msg->num_handles]);
+		} else {
+			LTRACEF("handle %d cannot be sent\n", ids[i]);
+			ret = ERR_NOT_SUPPORTED;
+		}
+		handle_decref(handle);
+		if (ret != NO_ERROR)
+			goto err;
+
+		msg->num_handles++;
+	}
+	return NO_ERROR;
+
+err:
+	msg_release_handles(msg->handles, &msg->num_handles);
+	return ret;
+}
+
+/*
+ *  Install handles detached from a message by msg_read_locked into the
+ *  receiver's user context and return their ids in the user message.
+ *  Must be called without ipc_lock held.
+ */
+static int msg_install_user_handles(msg_desc_t *msg)
+{
+	uctx_t *ctx = current_uctx();
+	handle_id_t ids[MAX_MSG_HANDLES];
+	handle_t *handle;
+	uint count;
+	int ret = NO_ERROR;
+
+	DEBUG_ASSERT(msg->type == IPC_MSG_BUFFER_USER);
+
+	for (count = 0; count < msg->num_handles; count++) {
+		/* transfers the ref held by msg */
+		ret = uctx_handle_install(ctx, msg->handles[count], &ids[count]);
+		if (ret != NO_ERROR)
+			break;
+	}
+
+	if (ret == NO_ERROR) {
+		ret = copy_to_user(msg->user.handles, ids,
+		                   count * sizeof(ids[0]));
+	}
+
+	if (ret != NO_ERROR) {
+		for (uint i = 0; i < count; i++) {
+			if (uctx_handle_remove(ctx, ids[i], &handle) == NO_ERROR)
+				handle_close(handle);
+		}
+		for (uint i = count; i < msg->num_handles; i++) {
+			handle_decref(msg->handles[i]);
+		}
+	}
+	msg->num_handles = 0;
+	return ret;
+}
+
+/*
+ *  Statistics. Server channels also count towards their port.
+ */
+static void stats_sent(ipc_stats_t *stats, size_t len)
+{
+	stats->tx_msgs++;
+	stats->tx_bytes += len;
+}
+
+static void stats_queued(ipc_stats_t *stats, uint num_queued)
+{
+	if (num_queued > stats->max_queued)
+		stats->max_queued = num_queued;
+}
+
+static void stats_received(ipc_stats_t *stats, size_t len, uint bucket)
+{
+	stats->rx_msgs++;
+	stats->rx_bytes += len;
+	stats->latency_hist[bucket]++;
+}
+
+static void chan_stats_sent_locked(ipc_chan_t *chan, size_t len)
+{
+	ipc_chan_t *peer = chan->peer;
+	uint num_queued = peer->msg_queue->num_queued;
+
+	stats_sent(&chan->stats, len);
+	if (chan->port)
+		stats_sent(&chan->port->stats, len);
+
+	stats_queued(&peer->stats, num_queued);
+	if (peer->port)
+		stats_queued(&peer->port->stats, num_queued);
+}
+
+static void chan_stats_send_blocked_locked(ipc_chan_t *chan)
+{
+	ipc_chan_t *peer = chan->peer;
+
+	chan->stats.send_blocked++;
+	if (chan->port)
+		chan->port->stats.send_blocked++;
+
+	peer->stats.peer_send_blocked++;
+	if (peer->port)
+		peer->port->stats.peer_send_blocked++;
+}
+
+static void chan_stats_received_locked(ipc_chan_t *chan, msg_item_t *item)
+{
+	lk_bigtime_t usecs = current_time_hires() - item->sent_time;
+	uint bucket = 0;
+
+	while (usecs && bucket < IPC_STATS_LATENCY_BUCKETS - 1) {
+		usecs >>= 1;
+		bucket++;
+	}
+
+	stats_received(&chan->stats, item->len, bucket);
+	if (chan->port)
+		stats_received(&chan->port->stats, item->len, bucket);
+}
+
 static int msg_write_locked(ipc_chan_t *chan, msg_desc_t *msg)
 {
 	ssize_t ret;
@@ -221,14 +459,15 @@ static int msg_write_locked(ipc_chan_t *chan, msg_desc_t *msg)
 
 	item = list_peek_head_type(&mq->free_list, msg_item_t, node);
 	if (item == NULL) {
+		if (!(chan->aux_state & IPC_CHAN_AUX_STATE_SEND_BLOCKED))
+			chan_stats_send_blocked_locked(chan);
 		chan->aux_state |= IPC_CHAN_AUX_STATE_SEND_BLOCKED;
 		return ERR_NOT_ENOUGH_BUFFER;
 	}
 
 	DEBUG_ASSERT(item->state == MSG_ITEM_STATE_FREE);
 
-	/* TODO: figure out what to do about handles */
-	item->num_handles = 0;
+	DEBUG_ASSERT(!item->num_handles);
 	item->len = 0;
 
 	uint8_t *buf = msg_queue_get_buf(mq, item);
@@ -242,10 +481,6 @@ static int msg_write_locked(ipc_chan_t *chan, msg_desc_t *msg)
 		                          (const iovec_kern_t *)msg->kern.iov,
 		                           msg->kern.num_iov);
 	} else if (msg->type == IPC_MSG_BUFFER_USER) {
-		if (msg->user.num_handles) {
-			LTRACEF("handles are not supported yet\n");
-			return ERR_NOT_SUPPORTED;
-		}
 		ret = user_iovec_to_membuf(buf, mq->item_sz,
 		                           msg->user.iov, msg->user.num_iov);
 	} else {
@@ -256,9 +491,20 @@ static int msg_write_locked(ipc_chan_t *chan, msg_desc_t *msg)
 		return ret;
 
 	item->len = (size_t) ret;
+
+	/* the message now owns the handles resolved by the sender */
+	memcpy(item->handles, msg->handles,
+	       msg->num_handles * sizeof(msg->handles[0]));
+	item->num_handles = msg->num_handles;
+	msg->num_handles = 0;
+
 	list_delete(&item->node);
 	list_add_tail(&mq->filled_list, &item->node);
 	item->state = MSG_ITEM_STATE_FILLED;
+	item->sent_time = current_time_hires();
+	mq->num_queued++;
+
+	chan_stats_sent_locked(chan, item->len);
 
 	return item->len;
 }
@@ -267,6 +513,11 @@ static int msg_write_locked(ipc_chan_t *chan, msg_desc_t *msg)
  * reads the specified message by copying the data into the iov list
  * provided by msg. The message must have been previously moved
  * to the read list (and thus put into READ state).
+ *
+ * If a user msg has room for handles, the handles attached to the
+ * message are detached and moved to msg, to be installed by the caller
+ * once ipc_lock is released. Later reads of the same message return
+ * data only.
  */
 static int msg_read_locked(ipc_msg_queue_t *mq, uint32_t msg_id,
                            uint32_t offset, msg_desc_t *msg)
@@ -285,11 +536,6 @@ static int msg_read_locked(ipc_msg_queue_t *mq, uint32_t msg_id,
 		return ERR_INVALID_ARGS;
 	}
 
-	if (item->num_handles) {
-		LTRACEF("handles are not supported yet\n");
-		return ERR_NOT_SUPPORTED;
-	}
-
 	if (offset > item->len) {
 		LTRACEF("invalid offset %d\n", offset);
 		return ERR_INVALID_ARGS;
@@ -307,12 +553,21 @@ static int msg_read_locked(ipc_msg_queue_t *mq, uint32_t msg_id,
 		                            msg->kern.num_iov,
 		                            buf, bytes_left);
 	} else if (msg->type == IPC_MSG_BUFFER_USER) {
-		if (msg->user.num_handles) {
-			LTRACEF("handles are not supported yet\n");
-			return ERR_NOT_SUPPORTED;
+		if (msg->user.num_handles &&
+		    msg->user.num_handles < item->num_handles) {
+			LTRACEF("no room for %d handles\n", item->num_handles);
+			return ERR_NOT_ENOUGH_BUFFER;
 		}
-		return membuf_to_user_iovec(msg->user.iov, msg->user.num_iov,
-		                            buf, bytes_left);
+		int ret = membuf_to_user_iovec(msg->user.iov,
+		                               msg->user.num_iov,
+		                               buf, bytes_left);
+		if (ret >= 0 && msg->user.num_handles) {
+			memcpy(msg->handles, item->handles,
+			       item->num_handles * sizeof(item->handles[0]));
+			msg->num_handles = item->num_handles;
+			item->num_handles = 0;
+		}
+		return ret;
 	} else {
 		return ERR_INVALID_ARGS;
 	}
@@ -333,6 +588,9 @@ static int msg_peek_next_filled_locked(ipc_msg_queue_t *mq, ipc_msg_info_t *info
 
 	info->len = item->len;
 	info->id  = item->id;
+	info->num_handles = item->num_handles;
+	/* the message stays in place until it is put */
+	info->buf = mq->ut ? mq->vaddr + (item->id * mq->item_sz) : 0;
 
 	return NO_ERROR;
 }
@@ -341,8 +599,9 @@ static int msg_peek_next_filled_locked(ipc_msg_queue_t *mq, ipc_msg_info_t *info
 /*
  *  Is called to move top of the queue item to readable list.
  */
-static void msg_get_filled_locked(ipc_msg_queue_t *mq)
+static void msg_get_filled_locked(ipc_chan_t *chan)
 {
+	ipc_msg_queue_t *mq = chan->msg_queue;
 	msg_item_t *item;
 
 	item = list_peek_head_type(&mq->filled_list, msg_item_t, node);
@@ -351,6 +610,8 @@ static void msg_get_filled_locked(ipc_msg_queue_t *mq)
 	list_delete(&item->node);
 	list_add_tail(&mq->read_list, &item->node);
 	item->state = MSG_ITEM_STATE_READ;
+
+	chan_stats_received_locked(chan, item);
 }
 
 static int msg_put_read_locked(ipc_chan_t *chan, uint32_t msg_id)
@@ -364,11 +625,15 @@ static int msg_put_read_locked(ipc_chan_t *chan, uint32_t msg_id)
 	if (!item || item->state != MSG_ITEM_STATE_READ)
 		return ERR_INVALID_ARGS;
 
+	/* close handles the receiver did not take */
+	msg_release_handles(item->handles, &item->num_handles);
+
 	list_delete(&item->node);
 
 	/* put it on the head since it was just taken off here */
 	list_add_head(&mq->free_list, &item->node);
 	item->state = MSG_ITEM_STATE_FREE;
+	mq->num_queued--;
 
 	ipc_chan_t *peer = chan->peer;
 	if (peer && (peer->aux_state & IPC_CHAN_AUX_STATE_SEND_BLOCKED)) {
@@ -398,6 +663,13 @@ long __SYSCALL sys_send_msg(uint32_t handle_id, user_addr_t user_msg)
 	if (unlikely(ret != NO_ERROR))
 		return (long) ret;
 
+	/* and the handles to send, before taking ipc_lock */
+	ret = msg_get_user_handles(&tmp_msg);
+	if (unlikely(ret != NO_ERROR)) {
+		handle_decref(chandle);
+		return (long) ret;
+	}
+
 	mutex_acquire(&ipc_lock);
 	/* check if it is  avalid channel to call send_msg */
 	ret = check_channel_connected_locked(chandle);
@@ -411,6 +683,8 @@ long __SYSCALL sys_send_msg(uint32_t handle_id, user_addr_t user_msg)
 		}
 	}
 	mutex_release(&ipc_lock);
+	/* drop handles if the message was not sent */
+	msg_release_handles(tmp_msg.handles, &tmp_msg.num_handles);
 	handle_decref(chandle);
 	return (long) ret;
 }
@@ -425,6 +699,7 @@ int ipc_send_msg(handle_t *chandle, ipc_msg_kern_t *msg)
 
 	tmp_msg.type = IPC_MSG_BUFFER_KERNEL;
 	memcpy(&tmp_msg.kern, msg, sizeof(ipc_msg_kern_t));
+	tmp_msg.num_handles = 0;
 
 	mutex_acquire(&ipc_lock);
 	ret = check_channel_connected_locked(chandle);
@@ -463,7 +738,7 @@ long __SYSCALL sys_get_msg(uint32_t handle_id, user_addr_t user_msg_info)
 					   &msg_info, sizeof(ipc_msg_info_t));
 			if (likely(ret == NO_ERROR)) {
 				/* and make it readable */
-				msg_get_filled_locked(chan->msg_queue);
+				msg_get_filled_locked(chan);
 			}
 		}
 	}
@@ -485,7 +760,7 @@ int ipc_get_msg(handle_t *chandle, ipc_msg_info_t *msg_info)
 		ret  = msg_peek_next_filled_locked(chan->msg_queue, msg_info);
 		if (likely(ret == NO_ERROR)) {
 			/* and make it readable */
-			msg_get_filled_locked(chan->msg_queue);
+			msg_get_filled_locked(chan);
 		}
 	}
 	mutex_release(&ipc_lock);
@@ -538,6 +813,7 @@ long __SYSCALL sys_read_msg(uint32_t handle_id, uint32_t msg_id, uint32_t offset
 	ret = copy_from_user(&tmp_msg.user, user_msg, sizeof(ipc_msg_user_t));
 	if (unlikely(ret != NO_ERROR))
 		return (long) ret;
+	tmp_msg.num_handles = 0;
 
 	/* grab handle */
 	ret = uctx_handle_get(current_uctx(), handle_id, &chandle);
@@ -556,6 +832,13 @@ long __SYSCALL sys_read_msg(uint32_t handle_id, uint32_t msg_id, uint32_t offset
 	mutex_release(&ipc_lock);
 	handle_decref(chandle);
 
+	if (ret >= 0 && tmp_msg.num_handles) {
+		/* hand received handles to the reader */
+		int rc = msg_install_user_handles(&tmp_msg);
+		if (rc != NO_ERROR)
+			ret = rc;
+	}
+
 	return (long) ret;
 }
 
@@ -570,6 +853,7 @@ int ipc_read_msg(handle_t *chandle, uint32_t msg_id, uint32_t offset,
 
 	tmp_msg.type = IPC_MSG_BUFFER_KERNEL;
 	memcpy(&tmp_msg.kern, msg, sizeof(ipc_msg_kern_t));
+	tmp_msg.num_handles = 0;
 
 	mutex_acquire(&ipc_lock);
 	ret = check_channel_locked (chandle);
@@ -582,6 +866,107 @@ int ipc_read_msg(handle_t *chandle, uint32_t msg_id, uint32_t offset,
 	return ret;
 }
 
+/*
+ *  Send a request on a channel, wait for the reply, read it into the iovecs
+ *  of user_reply and retire it. The first message that arrives on the
+ *  channel is taken as the reply, so the caller must not have other
+ *  messages in flight on it. The server is woken up without a reschedule,
+ *  so the cpu goes straight to it once the caller blocks.
+ *
+ *  Returns the length of the reply, ERR_TOO_BIG if the reply did not fit,
+ *  or ERR_NOT_ENOUGH_BUFFER if the request could not be queued. In the
+ *  last case nothing was sent.
+ */
+long __SYSCALL sys_call(uint32_t handle_id, user_addr_t user_msg,
+                        user_addr_t user_reply, unsigned long timeout_msecs)
+{
+	handle_t  *chandle;
+	ipc_chan_t *chan;
+	msg_desc_t tmp_msg;
+	msg_desc_t reply_msg;
+	ipc_msg_info_t msg_info;
+	uint32_t event;
+	int ret;
+
+	/* copy message descriptors from user space */
+	tmp_msg.type = IPC_MSG_BUFFER_USER;
+	ret = copy_from_user(&tmp_msg.user, user_msg, sizeof(ipc_msg_user_t));
+	if (unlikely(ret != NO_ERROR))
+		return (long) ret;
+
+	reply_msg.type = IPC_MSG_BUFFER_USER;
+	ret = copy_from_user(&reply_msg.user, user_reply,
+	                     sizeof(ipc_msg_user_t));
+	if (unlikely(ret != NO_ERROR))
+		return (long) ret;
+	reply_msg.num_handles = 0;
+
+	/* grab handle */
+	ret = uctx_handle_get(current_uctx(), handle_id, &chandle);
+	if (unlikely(ret != NO_ERROR))
+		return (long) ret;
+
+	ret = msg_get_user_handles(&tmp_msg);
+	if (unlikely(ret != NO_ERROR))
+		goto out;
+
+	mutex_acquire(&ipc_lock);
+	ret = check_channel_connected_locked(chandle);
+	if (likely(ret == NO_ERROR)) {
+		chan = containerof(chandle, ipc_chan_t, handle);
+		ret = msg_write_locked(chan, &tmp_msg);
+		if (ret >= 0) {
+			/* the server runs when we block below */
+			handle_notify_no_resched(&chan->peer->handle);
+		}
+	}
+	mutex_release(&ipc_lock);
+	msg_release_handles(tmp_msg.handles, &tmp_msg.num_handles);
+	if (ret < 0)
+		goto out;
+
+	/* wait for the reply or for the server to go away */
+	do {
+		ret = handle_wait(chandle, &event, timeout_msecs);
+		if (ret < 0)
+			goto out;
+	} while (!(event & (IPC_HANDLE_POLL_MSG | IPC_HANDLE_POLL_HUP |
+	                    IPC_HANDLE_POLL_ERROR)));
+
+	mutex_acquire(&ipc_lock);
+	chan = containerof(chandle, ipc_chan_t, handle);
+	if (!chan->msg_queue) {
+		ret = ERR_CHANNEL_CLOSED;
+	} else {
+		ret = msg_peek_next_filled_locked(chan->msg_queue, &msg_info);
+		if (ret == ERR_NO_MSG && (event & IPC_HANDLE_POLL_HUP))
+			ret = ERR_CHANNEL_CLOSED;
+	}
+	if (ret == NO_ERROR) {
+		msg_get_filled_locked(chan);
+		ret = msg_read_locked(chan->msg_queue, msg_info.id, 0,
+		                      &reply_msg);
+		if (ret >= 0 && (size_t)ret != msg_info.len) {
+			LTRACEF("reply too big (%zu)\n", msg_info.len);
+			ret = ERR_TOO_BIG;
+		}
+		msg_put_read_locked(chan, msg_info.id);
+	}
+	mutex_release(&ipc_lock);
+
+	if (ret >= 0 && reply_msg.num_handles) {
+		/* hand received handles to the caller */
+		int rc = msg_install_user_handles(&reply_msg);
+		if (rc != NO_ERROR)
+			ret = rc;
+	}
+	msg_release_handles(reply_msg.handles, &reply_msg.num_handles);
+
+out:
+	handle_decref(chandle);
+	return (long) ret;
+}
+
 #else /* WITH_TRUSTY_IPC */
 
 long __SYSCALL sys_send_msg(uint32_t handle_id, user_addr_t user_msg)
@@ -605,6 +990,12 @@ long __SYSCALL sys_read_msg(uint32_t handle_id, uint32_t msg_id, uint32_t offset
 	return (long) ERR_NOT_SUPPORTED;
 }
 
+long __SYSCALL sys_call(uint32_t handle_id, user_addr_t user_msg,
+                        user_addr_t user_reply, unsigned long timeout_msecs)
+{
+	return (long) ERR_NOT_SUPPORTED;
+}
+
 #endif  /* WITH_TRUSTY_IPC */
 
 
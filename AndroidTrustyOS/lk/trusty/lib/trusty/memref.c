@@ -0,0 +1,316 @@
+/*
+ * Copyright (c) 2016, Google, Inc. All rights reserved
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#define LOCAL_TRACE 0
+
+#include <assert.h>
+#include <err.h>
+#include <list.h>
+#include <malloc.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <trace.h>
+#include <uthread.h>
+
+#include <kernel/mutex.h>
+#include <lib/syscall.h>
+#include <lib/trusty/memref.h>
+
+#if WITH_TRUSTY_IPC
+
+#include <refcount.h>
+#include <lib/trusty/handle.h>
+#include <lib/trusty/uctx.h>
+
+/*
+ * The pages shared by every memref handle created from the same
+ * memref_create call. Each handle and each mapping holds a reference.
+ */
+struct memref_obj {
+	refcount_t		refcnt;
+	void			*buf;
+	size_t			size;
+};
+
+/*
+ * A handle can only be installed in one user context, so every app that
+ * receives a memory object gets its own memref handle for it.
+ */
+struct memref {
+	handle_t		handle;
+	struct memref_obj	*obj;
+};
+
+struct memref_mapping {
+	struct list_node	node;
+	uthread_t		*ut;
+	vaddr_t			vaddr;
+	size_t			size;
+	struct memref_obj	*obj;
+};
+
+static mutex_t memref_lock = MUTEX_INITIAL_VALUE(memref_lock);
+static struct list_node memref_mappings = LIST_INITIAL_VALUE(memref_mappings);
+
+static uint32_t memref_poll(handle_t *handle);
+static void memref_handle_destroy(handle_t *handle);
+
+static struct handle_ops memref_handle_ops = {
+	.poll		= memref_poll,
+	.destroy	= memref_handle_destroy,
+};
+
+static void memref_obj_destroy(refcount_t *ref)
+{
+	struct memref_obj *obj = containerof(ref, struct memref_obj, refcnt);
+
+	LTRACEF("memref obj %p destroyed\n", obj);
+	free(obj->buf);
+	free(obj);
+}
+
+static void memref_obj_decref(struct memref_obj *obj)
+{
+	refcount_dec(&obj->refcnt, memref_obj_destroy);
+}
+
+/*
+ *  Memory objects never have events pending
+ */
+static uint32_t memref_poll(handle_t *handle)
+{
+	DEBUG_ASSERT(memref_is_memref(handle));
+	return 0;
+}
+
+static void memref_handle_destroy(handle_t *handle)
+{
+	struct memref *mr = containerof(handle, struct memref, handle);
+
+	memref_obj_decref(mr->obj);
+	free(mr);
+}
+
+static int memref_handle_create(struct memref_obj *obj, handle_t **handle_ptr)
+{
+	struct memref *mr;
+
+	mr = calloc(1, sizeof(*mr));
+	if (!mr)
+		return ERR_NO_MEMORY;
+
+	refcount_inc(&obj->refcnt);
+	mr->obj = obj;
+	handle_init(&mr->handle, &memref_handle_ops);
+
+	*handle_ptr = &mr->handle;
+	return NO_ERROR;
+}
+
+bool memref_is_memref(handle_t *handle)
+{
+	return handle->ops == &memref_handle_ops;
+}
+
+/*
+ *  Allocate a zero filled memory object of at least size bytes and
+ *  return a new handle for it.
+ */
+int memref_create(size_t size, handle_t **handle_ptr)
+{
+	struct memref_obj *obj;
+	int ret;
+
+	if (!size || size > MEMREF_MAX_SIZE)
+		return ERR_INVALID_ARGS;
+
+	obj = calloc(1, sizeof(*obj));
+	if (!obj)
+		return ERR_NO_MEMORY;
+
+	obj->size = ROUNDUP(size, PAGE_SIZE);
+	obj->buf = memalign(PAGE_SIZE, obj->size);
+	if (!obj->buf) {
+		ret = ERR_NO_MEMORY;
+		goto err_alloc_buf;
+	}
+	memset(obj->buf, 0, obj->size);
+	refcount_init(&obj->refcnt);
+
+	LTRACEF("memref obj %p created, %zd bytes\n", obj, obj->size);
+
+	ret = memref_handle_create(obj, handle_ptr);
+
+	/* drop the initial reference, the handle holds its own */
+	memref_obj_decref(obj);
+	return ret;
+
+err_alloc_buf:
+	free(obj);
+	return ret;
+}
+
+/*
+ *  Create a new handle for the memory object that handle refers to,
+ *  so it can be installed in the user context of another app.
+ */
+int memref_dup(handle_t *handle, handle_t **handle_ptr)
+{
+	DEBUG_ASSERT(memref_is_memref(handle));
+
+	struct memref *mr = containerof(handle, struct memref, handle);
+	return memref_handle_create(mr->obj, handle_ptr);
+}
+
+/*
+ *  Map the first size bytes of the memory object referred to by handle_id
+ *  into the current app. The mapping keeps the object alive until it is
+ *  removed with memref_munmap.
+ */
+int memref_mmap(handle_id_t handle_id, size_t size, vaddr_t *vaddr)
+{
+	uthread_t *ut = uthread_get_current();
+	struct memref_mapping *mapping;
+	struct memref_obj *obj;
+	handle_t *handle;
+	int ret;
+
+	ret = uctx_handle_get(current_uctx(), handle_id, &handle);
+	if (ret != NO_ERROR)
+		return ret;
+
+	if (!memref_is_memref(handle)) {
+		ret = ERR_INVALID_ARGS;
+		goto out;
+	}
+
+	obj = containerof(handle, struct memref, handle)->obj;
+	size = ROUNDUP(size, PAGE_SIZE);
+	if (!size || size > obj->size) {
+		ret = ERR_INVALID_ARGS;
+		goto out;
+	}
+
+	mapping = calloc(1, sizeof(*mapping));
+	if (!mapping) {
+		ret = ERR_NO_MEMORY;
+		goto out;
+	}
+
+	ret = uthread_map_contig(ut, vaddr, vaddr_to_paddr(obj->buf), size,
+				 UTM_R | UTM_W, UT_MAP_ALIGN_DEFAULT);
+	if (ret != NO_ERROR) {
+		free(mapping);
+		goto out;
+	}
+
+	refcount_inc(&obj->refcnt);
+	mapping->ut = ut;
+	mapping->vaddr = *vaddr;
+	mapping->size = size;
+	mapping->obj = obj;
+
+	mutex_acquire(&memref_lock);
+	list_add_tail(&memref_mappings, &mapping->node);
+	mutex_release(&memref_lock);
+
+out:
+	handle_decref(handle);
+	return ret;
+}
+
+/*
+ *  Remove a mapping created by memref_mmap from the current app. Returns
+ *  ERR_NOT_FOUND if vaddr is not the start of such a mapping, so the caller
+ *  can fall back to other kinds of mappings.
+ */
+int memref_munmap(vaddr_t vaddr)
+{
+	uthread_t *ut = uthread_get_current();
+	struct memref_mapping *mapping;
+	int ret = ERR_NOT_FOUND;
+
+	mutex_acquire(&memref_lock);
+	list_for_every_entry(&memref_mappings, mapping,
+			     struct memref_mapping, node) {
+		if (mapping->ut == ut && mapping->vaddr == vaddr) {
+			ret = uthread_unmap(ut, vaddr, mapping->size);
+			if (ret == NO_ERROR)
+				list_delete(&mapping->node);
+			break;
+		}
+	}
+	mutex_release(&memref_lock);
+
+	if (ret != NO_ERROR)
+		return ret;
+
+	memref_obj_decref(mapping->obj);
+	free(mapping);
+	return NO_ERROR;
+}
+
+long __SYSCALL sys_memref_create(uint32_t size, uint32_t flags)
+{
+	uctx_t *ctx = current_uctx();
+	handle_t *handle;
+	handle_id_t handle_id;
+	int ret;
+
+	if (flags)
+		return ERR_INVALID_ARGS;
+
+	ret = memref_create(size, &handle);
+	if (ret != NO_ERROR)
+		return (long) ret;
+
+	ret = uctx_handle_install(ctx, handle, &handle_id);
+	if (ret != NO_ERROR) {
+		handle_decref(handle);
+		return (long) ret;
+	}
+
+	return (long) handle_id;
+}
+
+#else /* WITH_TRUSTY_IPC */
+
+int memref_mmap(handle_id_t handle_id, size_t size, vaddr_t *vaddr)
+{
+	return ERR_NOT_SUPPORTED;
+}
+
+int memref_munmap(vaddr_t vaddr)
+{
+	return ERR_NOT_FOUND;
+}
+
+long __SYSCALL sys_memref_create(uint32_t size, uint32_t flags)
+{
+	return (long) ERR_NOT_SUPPORTED;
+}
+
+#endif /* WITH_TRUSTY_IPC */
@@ -36,6 +36,7 @@ MODULE_SRCS := \
 	$(LOCAL_DIR)/ipc.c \
 	$(LOCAL_DIR)/ipc_msg.c \
 	$(LOCAL_DIR)/iovec.c \
+	$(LOCAL_DIR)/memref.c \
 	$(LOCAL_DIR)/uuid.c
 
 ifeq (true,$(call TOBOOL,$(WITH_TRUSTY_IPC)))
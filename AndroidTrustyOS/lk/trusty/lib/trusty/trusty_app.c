@@ -55,6 +55,7 @@ enum {
 	TRUSTY_APP_CONFIG_KEY_MIN_STACK_SIZE	= 1,
 	TRUSTY_APP_CONFIG_KEY_MIN_HEAP_SIZE	= 2,
 	TRUSTY_APP_CONFIG_KEY_MAP_MEM		= 3,
+	TRUSTY_APP_CONFIG_KEY_IPC_STATS		= 4,
 };
 
 typedef struct trusty_app_manifest {
@@ -206,6 +207,10 @@ static void load_app_config_options(intptr_t trusty_app_image_addr,
 			trusty_app->props.map_io_mem_cnt++;
 			i += 3;
 			break;
+		case TRUSTY_APP_CONFIG_KEY_IPC_STATS:
+			/* IPC_STATS takes no data values */
+			trusty_app->props.ipc_stats = true;
+			break;
 		default:
 			dprintf(CRITICAL,
 				"%s: unknown config key: %d\n",
@@ -223,6 +228,8 @@ static void load_app_config_options(intptr_t trusty_app_image_addr,
 		trusty_app->props.min_heap_size);
 	dprintf(SPEW, "trusty_app %p: num_io_mem=%d\n", trusty_app,
 		trusty_app->props.map_io_mem_cnt);
+	dprintf(SPEW, "trusty_app %p: ipc_stats=%d\n", trusty_app,
+		trusty_app->props.ipc_stats);
 #endif
 }
 
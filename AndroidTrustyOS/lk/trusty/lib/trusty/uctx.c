@@ -129,22 +129,6 @@ static int _check_handle_id(uctx_t *ctx, handle_id_t handle_id)
 	return NO_ERROR;
 }
 
-/*
- *  Return handle id for specified handle
- */
-static handle_id_t _handle_to_id_locked(uctx_t *ctx, handle_t *handle)
-{
-	DEBUG_ASSERT(ctx);
-
-	for (int i = 0; i < IPC_MAX_HANDLES; i++) {
-		if (ctx->handles[i] == handle) {
-			return i;
-		}
-	}
-	return INVALID_HANDLE_ID;
-}
-
-
 /*
  *  Allocate and initialize user context - the structure that is used
  *  to keep track handles on behalf of user space app. Exactly one user
@@ -220,6 +204,7 @@ int uctx_handle_install(uctx_t *ctx, handle_t *handle, handle_id_t *id)
 
 	bitmap_set(ctx->inuse, new_id);
 	ctx->handles[new_id] = handle;
+	handle->id = (handle_id_t) new_id;
 	handle_list_add(&ctx->handle_list, handle);
 	*id = (handle_id_t) new_id;
 
@@ -261,6 +246,7 @@ int uctx_handle_remove(uctx_t *ctx, handle_id_t handle_id, handle_t **handle_ptr
 		bitmap_clear(ctx->inuse, handle_id);
 		ctx->handles[handle_id] = NULL;
 		handle_list_del(&ctx->handle_list, handle);
+		handle->id = INVALID_HANDLE_ID;
 		*handle_ptr = handle;
 	}
 
@@ -349,7 +335,7 @@ long __SYSCALL sys_wait_any(user_addr_t user_event, unsigned long timeout_msecs)
 
 	DEBUG_ASSERT(handle); /* there should be a handle */
 
-	tmp_event.handle = _handle_to_id_locked(ctx, handle);
+	tmp_event.handle = handle->id;
 	tmp_event.cookie = (user_addr_t)(uintptr_t)handle_get_cookie(handle);
 
 	/* drop the reference that was taken by wait_any */